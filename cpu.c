@@ -17,8 +17,10 @@
 
 #include <isl/aff.h>
 #include <isl/ctx.h>
+#include <isl/id.h>
 #include <isl/flow.h>
 #include <isl/map.h>
+#include <isl/union_map.h>
 #include <isl/ast_build.h>
 #include <isl/schedule.h>
 #include <isl/schedule_node.h>
@@ -27,6 +29,8 @@
 #include "ppcg.h"
 #include "ppcg_options.h"
 #include "cpu.h"
+#include "cpu_layout.h"
+#include "hybrid.h"
 #include "print.h"
 #include "schedule.h"
 #include "util.h"
@@ -37,11 +41,19 @@
  * "ref2expr" maps the reference identifier of each access in
  * the statement to an AST expression that should be printed
  * at the place of the access.
+ * "prefetch_read" and "prefetch_write" contain the array elements
+ * that should be prefetched for reading and writing before
+ * the statement is executed, if any.
  */
 struct ppcg_stmt {
 	struct pet_stmt *stmt;
 
 	isl_id_to_ast_expr *ref2expr;
+	isl_ast_expr_list *prefetch_read;
+	isl_ast_expr_list *prefetch_write;
+
+	/* Should the update be performed atomically? */
+	int atomic;
 };
 
 static void ppcg_stmt_free(void *user)
@@ -52,6 +64,8 @@ static void ppcg_stmt_free(void *user)
 		return;
 
 	isl_id_to_ast_expr_free(stmt->ref2expr);
+	isl_ast_expr_list_free(stmt->prefetch_read);
+	isl_ast_expr_list_free(stmt->prefetch_write);
 
 	free(stmt);
 }
@@ -89,11 +103,85 @@ static FILE *get_output_file(const char *input, const char *output)
 	return file;
 }
 
+/* Internal data structure for generate_cpu.
+ *
+ * "options" are the ppcg options.
+ * "source" is the contents of the input file if the code cache is used
+ * and NULL otherwise.
+ * "sizes" are the user specified tile sizes, mapping bands identified
+ * by their sequence number in a "band" space to a "tile" space.
+ * "used_sizes" collects the effectively used tile sizes
+ * if the dump_sizes debug option is set.
+ * "band_id" is the sequence number of the next band that may be tiled.
+ * "scop" is the scop that is currently being transformed.
+ */
+struct cpu_gen {
+	struct ppcg_options *options;
+	char *source;
+	struct ppcg_scop *scop;
+	isl_union_map *sizes;
+	isl_union_map *used_sizes;
+	int band_id;
+};
+
+/* An array element that is promoted to a local scalar
+ * around an innermost for node.
+ *
+ * "array" is the identifier of the accessed array.
+ * "expr" is the access to the array element, expressed in terms of
+ * the outer loop iterators.
+ * "type" is the element type of the array.
+ * "write" is set if the element is written inside the for node.
+ * "blocked" is set if the element cannot be promoted.
+ * "name" is the identifier of the local scalar.
+ */
+struct cpu_promotion {
+	isl_id *array;
+	isl_ast_expr *expr;
+	const char *type;
+	int write;
+	int blocked;
+	isl_id *name;
+};
+
 /* Data used to annotate for nodes in the ast.
  */
 struct ast_node_userinfo {
 	/* The for node is an openmp parallel for node. */
 	int is_openmp;
+	/* The schedule clause of the openmp parallel for node
+	 * (PPCG_OPENMP_SCHEDULE_DEFAULT if none) and its chunk size
+	 * (0 if none).
+	 */
+	int schedule;
+	int chunk_size;
+	/* The proc_bind clause of the openmp parallel for node. */
+	int proc_bind;
+	/* The openmp parallel for node is printed as an openmp taskloop
+	 * because it appears inside the body of an openmp task.
+	 */
+	int taskloop;
+
+	/* The for node is an innermost loop that can be executed
+	 * using SIMD instructions.
+	 */
+	int is_simd;
+	/* The maximal number of iterations that may be executed concurrently
+	 * by a SIMD loop or 0 if there is no such limit.
+	 */
+	int safelen;
+
+	/* The for node is only parallel if reductions are performed
+	 * atomically or through a reduction clause.
+	 */
+	int reduction;
+
+	/* The scalar reduction targets inside the for node or NULL. */
+	isl_id_list *reduction_scalars;
+
+	/* The array elements promoted to local scalars around the for node. */
+	int n_promoted;
+	struct cpu_promotion *promoted;
 };
 
 /* Information used while building the ast.
@@ -104,8 +192,43 @@ struct ast_build_userinfo {
 
 	/* Are we currently in a parallel for loop? */
 	int in_parallel_for;
+	/* Is the code generated for the body of an openmp task? */
+	int in_task;
+
+	/* The annotation of the current parallel for loop, if any. */
+	struct ast_node_userinfo *parallel_for;
+
+	/* The arrays that are accessed through a copy with a new layout. */
+	struct cpu_layouts *layouts;
 };
 
+/* Collect the dependences that need to be respected by the loops
+ * in the AST of "scop".
+ * If the live_range_reordering option is set, then this includes
+ * the order dependences.
+ * If "relax_reductions" is set, then the dependences between
+ * reduction statement instances that update the same element are removed.
+ */
+static __isl_give isl_union_map *collect_dependences(struct ppcg_scop *scop,
+	int relax_reductions)
+{
+	isl_union_map *deps;
+
+	deps = isl_union_map_copy(scop->dep_flow);
+	deps = isl_union_map_union(deps, isl_union_map_copy(scop->dep_false));
+	if (scop->options->live_range_reordering) {
+		isl_union_map *order;
+
+		order = isl_union_map_copy(ppcg_scop_get_dep_order(scop));
+		deps = isl_union_map_union(deps, order);
+	}
+	if (relax_reductions)
+		deps = isl_union_map_subtract(deps,
+				ppcg_scop_reduction_dependences(scop));
+
+	return deps;
+}
+
 /* Check if the current scheduling dimension is parallel.
  *
  * We check for parallelism by verifying that the loop does not carry any
@@ -113,6 +236,8 @@ struct ast_build_userinfo {
  * If the live_range_reordering option is set, then this currently
  * includes the order dependences.  In principle, non-zero order dependences
  * could be allowed, but this would require privatization and/or expansion.
+ * If "relax_reductions" is set, then the dependences between
+ * reduction statement instances that update the same element are ignored.
  *
  * Parallelism test: if the distance is zero in all outer dimensions, then it
  * has to be zero in the current dimension as well.
@@ -123,7 +248,7 @@ struct ast_build_userinfo {
  * with equal values for the current dimension.
  */
 static int ast_schedule_dim_is_parallel(__isl_keep isl_ast_build *build,
-	struct ppcg_scop *scop)
+	struct ppcg_scop *scop, int relax_reductions)
 {
 	isl_union_map *schedule, *deps;
 	isl_map *schedule_deps, *test;
@@ -135,12 +260,7 @@ static int ast_schedule_dim_is_parallel(__isl_keep isl_ast_build *build,
 
 	dimension = isl_space_dim(schedule_space, isl_dim_out) - 1;
 
-	deps = isl_union_map_copy(scop->dep_flow);
-	deps = isl_union_map_union(deps, isl_union_map_copy(scop->dep_false));
-	if (scop->options->live_range_reordering) {
-		isl_union_map *order = isl_union_map_copy(scop->dep_order);
-		deps = isl_union_map_union(deps, order);
-	}
+	deps = collect_dependences(scop, relax_reductions);
 	deps = isl_union_map_apply_range(deps, isl_union_map_copy(schedule));
 	deps = isl_union_map_apply_domain(deps, schedule);
 
@@ -168,18 +288,254 @@ static int ast_schedule_dim_is_parallel(__isl_keep isl_ast_build *build,
 	return is_parallel;
 }
 
-/* Mark a for node openmp parallel, if it is the outermost parallel for node.
+/* Return the minimal positive dependence distance in the current
+ * scheduling dimension over the dependences with zero distance
+ * in all outer dimensions, divided by the (positive) increment "stride"
+ * of the current loop and rounded down.
+ * This is the number of consecutive iterations of the current loop
+ * that may be executed concurrently.
+ * Return 0 if there are no such dependences or if the minimal distance
+ * cannot be determined and -1 on error.
+ */
+static int ast_schedule_dim_safelen(__isl_keep isl_ast_build *build,
+	struct ppcg_scop *scop, int stride)
+{
+	isl_union_map *schedule, *deps;
+	isl_map *schedule_deps;
+	isl_space *schedule_space;
+	isl_set *delta;
+	isl_aff *obj;
+	isl_val *min;
+	unsigned i, dimension;
+	int safelen;
+
+	schedule = isl_ast_build_get_schedule(build);
+	schedule_space = isl_ast_build_get_schedule_space(build);
+
+	dimension = isl_space_dim(schedule_space, isl_dim_out) - 1;
+
+	deps = collect_dependences(scop, 0);
+	deps = isl_union_map_apply_range(deps, isl_union_map_copy(schedule));
+	deps = isl_union_map_apply_domain(deps, schedule);
+
+	schedule_space = isl_space_map_from_set(schedule_space);
+	schedule_deps = isl_union_map_extract_map(deps, schedule_space);
+	isl_union_map_free(deps);
+
+	for (i = 0; i < dimension; i++)
+		schedule_deps = isl_map_equate(schedule_deps, isl_dim_out, i,
+					       isl_dim_in, i);
+
+	delta = isl_map_deltas(schedule_deps);
+	delta = isl_set_lower_bound_si(delta, isl_dim_set, dimension, 1);
+	obj = isl_aff_zero_on_domain(
+			isl_local_space_from_space(isl_set_get_space(delta)));
+	obj = isl_aff_set_coefficient_si(obj, isl_dim_in, dimension, 1);
+	min = isl_set_min_val(delta, obj);
+	isl_aff_free(obj);
+	isl_set_free(delta);
+
+	if (!min)
+		return -1;
+	safelen = 0;
+	if (isl_val_is_int(min))
+		safelen = isl_val_get_num_si(min) / stride;
+	isl_val_free(min);
+
+	return safelen;
+}
+
+/* Return the increment of the for node "node" if it is
+ * a positive integer constant, 0 if it is not and -1 on error.
+ */
+static int for_node_stride(__isl_keep isl_ast_node *node)
+{
+	isl_ast_expr *inc;
+	isl_val *v;
+	int stride = 0;
+
+	inc = isl_ast_node_for_get_inc(node);
+	if (!inc)
+		return -1;
+	if (isl_ast_expr_get_type(inc) == isl_ast_expr_int) {
+		v = isl_ast_expr_get_val(inc);
+		if (!v)
+			stride = -1;
+		else if (isl_val_is_pos(v))
+			stride = isl_val_get_num_si(v);
+		isl_val_free(v);
+	}
+	isl_ast_expr_free(inc);
+
+	return stride;
+}
+
+/* Does "set" contain pairs of elements that only differ
+ * in the last dimension?
+ */
+static isl_bool has_several_last_values(__isl_keep isl_set *set)
+{
+	int i, n;
+	isl_map *map;
+	isl_bool empty;
+
+	n = isl_set_dim(set, isl_dim_set);
+	map = isl_map_from_domain_and_range(isl_set_copy(set),
+					    isl_set_copy(set));
+	for (i = 0; i < n - 1; ++i)
+		map = isl_map_equate(map, isl_dim_in, i, isl_dim_out, i);
+	map = isl_map_order_lt(map, isl_dim_in, n - 1, isl_dim_out, n - 1);
+	empty = isl_map_is_empty(map);
+	isl_map_free(map);
+
+	if (empty < 0)
+		return isl_bool_error;
+	return !empty;
+}
+
+/* This function is called for each piece of the extent of
+ * a statement dimension, expressed in terms of the outer schedule dimensions.
+ * Set *unbalanced and abort the traversal if the extent depends
+ * on the current (i.e., the last) schedule dimension on a piece
+ * that covers several iterations of the current loop
+ * (for the same values of the outer schedule dimensions).
+ * In particular, a piece that only covers a single (partial) tile
+ * at the boundary of the domain of a rectangular tiled loop
+ * does not make the loop unbalanced, even though its extent
+ * depends on the current schedule dimension.
+ */
+static isl_stat extent_involves_last_dim(__isl_take isl_set *set,
+	__isl_take isl_aff *aff, void *user)
+{
+	int *unbalanced = user;
+	int n;
+	isl_bool involves;
+
+	n = isl_aff_dim(aff, isl_dim_in);
+	involves = isl_aff_involves_dims(aff, isl_dim_in, n - 1, 1);
+	if (involves == isl_bool_true)
+		involves = has_several_last_values(set);
+	isl_set_free(set);
+	isl_aff_free(aff);
+
+	if (involves < 0)
+		return isl_stat_error;
+	if (involves) {
+		*unbalanced = 1;
+		return isl_stat_error;
+	}
+	return isl_stat_ok;
+}
+
+/* Given a map "map" from the outer schedule dimensions to
+ * the instances of a statement, check if the extent of any of
+ * the statement dimensions, i.e., the difference between its maximal and
+ * minimal value, depends on the current schedule dimension.
+ * If so, set *unbalanced and abort the traversal.
+ */
+static isl_stat check_extent(__isl_take isl_map *map, void *user)
+{
+	int *unbalanced = user;
+	int i, n;
+	isl_stat r = isl_stat_ok;
+
+	n = isl_map_dim(map, isl_dim_out);
+	for (i = 0; r >= 0 && i < n; ++i) {
+		isl_pw_aff *min, *max;
+
+		max = isl_map_dim_max(isl_map_copy(map), i);
+		min = isl_map_dim_min(isl_map_copy(map), i);
+		max = isl_pw_aff_sub(max, min);
+		r = isl_pw_aff_foreach_piece(max, &extent_involves_last_dim,
+						unbalanced);
+		isl_pw_aff_free(max);
+	}
+	isl_map_free(map);
+
+	return r;
+}
+
+/* Is the amount of work performed by an iteration of
+ * the current schedule dimension likely to depend on the iteration?
+ * That is, does the extent of any of the dimensions of the statement
+ * instances executed by an iteration depend on the value of
+ * the current schedule dimension, as in the case of a triangular or
+ * trapezoidal domain?
+ * Pieces of the extents that only apply to a single iteration,
+ * e.g., partial tiles at the boundary of the domain,
+ * do not make a loop unbalanced.
+ */
+static int ast_schedule_dim_is_unbalanced(__isl_keep isl_ast_build *build)
+{
+	isl_union_map *schedule;
+	isl_stat r;
+	int unbalanced = 0;
+
+	schedule = isl_ast_build_get_schedule(build);
+	schedule = isl_union_map_reverse(schedule);
+	r = isl_union_map_foreach_map(schedule, &check_extent, &unbalanced);
+	isl_union_map_free(schedule);
+
+	if (r < 0 && !unbalanced)
+		return -1;
+	return unbalanced;
+}
+
+/* Set the schedule and proc_bind clauses of the openmp parallel for node
+ * "node_info" based on the openmp_schedule and openmp_proc_bind options.
+ * If this option is set to "auto", then a dynamic schedule is used
+ * for loops with unbalanced iterations and no schedule clause
+ * is printed for other loops.
+ */
+static void set_openmp_schedule(__isl_keep isl_ast_build *build,
+	struct ppcg_options *options, struct ast_node_userinfo *node_info)
+{
+	node_info->schedule = options->openmp_schedule;
+	node_info->chunk_size = options->openmp_chunk_size;
+	node_info->proc_bind = options->openmp_proc_bind;
+	if (options->openmp_schedule != PPCG_OPENMP_SCHEDULE_AUTO)
+		return;
+	if (ast_schedule_dim_is_unbalanced(build) > 0)
+		node_info->schedule = PPCG_OPENMP_SCHEDULE_DYNAMIC;
+	else
+		node_info->schedule = PPCG_OPENMP_SCHEDULE_DEFAULT;
+}
+
+/* Mark a for node openmp parallel, if the openmp option is set and
+ * if it is the outermost parallel for node.
+ * Inside the body of an openmp task, the for node is printed
+ * as an openmp taskloop instead, such that its iterations are
+ * distributed over the threads of the enclosing parallel region
+ * rather than creating a nested parallel region for each task.
+ *
+ * If the for node is not parallel, but would be parallel if
+ * the reductions were executed atomically and if the reductions option
+ * is set, then the for node is also marked openmp parallel,
+ * but with the reduction flag set such that the reductions inside
+ * the loop are handled by at_each_domain.
  */
 static void mark_openmp_parallel(__isl_keep isl_ast_build *build,
 	struct ast_build_userinfo *build_info,
 	struct ast_node_userinfo *node_info)
 {
-	if (build_info->in_parallel_for)
+	struct ppcg_scop *scop = build_info->scop;
+
+	if (!scop->options->openmp || build_info->in_parallel_for)
 		return;
 
-	if (ast_schedule_dim_is_parallel(build, build_info->scop)) {
-		build_info->in_parallel_for = 1;
+	if (ast_schedule_dim_is_parallel(build, scop, 0)) {
+		node_info->is_openmp = 1;
+	} else if (scop->options->reductions &&
+		    ast_schedule_dim_is_parallel(build, scop, 1)) {
 		node_info->is_openmp = 1;
+		node_info->reduction = 1;
+	}
+
+	if (node_info->is_openmp) {
+		set_openmp_schedule(build, scop->options, node_info);
+		node_info->taskloop = build_info->in_task;
+		build_info->in_parallel_for = 1;
+		build_info->parallel_for = node_info;
 	}
 }
 
@@ -191,15 +547,42 @@ static struct ast_node_userinfo *allocate_ast_node_userinfo()
 	node_info = (struct ast_node_userinfo *)
 		malloc(sizeof(struct ast_node_userinfo));
 	node_info->is_openmp = 0;
+	node_info->schedule = PPCG_OPENMP_SCHEDULE_DEFAULT;
+	node_info->chunk_size = 0;
+	node_info->taskloop = 0;
+	node_info->is_simd = 0;
+	node_info->safelen = 0;
+	node_info->reduction = 0;
+	node_info->reduction_scalars = NULL;
+	node_info->n_promoted = 0;
+	node_info->promoted = NULL;
 	return node_info;
 }
 
+/* Free the "n" elements of "promoted" along with the array itself.
+ */
+static void free_promotions(struct cpu_promotion *promoted, int n)
+{
+	int i;
+
+	if (!promoted)
+		return;
+	for (i = 0; i < n; ++i) {
+		isl_id_free(promoted[i].array);
+		isl_ast_expr_free(promoted[i].expr);
+		isl_id_free(promoted[i].name);
+	}
+	free(promoted);
+}
+
 /* Free an ast_node_info structure.
  */
 static void free_ast_node_userinfo(void *ptr)
 {
 	struct ast_node_userinfo *info;
 	info = (struct ast_node_userinfo *) ptr;
+	isl_id_list_free(info->reduction_scalars);
+	free_promotions(info->promoted, info->n_promoted);
 	free(info);
 }
 
@@ -227,10 +610,423 @@ static __isl_give isl_id *ast_build_before_for(
 	return id;
 }
 
+/* This function is called for each node in the body of a for node.
+ * Return false (and stop the traversal) if "node" is a for node
+ * or a user node for a statement that needs to be performed atomically,
+ * since neither of them can appear inside a SIMD loop.
+ */
+static isl_bool allows_simd(__isl_keep isl_ast_node *node, void *user)
+{
+	int *simd = user;
+	struct ppcg_stmt *stmt;
+	isl_id *id;
+
+	if (isl_ast_node_get_type(node) == isl_ast_node_for) {
+		*simd = 0;
+		return isl_bool_false;
+	}
+	if (isl_ast_node_get_type(node) != isl_ast_node_user)
+		return isl_bool_true;
+
+	id = isl_ast_node_get_annotation(node);
+	stmt = isl_id_get_user(id);
+	isl_id_free(id);
+
+	if (stmt && stmt->atomic)
+		*simd = 0;
+
+	return isl_bool_false;
+}
+
+/* Mark the for node "node" with annotation "node_info" as a SIMD loop
+ * if the openmp_simd option is set, if it is an innermost loop
+ * and if its iterations can be executed concurrently.
+ * The iterations can be executed concurrently if the loop is parallel or
+ * if the minimal dependence distance carried by the loop is greater than one.
+ * In the latter case, the minimal dependence distance, expressed
+ * in iterations of the loop, is recorded as the safe SIMD length
+ * of the loop.  If the loop does not have a constant increment,
+ * then this number of iterations cannot be determined and
+ * the loop is not marked.
+ *
+ * The statements have already been attached to the user nodes
+ * inside "node" by at_each_domain.  Loops containing statements
+ * that need to be performed atomically are not marked.
+ */
+static isl_stat mark_openmp_simd(__isl_keep isl_ast_node *node,
+	__isl_keep isl_ast_build *build, struct ast_build_userinfo *build_info,
+	struct ast_node_userinfo *node_info)
+{
+	struct ppcg_scop *scop = build_info->scop;
+	isl_ast_node *body;
+	int simd = 1;
+	int safelen, stride;
+
+	if (!scop->options->openmp_simd)
+		return isl_stat_ok;
+
+	body = isl_ast_node_for_get_body(node);
+	if (isl_ast_node_foreach_descendant_top_down(body, &allows_simd,
+						    &simd) < 0)
+		simd = -1;
+	isl_ast_node_free(body);
+	if (simd < 0)
+		return isl_stat_error;
+	if (!simd)
+		return isl_stat_ok;
+
+	if (ast_schedule_dim_is_parallel(build, scop, 0)) {
+		node_info->is_simd = 1;
+		return isl_stat_ok;
+	}
+
+	stride = for_node_stride(node);
+	if (stride <= 0)
+		return stride < 0 ? isl_stat_error : isl_stat_ok;
+	safelen = ast_schedule_dim_safelen(build, scop, stride);
+	if (safelen < 0)
+		return isl_stat_error;
+	if (safelen > 1) {
+		node_info->is_simd = 1;
+		node_info->safelen = safelen;
+	}
+
+	return isl_stat_ok;
+}
+
+/* Does the AST expression "expr" refer to the identifier "id"?
+ */
+static isl_bool expr_involves_id(__isl_keep isl_ast_expr *expr,
+	__isl_keep isl_id *id)
+{
+	int i, n;
+	isl_id *expr_id;
+
+	switch (isl_ast_expr_get_type(expr)) {
+	case isl_ast_expr_error:
+		return isl_bool_error;
+	case isl_ast_expr_int:
+		return isl_bool_false;
+	case isl_ast_expr_id:
+		expr_id = isl_ast_expr_get_id(expr);
+		isl_id_free(expr_id);
+		return expr_id == id;
+	case isl_ast_expr_op:
+		break;
+	}
+
+	n = isl_ast_expr_get_op_n_arg(expr);
+	for (i = 0; i < n; ++i) {
+		isl_ast_expr *arg;
+		isl_bool involves;
+
+		arg = isl_ast_expr_get_op_arg(expr, i);
+		involves = expr_involves_id(arg, id);
+		isl_ast_expr_free(arg);
+		if (involves < 0 || involves)
+			return involves;
+	}
+
+	return isl_bool_false;
+}
+
+/* Is "expr" an access to an element of an array with at least
+ * one dimension?
+ */
+static int is_array_element(__isl_keep isl_ast_expr *expr)
+{
+	if (isl_ast_expr_get_type(expr) != isl_ast_expr_op)
+		return 0;
+	if (isl_ast_expr_get_op_type(expr) != isl_ast_op_access)
+		return 0;
+	return isl_ast_expr_get_op_n_arg(expr) > 1;
+}
+
+/* Internal data structure for promote_invariant_elements.
+ *
+ * "iterator" is the iterator of the innermost for node.
+ * "stmt" is the statement that is currently being considered.
+ * "n" is the number of elements in "list", each of which
+ * corresponds to a different array accessed inside the for node.
+ * "size" is the number of allocated elements of "list".
+ * "invalid" is set if no array elements should be promoted.
+ */
+struct cpu_promotion_data {
+	isl_id *iterator;
+	struct ppcg_stmt *stmt;
+	int n;
+	int size;
+	struct cpu_promotion *list;
+	int invalid;
+};
+
+/* Return the element of data->list that corresponds to the array "array",
+ * adding it if needed, or NULL on error.
+ */
+static struct cpu_promotion *get_promotion(struct cpu_promotion_data *data,
+	__isl_take isl_id *array)
+{
+	int i;
+	struct cpu_promotion *p;
+
+	for (i = 0; i < data->n; ++i) {
+		if (data->list[i].array != array)
+			continue;
+		isl_id_free(array);
+		return &data->list[i];
+	}
+
+	if (data->n >= data->size) {
+		data->size = 2 * data->size + 4;
+		data->list = isl_realloc_array(isl_id_get_ctx(array),
+				data->list, struct cpu_promotion, data->size);
+		if (!data->list) {
+			isl_id_free(array);
+			return NULL;
+		}
+	}
+	p = &data->list[data->n++];
+	p->array = array;
+	p->expr = NULL;
+	p->type = NULL;
+	p->write = 0;
+	p->blocked = 0;
+	p->name = NULL;
+
+	return p;
+}
+
+/* Record the access "expr" of data->stmt in data->list.
+ * The array element can only be promoted if all accesses
+ * to the same array inside the for node are accesses to this element and
+ * if the element does not depend on the iterator of the for node.
+ */
+static int collect_access(__isl_keep pet_expr *expr, void *user)
+{
+	struct cpu_promotion_data *data = user;
+	struct cpu_promotion *p;
+	isl_ast_expr *ast_expr;
+	isl_bool involves;
+	isl_id *id;
+
+	id = pet_expr_access_get_ref_id(expr);
+	ast_expr = isl_id_to_ast_expr_get(data->stmt->ref2expr, id);
+	isl_id_free(id);
+	p = get_promotion(data, pet_expr_access_get_id(expr));
+	if (!p || !ast_expr) {
+		isl_ast_expr_free(ast_expr);
+		return -1;
+	}
+
+	if (pet_expr_access_is_write(expr))
+		p->write = 1;
+	involves = expr_involves_id(ast_expr, data->iterator);
+	if (involves < 0) {
+		isl_ast_expr_free(ast_expr);
+		return -1;
+	}
+	if (involves || !is_array_element(ast_expr))
+		p->blocked = 1;
+	else if (!p->expr)
+		p->expr = isl_ast_expr_copy(ast_expr);
+	else if (!isl_ast_expr_is_equal(p->expr, ast_expr))
+		p->blocked = 1;
+	isl_ast_expr_free(ast_expr);
+
+	return 0;
+}
+
+/* Replace the access "expr" of data->stmt by the local scalar
+ * of the corresponding array in data->list, if any.
+ */
+static int replace_access(__isl_keep pet_expr *expr, void *user)
+{
+	struct cpu_promotion_data *data = user;
+	struct ppcg_stmt *stmt = data->stmt;
+	isl_ast_expr *scalar;
+	isl_id *array, *id;
+	int i;
+
+	array = pet_expr_access_get_id(expr);
+	isl_id_free(array);
+	for (i = 0; i < data->n; ++i)
+		if (data->list[i].array == array)
+			break;
+	if (i >= data->n)
+		return 0;
+
+	id = pet_expr_access_get_ref_id(expr);
+	scalar = isl_ast_expr_from_id(isl_id_copy(data->list[i].name));
+	stmt->ref2expr = isl_id_to_ast_expr_set(stmt->ref2expr, id, scalar);
+
+	return stmt->ref2expr ? 0 : -1;
+}
+
+/* This function is called for each node in the body of an innermost
+ * for node, with "user" pointing to a cpu_promotion_data.
+ * Only blocks of user nodes are allowed such that every promoted
+ * access is executed in every iteration.  Statements that need
+ * to be performed atomically are not allowed either.
+ * If "data->list" has already been filtered (i.e., its elements
+ * have been assigned names), then replace the accesses to
+ * the promoted elements.  Otherwise, collect the accesses.
+ */
+static isl_bool at_promotion_node(__isl_keep isl_ast_node *node, void *user)
+{
+	struct cpu_promotion_data *data = user;
+	struct ppcg_stmt *stmt;
+	isl_id *id;
+	int r;
+
+	if (isl_ast_node_get_type(node) == isl_ast_node_block)
+		return isl_bool_true;
+	if (isl_ast_node_get_type(node) != isl_ast_node_user) {
+		data->invalid = 1;
+		return isl_bool_false;
+	}
+
+	id = isl_ast_node_get_annotation(node);
+	stmt = isl_id_get_user(id);
+	isl_id_free(id);
+	if (!stmt)
+		return isl_bool_error;
+	if (stmt->atomic) {
+		data->invalid = 1;
+		return isl_bool_false;
+	}
+
+	data->stmt = stmt;
+	if (data->n > 0 && data->list[0].name)
+		r = pet_tree_foreach_access_expr(stmt->stmt->body,
+						&replace_access, data);
+	else
+		r = pet_tree_foreach_access_expr(stmt->stmt->body,
+						&collect_access, data);
+	if (r < 0)
+		return isl_bool_error;
+
+	return isl_bool_false;
+}
+
+/* Return the pet_array in "scop" with identifier "id" or
+ * NULL if there is no such array.
+ */
+static struct pet_array *find_array(struct pet_scop *scop,
+	__isl_keep isl_id *id)
+{
+	int i;
+
+	for (i = 0; i < scop->n_array; ++i) {
+		isl_id *array_id;
+
+		array_id = isl_set_get_tuple_id(scop->arrays[i]->extent);
+		isl_id_free(array_id);
+		if (array_id == id)
+			return scop->arrays[i];
+	}
+
+	return NULL;
+}
+
+/* Remove the elements of data->list that cannot be promoted,
+ * which is all of them if data->invalid is set, and
+ * assign a name and a type to the others.
+ * Elements that are written inside an openmp parallel for node
+ * (described by "node_info") are not promoted since the loop
+ * is then only parallel because the writes are reductions.
+ */
+static isl_stat filter_promotions(struct cpu_promotion_data *data,
+	struct ppcg_scop *scop, struct ast_node_userinfo *node_info)
+{
+	int i, n = 0;
+	char name[40];
+
+	for (i = 0; i < data->n; ++i) {
+		struct cpu_promotion *p = &data->list[i];
+		struct pet_array *pa;
+
+		pa = find_array(scop->pet, p->array);
+		if (!data->invalid && !p->blocked && p->expr &&
+		    pa && !pa->element_is_record &&
+		    !(p->write && node_info->is_openmp)) {
+			p->type = pa->element_type;
+			snprintf(name, sizeof(name), "ppcg_priv%d", n);
+			p->name = isl_id_alloc(isl_id_get_ctx(p->array),
+						name, NULL);
+			data->list[n++] = *p;
+			continue;
+		}
+		isl_id_free(p->array);
+		isl_ast_expr_free(p->expr);
+	}
+	data->n = n;
+
+	for (i = 0; i < n; ++i)
+		if (!data->list[i].name)
+			return isl_stat_error;
+	return isl_stat_ok;
+}
+
+/* Promote the array elements that are accessed inside the innermost
+ * for node "node" with annotation "node_info", but that do not depend
+ * on the loop iterator, to local scalars, if the register_promotion
+ * option is set.
+ * Such an element is loaded into the scalar before the loop and,
+ * if it is written inside the loop, stored back after the loop
+ * (see print_for).
+ * This allows the compiler to keep the element in a register
+ * without having to prove that other accesses do not alias it.
+ *
+ * The statements have already been attached to the user nodes
+ * inside "node" by at_each_domain.  First collect the accesses
+ * and determine which elements can be promoted.
+ * Then replace the accesses to these elements by the local scalars.
+ */
+static isl_stat promote_invariant_elements(__isl_keep isl_ast_node *node,
+	struct ast_build_userinfo *build_info,
+	struct ast_node_userinfo *node_info)
+{
+	struct ppcg_scop *scop = build_info->scop;
+	struct cpu_promotion_data data = { NULL, NULL, 0, 0, NULL, 0 };
+	isl_ast_expr *iterator;
+	isl_ast_node *body;
+	isl_stat r;
+
+	if (!scop->options->register_promotion)
+		return isl_stat_ok;
+
+	iterator = isl_ast_node_for_get_iterator(node);
+	data.iterator = isl_ast_expr_get_id(iterator);
+	isl_ast_expr_free(iterator);
+	body = isl_ast_node_for_get_body(node);
+
+	r = isl_ast_node_foreach_descendant_top_down(body,
+						&at_promotion_node, &data);
+	if (r >= 0)
+		r = filter_promotions(&data, scop, node_info);
+	if (r >= 0 && data.n > 0)
+		r = isl_ast_node_foreach_descendant_top_down(body,
+						&at_promotion_node, &data);
+
+	isl_ast_node_free(body);
+	isl_id_free(data.iterator);
+
+	if (r < 0) {
+		free_promotions(data.list, data.n);
+		return isl_stat_error;
+	}
+	node_info->n_promoted = data.n;
+	node_info->promoted = data.list;
+
+	return isl_stat_ok;
+}
+
 /* This method is executed after the construction of a for node.
  *
  * It performs the following actions:
  *
+ * 	- Detection of SIMD loops
+ * 	- Promotion of loop invariant array elements to scalars
  * 	- Reset the 'in_parallel_for' flag, as soon as we leave a for node,
  * 	  that is marked as openmp parallel.
  *
@@ -245,10 +1041,16 @@ static __isl_give isl_ast_node *ast_build_after_for(
 
 	id = isl_ast_node_get_annotation(node);
 	info = isl_id_get_user(id);
+	build_info = (struct ast_build_userinfo *) user;
+
+	if (info && mark_openmp_simd(node, build, build_info, info) < 0)
+		node = isl_ast_node_free(node);
+	if (info && promote_invariant_elements(node, build_info, info) < 0)
+		node = isl_ast_node_free(node);
 
 	if (info && info->is_openmp) {
-		build_info = (struct ast_build_userinfo *) user;
 		build_info->in_parallel_for = 0;
+		build_info->parallel_for = NULL;
 	}
 
 	isl_id_free(id);
@@ -277,8 +1079,38 @@ static struct pet_stmt *find_stmt(struct ppcg_scop *scop, __isl_keep isl_id *id)
 		"statement not found", return NULL);
 }
 
+/* Print a prefetch of each of the array elements in "list", if any.
+ * If "write" is set, then the elements are prefetched for writing.
+ */
+static __isl_give isl_printer *print_prefetches(__isl_take isl_printer *p,
+	__isl_keep isl_ast_expr_list *list, int write)
+{
+	int i, n;
+
+	n = list ? isl_ast_expr_list_n_ast_expr(list) : 0;
+	for (i = 0; i < n; ++i) {
+		isl_ast_expr *expr;
+
+		expr = isl_ast_expr_list_get_ast_expr(list, i);
+		p = isl_printer_start_line(p);
+		p = isl_printer_print_str(p, "__builtin_prefetch(&");
+		p = isl_printer_print_ast_expr(p, expr);
+		if (write)
+			p = isl_printer_print_str(p, ", 1");
+		p = isl_printer_print_str(p, ");");
+		p = isl_printer_end_line(p);
+		isl_ast_expr_free(expr);
+	}
+
+	return p;
+}
+
 /* Print a user statement in the generated AST.
  * The ppcg_stmt has been attached to the node in at_each_domain.
+ * The statement is preceded by the prefetches of the array elements
+ * that will be accessed a number of iterations later, if any.
+ * If the statement is a reduction that needs to be performed atomically,
+ * then it is preceded by an "omp atomic" directive.
  */
 static __isl_give isl_printer *print_user(__isl_take isl_printer *p,
 	__isl_take isl_ast_print_options *print_options,
@@ -291,6 +1123,13 @@ static __isl_give isl_printer *print_user(__isl_take isl_printer *p,
 	stmt = isl_id_get_user(id);
 	isl_id_free(id);
 
+	p = print_prefetches(p, stmt->prefetch_read, 0);
+	p = print_prefetches(p, stmt->prefetch_write, 1);
+	if (stmt->atomic) {
+		p = isl_printer_start_line(p);
+		p = isl_printer_print_str(p, "#pragma omp atomic");
+		p = isl_printer_end_line(p);
+	}
 	p = pet_stmt_print_body(stmt->stmt, p, stmt->ref2expr);
 
 	isl_ast_print_options_free(print_options);
@@ -299,10 +1138,47 @@ static __isl_give isl_printer *print_user(__isl_take isl_printer *p,
 }
 
 
-/* Print a for loop node as an openmp parallel loop.
+/* Print the schedule clause of the openmp parallel for node "info", if any.
+ */
+static __isl_give isl_printer *print_schedule_clause(__isl_take isl_printer *p,
+	struct ast_node_userinfo *info)
+{
+	const char *kind;
+
+	switch (info->schedule) {
+	case PPCG_OPENMP_SCHEDULE_STATIC:
+		kind = "static";
+		break;
+	case PPCG_OPENMP_SCHEDULE_DYNAMIC:
+		kind = "dynamic";
+		break;
+	case PPCG_OPENMP_SCHEDULE_GUIDED:
+		kind = "guided";
+		break;
+	default:
+		return p;
+	}
+
+	p = isl_printer_print_str(p, " schedule(");
+	p = isl_printer_print_str(p, kind);
+	if (info->chunk_size > 0) {
+		p = isl_printer_print_str(p, ", ");
+		p = isl_printer_print_int(p, info->chunk_size);
+	}
+	p = isl_printer_print_str(p, ")");
+
+	return p;
+}
+
+/* Print a for loop node as an openmp parallel and/or SIMD loop.
  *
  * To print an openmp parallel loop we print a normal for loop, but add
  * "#pragma openmp parallel for" in front.
+ * An innermost loop that has been marked as a SIMD loop gets
+ * "#pragma omp simd" instead or "#pragma omp parallel for simd"
+ * if it is also the openmp parallel loop.  If the dependences only
+ * allow a limited number of iterations to be executed concurrently,
+ * then this number is passed in a safelen clause.
  *
  * Variables that are declared within the body of this for loop are
  * automatically openmp 'private'. Iterators declared outside of the
@@ -313,13 +1189,56 @@ static __isl_give isl_printer *print_user(__isl_take isl_printer *p,
  * This function only generates valid OpenMP code, if the ast was generated
  * with the 'atomic-bounds' option enabled.
  *
+ * If "info" has any scalar reduction targets, then they are added
+ * to a reduction clause.
+ * If "info" has a schedule clause, then it is printed as well,
+ * with the chunk size specified by the user, if any,
+ * followed by the proc_bind clause, if any.
+ *
+ * An openmp parallel loop inside the body of an openmp task
+ * is printed as "#pragma omp taskloop" instead, without
+ * schedule and proc_bind clauses since they do not apply to taskloops.
+ * Reductions on array elements are performed atomically as usual,
+ * while scalar reduction targets are added to the reduction clause
+ * of the taskloop, which requires OpenMP 5.0.
  */
 static __isl_give isl_printer *print_for_with_openmp(
 	__isl_keep isl_ast_node *node, __isl_take isl_printer *p,
-	__isl_take isl_ast_print_options *print_options)
+	__isl_take isl_ast_print_options *print_options,
+	struct ast_node_userinfo *info)
 {
+	int i, n;
+
 	p = isl_printer_start_line(p);
-	p = isl_printer_print_str(p, "#pragma omp parallel for");
+	p = isl_printer_print_str(p, "#pragma omp");
+	if (info->is_openmp && info->taskloop)
+		p = isl_printer_print_str(p, " taskloop");
+	else if (info->is_openmp)
+		p = isl_printer_print_str(p, " parallel for");
+	if (info->is_simd)
+		p = isl_printer_print_str(p, " simd");
+	if (info->is_openmp && !info->taskloop) {
+		p = print_schedule_clause(p, info);
+		p = ppcg_print_openmp_proc_bind(p, info->proc_bind);
+	}
+	if (info->safelen > 0) {
+		p = isl_printer_print_str(p, " safelen(");
+		p = isl_printer_print_int(p, info->safelen);
+		p = isl_printer_print_str(p, ")");
+	}
+	n = 0;
+	if (info->reduction_scalars)
+		n = isl_id_list_n_id(info->reduction_scalars);
+	for (i = 0; i < n; ++i) {
+		isl_id *id;
+
+		id = isl_id_list_get_id(info->reduction_scalars, i);
+		p = isl_printer_print_str(p, i ? ", " : " reduction(+: ");
+		p = isl_printer_print_str(p, isl_id_get_name(id));
+		isl_id_free(id);
+	}
+	if (n > 0)
+		p = isl_printer_print_str(p, ")");
 	p = isl_printer_end_line(p);
 
 	p = isl_ast_node_for_print(node, p, print_options);
@@ -327,33 +1246,90 @@ static __isl_give isl_printer *print_for_with_openmp(
 	return p;
 }
 
+/* Print the declarations of the local scalars of the promoted
+ * array elements "promoted" of size "n", initialized
+ * to the values of the array elements.
+ */
+static __isl_give isl_printer *print_promoted_loads(__isl_take isl_printer *p,
+	struct cpu_promotion *promoted, int n)
+{
+	int i;
+
+	for (i = 0; i < n; ++i) {
+		p = isl_printer_start_line(p);
+		p = isl_printer_print_str(p, promoted[i].type);
+		p = isl_printer_print_str(p, " ");
+		p = isl_printer_print_str(p, isl_id_get_name(promoted[i].name));
+		p = isl_printer_print_str(p, " = ");
+		p = isl_printer_print_ast_expr(p, promoted[i].expr);
+		p = isl_printer_print_str(p, ";");
+		p = isl_printer_end_line(p);
+	}
+
+	return p;
+}
+
+/* Print statements that store the local scalars of the promoted
+ * array elements "promoted" of size "n" that are written inside the loop
+ * back to the array elements.
+ */
+static __isl_give isl_printer *print_promoted_stores(__isl_take isl_printer *p,
+	struct cpu_promotion *promoted, int n)
+{
+	int i;
+
+	for (i = 0; i < n; ++i) {
+		if (!promoted[i].write)
+			continue;
+		p = isl_printer_start_line(p);
+		p = isl_printer_print_ast_expr(p, promoted[i].expr);
+		p = isl_printer_print_str(p, " = ");
+		p = isl_printer_print_str(p, isl_id_get_name(promoted[i].name));
+		p = isl_printer_print_str(p, ";");
+		p = isl_printer_end_line(p);
+	}
+
+	return p;
+}
+
 /* Print a for node.
  *
  * Depending on how the node is annotated, we either print a normal
- * for node or an openmp parallel for node.
+ * for node or an openmp parallel and/or SIMD for node.
+ * If any array elements have been promoted to local scalars
+ * around the for node, then the for node is printed inside a block
+ * that loads the elements into the scalars before the loop and
+ * stores any modified elements after the loop.
  */
 static __isl_give isl_printer *print_for(__isl_take isl_printer *p,
 	__isl_take isl_ast_print_options *print_options,
 	__isl_keep isl_ast_node *node, void *user)
 {
 	isl_id *id;
+	struct ast_node_userinfo *info = NULL;
 	int openmp;
 
 	openmp = 0;
 	id = isl_ast_node_get_annotation(node);
 
 	if (id) {
-		struct ast_node_userinfo *info;
-
 		info = (struct ast_node_userinfo *) isl_id_get_user(id);
-		if (info && info->is_openmp)
+		if (info && (info->is_openmp || info->is_simd))
 			openmp = 1;
 	}
 
+	if (info && info->n_promoted > 0) {
+		p = ppcg_start_block(p);
+		p = print_promoted_loads(p, info->promoted, info->n_promoted);
+	}
 	if (openmp)
-		p = print_for_with_openmp(node, p, print_options);
+		p = print_for_with_openmp(node, p, print_options, info);
 	else
 		p = isl_ast_node_for_print(node, p, print_options);
+	if (info && info->n_promoted > 0) {
+		p = print_promoted_stores(p, info->promoted, info->n_promoted);
+		p = ppcg_end_block(p);
+	}
 
 	isl_id_free(id);
 
@@ -378,15 +1354,370 @@ static __isl_give isl_multi_pw_aff *pullback_index(
 	return isl_multi_pw_aff_pullback_pw_multi_aff(index, iterator_map);
 }
 
+/* Add "id" to the scalar reduction targets of "info",
+ * unless it already appears among them.
+ */
+static isl_stat add_reduction_scalar(struct ast_node_userinfo *info,
+	__isl_take isl_id *id)
+{
+	int i, n;
+
+	if (!info->reduction_scalars)
+		info->reduction_scalars = isl_id_list_alloc(isl_id_get_ctx(id),
+							    1);
+	n = isl_id_list_n_id(info->reduction_scalars);
+	for (i = 0; i < n; ++i) {
+		isl_id *id_i;
+
+		id_i = isl_id_list_get_id(info->reduction_scalars, i);
+		isl_id_free(id_i);
+		if (id_i == id) {
+			isl_id_free(id);
+			return isl_stat_ok;
+		}
+	}
+	info->reduction_scalars = isl_id_list_add(info->reduction_scalars, id);
+	if (!info->reduction_scalars)
+		return isl_stat_error;
+
+	return isl_stat_ok;
+}
+
+/* If "stmt" is a reduction inside an openmp parallel for loop
+ * that is only parallel thanks to the reductions being executed
+ * atomically, then make sure the reduction is executed atomically.
+ * If the reduction target is a scalar, then it is added
+ * to the reduction clause of the parallel for loop.
+ * Otherwise, the statement is marked atomic.
+ */
+static isl_stat mark_reduction(struct ast_build_userinfo *build_info,
+	struct ppcg_stmt *stmt)
+{
+	struct ast_node_userinfo *info = build_info->parallel_for;
+	isl_union_map *reductions;
+	isl_union_set *domain;
+	isl_bool reduction;
+	isl_map *write;
+	isl_id *id;
+
+	if (!info || !info->reduction)
+		return isl_stat_ok;
+	reduction = ppcg_scop_is_reduction(build_info->scop, stmt->stmt);
+	if (reduction < 0)
+		return isl_stat_error;
+	if (!reduction)
+		return isl_stat_ok;
+
+	reductions = isl_union_map_copy(build_info->scop->reductions);
+	domain = isl_union_set_from_set(isl_set_copy(stmt->stmt->domain));
+	reductions = isl_union_map_intersect_domain(reductions, domain);
+	write = isl_map_from_union_map(reductions);
+	if (!write)
+		return isl_stat_error;
+	if (isl_map_dim(write, isl_dim_out) != 0) {
+		isl_map_free(write);
+		stmt->atomic = 1;
+		return isl_stat_ok;
+	}
+	id = isl_map_get_tuple_id(write, isl_dim_out);
+	isl_map_free(write);
+
+	return add_reduction_scalar(info, id);
+}
+
+/* Internal data structure for add_prefetch.
+ *
+ * "build" is the AST build at the statement.
+ * "layouts" are the arrays that are accessed through a copy.
+ * "stmt" is the statement for which prefetches are collected.
+ * "schedule" is the isl_ast_build_get_schedule of the statement and
+ * "iterator_map" its inverse.
+ * "next" maps an iteration of the innermost loop to the next iteration and
+ * "ahead" maps it to the iteration that is a prefetch distance later.
+ */
+struct ppcg_prefetch_data {
+	isl_ast_build *build;
+	struct cpu_layouts *layouts;
+	struct ppcg_stmt *stmt;
+	isl_map *schedule;
+	isl_pw_multi_aff *iterator_map;
+	isl_map *next;
+	isl_multi_aff *ahead;
+};
+
+/* Return a function on the schedule space "space" that adds "d"
+ * to dimension "pos".
+ */
+static __isl_give isl_multi_aff *shift_dim(__isl_take isl_space *space,
+	int pos, int d)
+{
+	isl_multi_aff *ma;
+	isl_aff *aff;
+
+	ma = isl_multi_aff_identity(isl_space_map_from_set(space));
+	aff = isl_multi_aff_get_aff(ma, pos);
+	aff = isl_aff_add_constant_si(aff, d);
+	ma = isl_multi_aff_set_aff(ma, pos, aff);
+
+	return ma;
+}
+
+/* Does the access relation "access", mapping the iterations
+ * of the AST to array elements, stream through the innermost dimension
+ * of the array along the innermost loop?
+ * That is, do consecutive iterations of the innermost loop
+ * access elements at a non-zero distance in the innermost
+ * array dimension and with the same indices in all other dimensions?
+ */
+static isl_bool is_streaming(__isl_keep isl_map *access,
+	struct ppcg_prefetch_data *data)
+{
+	isl_map *pairs;
+	isl_set *deltas, *other, *zero;
+	isl_bool empty, subset, streaming;
+	int i, n;
+
+	pairs = isl_map_apply_range(isl_map_copy(data->next),
+				isl_map_copy(access));
+	pairs = isl_map_apply_domain(pairs, isl_map_copy(access));
+	deltas = isl_map_deltas(pairs);
+
+	n = isl_set_dim(deltas, isl_dim_set);
+	other = isl_set_universe(isl_set_get_space(deltas));
+	for (i = 0; i < n - 1; ++i)
+		other = isl_set_fix_si(other, isl_dim_set, i, 0);
+	zero = isl_set_fix_si(isl_set_copy(deltas), isl_dim_set, n - 1, 0);
+
+	empty = isl_set_is_empty(deltas);
+	subset = isl_set_is_subset(deltas, other);
+	streaming = isl_set_is_empty(zero);
+	if (empty < 0 || subset < 0)
+		streaming = isl_bool_error;
+	else if (empty || !subset)
+		streaming = isl_bool_false;
+
+	isl_set_free(zero);
+	isl_set_free(other);
+	isl_set_free(deltas);
+
+	return streaming;
+}
+
+/* Store the expression "ma" of a piece of a piecewise multi affine
+ * expression in *user.
+ */
+static isl_stat extract_piece(__isl_take isl_set *set,
+	__isl_take isl_multi_aff *ma, void *user)
+{
+	isl_multi_aff **res = user;
+
+	isl_set_free(set);
+	*res = ma;
+
+	return isl_stat_ok;
+}
+
+/* Extract the single piece of "pma" as a function on the entire space or
+ * return NULL if "pma" does not consist of a single piece.
+ */
+static __isl_give isl_pw_multi_aff *single_piece(
+	__isl_take isl_pw_multi_aff *pma)
+{
+	isl_multi_aff *ma = NULL;
+
+	if (isl_pw_multi_aff_n_piece(pma) != 1) {
+		isl_pw_multi_aff_free(pma);
+		return NULL;
+	}
+	if (isl_pw_multi_aff_foreach_piece(pma, &extract_piece, &ma) < 0)
+		ma = isl_multi_aff_free(ma);
+	isl_pw_multi_aff_free(pma);
+
+	return ma ? isl_pw_multi_aff_from_multi_aff(ma) : NULL;
+}
+
+/* Add "expr" to "list", unless it already appears in "list".
+ */
+static __isl_give isl_ast_expr_list *add_unique(
+	__isl_take isl_ast_expr_list *list, __isl_take isl_ast_expr *expr)
+{
+	int i, n;
+
+	if (!expr)
+		return isl_ast_expr_list_free(list);
+	if (!list)
+		list = isl_ast_expr_list_alloc(isl_ast_expr_get_ctx(expr), 1);
+	n = isl_ast_expr_list_n_ast_expr(list);
+	for (i = 0; i < n; ++i) {
+		isl_ast_expr *expr_i;
+		isl_bool equal;
+
+		expr_i = isl_ast_expr_list_get_ast_expr(list, i);
+		equal = isl_ast_expr_is_equal(expr_i, expr);
+		isl_ast_expr_free(expr_i);
+		if (equal < 0 || equal) {
+			isl_ast_expr_free(expr);
+			return equal < 0 ? isl_ast_expr_list_free(list) : list;
+		}
+	}
+
+	return isl_ast_expr_list_add(list, expr);
+}
+
+/* If the access expression "expr" of data->stmt streams through an array
+ * along the innermost loop, then add the element that it accesses
+ * a prefetch distance later to the prefetches of data->stmt.
+ * Accesses with nested accesses in their index expressions are skipped.
+ */
+static int add_prefetch(__isl_keep pet_expr *expr, void *user)
+{
+	struct ppcg_prefetch_data *data = user;
+	isl_multi_pw_aff *index;
+	isl_pw_multi_aff *pma;
+	isl_ast_expr *access;
+	isl_map *map;
+	isl_bool streaming;
+	int n;
+
+	if (pet_expr_get_n_arg(expr) > 0)
+		return 0;
+	index = pet_expr_access_get_index(expr);
+	n = isl_multi_pw_aff_dim(index, isl_dim_out);
+	if (n <= 0 || isl_multi_pw_aff_range_is_wrapping(index)) {
+		isl_multi_pw_aff_free(index);
+		return n < 0 ? -1 : 0;
+	}
+
+	pma = isl_pw_multi_aff_from_multi_pw_aff(index);
+	pma = isl_pw_multi_aff_pullback_pw_multi_aff(pma,
+				isl_pw_multi_aff_copy(data->iterator_map));
+	map = isl_map_from_pw_multi_aff(isl_pw_multi_aff_copy(pma));
+	map = isl_map_intersect_domain(map,
+				isl_map_range(isl_map_copy(data->schedule)));
+	streaming = is_streaming(map, data);
+	isl_map_free(map);
+	if (streaming <= 0) {
+		isl_pw_multi_aff_free(pma);
+		return streaming < 0 ? -1 : 0;
+	}
+
+	pma = isl_pw_multi_aff_pullback_multi_aff(pma,
+				isl_multi_aff_copy(data->ahead));
+	pma = single_piece(pma);
+	if (!pma)
+		return 0;
+	access = isl_ast_build_access_from_pw_multi_aff(data->build, pma);
+	access = cpu_layouts_rewrite_access(data->layouts, access);
+	if (pet_expr_access_is_write(expr)) {
+		data->stmt->prefetch_write = add_unique(
+					data->stmt->prefetch_write, access);
+		if (!data->stmt->prefetch_write)
+			return -1;
+	} else {
+		data->stmt->prefetch_read = add_unique(
+					data->stmt->prefetch_read, access);
+		if (!data->stmt->prefetch_read)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Return the prefetch distance, in iterations of the innermost loop,
+ * i.e., the value of the prefetch_distance option or,
+ * if this option is not set, the default tile size, if tiling is enabled.
+ * Return 0 if no prefetches should be inserted.
+ */
+static int prefetch_distance(struct ppcg_options *options)
+{
+	if (options->prefetch_distance > 0)
+		return options->prefetch_distance;
+	if (options->tile)
+		return options->tile_size;
+	return 0;
+}
+
+/* Collect the array elements that the statement "stmt" at "build"
+ * will access a prefetch distance further along the innermost loop,
+ * in case this is an access that streams through the array,
+ * and keep track of them in stmt->prefetch_read and stmt->prefetch_write.
+ * In the case of a tiled loop, the default prefetch distance
+ * is the tile size, such that the elements of the next tile
+ * are prefetched while the current tile is being executed.
+ *
+ * Prefetching relies on __builtin_prefetch and is therefore
+ * only performed if GNU extensions are allowed.
+ * The innermost loop is the innermost schedule dimension that
+ * does not have a fixed value.
+ */
+static isl_stat add_prefetches(__isl_keep isl_ast_build *build,
+	struct ast_build_userinfo *build_info, struct ppcg_stmt *stmt)
+{
+	struct ppcg_options *options = build_info->scop->options;
+	struct ppcg_prefetch_data data;
+	isl_union_map *schedule;
+	isl_space *space;
+	isl_set *range;
+	int distance, pos, r;
+
+	distance = prefetch_distance(options);
+	if (!options->allow_gnu_extensions || distance <= 0)
+		return isl_stat_ok;
+
+	schedule = isl_ast_build_get_schedule(build);
+	data.schedule = isl_map_from_union_map(schedule);
+	range = isl_map_range(isl_map_copy(data.schedule));
+	for (pos = isl_set_dim(range, isl_dim_set) - 1; pos >= 0; --pos) {
+		isl_val *v;
+		int fixed;
+
+		v = isl_set_plain_get_val_if_fixed(range, isl_dim_set, pos);
+		fixed = v && !isl_val_is_nan(v);
+		isl_val_free(v);
+		if (!fixed)
+			break;
+	}
+	space = isl_set_get_space(range);
+	isl_set_free(range);
+	if (pos < 0) {
+		isl_space_free(space);
+		isl_map_free(data.schedule);
+		return isl_stat_ok;
+	}
+
+	data.build = build;
+	data.layouts = build_info->layouts;
+	data.stmt = stmt;
+	data.iterator_map = isl_pw_multi_aff_from_map(
+				isl_map_reverse(isl_map_copy(data.schedule)));
+	data.next = isl_map_from_multi_aff(shift_dim(isl_space_copy(space),
+				pos, 1));
+	data.ahead = shift_dim(space, pos, distance);
+	r = pet_tree_foreach_access_expr(stmt->stmt->body, &add_prefetch,
+					&data);
+	isl_multi_aff_free(data.ahead);
+	isl_map_free(data.next);
+	isl_pw_multi_aff_free(data.iterator_map);
+	isl_map_free(data.schedule);
+
+	return r < 0 ? isl_stat_error : isl_stat_ok;
+}
+
 /* Transform the accesses in the statement associated to the domain
  * called by "node" to refer to the AST loop iterators, construct
  * corresponding AST expressions using "build",
  * collect them in a ppcg_stmt and annotate the node with the ppcg_stmt.
+ * If the statement is a reduction inside a parallel for loop that
+ * depends on the reductions being executed atomically, then
+ * mark the reduction accordingly.
+ * If the prefetch option is set, then also collect the array elements
+ * that should be prefetched.
  */
 static __isl_give isl_ast_node *at_each_domain(__isl_take isl_ast_node *node,
 	__isl_keep isl_ast_build *build, void *user)
 {
-	struct ppcg_scop *scop = user;
+	struct ast_build_userinfo *build_info = user;
+	struct ppcg_scop *scop = build_info->scop;
 	isl_ast_expr *expr, *arg;
 	isl_ctx *ctx;
 	isl_id *id;
@@ -415,6 +1746,13 @@ static __isl_give isl_ast_node *at_each_domain(__isl_take isl_ast_node *node,
 	stmt->ref2expr = pet_stmt_build_ast_exprs(stmt->stmt, build,
 				    &pullback_index, iterator_map, NULL, NULL);
 	isl_pw_multi_aff_free(iterator_map);
+	stmt->ref2expr = cpu_layouts_rewrite_accesses(build_info->layouts,
+							stmt->ref2expr);
+	if (mark_reduction(build_info, stmt) < 0)
+		goto error;
+	if (scop->options->prefetch &&
+	    add_prefetches(build, build_info, stmt) < 0)
+		goto error;
 
 	id = isl_id_alloc(isl_ast_node_get_ctx(node), NULL, stmt);
 	id = isl_id_set_free_user(id, &ppcg_stmt_free);
@@ -432,18 +1770,62 @@ static isl_bool update_depth(__isl_keep isl_schedule_node *node, void *user)
 	int *depth = user;
 	int node_depth;
 
-	if (isl_schedule_node_get_type(node) != isl_schedule_node_leaf)
-		return isl_bool_true;
-	node_depth = isl_schedule_node_get_schedule_depth(node);
-	if (node_depth > *depth)
-		*depth = node_depth;
+	if (isl_schedule_node_get_type(node) != isl_schedule_node_leaf)
+		return isl_bool_true;
+	node_depth = isl_schedule_node_get_schedule_depth(node);
+	if (node_depth > *depth)
+		*depth = node_depth;
+
+	return isl_bool_false;
+}
+
+/* Print the macro definitions required for printing the array elements
+ * that have been promoted around the for node "node", if any, to *p.
+ * Return true such that the descendants of "node" are also visited.
+ */
+static isl_bool at_for_node(__isl_keep isl_ast_node *node, isl_printer **p)
+{
+	struct ast_node_userinfo *info;
+	isl_id *id;
+	int i;
+
+	id = isl_ast_node_get_annotation(node);
+	info = id ? isl_id_get_user(id) : NULL;
+	isl_id_free(id);
+
+	for (i = 0; info && i < info->n_promoted; ++i)
+		*p = ppcg_ast_expr_print_macros(info->promoted[i].expr, *p);
+	if (!*p)
+		return isl_bool_error;
+
+	return isl_bool_true;
+}
+
+/* Print the macro definitions required for printing the AST expressions
+ * in "list", if any, to "p".
+ */
+static __isl_give isl_printer *print_list_macros(__isl_take isl_printer *p,
+	__isl_keep isl_ast_expr_list *list)
+{
+	int i, n;
+
+	n = list ? isl_ast_expr_list_n_ast_expr(list) : 0;
+	for (i = 0; i < n; ++i) {
+		isl_ast_expr *expr;
 
-	return isl_bool_false;
+		expr = isl_ast_expr_list_get_ast_expr(list, i);
+		p = ppcg_ast_expr_print_macros(expr, p);
+		isl_ast_expr_free(expr);
+	}
+
+	return p;
 }
 
 /* This function is called for each node in a CPU AST.
  * In case of a user node, print the macro definitions required
  * for printing the AST expressions in the annotation, if any.
+ * In case of a for node, print the macro definitions required
+ * for printing the promoted array elements, if any.
  * For other nodes, return true such that descendants are also
  * visited.
  *
@@ -456,6 +1838,8 @@ static isl_bool at_node(__isl_keep isl_ast_node *node, void *user)
 	isl_id *id;
 	isl_printer **p = user;
 
+	if (isl_ast_node_get_type(node) == isl_ast_node_for)
+		return at_for_node(node, p);
 	if (isl_ast_node_get_type(node) != isl_ast_node_user)
 		return isl_bool_true;
 
@@ -467,6 +1851,8 @@ static isl_bool at_node(__isl_keep isl_ast_node *node, void *user)
 		return isl_bool_error;
 
 	*p = ppcg_print_body_macros(*p, stmt->ref2expr);
+	*p = print_list_macros(*p, stmt->prefetch_read);
+	*p = print_list_macros(*p, stmt->prefetch_write);
 	if (!*p)
 		return isl_bool_error;
 
@@ -487,10 +1873,13 @@ static __isl_give isl_printer *cpu_print_macros(__isl_take isl_printer *p,
 
 /* Code generate the scop 'scop' using "schedule"
  * and print the corresponding C code to 'p'.
+ * Accesses to the arrays in "layouts" are replaced by accesses
+ * to their copies.
+ * "in_task" is set if the code is printed as the body of an openmp task.
  */
 static __isl_give isl_printer *print_scop(struct ppcg_scop *scop,
 	__isl_take isl_schedule *schedule, __isl_take isl_printer *p,
-	struct ppcg_options *options)
+	struct ppcg_options *options, struct cpu_layouts *layouts, int in_task)
 {
 	isl_ctx *ctx = isl_printer_get_ctx(p);
 	isl_ast_build *build;
@@ -498,8 +1887,10 @@ static __isl_give isl_printer *print_scop(struct ppcg_scop *scop,
 	isl_ast_node *tree;
 	isl_id_list *iterators;
 	struct ast_build_userinfo build_info;
+	struct ppcg_timer timer;
 	int depth;
 
+	ppcg_timer_start(&timer);
 	depth = 0;
 	if (isl_schedule_foreach_schedule_node_top_down(schedule, &update_depth,
 						&depth) < 0)
@@ -508,12 +1899,16 @@ static __isl_give isl_printer *print_scop(struct ppcg_scop *scop,
 	build = isl_ast_build_alloc(ctx);
 	iterators = ppcg_scop_generate_names(scop, depth, "c");
 	build = isl_ast_build_set_iterators(build, iterators);
-	build = isl_ast_build_set_at_each_domain(build, &at_each_domain, scop);
-
-	if (options->openmp) {
-		build_info.scop = scop;
-		build_info.in_parallel_for = 0;
-
+	build_info.scop = scop;
+	build_info.in_parallel_for = 0;
+	build_info.in_task = in_task;
+	build_info.parallel_for = NULL;
+	build_info.layouts = layouts;
+	build = isl_ast_build_set_at_each_domain(build, &at_each_domain,
+						&build_info);
+
+	if (options->openmp || options->openmp_simd ||
+	    options->register_promotion) {
 		build = isl_ast_build_set_before_each_for(build,
 							&ast_build_before_for,
 							&build_info);
@@ -524,7 +1919,10 @@ static __isl_give isl_printer *print_scop(struct ppcg_scop *scop,
 
 	tree = isl_ast_build_node_from_schedule(build, schedule);
 	isl_ast_build_free(build);
+	ppcg_timer_report(&timer, options, "AST generation",
+			"scop", scop->start);
 
+	ppcg_timer_start(&timer);
 	print_options = isl_ast_print_options_alloc(ctx);
 	print_options = isl_ast_print_options_set_print_user(print_options,
 							&print_user, NULL);
@@ -536,6 +1934,7 @@ static __isl_give isl_printer *print_scop(struct ppcg_scop *scop,
 	p = isl_ast_node_print(tree, p, print_options);
 
 	isl_ast_node_free(tree);
+	ppcg_timer_report(&timer, options, "printing", "scop", scop->start);
 
 	return p;
 error:
@@ -544,6 +1943,185 @@ error:
 	return NULL;
 }
 
+/* Return a pointer to the outermost node of "schedule" that is not
+ * a domain or context node.
+ */
+static __isl_give isl_schedule_node *get_outer_node(
+	__isl_keep isl_schedule *schedule)
+{
+	isl_schedule_node *node;
+	enum isl_schedule_node_type type;
+
+	node = isl_schedule_get_root(schedule);
+	do {
+		node = isl_schedule_node_child(node, 0);
+		type = isl_schedule_node_get_type(node);
+	} while (type == isl_schedule_node_context);
+
+	return node;
+}
+
+/* Does any of the dependences in "deps" go from an instance in "src" to
+ * an instance in "sink"?
+ */
+static isl_bool has_dependence(__isl_keep isl_union_map *deps,
+	__isl_keep isl_union_set *src, __isl_keep isl_union_set *sink)
+{
+	isl_union_map *test;
+	isl_bool empty;
+
+	test = isl_union_map_copy(deps);
+	test = isl_union_map_intersect_domain(test, isl_union_set_copy(src));
+	test = isl_union_map_intersect_range(test, isl_union_set_copy(sink));
+	empty = isl_union_map_is_empty(test);
+	isl_union_map_free(test);
+
+	return isl_bool_not(empty);
+}
+
+/* Print a "#pragma omp task" for the child with filter "filters[j]"
+ * of the outer sequence node, with a depend(in) clause for each
+ * earlier child with filter "filters[i]" that it depends on according
+ * to "deps" and a depend(out) clause for the child itself.
+ * The dependences between the tasks are expressed on the elements
+ * of the ppcg_task_dep array.
+ */
+static __isl_give isl_printer *print_task_pragma(__isl_take isl_printer *p,
+	__isl_keep isl_union_map *deps, isl_union_set **filters, int j)
+{
+	int i;
+
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "#pragma omp task");
+	for (i = 0; i < j; ++i) {
+		isl_bool dep;
+
+		dep = has_dependence(deps, filters[i], filters[j]);
+		if (dep < 0)
+			return isl_printer_free(p);
+		if (!dep)
+			continue;
+		p = isl_printer_print_str(p, " depend(in: ppcg_task_dep[");
+		p = isl_printer_print_int(p, i);
+		p = isl_printer_print_str(p, "])");
+	}
+	p = isl_printer_print_str(p, " depend(out: ppcg_task_dep[");
+	p = isl_printer_print_int(p, j);
+	p = isl_printer_print_str(p, "])");
+	p = isl_printer_end_line(p);
+
+	return p;
+}
+
+/* Code generate the scop "scop" using "schedule", the outer node of which
+ * is the sequence node "seq", such that each child of "seq"
+ * is executed as a separate openmp task, and print the result to "p".
+ *
+ * The tasks are created by a single thread of a parallel region.
+ * A task only waits for the earlier tasks that it depends on
+ * according to the dependences of "scop", such that independent
+ * children of "seq" can be executed concurrently.
+ * The code for each task is generated from "schedule" restricted
+ * to the filter of the corresponding child.
+ * The outermost parallel loops inside a task are printed
+ * as openmp taskloops since the tasks already run inside
+ * a parallel region.
+ */
+static __isl_give isl_printer *print_tasks(struct ppcg_scop *scop,
+	__isl_take isl_schedule *schedule, __isl_take isl_schedule_node *seq,
+	__isl_take isl_printer *p, struct ppcg_options *options,
+	struct cpu_layouts *layouts)
+{
+	isl_ctx *ctx = isl_printer_get_ctx(p);
+	isl_union_map *deps;
+	isl_union_set **filters;
+	int i, n;
+
+	n = isl_schedule_node_n_children(seq);
+	filters = isl_calloc_array(ctx, isl_union_set *, n);
+	if (!filters)
+		goto error;
+	for (i = 0; i < n; ++i) {
+		isl_schedule_node *child;
+
+		child = isl_schedule_node_get_child(seq, i);
+		filters[i] = isl_schedule_node_filter_get_filter(child);
+		isl_schedule_node_free(child);
+	}
+	isl_schedule_node_free(seq);
+	deps = collect_dependences(scop, 0);
+
+	p = ppcg_start_block(p);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "char ppcg_task_dep[");
+	p = isl_printer_print_int(p, n);
+	p = isl_printer_print_str(p, "];");
+	p = isl_printer_end_line(p);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "#pragma omp parallel");
+	p = ppcg_print_openmp_proc_bind(p, options->openmp_proc_bind);
+	p = isl_printer_end_line(p);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "#pragma omp single");
+	p = isl_printer_end_line(p);
+	p = ppcg_start_block(p);
+	for (i = 0; p && i < n; ++i) {
+		isl_schedule *task;
+
+		p = print_task_pragma(p, deps, filters, i);
+		p = ppcg_start_block(p);
+		task = isl_schedule_copy(schedule);
+		task = isl_schedule_intersect_domain(task,
+					isl_union_set_copy(filters[i]));
+		p = print_scop(scop, task, p, options, layouts, 1);
+		p = ppcg_end_block(p);
+	}
+	p = ppcg_end_block(p);
+	p = ppcg_end_block(p);
+
+	isl_union_map_free(deps);
+	for (i = 0; i < n; ++i)
+		isl_union_set_free(filters[i]);
+	free(filters);
+	isl_schedule_free(schedule);
+
+	return p;
+error:
+	isl_schedule_node_free(seq);
+	isl_schedule_free(schedule);
+	return isl_printer_free(p);
+}
+
+/* Code generate the scop "scop" using "schedule" and print the result
+ * to "p".
+ * If the openmp_tasks option is set and the outer node of "schedule"
+ * is a sequence node, then its children are executed as openmp tasks.
+ * Accesses to the arrays in "layouts" are replaced by accesses
+ * to their copies.
+ */
+static __isl_give isl_printer *print_scop_with_tasks(struct ppcg_scop *scop,
+	__isl_take isl_schedule *schedule, __isl_take isl_printer *p,
+	struct ppcg_options *options, struct cpu_layouts *layouts)
+{
+	isl_schedule_node *node;
+
+	if (!options->openmp || !options->openmp_tasks)
+		return print_scop(scop, schedule, p, options, layouts, 0);
+
+	node = get_outer_node(schedule);
+	if (!node)
+		goto error;
+	if (isl_schedule_node_get_type(node) == isl_schedule_node_sequence)
+		return print_tasks(scop, schedule, node, p, options,
+				    layouts);
+	isl_schedule_node_free(node);
+
+	return print_scop(scop, schedule, p, options, layouts, 0);
+error:
+	isl_schedule_free(schedule);
+	return isl_printer_free(p);
+}
+
 /* Tile the band node "node" with tile sizes "sizes" and
  * mark all members of the resulting tile node as "atomic".
  */
@@ -556,28 +2134,469 @@ static __isl_give isl_schedule_node *tile(__isl_take isl_schedule_node *node,
 	return node;
 }
 
-/* Tile "node", if it is a band node with at least 2 members.
- * The tile sizes are set from the "tile_size" option.
+/* Tile the band node "node", which has *len members, with sizes
+ * read from the space called "type" in the "sizes" option
+ * for the band with sequence number "id".
+ * If no such sizes have been specified, then the sizes default
+ * to the "tile_size" option in each member if "use_default" is set and
+ * otherwise the band is not tiled.
+ * If fewer tile sizes are specified than the band has members,
+ * then the band is split and only the outer members are tiled.
+ * Add the effectively used sizes to gen->used_sizes.
+ *
+ * Update *len to the number of tiled members and increment *depth
+ * with the number of band nodes that are introduced by tiling
+ * (and splitting) "node".
  */
-static __isl_give isl_schedule_node *tile_band(
-	__isl_take isl_schedule_node *node, void *user)
+static __isl_give isl_schedule_node *tile_level(
+	__isl_take isl_schedule_node *node, struct cpu_gen *gen, int id,
+	const char *type, int use_default, int *len, int *depth)
 {
-	struct ppcg_scop *scop = user;
-	int n;
+	isl_ctx *ctx;
+	int i, n = *len;
+	int *tile_size;
+	isl_set *size;
 	isl_space *space;
 	isl_multi_val *sizes;
 
+	size = ppcg_extract_sizes(gen->sizes, "band", type, id);
+	if (!size && !use_default) {
+		*len = 0;
+		return node;
+	}
+
+	ctx = isl_schedule_node_get_ctx(node);
+	tile_size = isl_alloc_array(ctx, int, n);
+	if (!tile_size) {
+		isl_set_free(size);
+		return isl_schedule_node_free(node);
+	}
+	for (i = 0; i < n; ++i)
+		tile_size[i] = gen->options->tile_size;
+	ppcg_read_sizes_from_set(size, tile_size, len);
+	if (gen->options->debug->dump_sizes)
+		gen->used_sizes = ppcg_add_used_sizes(gen->used_sizes, "band",
+						    type, id, tile_size, *len);
+
+	if (*len == 0) {
+		free(tile_size);
+		return node;
+	}
+	if (*len < n) {
+		node = isl_schedule_node_band_split(node, *len);
+		++*depth;
+	}
+	space = isl_schedule_node_band_get_space(node);
+	sizes = ppcg_multi_val_from_int_list(space, tile_size);
+	free(tile_size);
+	++*depth;
+
+	return tile(node, sizes);
+}
+
+/* Should the tile band "node" with "n" members be skewed into
+ * a wavefront?
+ * This is the case if the wavefront option is set, the band has at least
+ * two members, it is permutable and none of its members is coincident.
+ * If any member is coincident, then the corresponding loop
+ * can already be executed in parallel without skewing.
+ * Since the coincidence constraints are only set when the openmp option
+ * is set (see construct_cpu_schedule_constraints) and since the
+ * parallelism exposed by the wavefront is only exploited through
+ * openmp pragmas, the band is not skewed if the openmp option is not set.
+ */
+static isl_bool need_wavefront(__isl_keep isl_schedule_node *node, int n,
+	struct ppcg_options *options)
+{
+	int i;
+	isl_bool permutable;
+
+	if (!options->wavefront || !options->openmp || n < 2)
+		return isl_bool_false;
+	permutable = isl_schedule_node_band_get_permutable(node);
+	if (permutable < 0 || !permutable)
+		return permutable;
+	for (i = 0; i < n; ++i) {
+		isl_bool coincident;
+
+		coincident = isl_schedule_node_band_member_get_coincident(node,
+									i);
+		if (coincident < 0 || coincident)
+			return isl_bool_not(coincident);
+	}
+	return isl_bool_true;
+}
+
+/* Return the AST build options of the band node "node" with "n" members,
+ * with the isolate option, if any, expressed in terms of the band
+ * that replaces the members t_0, ..., t_{n-1} of "node" by
+ * t_0 + ... + t_{n-1}, t_1, ..., t_{n-1} (see wavefront).
+ * The isolate option is of the form
+ *
+ *	isolate[[O] -> [t_0, ..., t_{n-1}]]
+ *
+ * with O the outer schedule dimensions.  It is pulled back
+ * over the inverse of the skewing.
+ * The other options only refer to members by position and
+ * are therefore not affected by the skewing.
+ */
+static __isl_give isl_union_set *wavefront_ast_build_options(
+	__isl_keep isl_schedule_node *node, int n)
+{
+	int i, depth;
+	isl_ctx *ctx;
+	isl_space *space;
+	isl_union_set *options;
+	isl_set *isolate;
+	isl_local_space *ls;
+	isl_multi_aff *ma;
+	isl_aff *aff;
+
+	ctx = isl_schedule_node_get_ctx(node);
+	depth = isl_schedule_node_get_schedule_depth(node);
+	options = isl_schedule_node_band_get_ast_build_options(node);
+	space = isl_space_alloc(ctx, 0, depth, n);
+	space = isl_space_wrap(space);
+	space = isl_space_set_tuple_name(space, isl_dim_set, "isolate");
+	isolate = isl_union_set_extract_set(options, space);
+	options = isl_union_set_subtract(options,
+				isl_union_set_from_set(isl_set_copy(isolate)));
+
+	space = isl_space_map_from_set(isl_set_get_space(isolate));
+	ma = isl_multi_aff_identity(space);
+	ls = isl_local_space_from_space(isl_set_get_space(isolate));
+	aff = isl_aff_var_on_domain(isl_local_space_copy(ls),
+				    isl_dim_set, depth);
+	for (i = 1; i < n; ++i)
+		aff = isl_aff_sub(aff,
+			isl_aff_var_on_domain(isl_local_space_copy(ls),
+					    isl_dim_set, depth + i));
+	isl_local_space_free(ls);
+	ma = isl_multi_aff_set_aff(ma, depth, aff);
+	isolate = isl_set_preimage_multi_aff(isolate, ma);
+
+	return isl_union_set_add_set(options, isolate);
+}
+
+/* Skew the permutable tile band "node" into a wavefront by replacing
+ * its outermost member by the sum of all its members.
+ * Since all dependence distances within a permutable band are
+ * non-negative, every dependence between different tiles is carried
+ * by the outermost member of the result, such that the remaining
+ * tile loops are parallel.
+ * The result is again permutable and its members are marked "atomic"
+ * as in tile().
+ * The AST build options of "node", in particular any isolate option,
+ * and the AST loop types of the isolated part are carried over
+ * to the result.
+ */
+static __isl_give isl_schedule_node *wavefront(
+	__isl_take isl_schedule_node *node)
+{
+	int i, n;
+	isl_multi_union_pw_aff *mupa;
+	isl_union_pw_aff *wave;
+	isl_union_set *options;
+	enum isl_ast_loop_type *isolate_type;
+
+	mupa = isl_schedule_node_band_get_partial_schedule(node);
+	n = isl_multi_union_pw_aff_dim(mupa, isl_dim_set);
+	wave = isl_multi_union_pw_aff_get_union_pw_aff(mupa, 0);
+	for (i = 1; i < n; ++i) {
+		isl_union_pw_aff *upa;
+
+		upa = isl_multi_union_pw_aff_get_union_pw_aff(mupa, i);
+		wave = isl_union_pw_aff_add(wave, upa);
+	}
+	mupa = isl_multi_union_pw_aff_set_union_pw_aff(mupa, 0, wave);
+
+	options = wavefront_ast_build_options(node, n);
+	isolate_type = isl_alloc_array(isl_schedule_node_get_ctx(node),
+					enum isl_ast_loop_type, n);
+	if (!isolate_type)
+		node = isl_schedule_node_free(node);
+	for (i = 0; node && i < n; ++i)
+		isolate_type[i] =
+		    isl_schedule_node_band_member_get_isolate_ast_loop_type(
+								node, i);
+
+	node = isl_schedule_node_delete(node);
+	node = isl_schedule_node_insert_partial_schedule(node, mupa);
+	node = isl_schedule_node_band_set_permutable(node, 1);
+	node = ppcg_set_schedule_node_type(node, isl_ast_loop_atomic);
+	node = isl_schedule_node_band_set_ast_build_options(node, options);
+	for (i = 0; node && i < n; ++i)
+		node = isl_schedule_node_band_member_set_isolate_ast_loop_type(
+						node, i, isolate_type[i]);
+	free(isolate_type);
+
+	return node;
+}
+
+/* Tile "node", if it is a band node with at least 2 members.
+ * Such bands are identified by their sequence number in a "band" space,
+ * in the order in which they are encountered in a top-down traversal.
+ * The tile sizes of the outermost level of tiling are read from
+ * the "tile" space in the "sizes" option (see tile_level).
+ * In particular, if the "tile" space has zero dimensions,
+ * then the band is not tiled.
+ * The point band of each level of tiling is in turn tiled
+ * with the sizes in the "tile2", "tile3", ... space, for as long
+ * as such sizes have been specified.  This allows the outer levels
+ * to be tuned for the outer caches and the inner levels
+ * for the inner caches.
+ * Since the outermost level contains the outermost loops,
+ * the openmp parallel loop, if any, is one of its tile loops.
+ * If the outermost level has no parallel outer tile loop,
+ * then it may get skewed into a wavefront to expose parallelism
+ * in its other tile loops.
+ *
+ * Set *depth to the number of band nodes that are introduced
+ * by tiling (and splitting) "node", such that the caller
+ * can skip them.
+ */
+static __isl_give isl_schedule_node *tile_band(
+	__isl_take isl_schedule_node *node, struct cpu_gen *gen, int *depth)
+{
+	int i, len, id, level, up;
+	char type[20];
+	isl_bool skew;
+
+	*depth = 0;
 	if (isl_schedule_node_get_type(node) != isl_schedule_node_band)
 		return node;
 
-	n = isl_schedule_node_band_n_member(node);
-	if (n <= 1)
+	len = isl_schedule_node_band_n_member(node);
+	if (len <= 1)
+		return node;
+
+	id = gen->band_id++;
+	node = tile_level(node, gen, id, "tile", 1, &len, depth);
+	skew = isl_bool_false;
+	if (len > 0)
+		skew = need_wavefront(node, len, gen->options);
+	if (skew < 0)
+		return isl_schedule_node_free(node);
+	if (skew)
+		node = wavefront(node);
+	up = 0;
+	for (level = 2; len > 0; ++level) {
+		snprintf(type, sizeof(type), "tile%d", level);
+		node = isl_schedule_node_child(node, 0);
+		up++;
+		node = tile_level(node, gen, id, type, 0, &len, depth);
+	}
+	for (i = 0; i < up; ++i)
+		node = isl_schedule_node_parent(node);
+
+	return node;
+}
+
+/* Have all domain elements been filtered out before reaching
+ * the "node" position in the schedule tree?
+ */
+static isl_bool has_empty_domain(__isl_keep isl_schedule_node *node)
+{
+	isl_union_set *domain;
+	isl_bool empty;
+
+	domain = isl_schedule_node_get_domain(node);
+	empty = isl_union_set_is_empty(domain);
+	isl_union_set_free(domain);
+
+	return empty;
+}
+
+/* Given a pointer to a phase mark in the result of hybrid tiling,
+ * shift the point loops of the original child band to start at zero,
+ * provided the phase is non-empty.
+ *
+ * The input has the following form:
+ *
+ *	M - CT - P - C - ...
+ *
+ * with M the phase marker, CT the space tiling, P the original
+ * parent band and C the original child band.
+ * The hexagons iterated over by the outer dimension of CT
+ * are independent by construction, such that this dimension
+ * gets detected as the openmp parallel loop.
+ */
+static __isl_give isl_schedule_node *shift_phase(
+	__isl_take isl_schedule_node *node, void *user)
+{
+	isl_bool empty_domain;
+	ppcg_ht_phase *phase;
+
+	empty_domain = has_empty_domain(node);
+	if (empty_domain < 0)
+		return isl_schedule_node_free(node);
+	if (empty_domain)
+		return node;
+
+	phase = ppcg_ht_phase_extract_from_mark(node);
+	node = isl_schedule_node_child(node, 0);
+	node = isl_schedule_node_child(node, 0);
+	node = isl_schedule_node_child(node, 0);
+	node = ppcg_ht_phase_shift_space_point(phase, node);
+	node = isl_schedule_node_ancestor(node, 3);
+
+	return node;
+}
+
+/* See if hybrid tiling can be performed on "node" and its child.
+ * If so, apply hybrid tiling, set *tiled and return the updated
+ * schedule tree.  If not, return the original schedule tree.
+ *
+ * The pair of bands is identified by its sequence number
+ * in the "band" space, like the bands tiled by tile_band, and
+ * the tile sizes are read from the "tile" space.
+ * The sequence number is only consumed if hybrid tiling is applied,
+ * such that it is otherwise used by tile_band for the same band.
+ * The first element is half the size of the tile in the time dimension,
+ * the second element the number of elements in the base of the hexagon and
+ * the remaining elements the tile sizes in the remaining space dimensions.
+ * If fewer sizes are specified than the child has members plus one,
+ * then the child is split first.
+ * If the base of the hexagon is too small for the dependence distances,
+ * then it is enlarged to the smallest valid width if
+ * the hybrid_auto_sizes option is set.
+ * Otherwise, or if the tile sizes are still too small,
+ * hybrid tiling is not applied.
+ *
+ * The space tiling of each phase is executed in parallel
+ * through the regular detection of openmp parallel loops.
+ */
+static __isl_give isl_schedule_node *try_hybrid_tile(
+	__isl_take isl_schedule_node *node, struct cpu_gen *gen, int *tiled)
+{
+	isl_ctx *ctx;
+	int i, id, tile_len;
+	int *tile_size;
+	isl_bool ok;
+	isl_set *size;
+	isl_space *space, *space2;
+	isl_multi_val *mv;
+	isl_schedule_node *orig;
+	ppcg_ht_bounds *bounds;
+
+	*tiled = 0;
+	ok = ppcg_ht_has_input_pattern(node);
+	if (ok < 0)
+		return isl_schedule_node_free(node);
+	if (!ok)
+		return node;
+
+	ctx = isl_schedule_node_get_ctx(node);
+	node = isl_schedule_node_child(node, 0);
+	tile_len = 1 + isl_schedule_node_band_n_member(node);
+	node = isl_schedule_node_parent(node);
+	tile_size = isl_alloc_array(ctx, int, tile_len);
+	if (!tile_size)
+		return isl_schedule_node_free(node);
+	for (i = 0; i < tile_len; ++i)
+		tile_size[i] = gen->options->tile_size;
+	id = gen->band_id;
+	size = ppcg_extract_sizes(gen->sizes, "band", "tile", id);
+	ppcg_read_sizes_from_set(size, tile_size, &tile_len);
+	if (tile_len < 2) {
+		free(tile_size);
 		return node;
+	}
 
+	orig = isl_schedule_node_copy(node);
+	node = isl_schedule_node_child(node, 0);
+	if (tile_len - 1 < isl_schedule_node_band_n_member(node))
+		node = isl_schedule_node_band_split(node, tile_len - 1);
+	space2 = isl_schedule_node_band_get_space(node);
+	node = isl_schedule_node_parent(node);
 	space = isl_schedule_node_band_get_space(node);
-	sizes = ppcg_multi_val_from_int(space, scop->options->tile_size);
+	space = isl_space_product(space, space2);
+	mv = ppcg_multi_val_from_int_list(space, tile_size);
+	bounds = ppcg_ht_compute_bounds(gen->scop, node);
+	if (gen->options->hybrid_auto_sizes) {
+		isl_val *v;
+
+		mv = ppcg_ht_bounds_widen_sizes(bounds, mv);
+		v = isl_multi_val_get_val(mv, 1);
+		if (v && isl_val_is_int(v))
+			tile_size[1] = isl_val_get_num_si(v);
+		isl_val_free(v);
+	}
 
-	return tile(node, sizes);
+	ok = ppcg_ht_bounds_supports_sizes(bounds, mv);
+	if (ok < 0 || !ok) {
+		free(tile_size);
+		isl_multi_val_free(mv);
+		ppcg_ht_bounds_free(bounds);
+		isl_schedule_node_free(node);
+		if (ok < 0)
+			return isl_schedule_node_free(orig);
+		return orig;
+	}
+	isl_schedule_node_free(orig);
+
+	if (gen->options->debug->dump_sizes)
+		gen->used_sizes = ppcg_add_used_sizes(gen->used_sizes, "band",
+					    "tile", id, tile_size, tile_len);
+	free(tile_size);
+
+	node = ppcg_ht_bounds_insert_tiling(bounds, mv, node, gen->options);
+	node = hybrid_tile_foreach_phase(node, &shift_phase, NULL);
+	node = hybrid_tile_drop_phase_marks(node);
+	gen->band_id++;
+	*tiled = 1;
+
+	return node;
+}
+
+/* Tile the bands in the subtree at "node" with at least 2 members,
+ * visiting outer bands before inner bands.
+ * The band nodes introduced by tile_band are not visited.
+ * If the hybrid option is set, then first try and apply hybrid tiling
+ * to "node" and its child.  If this succeeds, then the resulting
+ * subtree is not tiled any further.
+ * Since hybrid tiling only exposes parallelism through openmp pragmas,
+ * it is only applied if the openmp option is set as well.
+ */
+static __isl_give isl_schedule_node *tile_bands(
+	__isl_take isl_schedule_node *node, struct cpu_gen *gen)
+{
+	int i, n, depth, tiled = 0;
+
+	if (gen->options->hybrid && gen->options->openmp)
+		node = try_hybrid_tile(node, gen, &tiled);
+	if (tiled)
+		return node;
+
+	node = tile_band(node, gen, &depth);
+	for (i = 0; i < depth; ++i)
+		node = isl_schedule_node_child(node, 0);
+	n = isl_schedule_node_n_children(node);
+	for (i = 0; i < n; ++i) {
+		node = isl_schedule_node_child(node, i);
+		node = tile_bands(node, gen);
+		node = isl_schedule_node_parent(node);
+	}
+	for (i = 0; i < depth; ++i)
+		node = isl_schedule_node_parent(node);
+
+	return node;
+}
+
+/* Tile the bands in "schedule" with at least 2 members.
+ */
+static __isl_give isl_schedule *tile_schedule(__isl_take isl_schedule *schedule,
+	struct cpu_gen *gen)
+{
+	isl_schedule_node *node;
+
+	node = isl_schedule_get_root(schedule);
+	isl_schedule_free(schedule);
+	node = tile_bands(node, gen);
+	schedule = isl_schedule_node_get_schedule(node);
+	isl_schedule_node_free(node);
+
+	return schedule;
 }
 
 /* Construct schedule constraints from the dependences in ps
@@ -610,25 +2629,32 @@ static __isl_give isl_schedule_node *tile_band(
  * the coincidence constraints.  If the openmp handling learns
  * how to privatize some memory, then the corresponding order
  * dependences can be removed from the coincidence constraints.
+ * Similarly, the dependences between reduction statement instances
+ * that update the same element are removed from the coincidence constraints
+ * since these reductions can be executed atomically.
  */
 static __isl_give isl_schedule_constraints *construct_cpu_schedule_constraints(
 	struct ppcg_scop *ps)
 {
 	isl_schedule_constraints *sc;
 	isl_union_map *validity, *coincidence;
+	isl_union_map *forced, *order;
 
 	sc = isl_schedule_constraints_on_domain(isl_union_set_copy(ps->domain));
 	if (ps->options->live_range_reordering) {
+		order = ppcg_scop_get_tagged_dep_order(ps);
 		sc = isl_schedule_constraints_set_conditional_validity(sc,
 				isl_union_map_copy(ps->tagged_dep_flow),
-				isl_union_map_copy(ps->tagged_dep_order));
+				isl_union_map_copy(order));
+		forced = ppcg_scop_get_dep_forced(ps);
 		validity = isl_union_map_copy(ps->dep_flow);
 		validity = isl_union_map_union(validity,
-				isl_union_map_copy(ps->dep_forced));
+				isl_union_map_copy(forced));
 		if (ps->options->openmp) {
+			order = ppcg_scop_get_dep_order(ps);
 			coincidence = isl_union_map_copy(validity);
 			coincidence = isl_union_map_union(coincidence,
-					isl_union_map_copy(ps->dep_order));
+					isl_union_map_copy(order));
 		}
 	} else {
 		validity = isl_union_map_copy(ps->dep_flow);
@@ -637,8 +2663,11 @@ static __isl_give isl_schedule_constraints *construct_cpu_schedule_constraints(
 		if (ps->options->openmp)
 			coincidence = isl_union_map_copy(validity);
 	}
-	if (ps->options->openmp)
+	if (ps->options->openmp) {
+		coincidence = isl_union_map_subtract(coincidence,
+				ppcg_scop_reduction_dependences(ps));
 		sc = isl_schedule_constraints_set_coincidence(sc, coincidence);
+	}
 	sc = isl_schedule_constraints_set_validity(sc, validity);
 	sc = isl_schedule_constraints_set_proximity(sc,
 					isl_union_map_copy(ps->dep_flow));
@@ -651,6 +2680,8 @@ static __isl_give isl_schedule_constraints *construct_cpu_schedule_constraints(
  * First derive the appropriate schedule constraints from the dependences
  * in "ps" and then compute a schedule from those schedule constraints,
  * possibly grouping statement instances based on the input schedule.
+ * If the scheduler exceeds its budget, then fall back
+ * to the original schedule.
  */
 static __isl_give isl_schedule *compute_cpu_schedule(struct ppcg_scop *ps)
 {
@@ -663,6 +2694,9 @@ static __isl_give isl_schedule *compute_cpu_schedule(struct ppcg_scop *ps)
 	sc = construct_cpu_schedule_constraints(ps);
 
 	schedule = ppcg_compute_schedule(sc, ps->schedule, ps->options);
+	if (!schedule &&
+	    ppcg_schedule_out_of_budget(isl_schedule_get_ctx(ps->schedule)))
+		return isl_schedule_copy(ps->schedule);
 
 	return schedule;
 }
@@ -685,8 +2719,9 @@ static __isl_give isl_schedule *optionally_compute_schedule(void *user)
  * tile it if requested by the user.
  */
 static __isl_give isl_schedule *get_schedule(struct ppcg_scop *ps,
-	struct ppcg_options *options)
+	struct cpu_gen *gen)
 {
+	struct ppcg_options *options = gen->options;
 	isl_ctx *ctx;
 	isl_schedule *schedule;
 
@@ -696,15 +2731,76 @@ static __isl_give isl_schedule *get_schedule(struct ppcg_scop *ps,
 	ctx = isl_union_set_get_ctx(ps->domain);
 	schedule = ppcg_get_schedule(ctx, options,
 				    &optionally_compute_schedule, ps);
+	gen->scop = ps;
 	if (ps->options->tile)
-		schedule = isl_schedule_map_schedule_node_bottom_up(schedule,
-							&tile_band, ps);
+		schedule = tile_schedule(schedule, gen);
 
 	return schedule;
 }
 
+/* Are the layouts of some arrays possibly changed according to "options"?
+ */
+static int may_change_layouts(struct ppcg_options *options)
+{
+	return options->array_layout ||
+	    (options->openmp && options->openmp_first_touch);
+}
+
+/* Start a block to "p" that is only executed if the scop "ps"
+ * executes any statement instance, i.e., a block that is guarded
+ * by the parameter constraints of the iteration domain,
+ * simplified with respect to the context.
+ * The constraints of the context can then be assumed by the code
+ * inside the block, allowing the sizes of the copies of the arrays
+ * with a different layout to be computed under these constraints.
+ * Moreover, the copies are then only allocated and filled
+ * if they are actually used.
+ */
+static __isl_give isl_printer *print_layout_block_start(
+	__isl_take isl_printer *p, struct ppcg_scop *ps)
+{
+	isl_ast_build *build;
+	isl_ast_expr *cond;
+	isl_set *guard;
+	isl_bool trivial;
+
+	guard = isl_union_set_params(isl_union_set_copy(ps->domain));
+	guard = isl_set_gist_params(guard, isl_set_copy(ps->context));
+	trivial = isl_set_plain_is_universe(guard);
+	if (trivial < 0)
+		p = isl_printer_free(p);
+	if (trivial) {
+		isl_set_free(guard);
+		return ppcg_start_block(p);
+	}
+
+	build = isl_ast_build_from_context(isl_set_copy(ps->context));
+	cond = isl_ast_build_expr_from_set(build, guard);
+	isl_ast_build_free(build);
+
+	p = ppcg_ast_expr_print_macros(cond, p);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "if (");
+	p = isl_printer_print_ast_expr(p, cond);
+	p = isl_printer_print_str(p, ")");
+	p = isl_printer_end_line(p);
+	isl_ast_expr_free(cond);
+
+	return ppcg_start_block(p);
+}
+
 /* Generate CPU code for the scop "ps" using "schedule" and
  * print the corresponding C code to "p", including variable declarations.
+ *
+ * If the array_layout option is set, then the arrays that are traversed
+ * column-wise by innermost loops are copied into local arrays
+ * with a different layout before the generated code and
+ * copied back afterwards.
+ * Similarly, if the openmp_first_touch option is set, then the arrays
+ * accessed by openmp parallel loops are copied into local arrays
+ * by the threads that access them.
+ * The copying, along with the generated code, is guarded
+ * by print_layout_block_start.
  */
 static __isl_give isl_printer *print_cpu_with_schedule(
 	__isl_take isl_printer *p, struct ppcg_scop *ps,
@@ -712,6 +2808,7 @@ static __isl_give isl_printer *print_cpu_with_schedule(
 {
 	int hidden;
 	isl_set *context;
+	struct cpu_layouts *layouts = NULL;
 
 	p = isl_printer_start_line(p);
 	p = isl_printer_print_str(p, "/* ppcg generated CPU code */");
@@ -733,7 +2830,21 @@ static __isl_give isl_printer *print_cpu_with_schedule(
 	schedule = isl_schedule_insert_context(schedule, context);
 	if (options->debug->dump_final_schedule)
 		isl_schedule_dump(schedule);
-	p = print_scop(ps, schedule, p, options);
+	if (may_change_layouts(options)) {
+		layouts = cpu_layouts_compute(ps, schedule);
+		if (!layouts)
+			p = isl_printer_free(p);
+	}
+	if (!cpu_layouts_is_empty(layouts)) {
+		p = print_layout_block_start(p, ps);
+		p = cpu_layouts_print_copy_in(p, layouts, ps);
+	}
+	p = print_scop_with_tasks(ps, schedule, p, options, layouts);
+	if (!cpu_layouts_is_empty(layouts)) {
+		p = cpu_layouts_print_copy_out(p, layouts, ps);
+		p = ppcg_end_block(p);
+	}
+	cpu_layouts_free(layouts);
 	if (hidden)
 		p = ppcg_end_block(p);
 
@@ -758,41 +2869,241 @@ __isl_give isl_printer *print_cpu(__isl_take isl_printer *p,
  * using that schedule.
  */
 static __isl_give isl_printer *generate(__isl_take isl_printer *p,
-	struct ppcg_scop *scop, struct ppcg_options *options)
+	struct ppcg_scop *scop, struct cpu_gen *gen)
 {
 	isl_schedule *schedule;
 
-	schedule = get_schedule(scop, options);
+	schedule = get_schedule(scop, gen);
+
+	return print_cpu_with_schedule(p, scop, schedule, gen->options);
+}
+
+/* Return the key of the code cache entry for the scop "ps".
+ * The key consists of the options that affect the generated code,
+ * the version of ppcg, the source text of the scop
+ * and those properties of "ps" that may be affected by code
+ * outside the scop such as macro definitions and declarations.
+ * Return NULL if the source text of the scop is not available.
+ */
+static char *code_cache_key(struct cpu_gen *gen, struct ppcg_scop *ps)
+{
+	isl_printer *p;
+	char *text;
+	char *key;
+	size_t len;
+	int i;
+
+	len = strlen(gen->source);
+	if (ps->start > ps->end || ps->end > len)
+		return NULL;
+	len = ps->end - ps->start;
+	text = malloc(len + 1);
+	if (!text)
+		return NULL;
+	memcpy(text, gen->source + ps->start, len);
+	text[len] = '\0';
+
+	p = isl_printer_to_str(isl_set_get_ctx(ps->context));
+	p = ppcg_print_options_key(p);
+	p = isl_printer_print_str(p, text);
+	p = isl_printer_end_line(p);
+	free(text);
+	p = isl_printer_print_set(p, ps->context);
+	p = isl_printer_end_line(p);
+	p = isl_printer_print_union_set(p, ps->domain);
+	p = isl_printer_end_line(p);
+	p = isl_printer_print_union_map(p, ps->tagged_reads);
+	p = isl_printer_end_line(p);
+	p = isl_printer_print_union_map(p, ps->tagged_may_writes);
+	p = isl_printer_end_line(p);
+	p = isl_printer_print_union_map(p, ps->tagged_must_writes);
+	p = isl_printer_end_line(p);
+	for (i = 0; i < ps->pet->n_array; ++i) {
+		struct pet_array *array = ps->pet->arrays[i];
+
+		p = isl_printer_print_str(p, array->element_type);
+		p = isl_printer_print_str(p, " ");
+		p = isl_printer_print_set(p, array->extent);
+		p = isl_printer_end_line(p);
+	}
+	p = isl_printer_print_schedule(p, ps->schedule);
+	key = isl_printer_get_str(p);
+	isl_printer_free(p);
+
+	return key;
+}
+
+/* Return the code stored in the code cache for the scop
+ * described by "key" or NULL if there is no such code.
+ */
+static char *code_cache_lookup(const char *key, struct ppcg_options *options)
+{
+	char *key_file, *code_file;
+	char *code = NULL;
+
+	key_file = ppcg_cache_file_name(options->code_cache_dir, key, ".key");
+	code_file = ppcg_cache_file_name(options->code_cache_dir, key, ".c");
+	if (key_file && code_file && ppcg_file_has_contents(key_file, key))
+		code = ppcg_read_file(code_file);
+	free(code_file);
+	free(key_file);
+
+	return code;
+}
+
+/* Store "code" as the code generated for the scop described by "key"
+ * in the code cache.
+ * The code is written before the key such that the presence
+ * of the key implies that of the code.
+ * Failures are ignored since they only mean that the code
+ * will have to be generated again next time.
+ */
+static void code_cache_store(const char *code, const char *key,
+	struct ppcg_options *options)
+{
+	char *key_file, *code_file;
+
+	key_file = ppcg_cache_file_name(options->code_cache_dir, key, ".key");
+	code_file = ppcg_cache_file_name(options->code_cache_dir, key, ".c");
+	if (code && key_file && code_file &&
+	    ppcg_write_file(code_file, code) == 0)
+		ppcg_write_file(key_file, key);
+	free(code_file);
+	free(key_file);
+}
+
+/* Generate CPU code for "scop" and print it to "p",
+ * reusing the code generated for an identical scop
+ * by a previous invocation if it can be found in the code cache.
+ * The code is printed to a string first such that it can be
+ * stored in the cache.
+ */
+static __isl_give isl_printer *generate_cached(__isl_take isl_printer *p,
+	struct ppcg_scop *scop, struct cpu_gen *gen)
+{
+	isl_printer *p_scop;
+	char *key, *code;
+
+	key = code_cache_key(gen, scop);
+	if (!key)
+		return generate(p, scop, gen);
 
-	return print_cpu_with_schedule(p, scop, schedule, options);
+	code = code_cache_lookup(key, gen->options);
+	if (code) {
+		if (gen->options->debug->verbose)
+			fprintf(stdout, "Using cached code\n");
+	} else {
+		p_scop = isl_printer_to_str(isl_printer_get_ctx(p));
+		p_scop = isl_printer_set_output_format(p_scop, ISL_FORMAT_C);
+		p_scop = generate(p_scop, scop, gen);
+		code = isl_printer_get_str(p_scop);
+		isl_printer_free(p_scop);
+		code_cache_store(code, key, gen->options);
+	}
+	free(key);
+
+	if (!code)
+		return isl_printer_free(p);
+	p = isl_printer_print_str(p, code);
+	free(code);
+
+	return p;
 }
 
 /* Wrapper around generate for use as a ppcg_transform callback.
+ * Generate CPU code for "scop" and print it to "p",
+ * using the code cache if it is enabled.
  */
 static __isl_give isl_printer *print_cpu_wrap(__isl_take isl_printer *p,
 	struct ppcg_scop *scop, void *user)
 {
-	struct ppcg_options *options = user;
+	struct cpu_gen *gen = user;
+
+	if (gen->source && scop)
+		return generate_cached(p, scop, gen);
+	return generate(p, scop, gen);
+}
+
+/* Return a copy of the cpu_gen "user" for use by a thread
+ * of ppcg_transform_parallel.
+ * The copy does not keep track of any sizes.
+ */
+static void *copy_cpu_gen(void *user)
+{
+	struct cpu_gen *gen = user;
+	struct cpu_gen *copy;
 
-	return generate(p, scop, options);
+	copy = malloc(sizeof(*copy));
+	if (!copy)
+		return NULL;
+	copy->options = gen->options;
+	copy->source = gen->source;
+	copy->scop = NULL;
+	copy->sizes = NULL;
+	copy->used_sizes = NULL;
+	copy->band_id = 0;
+
+	return copy;
 }
 
 /* Transform the code in the file called "input" by replacing
  * all scops by corresponding CPU code and write the results to a file
  * called "output".
+ *
+ * The scops are transformed in parallel if the threads option is set,
+ * except when sizes are specified or dumped since the band identifiers
+ * are numbered consecutively over all scops.
+ * For the same reason, the code cache is only used
+ * if no sizes are specified or dumped.
+ * If the layouts of some arrays may be changed, then <stdlib.h>
+ * is included for the allocation of their copies.
  */
 int generate_cpu(isl_ctx *ctx, struct ppcg_options *options,
 	const char *input, const char *output)
 {
 	FILE *output_file;
+	struct cpu_gen gen;
 	int r;
 
 	output_file = get_output_file(input, output);
 	if (!output_file)
 		return -1;
 
-	r = ppcg_transform(ctx, input, output_file, options,
-					&print_cpu_wrap, options);
+	if (options->hybrid && options->tile && !options->openmp)
+		fprintf(stderr, "hybrid tiling on the C target requires "
+			"--openmp, ignoring --hybrid\n");
+	if (may_change_layouts(options))
+		fprintf(output_file, "#include <stdlib.h>\n");
+
+	gen.options = options;
+	gen.source = NULL;
+	if (options->code_cache_dir && !options->sizes &&
+	    !options->debug->dump_sizes)
+		gen.source = ppcg_read_file(input);
+	gen.scop = NULL;
+	gen.sizes = NULL;
+	if (options->sizes)
+		gen.sizes = isl_union_map_read_from_str(ctx, options->sizes);
+	gen.band_id = 0;
+	gen.used_sizes = NULL;
+	if (options->debug->dump_sizes) {
+		isl_space *space = isl_space_params_alloc(ctx, 0);
+		gen.used_sizes = isl_union_map_empty(space);
+	}
+
+	if (options->sizes || options->debug->dump_sizes)
+		r = ppcg_transform(ctx, input, output_file, options,
+					&print_cpu_wrap, &gen);
+	else
+		r = ppcg_transform_parallel(ctx, input, output_file, options,
+					&print_cpu_wrap, &copy_cpu_gen, &free,
+					&gen);
+
+	if (options->debug->dump_sizes)
+		isl_union_map_dump(gen.used_sizes);
+	isl_union_map_free(gen.used_sizes);
+	isl_union_map_free(gen.sizes);
+	free(gen.source);
 
 	fclose(output_file);
 
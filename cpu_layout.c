@@ -0,0 +1,917 @@
+/*
+ * Use of this software is governed by the MIT license
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <isl/ctx.h>
+#include <isl/id.h>
+#include <isl/val.h>
+#include <isl/aff.h>
+#include <isl/constraint.h>
+#include <isl/set.h>
+#include <isl/map.h>
+#include <isl/union_set.h>
+#include <isl/union_map.h>
+#include <isl/ast.h>
+#include <isl/ast_build.h>
+#include <isl/schedule_node.h>
+#include <pet.h>
+
+#include "cpu_layout.h"
+#include "ppcg_options.h"
+#include "print.h"
+#include "util.h"
+
+/* The functions in this file change the layout of arrays that are
+ * accessed in an unfavorable order by the innermost loops of the code
+ * generated for the C target.
+ * Such an array is copied into a local array with the new layout
+ * before the scop and, if it is written inside the scop,
+ * copied back after the scop.  All accesses inside the scop
+ * refer to the local array.
+ * Since the local array is allocated by the generated code,
+ * it can also be first touched in parallel, placing its pages
+ * close to the threads that access them inside the scop.
+ */
+
+/* A change of layout for "array".
+ *
+ * "id" is the identifier of "array" and "copy_id" the identifier
+ * of the local copy with the new layout.
+ * "n_index" is the number of dimensions of "array".
+ * If "transpose" is set, then the two dimensions of "array" are
+ * interchanged in the copy.
+ * "pad" is the number of elements by which the innermost dimension
+ * of the copy is extended.
+ * "copy_out" is set if "array" is written inside the scop.
+ * "owner" maps the elements of "array" to the first iteration
+ * of an outermost parallel loop that accesses them, if any.
+ */
+struct cpu_array_layout {
+	struct pet_array *array;
+	isl_id *id;
+	isl_id *copy_id;
+	int n_index;
+	int transpose;
+	int pad;
+	int copy_out;
+	isl_map *owner;
+};
+
+/* The changes of layout of the arrays of a scop.
+ */
+struct cpu_layouts {
+	int n;
+	struct cpu_array_layout *layout;
+};
+
+/* Free "layouts".
+ */
+void cpu_layouts_free(struct cpu_layouts *layouts)
+{
+	int i;
+
+	if (!layouts)
+		return;
+	for (i = 0; i < layouts->n; ++i) {
+		isl_id_free(layouts->layout[i].id);
+		isl_id_free(layouts->layout[i].copy_id);
+		isl_map_free(layouts->layout[i].owner);
+	}
+	free(layouts->layout);
+	free(layouts);
+}
+
+/* Does "layouts" not change the layout of any array?
+ */
+int cpu_layouts_is_empty(struct cpu_layouts *layouts)
+{
+	return !layouts || layouts->n == 0;
+}
+
+/* Internal data structure for classify_statement and classify_deltas.
+ *
+ * "accesses" are the accesses to the array under consideration.
+ * "col" is set if some pair of consecutive iterations of an innermost loop
+ * accesses elements that differ in some dimension other than
+ * the innermost dimension, but not in the innermost dimension.
+ * "row" is set if some pair of consecutive iterations of an innermost
+ * loop accesses elements that differ in the innermost dimension.
+ */
+struct cpu_layout_access_data {
+	isl_union_map *accesses;
+	int col;
+	int row;
+};
+
+/* Given the differences "deltas" between array elements accessed
+ * by consecutive iterations of an innermost loop, update data->col and
+ * data->row.
+ */
+static isl_stat classify_deltas(__isl_take isl_set *deltas, void *user)
+{
+	struct cpu_layout_access_data *data = user;
+	isl_set *zero_last, *zero_first;
+	isl_bool subset;
+	int n;
+
+	n = isl_set_dim(deltas, isl_dim_set);
+	zero_last = isl_set_fix_si(isl_set_copy(deltas), isl_dim_set, n - 1, 0);
+	zero_first = isl_set_fix_si(isl_set_copy(zero_last), isl_dim_set, 0, 0);
+
+	subset = isl_set_is_subset(deltas, zero_last);
+	if (subset >= 0 && !subset)
+		data->row = 1;
+	if (subset >= 0)
+		subset = isl_set_is_subset(zero_last, zero_first);
+	if (subset >= 0 && !subset)
+		data->col = 1;
+
+	isl_set_free(zero_first);
+	isl_set_free(zero_last);
+	isl_set_free(deltas);
+
+	return subset < 0 ? isl_stat_error : isl_stat_ok;
+}
+
+/* Return the position of the innermost dimension of the range of
+ * "schedule" that does not have a fixed value or -1 if there is
+ * no such dimension.
+ */
+static int innermost_loop_dim(__isl_keep isl_map *schedule)
+{
+	int i, n;
+	isl_set *range;
+
+	range = isl_map_range(isl_map_copy(schedule));
+	n = isl_set_dim(range, isl_dim_set);
+	for (i = n - 1; i >= 0; --i) {
+		isl_val *v;
+		int fixed;
+
+		v = isl_set_plain_get_val_if_fixed(range, isl_dim_set, i);
+		fixed = v && !isl_val_is_nan(v);
+		isl_val_free(v);
+		if (!fixed)
+			break;
+	}
+	isl_set_free(range);
+
+	return i;
+}
+
+/* Return a map from the schedule space "space" to itself that maps
+ * each iteration to the next iteration of the loop corresponding
+ * to schedule dimension "pos".
+ */
+static __isl_give isl_map *next_iteration(__isl_take isl_space *space,
+	int pos)
+{
+	int i;
+	isl_map *map;
+	isl_constraint *c;
+
+	space = isl_space_map_from_set(space);
+	map = isl_map_universe(isl_space_copy(space));
+	for (i = 0; i < pos; ++i)
+		map = isl_map_equate(map, isl_dim_in, i, isl_dim_out, i);
+	c = isl_constraint_alloc_equality(isl_local_space_from_space(space));
+	c = isl_constraint_set_coefficient_si(c, isl_dim_in, pos, 1);
+	c = isl_constraint_set_coefficient_si(c, isl_dim_out, pos, -1);
+	c = isl_constraint_set_constant_si(c, 1);
+	map = isl_map_add_constraint(map, c);
+
+	return map;
+}
+
+/* Given the flattened schedule "schedule" of a statement,
+ * compute the differences between the elements of data->accesses
+ * accessed by the statement in consecutive iterations
+ * of its innermost loop and update data->col and data->row accordingly.
+ */
+static isl_stat classify_statement(__isl_take isl_map *schedule, void *user)
+{
+	struct cpu_layout_access_data *data = user;
+	isl_union_map *acc, *pairs;
+	isl_union_set *deltas;
+	isl_map *next;
+	isl_stat r;
+	int pos;
+
+	pos = innermost_loop_dim(schedule);
+	if (pos < 0) {
+		isl_map_free(schedule);
+		return isl_stat_ok;
+	}
+
+	acc = isl_union_map_copy(data->accesses);
+	acc = isl_union_map_intersect_domain(acc,
+			isl_union_set_from_set(isl_map_domain(
+				isl_map_copy(schedule))));
+	next = next_iteration(isl_space_range(isl_map_get_space(schedule)),
+				pos);
+	acc = isl_union_map_apply_domain(acc,
+				isl_union_map_from_map(schedule));
+	pairs = isl_union_map_reverse(isl_union_map_copy(acc));
+	pairs = isl_union_map_apply_range(pairs, isl_union_map_from_map(next));
+	pairs = isl_union_map_apply_range(pairs, acc);
+	deltas = isl_union_map_deltas(pairs);
+
+	r = isl_union_set_foreach_set(deltas, &classify_deltas, data);
+	isl_union_set_free(deltas);
+
+	return r;
+}
+
+/* Internal data structure for check_access.
+ *
+ * "id" is the identifier of the array under consideration and
+ * "n_index" its number of dimensions.
+ * "partial" is set if some access does not access a single element
+ * of the array.
+ */
+struct cpu_layout_check_data {
+	isl_id *id;
+	int n_index;
+	int partial;
+};
+
+/* Set data->partial if "expr" is an access to data->id that
+ * does not access a single element of the array.
+ */
+static int check_access(__isl_keep pet_expr *expr, void *user)
+{
+	struct cpu_layout_check_data *data = user;
+	isl_multi_pw_aff *index;
+	isl_id *id;
+	int wrapping, n;
+
+	id = pet_expr_access_get_id(expr);
+	isl_id_free(id);
+	if (id != data->id)
+		return 0;
+
+	index = pet_expr_access_get_index(expr);
+	wrapping = isl_multi_pw_aff_range_is_wrapping(index);
+	n = isl_multi_pw_aff_dim(index, isl_dim_out);
+	isl_multi_pw_aff_free(index);
+	if (wrapping || n != data->n_index)
+		data->partial = 1;
+
+	return 0;
+}
+
+/* Can "array" be copied into a local array?
+ * That is, is it an array with known extent
+ * that is declared outside the scop, with elements that are not structures,
+ * and are all accesses to the array inside the scop accesses
+ * to single elements?
+ * Only the layout of arrays of at least two dimensions can be changed,
+ * but if "first_touch" is set, then one-dimensional arrays
+ * may also be copied such that they are first touched in parallel.
+ */
+static int is_layout_candidate(struct pet_scop *pet, struct pet_array *array,
+	int first_touch)
+{
+	struct cpu_layout_check_data data;
+	int i;
+
+	if (array->declared || array->element_is_record)
+		return 0;
+	data.n_index = isl_set_dim(array->extent, isl_dim_set);
+	if (data.n_index < (first_touch ? 1 : 2))
+		return 0;
+	for (i = 0; i < data.n_index; ++i)
+		if (!isl_set_dim_has_upper_bound(array->extent, isl_dim_set, i))
+			return 0;
+
+	data.id = isl_set_get_tuple_id(array->extent);
+	data.partial = 0;
+	for (i = 0; i < pet->n_stmt; ++i)
+		if (pet_tree_foreach_access_expr(pet->stmts[i]->body,
+					    &check_access, &data) < 0)
+			data.partial = 1;
+	isl_id_free(data.id);
+
+	return !data.partial;
+}
+
+/* Extract the part of "owners" that maps elements of "extent"
+ * or return NULL if there is no such part.
+ */
+static __isl_give isl_map *extract_owner(__isl_keep isl_union_map *owners,
+	__isl_keep isl_set *extent)
+{
+	isl_union_map *owner;
+	int n;
+
+	owner = isl_union_map_copy(owners);
+	owner = isl_union_map_intersect_domain(owner,
+				isl_union_set_from_set(isl_set_copy(extent)));
+	n = isl_union_map_n_map(owner);
+	if (n <= 0) {
+		isl_union_map_free(owner);
+		return NULL;
+	}
+
+	return isl_map_from_union_map(owner);
+}
+
+/* Determine the layout of the copy of "array", given the accesses
+ * "accesses" to all arrays and the flattened schedule "schedule",
+ * and store it in "layout".
+ * "owners" maps array elements to the first iteration of an outermost
+ * parallel loop accessing them.  It is NULL if the copies should not
+ * be first touched in parallel.
+ * Return 1 if the array should be copied, 0 if not and -1 on error.
+ *
+ * If the innermost loops only traverse a two-dimensional "array"
+ * column-wise, then the copy is transposed.
+ * Otherwise, if the innermost loops traverse "array" column-wise
+ * in some places and the array_padding option is set,
+ * then the innermost dimension of the copy is extended by the number
+ * of elements specified by this option, in order to reduce
+ * cache set conflicts between consecutive accesses.
+ * The layout is only changed if the array_layout option is set.
+ * If "owners" is not NULL, then any array that is accessed inside
+ * a parallel loop is copied, even if its layout is not changed.
+ */
+static int compute_layout(struct cpu_array_layout *layout,
+	struct pet_array *array, __isl_keep isl_union_map *accesses,
+	__isl_keep isl_union_map *schedule, __isl_keep isl_union_map *writes,
+	__isl_keep isl_union_map *owners, struct ppcg_options *options)
+{
+	struct cpu_layout_access_data data;
+	isl_union_set *extent;
+	isl_union_map *written;
+	isl_bool empty;
+	isl_stat r;
+	char name[40];
+
+	extent = isl_union_set_from_set(isl_set_copy(array->extent));
+	data.accesses = isl_union_map_copy(accesses);
+	data.accesses = isl_union_map_intersect_range(data.accesses,
+					isl_union_set_copy(extent));
+	data.col = 0;
+	data.row = 0;
+	r = isl_union_map_foreach_map(schedule, &classify_statement, &data);
+	isl_union_map_free(data.accesses);
+	written = isl_union_map_copy(writes);
+	written = isl_union_map_intersect_range(written, extent);
+	empty = isl_union_map_is_empty(written);
+	isl_union_map_free(written);
+	if (r < 0 || empty < 0)
+		return -1;
+
+	layout->array = array;
+	layout->n_index = isl_set_dim(array->extent, isl_dim_set);
+	layout->transpose = options->array_layout &&
+			layout->n_index == 2 && data.col && !data.row;
+	layout->pad = 0;
+	if (options->array_layout && !layout->transpose && data.col)
+		layout->pad = options->array_padding;
+	if (owners)
+		layout->owner = extract_owner(owners, array->extent);
+	if (!layout->transpose && layout->pad <= 0 && !layout->owner)
+		return 0;
+
+	layout->copy_out = !empty;
+	layout->id = isl_set_get_tuple_id(array->extent);
+	snprintf(name, sizeof(name), "ppcg_layout_%s",
+		isl_id_get_name(layout->id));
+	layout->copy_id = isl_id_alloc(isl_id_get_ctx(layout->id), name, NULL);
+	if (!layout->id || !layout->copy_id)
+		return -1;
+
+	return 1;
+}
+
+/* If "node" is a band node with a coincident outer member,
+ * then add the schedule of this member to *user and
+ * do not look for any further parallel loops inside "node".
+ */
+static isl_bool collect_parallel_band(__isl_keep isl_schedule_node *node,
+	void *user)
+{
+	isl_union_map **sched = user;
+	isl_multi_union_pw_aff *mupa;
+	isl_union_pw_aff *upa;
+	isl_union_map *umap;
+	isl_bool coincident;
+
+	if (isl_schedule_node_get_type(node) != isl_schedule_node_band)
+		return isl_bool_true;
+	if (isl_schedule_node_band_n_member(node) <= 0)
+		return isl_bool_true;
+	coincident = isl_schedule_node_band_member_get_coincident(node, 0);
+	if (coincident < 0 || !coincident)
+		return coincident < 0 ? isl_bool_error : isl_bool_true;
+
+	mupa = isl_schedule_node_band_get_partial_schedule(node);
+	upa = isl_multi_union_pw_aff_get_union_pw_aff(mupa, 0);
+	isl_multi_union_pw_aff_free(mupa);
+	umap = isl_union_map_from_union_pw_aff(upa);
+	umap = isl_union_map_intersect_domain(umap,
+					isl_schedule_node_get_domain(node));
+	*sched = isl_union_map_union(*sched, umap);
+
+	return isl_bool_false;
+}
+
+/* Return a map from the elements accessed by "accesses" to
+ * the first iteration of an outermost parallel loop in "schedule"
+ * that accesses them.
+ * The outermost parallel loops are approximated by the coincident
+ * outer members of the outermost bands with such a member,
+ * which is what the openmp parallel loops are derived from.
+ */
+static __isl_give isl_union_map *compute_owners(
+	__isl_keep isl_schedule *schedule, __isl_keep isl_union_map *accesses)
+{
+	isl_union_map *sched, *owners;
+
+	sched = isl_union_map_empty(isl_union_map_get_space(accesses));
+	if (isl_schedule_foreach_schedule_node_top_down(schedule,
+				&collect_parallel_band, &sched) < 0)
+		sched = isl_union_map_free(sched);
+	owners = isl_union_map_reverse(isl_union_map_copy(accesses));
+	owners = isl_union_map_apply_range(owners, sched);
+
+	return isl_union_map_lexmin(owners);
+}
+
+/* Determine the arrays of "scop" that should be copied into
+ * a local array, given that the scop is executed according to "schedule".
+ * These are the arrays with a different layout, if the array_layout
+ * option is set, and, if the openmp_first_touch option is set,
+ * the arrays that are accessed by outermost parallel loops.
+ * Return NULL on error.
+ */
+struct cpu_layouts *cpu_layouts_compute(struct ppcg_scop *scop,
+	__isl_keep isl_schedule *schedule)
+{
+	isl_ctx *ctx = isl_schedule_get_ctx(schedule);
+	struct cpu_layouts *layouts;
+	isl_union_map *accesses, *map, *owners = NULL;
+	int i;
+
+	layouts = isl_calloc_type(ctx, struct cpu_layouts);
+	if (!layouts)
+		return NULL;
+	layouts->layout = isl_calloc_array(ctx, struct cpu_array_layout,
+					    scop->pet->n_array);
+	if (scop->pet->n_array && !layouts->layout)
+		return NULL;
+
+	accesses = isl_union_map_copy(scop->reads);
+	accesses = isl_union_map_union(accesses,
+				isl_union_map_copy(scop->may_writes));
+	map = isl_schedule_get_map(schedule);
+	if (scop->options->openmp && scop->options->openmp_first_touch)
+		owners = compute_owners(schedule, accesses);
+	for (i = 0; i < scop->pet->n_array; ++i) {
+		struct pet_array *array = scop->pet->arrays[i];
+		struct cpu_array_layout *layout;
+		int change;
+
+		if (!is_layout_candidate(scop->pet, array, owners != NULL))
+			continue;
+		layout = &layouts->layout[layouts->n];
+		change = compute_layout(layout, array, accesses, map,
+				scop->may_writes, owners, scop->options);
+		if (change <= 0) {
+			isl_id_free(layout->id);
+			isl_id_free(layout->copy_id);
+			isl_map_free(layout->owner);
+			memset(layout, 0, sizeof(*layout));
+		}
+		if (change < 0)
+			break;
+		if (change)
+			layouts->n++;
+	}
+	isl_union_map_free(owners);
+	isl_union_map_free(map);
+	isl_union_map_free(accesses);
+
+	if (i < scop->pet->n_array) {
+		cpu_layouts_free(layouts);
+		return NULL;
+	}
+
+	return layouts;
+}
+
+/* Return the layout in "layouts" of the array with identifier "id" or
+ * NULL if the layout of this array is not changed.
+ */
+static struct cpu_array_layout *find_layout(struct cpu_layouts *layouts,
+	__isl_keep isl_id *id)
+{
+	int i;
+
+	for (i = 0; i < layouts->n; ++i)
+		if (layouts->layout[i].id == id)
+			return &layouts->layout[i];
+
+	return NULL;
+}
+
+/* Return the position of index "i" of the original array
+ * in the copy with layout "layout".
+ */
+static int copy_pos(struct cpu_array_layout *layout, int i)
+{
+	if (layout->transpose)
+		return layout->n_index - 1 - i;
+	return i;
+}
+
+/* Rewrite any access to an array in "expr" of which the layout is
+ * changed according to "layouts" into an access to its copy.
+ */
+static __isl_give isl_ast_expr *rewrite_expr(struct cpu_layouts *layouts,
+	__isl_take isl_ast_expr *expr)
+{
+	int i, n;
+	isl_ast_expr *arg;
+	isl_ast_expr_list *index;
+	struct cpu_array_layout *layout = NULL;
+
+	if (isl_ast_expr_get_type(expr) != isl_ast_expr_op)
+		return expr;
+
+	n = isl_ast_expr_get_op_n_arg(expr);
+	if (isl_ast_expr_get_op_type(expr) == isl_ast_op_access) {
+		isl_id *id;
+
+		arg = isl_ast_expr_get_op_arg(expr, 0);
+		id = isl_ast_expr_get_id(arg);
+		isl_ast_expr_free(arg);
+		layout = find_layout(layouts, id);
+		isl_id_free(id);
+	}
+	if (!layout || n != 1 + layout->n_index) {
+		for (i = 0; i < n; ++i) {
+			arg = isl_ast_expr_get_op_arg(expr, i);
+			arg = rewrite_expr(layouts, arg);
+			expr = isl_ast_expr_set_op_arg(expr, i, arg);
+		}
+		return expr;
+	}
+
+	index = isl_ast_expr_list_alloc(isl_ast_expr_get_ctx(expr), n - 1);
+	for (i = 0; i < n - 1; ++i) {
+		arg = isl_ast_expr_get_op_arg(expr, 1 + copy_pos(layout, i));
+		index = isl_ast_expr_list_add(index, arg);
+	}
+	isl_ast_expr_free(expr);
+	arg = isl_ast_expr_from_id(isl_id_copy(layout->copy_id));
+
+	return isl_ast_expr_access(arg, index);
+}
+
+/* Rewrite the access expression "expr" into an access to the copy
+ * of the accessed array, if its layout is changed according to "layouts".
+ */
+__isl_give isl_ast_expr *cpu_layouts_rewrite_access(
+	struct cpu_layouts *layouts, __isl_take isl_ast_expr *expr)
+{
+	if (cpu_layouts_is_empty(layouts))
+		return expr;
+	return rewrite_expr(layouts, expr);
+}
+
+/* Internal data structure for rewrite_entry.
+ */
+struct cpu_layout_rewrite_data {
+	struct cpu_layouts *layouts;
+	isl_id_to_ast_expr *res;
+};
+
+/* Add the rewritten version of the pair "key", "expr" to data->res.
+ */
+static isl_stat rewrite_entry(__isl_take isl_id *key,
+	__isl_take isl_ast_expr *expr, void *user)
+{
+	struct cpu_layout_rewrite_data *data = user;
+
+	expr = rewrite_expr(data->layouts, expr);
+	data->res = isl_id_to_ast_expr_set(data->res, key, expr);
+
+	return data->res ? isl_stat_ok : isl_stat_error;
+}
+
+/* Rewrite the accesses in "ref2expr" to arrays of which the layout
+ * is changed according to "layouts" into accesses to their copies.
+ */
+__isl_give isl_id_to_ast_expr *cpu_layouts_rewrite_accesses(
+	struct cpu_layouts *layouts, __isl_take isl_id_to_ast_expr *ref2expr)
+{
+	struct cpu_layout_rewrite_data data;
+	isl_ctx *ctx;
+
+	if (cpu_layouts_is_empty(layouts) || !ref2expr)
+		return ref2expr;
+
+	ctx = isl_id_to_ast_expr_get_ctx(ref2expr);
+	data.layouts = layouts;
+	data.res = isl_id_to_ast_expr_alloc(ctx, 0);
+	if (isl_id_to_ast_expr_foreach(ref2expr, &rewrite_entry, &data) < 0)
+		data.res = isl_id_to_ast_expr_free(data.res);
+	isl_id_to_ast_expr_free(ref2expr);
+
+	return data.res;
+}
+
+/* Print the size of dimension "pos" of the copy with layout "layout",
+ * given the sizes "size" of the original array, using "build".
+ */
+static __isl_give isl_printer *print_copy_size(__isl_take isl_printer *p,
+	struct cpu_array_layout *layout, __isl_keep isl_multi_pw_aff *size,
+	int pos, __isl_keep isl_ast_build *build)
+{
+	isl_pw_aff *bound;
+	isl_ast_expr *expr;
+	int pad;
+
+	pad = pos == layout->n_index - 1 ? layout->pad : 0;
+	bound = isl_multi_pw_aff_get_pw_aff(size, copy_pos(layout, pos));
+	expr = isl_ast_build_expr_from_pw_aff(build, bound);
+	p = isl_printer_print_str(p, "(");
+	p = isl_printer_print_ast_expr(p, expr);
+	p = isl_printer_print_str(p, ")");
+	if (pad > 0) {
+		p = isl_printer_print_str(p, " + ");
+		p = isl_printer_print_int(p, pad);
+	}
+	isl_ast_expr_free(expr);
+
+	return p;
+}
+
+/* Print the declaration of the copy with layout "layout" as a pointer
+ * to an array of all but its outermost dimension and allocate
+ * memory for the entire copy, using "build" to construct the sizes.
+ */
+static __isl_give isl_printer *print_copy_declaration(
+	__isl_take isl_printer *p, struct cpu_array_layout *layout,
+	__isl_keep isl_ast_build *build)
+{
+	isl_multi_pw_aff *size;
+	int i;
+
+	size = ppcg_size_from_extent(isl_set_copy(layout->array->extent));
+
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, layout->array->element_type);
+	p = isl_printer_print_str(p, " (*");
+	p = isl_printer_print_str(p, isl_id_get_name(layout->copy_id));
+	p = isl_printer_print_str(p, ")");
+	for (i = 1; i < layout->n_index; ++i) {
+		p = isl_printer_print_str(p, "[");
+		p = print_copy_size(p, layout, size, i, build);
+		p = isl_printer_print_str(p, "]");
+	}
+	p = isl_printer_print_str(p, " = malloc(sizeof(");
+	p = isl_printer_print_str(p, layout->array->element_type);
+	p = isl_printer_print_str(p, ")");
+	for (i = 0; i < layout->n_index; ++i) {
+		p = isl_printer_print_str(p, " * ");
+		p = print_copy_size(p, layout, size, i, build);
+	}
+	p = isl_printer_print_str(p, ");");
+	p = isl_printer_end_line(p);
+
+	isl_multi_pw_aff_free(size);
+
+	return p;
+}
+
+/* Internal data structure for print_copy_user and print_copy_for.
+ *
+ * "layout" is the layout of the copy.
+ * "in" is set if the original array is copied into the copy and
+ * not set if the copy is copied back into the original array.
+ * "parallel" is set if the outermost loop should be executed in parallel.
+ * "in_parallel" is set while this loop is being printed.
+ * "options" are the ppcg options.
+ */
+struct cpu_layout_copy_data {
+	struct cpu_array_layout *layout;
+	int in;
+	int parallel;
+	int in_parallel;
+	struct ppcg_options *options;
+};
+
+/* Print an access to the element of the copy (if "copy" is set) or
+ * of the original array (if "copy" is not set) of "layout"
+ * corresponding to the element of the original array
+ * accessed by the call expression "expr".
+ */
+static __isl_give isl_printer *print_element(__isl_take isl_printer *p,
+	struct cpu_array_layout *layout, __isl_keep isl_ast_expr *expr,
+	int copy)
+{
+	int i;
+	isl_id *id = copy ? layout->copy_id : layout->id;
+
+	p = isl_printer_print_str(p, isl_id_get_name(id));
+	for (i = 0; i < layout->n_index; ++i) {
+		isl_ast_expr *arg;
+		int pos = copy ? copy_pos(layout, i) : i;
+
+		arg = isl_ast_expr_get_op_arg(expr, 1 + pos);
+		p = isl_printer_print_str(p, "[");
+		p = isl_printer_print_ast_expr(p, arg);
+		p = isl_printer_print_str(p, "]");
+		isl_ast_expr_free(arg);
+	}
+
+	return p;
+}
+
+/* Print a statement that copies an element of the original array
+ * to the copy or back.
+ * The user node "node" is a call with the indices of the element
+ * in the original array as arguments.
+ */
+static __isl_give isl_printer *print_copy_user(__isl_take isl_printer *p,
+	__isl_take isl_ast_print_options *print_options,
+	__isl_keep isl_ast_node *node, void *user)
+{
+	struct cpu_layout_copy_data *data = user;
+	isl_ast_expr *expr;
+
+	isl_ast_print_options_free(print_options);
+
+	expr = isl_ast_node_user_get_expr(node);
+	p = isl_printer_start_line(p);
+	p = print_element(p, data->layout, expr, data->in);
+	p = isl_printer_print_str(p, " = ");
+	p = print_element(p, data->layout, expr, !data->in);
+	p = isl_printer_print_str(p, ";");
+	p = isl_printer_end_line(p);
+	isl_ast_expr_free(expr);
+
+	return p;
+}
+
+/* Print the outermost for node "node" of a parallel copy
+ * as an openmp parallel loop.
+ * The iterations are distributed statically, in the same way
+ * as those of the parallel loops inside the scop, provided
+ * these use the default or static schedule.
+ */
+static __isl_give isl_printer *print_copy_for(__isl_take isl_printer *p,
+	__isl_take isl_ast_print_options *print_options,
+	__isl_keep isl_ast_node *node, void *user)
+{
+	struct cpu_layout_copy_data *data = user;
+
+	if (!data->parallel || data->in_parallel)
+		return isl_ast_node_for_print(node, p, print_options);
+
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "#pragma omp parallel for");
+	p = isl_printer_print_str(p, " schedule(static)");
+	p = ppcg_print_openmp_proc_bind(p, data->options->openmp_proc_bind);
+	p = isl_printer_end_line(p);
+	data->in_parallel = 1;
+	p = isl_ast_node_for_print(node, p, print_options);
+	data->in_parallel = 0;
+
+	return p;
+}
+
+/* Print code for copying the elements of the original array of "layout"
+ * in the domain of "schedule" to the copy (if data->in is set)
+ * or back (if data->in is not set), in the order specified by "schedule".
+ * If data->parallel is set, then the outermost loop is executed
+ * in parallel.
+ */
+static __isl_give isl_printer *print_copy_nest(__isl_take isl_printer *p,
+	__isl_take isl_map *schedule, struct ppcg_scop *scop,
+	struct cpu_layout_copy_data *data)
+{
+	isl_ctx *ctx = isl_printer_get_ctx(p);
+	isl_ast_build *build;
+	isl_ast_print_options *print_options;
+	isl_ast_node *tree;
+	isl_id_list *iterators;
+	int n;
+
+	n = isl_map_dim(schedule, isl_dim_out);
+	build = isl_ast_build_from_context(isl_set_copy(scop->context));
+	iterators = ppcg_scop_generate_names(scop, n, "c");
+	build = isl_ast_build_set_iterators(build, iterators);
+	tree = isl_ast_build_node_from_schedule_map(build,
+					isl_union_map_from_map(schedule));
+	isl_ast_build_free(build);
+
+	print_options = isl_ast_print_options_alloc(ctx);
+	print_options = isl_ast_print_options_set_print_user(print_options,
+						&print_copy_user, data);
+	print_options = isl_ast_print_options_set_print_for(print_options,
+						&print_copy_for, data);
+	p = ppcg_print_macros(p, tree);
+	p = isl_ast_node_print(tree, p, print_options);
+	isl_ast_node_free(tree);
+
+	return p;
+}
+
+/* Print code for copying all elements of the original array of "layout"
+ * to the copy (if "in" is set) or back (if "in" is not set).
+ *
+ * The elements that are accessed by an outermost parallel loop
+ * inside the scop are copied by a parallel loop over the iterations
+ * of that loop, such that each element is first touched by
+ * the same thread that accesses it inside the scop.
+ * The remaining elements are copied sequentially.
+ */
+static __isl_give isl_printer *print_copy(__isl_take isl_printer *p,
+	struct cpu_array_layout *layout, struct ppcg_scop *scop, int in)
+{
+	struct cpu_layout_copy_data data = { layout, in, 0, 0, scop->options };
+	isl_set *rest;
+	isl_bool empty;
+
+	rest = isl_set_copy(layout->array->extent);
+	if (layout->owner) {
+		isl_set *owned;
+		isl_map *schedule;
+
+		owned = isl_map_domain(isl_map_copy(layout->owner));
+		rest = isl_set_subtract(rest, isl_set_copy(owned));
+		schedule = isl_map_flat_range_product(
+				isl_map_copy(layout->owner),
+				isl_set_identity(owned));
+		data.parallel = 1;
+		p = print_copy_nest(p, schedule, scop, &data);
+		data.parallel = 0;
+	}
+
+	empty = isl_set_is_empty(rest);
+	if (empty < 0)
+		p = isl_printer_free(p);
+	if (empty)
+		isl_set_free(rest);
+	else
+		p = print_copy_nest(p, isl_set_identity(rest), scop, &data);
+
+	return p;
+}
+
+/* Print declarations of the copies of the arrays of which the layout
+ * is changed according to "layouts" and code for copying
+ * the arrays into these copies.
+ */
+__isl_give isl_printer *cpu_layouts_print_copy_in(__isl_take isl_printer *p,
+	struct cpu_layouts *layouts, struct ppcg_scop *scop)
+{
+	int i;
+	isl_ast_build *build;
+
+	if (cpu_layouts_is_empty(layouts))
+		return p;
+
+	build = isl_ast_build_from_context(isl_set_copy(scop->context));
+	for (i = 0; i < layouts->n; ++i)
+		p = print_copy_declaration(p, &layouts->layout[i], build);
+	isl_ast_build_free(build);
+	for (i = 0; i < layouts->n; ++i)
+		p = print_copy(p, &layouts->layout[i], scop, 1);
+
+	return p;
+}
+
+/* Print code for copying the copies of the arrays of which the layout
+ * is changed according to "layouts" back to the original arrays,
+ * if they are written inside the scop, and for freeing the copies.
+ */
+__isl_give isl_printer *cpu_layouts_print_copy_out(__isl_take isl_printer *p,
+	struct cpu_layouts *layouts, struct ppcg_scop *scop)
+{
+	int i;
+
+	if (cpu_layouts_is_empty(layouts))
+		return p;
+
+	for (i = 0; i < layouts->n; ++i) {
+		struct cpu_array_layout *layout = &layouts->layout[i];
+
+		if (layout->copy_out)
+			p = print_copy(p, layout, scop, 0);
+		p = isl_printer_start_line(p);
+		p = isl_printer_print_str(p, "free(");
+		p = isl_printer_print_str(p, isl_id_get_name(layout->copy_id));
+		p = isl_printer_print_str(p, ");");
+		p = isl_printer_end_line(p);
+	}
+
+	return p;
+}
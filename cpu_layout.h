@@ -0,0 +1,27 @@
+#ifndef _CPU_LAYOUT_H
+#define _CPU_LAYOUT_H
+
+#include <isl/id_to_ast_expr.h>
+#include <isl/printer.h>
+#include <isl/schedule.h>
+
+#include "ppcg.h"
+
+struct cpu_layouts;
+
+struct cpu_layouts *cpu_layouts_compute(struct ppcg_scop *scop,
+	__isl_keep isl_schedule *schedule);
+void cpu_layouts_free(struct cpu_layouts *layouts);
+int cpu_layouts_is_empty(struct cpu_layouts *layouts);
+
+__isl_give isl_ast_expr *cpu_layouts_rewrite_access(
+	struct cpu_layouts *layouts, __isl_take isl_ast_expr *expr);
+__isl_give isl_id_to_ast_expr *cpu_layouts_rewrite_accesses(
+	struct cpu_layouts *layouts, __isl_take isl_id_to_ast_expr *ref2expr);
+
+__isl_give isl_printer *cpu_layouts_print_copy_in(__isl_take isl_printer *p,
+	struct cpu_layouts *layouts, struct ppcg_scop *scop);
+__isl_give isl_printer *cpu_layouts_print_copy_out(__isl_take isl_printer *p,
+	struct cpu_layouts *layouts, struct ppcg_scop *scop);
+
+#endif
@@ -39,140 +39,1327 @@ static __isl_give isl_printer *print_cuda_macros(__isl_take isl_printer *p)
 	return p;
 }
 
+/* Should the kernels be split across multiple devices?
+ * This relies on managed memory for making the data available
+ * to all devices.  Since the kernels on different devices are
+ * launched and synchronized from the host, the host code cannot be
+ * captured in a CUDA graph.  The launches are also not timed.
+ */
+static int use_multi_device(struct ppcg_options *options)
+{
+	return options->num_devices > 1 && options->managed_memory &&
+		!options->cuda_graphs && !options->device_timing;
+}
+
+/* Is "kernel" split across multiple devices?
+ * Only kernels with at least one block dimension can be split and
+ * kernels that perform grid-wide synchronization need to be
+ * executed on a single device.
+ * Kernels with reductions are also executed on a single device
+ * since the atomic updates are not atomic across devices.
+ */
+static int kernel_uses_multi_device(struct ppcg_kernel *kernel)
+{
+	return use_multi_device(kernel->options) && kernel->n_grid > 0 &&
+		!kernel->persistent_iterator && !kernel->any_reduction;
+}
+
+/* Should the device arrays and the information about their contents
+ * be kept alive across executions of the scop?
+ * Managed memory is migrated by the CUDA runtime instead.
+ */
+static int use_persistent_device_data(struct ppcg_options *options)
+{
+	return options->persistent_device_data && !options->managed_memory;
+}
+
+/* Should the device arrays be allocated only once and be kept
+ * across executions of the scop?
+ * This is the case if their contents persist across executions or
+ * if they are allocated in managed memory.  In the latter case,
+ * allocating the arrays only once keeps the migrated pages alive
+ * and avoids a costly allocation on each execution.
+ */
+static int use_static_device_arrays(struct ppcg_options *options)
+{
+	return use_persistent_device_data(options) || options->managed_memory;
+}
+
+/* Print the pointer declarator "*<name>" of the device array
+ * corresponding to "array" on "p", taking into account that
+ * a multi-dimensional array that is not linearized is accessed
+ * through a pointer to its rows.
+ * "name" may be empty, in which case an abstract declarator is printed.
+ */
+static __isl_give isl_printer *print_device_array_declarator(
+	__isl_take isl_printer *p, struct gpu_array_info *array,
+	const char *name)
+{
+	int i;
+
+	if (!array->linearize && array->n_index > 1)
+		p = isl_printer_print_str(p, "(");
+	p = isl_printer_print_str(p, "*");
+	p = isl_printer_print_str(p, name);
+	if (!array->linearize && array->n_index > 1) {
+		p = isl_printer_print_str(p, ")");
+		for (i = 1; i < array->n_index; i++) {
+			isl_ast_expr *bound;
+			bound = isl_ast_expr_get_op_arg(array->bound_expr,
+							1 + i);
+			p = isl_printer_print_str(p, "[");
+			p = isl_printer_print_ast_expr(p, bound);
+			p = isl_printer_print_str(p, "]");
+			isl_ast_expr_free(bound);
+		}
+	}
+
+	return p;
+}
+
 /* Print a declaration for the device array corresponding to "array" on "p".
+ * If the device array is kept across executions of the scop
+ * ("is_static" is set), then it is declared static.
+ */
+static __isl_give isl_printer *declare_device_array(__isl_take isl_printer *p,
+	struct gpu_array_info *array, int is_static)
+{
+	char name[100];
+
+	snprintf(name, sizeof(name), "dev_%s", array->name);
+	p = isl_printer_start_line(p);
+	if (is_static)
+		p = isl_printer_print_str(p, "static ");
+	p = isl_printer_print_str(p, array->type);
+	p = isl_printer_print_str(p, " ");
+	p = print_device_array_declarator(p, array, name);
+	p = isl_printer_print_str(p, ";");
+	p = isl_printer_end_line(p);
+
+	return p;
+}
+
+/* Print declarations of the variables that keep track of
+ * the window buffers holding the slabs of "array" that are accessed
+ * by the chunks of an out-of-core execution.
+ * "ppcg_window_buffer_<array>" contains the buffers,
+ * "ppcg_window_size_<array>" their sizes in bytes and
+ * "ppcg_window_<array>" is the index of the buffer
+ * used by the current chunk.
+ */
+static __isl_give isl_printer *declare_windows(__isl_take isl_printer *p,
+	struct gpu_array_info *array)
+{
+	const char *decl[] = {
+		"void *ppcg_window_buffer_",
+		"size_t ppcg_window_size_",
+	};
+	int i;
+
+	for (i = 0; i < 2; ++i) {
+		p = isl_printer_start_line(p);
+		p = isl_printer_print_str(p, decl[i]);
+		p = isl_printer_print_str(p, array->name);
+		p = isl_printer_print_str(p, "[");
+		p = isl_printer_print_int(p, array->windowed);
+		p = isl_printer_print_str(p, "] = { 0 };");
+		p = isl_printer_end_line(p);
+	}
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "int ppcg_window_");
+	p = isl_printer_print_str(p, array->name);
+	p = isl_printer_print_str(p, " = 0;");
+	p = isl_printer_end_line(p);
+
+	return p;
+}
+
+/* Print declarations of the static variables that keep track
+ * of the device copy of "array" across executions of the scop.
+ * "ppcg_allocated_<array>" is the number of bytes allocated for the device
+ * copy, "ppcg_resident_<array>" is the number of bytes of the device copy
+ * that are known to be equal to the host array, the contents of which
+ * were then hashed into "ppcg_hash_<array>", and
+ * "ppcg_pending_<array>" is set if the device copy has been (or is being)
+ * copied back to the host, but the host contents have not been hashed yet.
+ */
+static __isl_give isl_printer *declare_residency(__isl_take isl_printer *p,
+	struct gpu_array_info *array)
+{
+	const char *decl[] = {
+		"static size_t ppcg_allocated_",
+		"static size_t ppcg_resident_",
+		"static unsigned long long ppcg_hash_",
+		"static int ppcg_pending_",
+	};
+	int i;
+
+	for (i = 0; i < 4; ++i) {
+		p = isl_printer_start_line(p);
+		p = isl_printer_print_str(p, decl[i]);
+		p = isl_printer_print_str(p, array->name);
+		p = isl_printer_print_str(p, ";");
+		p = isl_printer_end_line(p);
+	}
+
+	return p;
+}
+
+/* Print a declaration of the static variable "ppcg_allocated_<array>"
+ * holding the number of bytes allocated for the device copy of "array"
+ * that is kept across executions of the scop.
+ */
+static __isl_give isl_printer *declare_allocated(__isl_take isl_printer *p,
+	struct gpu_array_info *array)
+{
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "static size_t ppcg_allocated_");
+	p = isl_printer_print_str(p, array->name);
+	p = isl_printer_print_str(p, ";");
+	p = isl_printer_end_line(p);
+
+	return p;
+}
+
+/* Print declarations of the device arrays and,
+ * if they persist across executions of the scop,
+ * of the variables keeping track of their contents or,
+ * if they are only kept across executions in managed memory,
+ * of the variables keeping track of their allocated sizes or,
+ * if they are only held in window buffers,
+ * of the variables keeping track of those buffers.
+ */
+static __isl_give isl_printer *declare_device_arrays(__isl_take isl_printer *p,
+	struct gpu_prog *prog)
+{
+	int i;
+	int persistent, is_static;
+
+	persistent = use_persistent_device_data(prog->scop->options);
+	is_static = use_static_device_arrays(prog->scop->options);
+	for (i = 0; i < prog->n_array; ++i) {
+		if (!gpu_array_requires_device_allocation(&prog->array[i]))
+			continue;
+
+		p = declare_device_array(p, &prog->array[i], is_static);
+		if (persistent)
+			p = declare_residency(p, &prog->array[i]);
+		else if (is_static)
+			p = declare_allocated(p, &prog->array[i]);
+		if (prog->array[i].windowed)
+			p = declare_windows(p, &prog->array[i]);
+	}
+	p = isl_printer_start_line(p);
+	p = isl_printer_end_line(p);
+	return p;
+}
+
+/* Print code for allocating the device copy of "array"
+ * that is kept across executions of the scop,
+ * unless a large enough device copy has been allocated
+ * during a previous execution of the scop.
+ * If "managed" is set, then the device copy is allocated
+ * in managed memory.  Otherwise, the device copy persists and
+ * the contents of a newly allocated device copy are unknown.
+ */
+static __isl_give isl_printer *allocate_static_device_array(
+	__isl_take isl_printer *p, struct gpu_array_info *array, int managed)
+{
+	const char *alloc;
+
+	if (managed)
+		alloc = "cudaCheckReturn(cudaMallocManaged((void **) &dev_";
+	else
+		alloc = "cudaCheckReturn(cudaMalloc((void **) &dev_";
+
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "if (ppcg_allocated_");
+	p = isl_printer_print_str(p, array->name);
+	p = isl_printer_print_str(p, " < ");
+	p = gpu_array_info_print_size(p, array);
+	p = isl_printer_print_str(p, ") {");
+	p = isl_printer_end_line(p);
+	p = isl_printer_indent(p, 2);
+
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "if (ppcg_allocated_");
+	p = isl_printer_print_str(p, array->name);
+	p = isl_printer_print_str(p, " > 0)");
+	p = isl_printer_end_line(p);
+	p = isl_printer_indent(p, 2);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "cudaCheckReturn(cudaFree(dev_");
+	p = isl_printer_print_str(p, array->name);
+	p = isl_printer_print_str(p, "));");
+	p = isl_printer_end_line(p);
+	p = isl_printer_indent(p, -2);
+
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, alloc);
+	p = isl_printer_print_str(p, array->name);
+	p = isl_printer_print_str(p, ", ");
+	p = gpu_array_info_print_size(p, array);
+	p = isl_printer_print_str(p, "));");
+	p = isl_printer_end_line(p);
+
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "ppcg_allocated_");
+	p = isl_printer_print_str(p, array->name);
+	p = isl_printer_print_str(p, " = ");
+	p = gpu_array_info_print_size(p, array);
+	p = isl_printer_print_str(p, ";");
+	p = isl_printer_end_line(p);
+	if (!managed) {
+		p = isl_printer_start_line(p);
+		p = isl_printer_print_str(p, "ppcg_resident_");
+		p = isl_printer_print_str(p, array->name);
+		p = isl_printer_print_str(p, " = 0;");
+		p = isl_printer_end_line(p);
+	}
+
+	p = isl_printer_indent(p, -2);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "}");
+	p = isl_printer_end_line(p);
+
+	return p;
+}
+
+/* Allocate the device arrays.
+ * If managed memory is used, then the arrays are allocated
+ * in memory that is managed by the CUDA runtime.
+ * If the device arrays are kept across executions of the scop,
+ * which is the case if they persist or if they are allocated
+ * in managed memory, then they are only allocated if needed.
+ * Arrays that are only held in window buffers are not allocated here,
+ * but in set_up_window instead.
+ */
+static __isl_give isl_printer *allocate_device_arrays(
+	__isl_take isl_printer *p, struct gpu_prog *prog)
+{
+	int i;
+	int is_static, managed;
+
+	managed = prog->scop->options->managed_memory;
+	is_static = use_static_device_arrays(prog->scop->options);
+	for (i = 0; i < prog->n_array; ++i) {
+		struct gpu_array_info *array = &prog->array[i];
+
+		if (!gpu_array_requires_device_allocation(&prog->array[i]))
+			continue;
+		if (array->windowed)
+			continue;
+		p = ppcg_ast_expr_print_macros(array->bound_expr, p);
+		if (is_static) {
+			p = allocate_static_device_array(p, array, managed);
+			continue;
+		}
+		p = isl_printer_start_line(p);
+		p = isl_printer_print_str(p,
+				"cudaCheckReturn(cudaMalloc((void **) &dev_");
+		p = isl_printer_print_str(p, prog->array[i].name);
+		p = isl_printer_print_str(p, ", ");
+		p = gpu_array_info_print_size(p, &prog->array[i]);
+		p = isl_printer_print_str(p, "));");
+		p = isl_printer_end_line(p);
+	}
+	p = isl_printer_start_line(p);
+	p = isl_printer_end_line(p);
+	return p;
+}
+
+/* Print code for freeing the window buffers of "array" that
+ * have been allocated.
+ */
+static __isl_give isl_printer *free_windows(__isl_take isl_printer *p,
+	struct gpu_array_info *array)
+{
+	int i;
+
+	for (i = 0; i < array->windowed; ++i) {
+		p = isl_printer_start_line(p);
+		p = isl_printer_print_str(p, "if (ppcg_window_size_");
+		p = isl_printer_print_str(p, array->name);
+		p = isl_printer_print_str(p, "[");
+		p = isl_printer_print_int(p, i);
+		p = isl_printer_print_str(p, "] > 0)");
+		p = isl_printer_end_line(p);
+		p = isl_printer_indent(p, 2);
+		p = isl_printer_start_line(p);
+		p = isl_printer_print_str(p, "cudaCheckReturn(cudaFree(");
+		p = isl_printer_print_str(p, "ppcg_window_buffer_");
+		p = isl_printer_print_str(p, array->name);
+		p = isl_printer_print_str(p, "[");
+		p = isl_printer_print_int(p, i);
+		p = isl_printer_print_str(p, "]));");
+		p = isl_printer_end_line(p);
+		p = isl_printer_indent(p, -2);
+	}
+
+	return p;
+}
+
+/* Free the device arrays, including the window buffers
+ * of the arrays that are only held in window buffers.
+ * If "windows_only" is set, then only the window buffers are freed.
+ */
+static __isl_give isl_printer *free_device_arrays(__isl_take isl_printer *p,
+	struct gpu_prog *prog, int windows_only)
+{
+	int i;
+
+	for (i = 0; i < prog->n_array; ++i) {
+		if (!gpu_array_requires_device_allocation(&prog->array[i]))
+			continue;
+		if (prog->array[i].windowed) {
+			p = free_windows(p, &prog->array[i]);
+			continue;
+		}
+		if (windows_only)
+			continue;
+		p = isl_printer_start_line(p);
+		p = isl_printer_print_str(p, "cudaCheckReturn(cudaFree(dev_");
+		p = isl_printer_print_str(p, prog->array[i].name);
+		p = isl_printer_print_str(p, "));");
+		p = isl_printer_end_line(p);
+	}
+
+	return p;
+}
+
+/* Print a statement page-locking (if "lock" is set) or releasing
+ * (if "lock" is not set) the host memory of "array".
+ * Since registering an empty range of memory fails,
+ * the statement is only executed if the size of the array is positive.
+ */
+static __isl_give isl_printer *print_host_register(__isl_take isl_printer *p,
+	struct gpu_array_info *array, int lock)
+{
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "if (");
+	p = gpu_array_info_print_size(p, array);
+	p = isl_printer_print_str(p, " > 0)");
+	p = isl_printer_end_line(p);
+	p = isl_printer_indent(p, 2);
+	p = isl_printer_start_line(p);
+	if (lock) {
+		p = isl_printer_print_str(p,
+					"cudaCheckReturn(cudaHostRegister(");
+		p = isl_printer_print_str(p, array->name);
+		p = isl_printer_print_str(p, ", ");
+		p = gpu_array_info_print_size(p, array);
+		p = isl_printer_print_str(p, ", cudaHostRegisterDefault));");
+	} else {
+		p = isl_printer_print_str(p,
+					"cudaCheckReturn(cudaHostUnregister(");
+		p = isl_printer_print_str(p, array->name);
+		p = isl_printer_print_str(p, "));");
+	}
+	p = isl_printer_end_line(p);
+	p = isl_printer_indent(p, -2);
+
+	return p;
+}
+
+/* Print code for page-locking (if "lock" is set) or releasing
+ * (if "lock" is not set) the host memory of the arrays
+ * that are copied to or from the device.
+ * Scalars are copied through a single element and are therefore skipped.
+ */
+static __isl_give isl_printer *register_host_arrays(__isl_take isl_printer *p,
+	struct gpu_prog *prog, int lock)
+{
+	int i;
+
+	for (i = 0; i < prog->n_array; ++i) {
+		struct gpu_array_info *array = &prog->array[i];
+
+		if (!gpu_array_requires_device_allocation(array))
+			continue;
+		if (gpu_array_is_scalar(array))
+			continue;
+		p = print_host_register(p, array, lock);
+	}
+	if (lock) {
+		p = isl_printer_start_line(p);
+		p = isl_printer_end_line(p);
+	}
+
+	return p;
+}
+
+/* Print a statement calling "fn" on the stream or event
+ * called "<prefix>_<array name>" or "<prefix>" if "array" is NULL,
+ * followed by "suffix".
+ */
+static __isl_give isl_printer *print_async_call(__isl_take isl_printer *p,
+	const char *fn, const char *prefix, struct gpu_array_info *array,
+	const char *suffix)
+{
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "cudaCheckReturn(");
+	p = isl_printer_print_str(p, fn);
+	p = isl_printer_print_str(p, "(");
+	p = isl_printer_print_str(p, prefix);
+	if (array) {
+		p = isl_printer_print_str(p, "_");
+		p = isl_printer_print_str(p, array->name);
+	}
+	p = isl_printer_print_str(p, suffix);
+	p = isl_printer_print_str(p, "));");
+	p = isl_printer_end_line(p);
+
+	return p;
+}
+
+/* Print the name of the stream on which kernels are launched
+ * (if "array" is NULL) or on which "array" is transferred.
+ */
+static __isl_give isl_printer *print_stream(__isl_take isl_printer *p,
+	struct gpu_array_info *array)
+{
+	p = isl_printer_print_str(p, "ppcg_stream");
+	if (array) {
+		p = isl_printer_print_str(p, "_");
+		p = isl_printer_print_str(p, array->name);
+	}
+
+	return p;
+}
+
+/* Print a statement recording the event "<event>_<array name>"
+ * on the stream of "on" (or the kernel stream if "on" is NULL).
+ */
+static __isl_give isl_printer *print_record_event(__isl_take isl_printer *p,
+	const char *event, struct gpu_array_info *array,
+	struct gpu_array_info *on)
+{
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "cudaCheckReturn(cudaEventRecord(");
+	p = isl_printer_print_str(p, event);
+	p = isl_printer_print_str(p, "_");
+	p = isl_printer_print_str(p, array->name);
+	p = isl_printer_print_str(p, ", ");
+	p = print_stream(p, on);
+	p = isl_printer_print_str(p, "));");
+	p = isl_printer_end_line(p);
+
+	return p;
+}
+
+/* Print a statement that makes the stream of "on" (or the kernel stream
+ * if "on" is NULL) wait for the event "<event>_<array name>".
+ */
+static __isl_give isl_printer *print_wait_event(__isl_take isl_printer *p,
+	const char *event, struct gpu_array_info *array,
+	struct gpu_array_info *on)
+{
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "cudaCheckReturn(cudaStreamWaitEvent(");
+	p = print_stream(p, on);
+	p = isl_printer_print_str(p, ", ");
+	p = isl_printer_print_str(p, event);
+	p = isl_printer_print_str(p, "_");
+	p = isl_printer_print_str(p, array->name);
+	p = isl_printer_print_str(p, ", 0));");
+	p = isl_printer_end_line(p);
+
+	return p;
+}
+
+/* Print a declaration of a variable of type "type" called
+ * "<prefix>_<array name>".
+ */
+static __isl_give isl_printer *declare_async_var(__isl_take isl_printer *p,
+	const char *type, const char *prefix, struct gpu_array_info *array)
+{
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, type);
+	p = isl_printer_print_str(p, " ");
+	p = isl_printer_print_str(p, prefix);
+	p = isl_printer_print_str(p, "_");
+	p = isl_printer_print_str(p, array->name);
+	p = isl_printer_print_str(p, ";");
+	p = isl_printer_end_line(p);
+
+	return p;
+}
+
+/* Print a statement calling "fn" on each of the events
+ * "ppcg_window_used_<array name>[i]", with "prefix" printed
+ * in front of the event and "suffix" printed after the event.
+ */
+static __isl_give isl_printer *print_window_events_call(
+	__isl_take isl_printer *p, const char *fn, const char *prefix,
+	struct gpu_array_info *array, const char *suffix)
+{
+	int i;
+
+	for (i = 0; i < array->windowed; ++i) {
+		p = isl_printer_start_line(p);
+		p = isl_printer_print_str(p, "cudaCheckReturn(");
+		p = isl_printer_print_str(p, fn);
+		p = isl_printer_print_str(p, "(");
+		p = isl_printer_print_str(p, prefix);
+		p = isl_printer_print_str(p, "ppcg_window_used_");
+		p = isl_printer_print_str(p, array->name);
+		p = isl_printer_print_str(p, "[");
+		p = isl_printer_print_int(p, i);
+		p = isl_printer_print_str(p, "]");
+		p = isl_printer_print_str(p, suffix);
+		p = isl_printer_print_str(p, "));");
+		p = isl_printer_end_line(p);
+	}
+
+	return p;
+}
+
+/* Print code for declaring and creating the events
+ * "ppcg_window_used_<array name>", one for each window buffer of "array".
+ * The event of a window buffer is recorded after each kernel
+ * that accesses the buffer.
+ */
+static __isl_give isl_printer *create_window_events(__isl_take isl_printer *p,
+	struct gpu_array_info *array)
+{
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "cudaEvent_t ppcg_window_used_");
+	p = isl_printer_print_str(p, array->name);
+	p = isl_printer_print_str(p, "[");
+	p = isl_printer_print_int(p, array->windowed);
+	p = isl_printer_print_str(p, "];");
+	p = isl_printer_end_line(p);
+	p = print_window_events_call(p, "cudaEventCreateWithFlags", "&",
+					array, ", cudaEventDisableTiming");
+
+	return p;
+}
+
+/* Print code for creating the streams and events used
+ * by asynchronous transfers.
+ * Kernels are launched on ppcg_stream, while each array that
+ * requires a device allocation is transferred on its own stream
+ * ppcg_stream_<array name>, such that transfers of different arrays
+ * can overlap with each other and with kernel execution.
+ * The event ppcg_copied_<array name> is recorded after the array
+ * has been copied to the device and the event ppcg_used_<array name>
+ * is recorded after each kernel that accesses the array.
+ * Arrays that are only held in window buffers also get
+ * an event for each buffer (see create_window_events).
+ */
+static __isl_give isl_printer *create_streams(__isl_take isl_printer *p,
+	struct gpu_prog *prog)
+{
+	int i;
+
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "cudaStream_t ppcg_stream;");
+	p = isl_printer_end_line(p);
+	p = print_async_call(p, "cudaStreamCreateWithFlags", "&ppcg_stream",
+				NULL, ", cudaStreamNonBlocking");
+	for (i = 0; i < prog->n_array; ++i) {
+		struct gpu_array_info *array = &prog->array[i];
+
+		if (!gpu_array_requires_device_allocation(array))
+			continue;
+		p = declare_async_var(p, "cudaStream_t", "ppcg_stream", array);
+		p = declare_async_var(p, "cudaEvent_t", "ppcg_copied", array);
+		p = declare_async_var(p, "cudaEvent_t", "ppcg_used", array);
+		p = print_async_call(p, "cudaStreamCreateWithFlags",
+			"&ppcg_stream", array, ", cudaStreamNonBlocking");
+		p = print_async_call(p, "cudaEventCreateWithFlags",
+			"&ppcg_copied", array, ", cudaEventDisableTiming");
+		p = print_async_call(p, "cudaEventCreateWithFlags",
+			"&ppcg_used", array, ", cudaEventDisableTiming");
+		if (array->windowed)
+			p = create_window_events(p, array);
+	}
+	p = isl_printer_start_line(p);
+	p = isl_printer_end_line(p);
+
+	return p;
+}
+
+/* Print code for waiting for all asynchronous operations to complete
+ * and for destroying the streams and events created by create_streams.
+ */
+static __isl_give isl_printer *destroy_streams(__isl_take isl_printer *p,
+	struct gpu_prog *prog)
+{
+	int i;
+
+	p = print_async_call(p, "cudaStreamSynchronize", "ppcg_stream",
+				NULL, "");
+	for (i = 0; i < prog->n_array; ++i) {
+		struct gpu_array_info *array = &prog->array[i];
+
+		if (!gpu_array_requires_device_allocation(array))
+			continue;
+		p = print_async_call(p, "cudaStreamSynchronize",
+					"ppcg_stream", array, "");
+		p = print_async_call(p, "cudaStreamDestroy",
+					"ppcg_stream", array, "");
+		p = print_async_call(p, "cudaEventDestroy",
+					"ppcg_copied", array, "");
+		p = print_async_call(p, "cudaEventDestroy",
+					"ppcg_used", array, "");
+		p = print_window_events_call(p, "cudaEventDestroy", "",
+					array, "");
+	}
+	p = print_async_call(p, "cudaStreamDestroy", "ppcg_stream", NULL, "");
+
+	return p;
+}
+
+/* Should the transfers be performed asynchronously on separate streams?
+ * Transfers to and from managed memory are performed on the default stream.
+ * If CUDA graphs are requested, then all transfers are performed
+ * on the kernel stream instead such that they can be captured.
+ */
+static int use_async_transfers(struct ppcg_options *options)
+{
+	return options->async_transfers && !options->managed_memory &&
+		!options->cuda_graphs;
+}
+
+/* Print code for creating the stream ppcg_stream and for starting
+ * the capture of all subsequent operations on this stream
+ * into the graph ppcg_graph.
+ * The instantiated graph ppcg_graph_exec is kept in a static variable
+ * such that it can be reused by subsequent executions of the scop.
+ */
+static __isl_give isl_printer *begin_capture(__isl_take isl_printer *p)
+{
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "static cudaGraphExec_t ppcg_graph_exec;");
+	p = isl_printer_end_line(p);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "cudaGraph_t ppcg_graph;");
+	p = isl_printer_end_line(p);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "cudaStream_t ppcg_stream;");
+	p = isl_printer_end_line(p);
+	p = print_async_call(p, "cudaStreamCreateWithFlags", "&ppcg_stream",
+				NULL, ", cudaStreamNonBlocking");
+	p = print_async_call(p, "cudaStreamBeginCapture", "ppcg_stream",
+				NULL, ", cudaStreamCaptureModeThreadLocal");
+	p = isl_printer_start_line(p);
+	p = isl_printer_end_line(p);
+
+	return p;
+}
+
+/* Print code for ending the capture started by begin_capture and
+ * for launching the captured graph.
+ * If a graph has been instantiated by a previous execution of the scop,
+ * then it is updated to the captured graph, which succeeds
+ * if the topology of the graph has not changed, i.e., typically
+ * if the parameters have not changed.
+ * Otherwise, the captured graph is instantiated anew.
+ */
+static __isl_give isl_printer *end_capture(__isl_take isl_printer *p)
+{
+	p = print_async_call(p, "cudaStreamEndCapture", "ppcg_stream",
+				NULL, ", &ppcg_graph");
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "if (ppcg_graph_exec) {");
+	p = isl_printer_end_line(p);
+	p = isl_printer_indent(p, 2);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p,
+			"cudaGraphExecUpdateResultInfo ppcg_update_info;");
+	p = isl_printer_end_line(p);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "if (cudaGraphExecUpdate(ppcg_graph_exec, "
+			"ppcg_graph, &ppcg_update_info) != cudaSuccess) {");
+	p = isl_printer_end_line(p);
+	p = isl_printer_indent(p, 2);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "cudaGetLastError();");
+	p = isl_printer_end_line(p);
+	p = print_async_call(p, "cudaGraphExecDestroy", "ppcg_graph_exec",
+				NULL, "");
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "ppcg_graph_exec = NULL;");
+	p = isl_printer_end_line(p);
+	p = isl_printer_indent(p, -2);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "}");
+	p = isl_printer_end_line(p);
+	p = isl_printer_indent(p, -2);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "}");
+	p = isl_printer_end_line(p);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "if (!ppcg_graph_exec)");
+	p = isl_printer_end_line(p);
+	p = isl_printer_indent(p, 2);
+	p = print_async_call(p, "cudaGraphInstantiate", "&ppcg_graph_exec",
+				NULL, ", ppcg_graph, 0");
+	p = isl_printer_indent(p, -2);
+	p = print_async_call(p, "cudaGraphLaunch", "ppcg_graph_exec",
+				NULL, ", ppcg_stream");
+	p = print_async_call(p, "cudaStreamSynchronize", "ppcg_stream",
+				NULL, "");
+	p = print_async_call(p, "cudaGraphDestroy", "ppcg_graph", NULL, "");
+	p = print_async_call(p, "cudaStreamDestroy", "ppcg_stream", NULL, "");
+
+	return p;
+}
+
+/* Print a pointer to the start of the elements of the host copy
+ * (if "device" is not set) or the device copy (if "device" is set)
+ * of "array" that are transferred.
+ * If "lo" is NULL, then the entire array is transferred.
+ * Otherwise, only the elements with outermost index starting at "lo"
+ * are transferred.
  */
-static __isl_give isl_printer *declare_device_array(__isl_take isl_printer *p,
+static __isl_give isl_printer *print_copy_pointer(__isl_take isl_printer *p,
+	struct gpu_array_info *array, int device, __isl_keep isl_ast_expr *lo)
+{
+	const char *prefix = device ? "dev_" : "";
+
+	if (lo) {
+		p = isl_printer_print_str(p, "(char *) ");
+		p = isl_printer_print_str(p, prefix);
+		p = isl_printer_print_str(p, array->name);
+		p = isl_printer_print_str(p, " + ");
+		p = gpu_array_info_print_slab_offset(p, array, lo);
+		return p;
+	}
+
+	if (!device && gpu_array_is_scalar(array))
+		p = isl_printer_print_str(p, "&");
+	p = isl_printer_print_str(p, prefix);
+	p = isl_printer_print_str(p, array->name);
+
+	return p;
+}
+
+/* Print a hint to "p" that the elements of the device copy of "array"
+ * with outermost index between "lo" and "hi" (or all elements
+ * if "lo" and "hi" are NULL) should be migrated to device "dst".
+ */
+static __isl_give isl_printer *print_prefetch(__isl_take isl_printer *p,
+	struct gpu_array_info *array, __isl_keep isl_ast_expr *lo,
+	__isl_keep isl_ast_expr *hi, const char *dst)
+{
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "cudaCheckReturn(cudaMemPrefetchAsync(");
+	p = print_copy_pointer(p, array, 1, lo);
+	p = isl_printer_print_str(p, ", ");
+	p = gpu_array_info_print_slab_size(p, array, lo, hi);
+	p = isl_printer_print_str(p, ", ");
+	p = isl_printer_print_str(p, dst);
+	p = isl_printer_print_str(p, "));");
+	p = isl_printer_end_line(p);
+
+	return p;
+}
+
+/* Print "str" on a line of its own.
+ */
+static __isl_give isl_printer *print_str_new_line(__isl_take isl_printer *p,
+	const char *str)
+{
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, str);
+	p = isl_printer_end_line(p);
+
+	return p;
+}
+
+/* Print the stream on which an operation is timed, i.e.,
+ * the default stream if "on_stream" is not set and
+ * the stream of "array" (or the kernel stream if "array" is NULL) otherwise.
+ */
+static __isl_give isl_printer *print_timing_stream(__isl_take isl_printer *p,
+	int on_stream, struct gpu_array_info *array)
+{
+	if (!on_stream)
+		return isl_printer_print_str(p, "0");
+	return print_stream(p, array);
+}
+
+/* Print code for starting to time an operation on the stream
+ * described by "on_stream" and "array" (see print_timing_stream),
+ * in case the --device-timing option is set.
+ * The code is placed in a separate block that is closed
+ * by print_timing_end.
+ */
+static __isl_give isl_printer *print_timing_start(__isl_take isl_printer *p,
+	struct ppcg_options *options, int on_stream,
 	struct gpu_array_info *array)
 {
-	int i;
+	if (!options->device_timing)
+		return p;
 
+	p = ppcg_start_block(p);
+	p = print_str_new_line(p,
+		"cudaEvent_t ppcg_timing_start, ppcg_timing_stop;");
+	p = print_str_new_line(p,
+		"cudaCheckReturn(cudaEventCreate(&ppcg_timing_start));");
+	p = print_str_new_line(p,
+		"cudaCheckReturn(cudaEventCreate(&ppcg_timing_stop));");
 	p = isl_printer_start_line(p);
-	p = isl_printer_print_str(p, array->type);
-	p = isl_printer_print_str(p, " ");
-	if (!array->linearize && array->n_index > 1)
-		p = isl_printer_print_str(p, "(");
-	p = isl_printer_print_str(p, "*dev_");
+	p = isl_printer_print_str(p,
+		"cudaCheckReturn(cudaEventRecord(ppcg_timing_start, ");
+	p = print_timing_stream(p, on_stream, array);
+	p = isl_printer_print_str(p, "));");
+	p = isl_printer_end_line(p);
+
+	return p;
+}
+
+/* Print code for finishing the timing started by print_timing_start
+ * and for recording the elapsed time as an operation of kind "kind"
+ * (see gpu_print_timing_add), in case the --device-timing option is set.
+ * The host waits for the operation to complete, meaning
+ * that timed operations are no longer overlapped with each other.
+ */
+static __isl_give isl_printer *print_timing_end(__isl_take isl_printer *p,
+	struct ppcg_options *options, int on_stream,
+	struct gpu_array_info *array, const char *kind,
+	struct ppcg_kernel *kernel, __isl_keep isl_ast_expr *lo,
+	__isl_keep isl_ast_expr *hi)
+{
+	if (!options->device_timing)
+		return p;
+
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p,
+		"cudaCheckReturn(cudaEventRecord(ppcg_timing_stop, ");
+	p = print_timing_stream(p, on_stream, array);
+	p = isl_printer_print_str(p, "));");
+	p = isl_printer_end_line(p);
+	p = print_str_new_line(p,
+		"cudaCheckReturn(cudaEventSynchronize(ppcg_timing_stop));");
+	p = print_str_new_line(p, "float ppcg_timing_ms;");
+	p = print_str_new_line(p,
+		"cudaCheckReturn(cudaEventElapsedTime(&ppcg_timing_ms, "
+		"ppcg_timing_start, ppcg_timing_stop));");
+	p = gpu_print_timing_add(p, kind, kernel, array, lo, hi,
+				"ppcg_timing_ms");
+	p = print_str_new_line(p,
+		"cudaCheckReturn(cudaEventDestroy(ppcg_timing_start));");
+	p = print_str_new_line(p,
+		"cudaCheckReturn(cudaEventDestroy(ppcg_timing_stop));");
+	p = ppcg_end_block(p);
+
+	return p;
+}
+
+/* Print "ppcg_<field>_<array name> = " followed by "value".
+ */
+static __isl_give isl_printer *print_residency_assignment(
+	__isl_take isl_printer *p, const char *field,
+	struct gpu_array_info *array, const char *value)
+{
+	p = isl_printer_print_str(p, "ppcg_");
+	p = isl_printer_print_str(p, field);
+	p = isl_printer_print_str(p, "_");
 	p = isl_printer_print_str(p, array->name);
-	if (!array->linearize && array->n_index > 1) {
-		p = isl_printer_print_str(p, ")");
-		for (i = 1; i < array->n_index; i++) {
-			isl_ast_expr *bound;
-			bound = isl_ast_expr_get_op_arg(array->bound_expr,
-							1 + i);
-			p = isl_printer_print_str(p, "[");
-			p = isl_printer_print_ast_expr(p, bound);
-			p = isl_printer_print_str(p, "]");
-			isl_ast_expr_free(bound);
-		}
-	}
-	p = isl_printer_print_str(p, ";");
+	p = isl_printer_print_str(p, " = ");
+	p = isl_printer_print_str(p, value);
+
+	return p;
+}
+
+/* Print a statement marking the contents of the persistent device copy
+ * of "array" as unknown.
+ */
+static __isl_give isl_printer *print_invalidate_residency(
+	__isl_take isl_printer *p, struct gpu_array_info *array)
+{
+	p = isl_printer_start_line(p);
+	p = print_residency_assignment(p, "resident", array, "0;");
 	p = isl_printer_end_line(p);
 
 	return p;
 }
 
-static __isl_give isl_printer *declare_device_arrays(__isl_take isl_printer *p,
-	struct gpu_prog *prog)
+/* Print a call to ppcg_hash computing the hash of the first "size"
+ * bytes of the host copy of "array" or the entire host copy
+ * if "size" is NULL.
+ */
+static __isl_give isl_printer *print_hash(__isl_take isl_printer *p,
+	struct gpu_array_info *array, const char *size)
 {
-	int i;
+	p = isl_printer_print_str(p, "ppcg_hash(");
+	p = print_copy_pointer(p, array, 0, NULL);
+	p = isl_printer_print_str(p, ", ");
+	if (size)
+		p = isl_printer_print_str(p, size);
+	else
+		p = gpu_array_info_print_size(p, array);
+	p = isl_printer_print_str(p, ")");
 
-	for (i = 0; i < prog->n_array; ++i) {
-		if (!gpu_array_requires_device_allocation(&prog->array[i]))
-			continue;
+	return p;
+}
+
+/* Print the start of code that only copies the entire "array"
+ * to its persistent device copy if it is not already known to hold
+ * the current contents of the host array, i.e.,
+ * if it holds a different number of bytes or
+ * a different hash of the contents.
+ * Only copies of entire arrays (with "lo" NULL) are checked.
+ */
+static __isl_give isl_printer *print_residency_check_start(
+	__isl_take isl_printer *p, struct gpu_array_info *array,
+	__isl_keep isl_ast_expr *lo, struct ppcg_options *options)
+{
+	if (!use_persistent_device_data(options) || lo)
+		return p;
+
+	p = ppcg_start_block(p);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "unsigned long long ppcg_hash_value = ");
+	p = print_hash(p, array, NULL);
+	p = isl_printer_print_str(p, ";");
+	p = isl_printer_end_line(p);
 
-		p = declare_device_array(p, &prog->array[i]);
-	}
 	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "if (ppcg_resident_");
+	p = isl_printer_print_str(p, array->name);
+	p = isl_printer_print_str(p, " != ");
+	p = gpu_array_info_print_size(p, array);
+	p = isl_printer_print_str(p, " || ppcg_hash_");
+	p = isl_printer_print_str(p, array->name);
+	p = isl_printer_print_str(p, " != ppcg_hash_value) {");
 	p = isl_printer_end_line(p);
+	p = isl_printer_indent(p, 2);
+
 	return p;
 }
 
-static __isl_give isl_printer *allocate_device_arrays(
-	__isl_take isl_printer *p, struct gpu_prog *prog)
+/* Print the end of the code started by print_residency_check_start,
+ * recording that the persistent device copy of "array" now holds
+ * the host contents.
+ * If only a slab of "array" was copied (with "lo" not NULL), then
+ * the contents of the device copy are no longer known instead.
+ */
+static __isl_give isl_printer *print_residency_check_end(
+	__isl_take isl_printer *p, struct gpu_array_info *array,
+	__isl_keep isl_ast_expr *lo, struct ppcg_options *options)
 {
-	int i;
+	if (!use_persistent_device_data(options))
+		return p;
+	if (lo)
+		return print_invalidate_residency(p, array);
 
-	for (i = 0; i < prog->n_array; ++i) {
-		struct gpu_array_info *array = &prog->array[i];
+	p = isl_printer_start_line(p);
+	p = print_residency_assignment(p, "resident", array, "");
+	p = gpu_array_info_print_size(p, array);
+	p = isl_printer_print_str(p, ";");
+	p = isl_printer_end_line(p);
+	p = isl_printer_start_line(p);
+	p = print_residency_assignment(p, "hash", array, "ppcg_hash_value;");
+	p = isl_printer_end_line(p);
 
-		if (!gpu_array_requires_device_allocation(&prog->array[i]))
-			continue;
-		p = ppcg_ast_expr_print_macros(array->bound_expr, p);
-		p = isl_printer_start_line(p);
-		p = isl_printer_print_str(p,
-			"cudaCheckReturn(cudaMalloc((void **) &dev_");
-		p = isl_printer_print_str(p, prog->array[i].name);
-		p = isl_printer_print_str(p, ", ");
-		p = gpu_array_info_print_size(p, &prog->array[i]);
-		p = isl_printer_print_str(p, "));");
-		p = isl_printer_end_line(p);
-	}
+	p = isl_printer_indent(p, -2);
 	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "}");
 	p = isl_printer_end_line(p);
+	p = ppcg_end_block(p);
+
 	return p;
 }
 
-static __isl_give isl_printer *free_device_arrays(__isl_take isl_printer *p,
-	struct gpu_prog *prog)
+/* Print code recording that "array" has been copied back to the host
+ * in its entirety (if "lo" is NULL) or only partially (if "lo" is not NULL),
+ * in case the device array persists across executions of the scop.
+ * After an entire copy, the device copy holds the host contents,
+ * which are hashed in clear_device once the copy is known to have completed.
+ * After a partial copy, the relation between the two is unknown.
+ */
+static __isl_give isl_printer *print_residency_copy_out(
+	__isl_take isl_printer *p, struct gpu_array_info *array,
+	__isl_keep isl_ast_expr *lo, struct ppcg_options *options)
 {
-	int i;
+	if (!use_persistent_device_data(options))
+		return p;
+	if (lo)
+		return print_invalidate_residency(p, array);
 
-	for (i = 0; i < prog->n_array; ++i) {
-		if (!gpu_array_requires_device_allocation(&prog->array[i]))
-			continue;
-		p = isl_printer_start_line(p);
-		p = isl_printer_print_str(p, "cudaCheckReturn(cudaFree(dev_");
-		p = isl_printer_print_str(p, prog->array[i].name);
-		p = isl_printer_print_str(p, "));");
-		p = isl_printer_end_line(p);
-	}
+	p = isl_printer_start_line(p);
+	p = print_residency_assignment(p, "resident", array, "");
+	p = gpu_array_info_print_size(p, array);
+	p = isl_printer_print_str(p, ";");
+	p = isl_printer_end_line(p);
+	p = isl_printer_start_line(p);
+	p = print_residency_assignment(p, "pending", array, "1;");
+	p = isl_printer_end_line(p);
+
+	return p;
+}
+
+/* Print a host side copy of the elements of "array"
+ * with outermost index between "lo" and "hi" (or all elements
+ * if "lo" and "hi" are NULL) to its device copy in managed memory
+ * (if "to_device" is set) or back from this device copy.
+ * Since managed memory is accessible from the host, this does not
+ * involve a cudaMemcpy.  The pages are migrated by the CUDA runtime,
+ * guided by the prefetch hints.
+ */
+static __isl_give isl_printer *print_managed_memcpy(__isl_take isl_printer *p,
+	struct gpu_array_info *array, __isl_keep isl_ast_expr *lo,
+	__isl_keep isl_ast_expr *hi, int to_device)
+{
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "memcpy(");
+	p = print_copy_pointer(p, array, to_device, lo);
+	p = isl_printer_print_str(p, ", ");
+	p = print_copy_pointer(p, array, !to_device, lo);
+	p = isl_printer_print_str(p, ", ");
+	p = gpu_array_info_print_slab_size(p, array, lo, hi);
+	p = isl_printer_print_str(p, ");");
+	p = isl_printer_end_line(p);
 
 	return p;
 }
 
+/* Is the device copy of "array" allocated in managed memory?
+ * Arrays that are only held in window buffers are allocated
+ * in set_up_window instead, in regular device memory.
+ */
+static int is_managed(struct gpu_array_info *array,
+	struct ppcg_options *options)
+{
+	return options->managed_memory && !array->windowed;
+}
+
 /* Print code to "p" for copying "array" from the host to the device
- * in its entirety.  The bounds on the extent of "array" have
+ * in its entirety or, if "lo" and "hi" are not NULL, only the elements
+ * with outermost index between "lo" and "hi".
+ * The bounds on the extent of "array" have
  * been precomputed in extract_array_info and are used in
  * gpu_array_info_print_size.
+ *
+ * If asynchronous transfers are used, then the copy is performed
+ * asynchronously on the stream of the array and the completion of the copy
+ * is recorded in the ppcg_copied event of the array.
+ * If the host code is being captured in a CUDA graph ("capture" is set),
+ * then the copy is performed asynchronously on the kernel stream.
+ * If the device copy is allocated in managed memory, then the elements
+ * are copied on the host and only migrated to the device through
+ * a prefetch hint ahead of the kernel launches.
+ * If the --device-timing option is set, then the copy is timed.
+ * If the device array persists across executions of the scop,
+ * then an entire array is only copied if the device does not
+ * already hold the current contents.
  */
 static __isl_give isl_printer *copy_array_to_device(__isl_take isl_printer *p,
-	struct gpu_array_info *array)
+	struct gpu_array_info *array, __isl_keep isl_ast_expr *lo,
+	__isl_keep isl_ast_expr *hi, struct ppcg_options *options, int capture)
 {
+	int async = use_async_transfers(options);
+
+	if (is_managed(array, options)) {
+		p = print_managed_memcpy(p, array, lo, hi, 1);
+		return print_prefetch(p, array, lo, hi, "ppcg_device");
+	}
+
+	p = print_residency_check_start(p, array, lo, options);
+	p = print_timing_start(p, options, async, array);
 	p = isl_printer_start_line(p);
-	p = isl_printer_print_str(p, "cudaCheckReturn(cudaMemcpy(dev_");
-	p = isl_printer_print_str(p, array->name);
+	if (async || capture)
+		p = isl_printer_print_str(p, "cudaCheckReturn(cudaMemcpyAsync(");
+	else
+		p = isl_printer_print_str(p, "cudaCheckReturn(cudaMemcpy(");
+	p = print_copy_pointer(p, array, 1, lo);
 	p = isl_printer_print_str(p, ", ");
-
-	if (gpu_array_is_scalar(array))
-		p = isl_printer_print_str(p, "&");
-	p = isl_printer_print_str(p, array->name);
+	p = print_copy_pointer(p, array, 0, lo);
 	p = isl_printer_print_str(p, ", ");
 
-	p = gpu_array_info_print_size(p, array);
-	p = isl_printer_print_str(p, ", cudaMemcpyHostToDevice));");
-	p = isl_printer_end_line(p);
+	p = gpu_array_info_print_slab_size(p, array, lo, hi);
+	if (async || capture) {
+		p = isl_printer_print_str(p, ", cudaMemcpyHostToDevice, ");
+		p = print_stream(p, async ? array : NULL);
+		p = isl_printer_print_str(p, "));");
+		p = isl_printer_end_line(p);
+	} else {
+		p = isl_printer_print_str(p, ", cudaMemcpyHostToDevice));");
+		p = isl_printer_end_line(p);
+	}
+	p = print_timing_end(p, options, async, array, "to_device",
+				NULL, lo, hi);
+	p = print_residency_check_end(p, array, lo, options);
+	if (async)
+		p = print_record_event(p, "ppcg_copied", array, array);
 
 	return p;
 }
 
 /* Print code to "p" for copying "array" back from the device to the host
- * in its entirety.  The bounds on the extent of "array" have
+ * in its entirety or, if "lo" and "hi" are not NULL, only the elements
+ * with outermost index between "lo" and "hi".
+ * The bounds on the extent of "array" have
  * been precomputed in extract_array_info and are used in
  * gpu_array_info_print_size.
+ *
+ * If asynchronous transfers are used, then the copy is performed
+ * asynchronously on the stream of the array, after the completion
+ * of the last kernel that accesses the array.
+ * The host waits for the completion of the copy in clear_device.
+ * If the host code is being captured in a CUDA graph ("capture" is set),
+ * then the copy is performed asynchronously on the kernel stream.
+ * If the device copy is allocated in managed memory, then the elements
+ * are migrated back to the host through a prefetch hint and,
+ * after waiting for the migration (and the kernels) to complete,
+ * copied on the host.
+ * If the --device-timing option is set, then the copy is timed.
+ * If the device array persists across executions of the scop,
+ * then the copy is recorded in print_residency_copy_out.
  */
 static __isl_give isl_printer *copy_array_from_device(
-	__isl_take isl_printer *p, struct gpu_array_info *array)
+	__isl_take isl_printer *p, struct gpu_array_info *array,
+	__isl_keep isl_ast_expr *lo, __isl_keep isl_ast_expr *hi,
+	struct ppcg_options *options, int capture)
 {
+	int async = use_async_transfers(options);
+
+	if (is_managed(array, options)) {
+		p = print_prefetch(p, array, lo, hi, "cudaCpuDeviceId");
+		p = print_str_new_line(p,
+				"cudaCheckReturn(cudaDeviceSynchronize());");
+		return print_managed_memcpy(p, array, lo, hi, 0);
+	}
+	if (async)
+		p = print_wait_event(p, "ppcg_used", array, array);
+	p = print_timing_start(p, options, async, array);
 	p = isl_printer_start_line(p);
-	p = isl_printer_print_str(p, "cudaCheckReturn(cudaMemcpy(");
-	if (gpu_array_is_scalar(array))
-		p = isl_printer_print_str(p, "&");
+	if (async || capture)
+		p = isl_printer_print_str(p, "cudaCheckReturn(cudaMemcpyAsync(");
+	else
+		p = isl_printer_print_str(p, "cudaCheckReturn(cudaMemcpy(");
+	p = print_copy_pointer(p, array, 0, lo);
+	p = isl_printer_print_str(p, ", ");
+	p = print_copy_pointer(p, array, 1, lo);
+	p = isl_printer_print_str(p, ", ");
+	p = gpu_array_info_print_slab_size(p, array, lo, hi);
+	if (async || capture) {
+		p = isl_printer_print_str(p, ", cudaMemcpyDeviceToHost, ");
+		p = print_stream(p, async ? array : NULL);
+		p = isl_printer_print_str(p, "));");
+	} else {
+		p = isl_printer_print_str(p, ", cudaMemcpyDeviceToHost));");
+	}
+	p = isl_printer_end_line(p);
+	p = print_timing_end(p, options, async, array, "from_device",
+				NULL, lo, hi);
+	p = print_residency_copy_out(p, array, lo, options);
+
+	return p;
+}
+
+/* Print the element of the window variable "ppcg_window_<kind>_<array>"
+ * corresponding to the window buffer used by the current chunk.
+ */
+static __isl_give isl_printer *print_window_var(__isl_take isl_printer *p,
+	const char *kind, struct gpu_array_info *array)
+{
+	p = isl_printer_print_str(p, "ppcg_window_");
+	p = isl_printer_print_str(p, kind);
+	p = isl_printer_print_str(p, "_");
 	p = isl_printer_print_str(p, array->name);
-	p = isl_printer_print_str(p, ", dev_");
+	p = isl_printer_print_str(p, "[ppcg_window_");
 	p = isl_printer_print_str(p, array->name);
+	p = isl_printer_print_str(p, "]");
+
+	return p;
+}
+
+/* Print code to "p" for setting up the window buffer of "array"
+ * that holds the elements with outermost index between "lo" and "hi"
+ * during the execution of the next chunk of an out-of-core execution.
+ *
+ * If there are two window buffers, then the chunks alternate
+ * between them.  In this case, asynchronous transfers are used and
+ * the transfers of the array on its stream first wait for
+ * the completion of the last kernel that accessed the buffer.
+ * Recording ppcg_copied_<array> makes the next kernel wait as well,
+ * in particular for any pending copy out of the buffer.
+ * The buffer is (re)allocated if it is too small to hold the slab.
+ * Finally, dev_<array> is set such that the elements of the slab
+ * are found at their original positions with respect to dev_<array>,
+ * i.e., the kernels and transfers access the window buffer
+ * without any change to their index expressions.
+ */
+static __isl_give isl_printer *set_up_window(__isl_take isl_printer *p,
+	struct gpu_array_info *array, __isl_keep isl_ast_expr *lo,
+	__isl_keep isl_ast_expr *hi, struct ppcg_options *options)
+{
+	if (array->windowed == 2) {
+		p = isl_printer_start_line(p);
+		p = isl_printer_print_str(p, "ppcg_window_");
+		p = isl_printer_print_str(p, array->name);
+		p = isl_printer_print_str(p, " = 1 - ppcg_window_");
+		p = isl_printer_print_str(p, array->name);
+		p = isl_printer_print_str(p, ";");
+		p = isl_printer_end_line(p);
+	}
+	if (use_async_transfers(options)) {
+		p = isl_printer_start_line(p);
+		p = isl_printer_print_str(p,
+					"cudaCheckReturn(cudaStreamWaitEvent(");
+		p = print_stream(p, array);
+		p = isl_printer_print_str(p, ", ");
+		p = print_window_var(p, "used", array);
+		p = isl_printer_print_str(p, ", 0));");
+		p = isl_printer_end_line(p);
+		p = print_record_event(p, "ppcg_copied", array, array);
+	}
+
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "if (");
+	p = print_window_var(p, "size", array);
+	p = isl_printer_print_str(p, " < ");
+	p = gpu_array_info_print_slab_size(p, array, lo, hi);
+	p = isl_printer_print_str(p, ") {");
+	p = isl_printer_end_line(p);
+	p = isl_printer_indent(p, 2);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "if (");
+	p = print_window_var(p, "size", array);
+	p = isl_printer_print_str(p, " > 0)");
+	p = isl_printer_end_line(p);
+	p = isl_printer_indent(p, 2);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "cudaCheckReturn(cudaFree(");
+	p = print_window_var(p, "buffer", array);
+	p = isl_printer_print_str(p, "));");
+	p = isl_printer_end_line(p);
+	p = isl_printer_indent(p, -2);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "cudaCheckReturn(cudaMalloc(&");
+	p = print_window_var(p, "buffer", array);
 	p = isl_printer_print_str(p, ", ");
-	p = gpu_array_info_print_size(p, array);
-	p = isl_printer_print_str(p, ", cudaMemcpyDeviceToHost));");
+	p = gpu_array_info_print_slab_size(p, array, lo, hi);
+	p = isl_printer_print_str(p, "));");
+	p = isl_printer_end_line(p);
+	p = isl_printer_start_line(p);
+	p = print_window_var(p, "size", array);
+	p = isl_printer_print_str(p, " = ");
+	p = gpu_array_info_print_slab_size(p, array, lo, hi);
+	p = isl_printer_print_str(p, ";");
+	p = isl_printer_end_line(p);
+	p = isl_printer_indent(p, -2);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "}");
+	p = isl_printer_end_line(p);
+
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "dev_");
+	p = isl_printer_print_str(p, array->name);
+	p = isl_printer_print_str(p, " = (");
+	p = isl_printer_print_str(p, array->type);
+	p = isl_printer_print_str(p, " ");
+	p = print_device_array_declarator(p, array, "");
+	p = isl_printer_print_str(p, ") ((char *) ");
+	p = print_window_var(p, "buffer", array);
+	p = isl_printer_print_str(p, " - ");
+	p = gpu_array_info_print_slab_offset(p, array, lo);
+	p = isl_printer_print_str(p, ");");
 	p = isl_printer_end_line(p);
 
 	return p;
@@ -240,6 +1427,42 @@ static __isl_give isl_printer *print_grid(__isl_take isl_printer *p,
 	return p;
 }
 
+/* Should array "i" be declared as a read-only argument of "kernel"?
+ * That is, is it an array that is only read by the kernel
+ * (other than a read-only scalar, which is passed by value) and
+ * has the use of read-only memory been requested?
+ */
+static int is_read_only_argument(struct ppcg_kernel *kernel, int i)
+{
+	struct gpu_local_array_info *local = &kernel->array[i];
+
+	if (!kernel->options->read_only_memory)
+		return 0;
+	if (gpu_array_is_read_only_scalar(local->array))
+		return 0;
+	return local->read_only;
+}
+
+/* Print the declaration of the read-only array argument "array".
+ * A pointer argument is declared "const" and "__restrict__" such that
+ * the compiler may load its elements through the read-only data cache.
+ * Non-linearized arrays are declared as arrays with "const" elements.
+ */
+static __isl_give isl_printer *print_read_only_declaration_argument(
+	__isl_take isl_printer *p, struct gpu_array_info *array)
+{
+	if (array->n_index != 0 && !array->linearize)
+		return gpu_array_info_print_declaration_argument(p, array,
+								"const");
+
+	p = isl_printer_print_str(p, "const ");
+	p = isl_printer_print_str(p, array->type);
+	p = isl_printer_print_str(p, " *__restrict__ ");
+	p = isl_printer_print_str(p, array->name);
+
+	return p;
+}
+
 /* Print the arguments to a kernel declaration or call.  If "types" is set,
  * then print a declaration (including the types of the arguments).
  *
@@ -269,7 +1492,10 @@ static __isl_give isl_printer *print_kernel_arguments(__isl_take isl_printer *p,
 		if (!first)
 			p = isl_printer_print_str(p, ", ");
 
-		if (types)
+		if (types && is_read_only_argument(kernel, i))
+			p = print_read_only_declaration_argument(p,
+				&prog->array[i]);
+		else if (types)
 			p = gpu_array_info_print_declaration_argument(p,
 				&prog->array[i], NULL);
 		else
@@ -297,6 +1523,8 @@ static __isl_give isl_printer *print_kernel_arguments(__isl_take isl_printer *p,
 	isl_space_free(space);
 
 	n = isl_space_dim(kernel->space, isl_dim_set);
+	if (kernel->persistent_iterator)
+		n--;
 	type = isl_options_get_ast_iterator_type(prog->ctx);
 	for (i = 0; i < n; ++i) {
 		const char *name;
@@ -313,16 +1541,57 @@ static __isl_give isl_printer *print_kernel_arguments(__isl_take isl_printer *p,
 		first = 0;
 	}
 
+	if (kernel_uses_multi_device(kernel)) {
+		if (!first)
+			p = isl_printer_print_str(p, ", ");
+		if (types)
+			p = isl_printer_print_str(p, "int ");
+		p = isl_printer_print_str(p, "ppcg_block_offset");
+	}
+
+	return p;
+}
+
+/* Print a __launch_bounds__ annotation for "kernel" specifying
+ * the total number of threads in a block, such that the compiler
+ * can allocate registers for the actual block size.
+ * If the min_blocks_per_multiprocessor option is set, then
+ * it is passed along as the minimal number of blocks
+ * that should be resident on a multiprocessor.
+ */
+static __isl_give isl_printer *print_launch_bounds(__isl_take isl_printer *p,
+	struct gpu_prog *prog, struct ppcg_kernel *kernel)
+{
+	int i;
+	int n_thread = 1;
+	int min_blocks = prog->scop->options->min_blocks_per_multiprocessor;
+
+	for (i = 0; i < kernel->n_block; ++i)
+		n_thread *= kernel->block_dim[i];
+
+	p = isl_printer_print_str(p, "__launch_bounds__(");
+	p = isl_printer_print_int(p, n_thread);
+	if (min_blocks > 0) {
+		p = isl_printer_print_str(p, ", ");
+		p = isl_printer_print_int(p, min_blocks);
+	}
+	p = isl_printer_print_str(p, ") ");
+
 	return p;
 }
 
 /* Print the header of the given kernel.
+ * If the launch_bounds option is set, then the kernel is annotated
+ * with its block size.
  */
 static __isl_give isl_printer *print_kernel_header(__isl_take isl_printer *p,
 	struct gpu_prog *prog, struct ppcg_kernel *kernel)
 {
 	p = isl_printer_start_line(p);
-	p = isl_printer_print_str(p, "__global__ void kernel");
+	p = isl_printer_print_str(p, "__global__ ");
+	if (prog->scop->options->launch_bounds)
+		p = print_launch_bounds(p, prog, kernel);
+	p = isl_printer_print_str(p, "void kernel");
 	p = isl_printer_print_int(p, kernel->id);
 	p = isl_printer_print_str(p, "(");
 	p = print_kernel_arguments(p, prog, kernel, 1);
@@ -386,6 +1655,11 @@ static void print_iterators(FILE *out, const char *type,
 	fprintf(out, ";\n");
 }
 
+/* Print the block and thread iterators of "kernel" to "out".
+ * If the kernel is split across multiple devices, then the blocks
+ * executed on a device start at ppcg_block_offset in the outermost
+ * block dimension.
+ */
 static void print_kernel_iterators(FILE *out, struct ppcg_kernel *kernel)
 {
 	isl_ctx *ctx = isl_ast_node_get_ctx(kernel->tree);
@@ -396,6 +1670,10 @@ static void print_kernel_iterators(FILE *out, struct ppcg_kernel *kernel)
 
 	type = isl_options_get_ast_iterator_type(ctx);
 
+	if (kernel_uses_multi_device(kernel))
+		block_dims[kernel->n_grid - 1] = kernel->n_grid == 1 ?
+			"blockIdx.x + ppcg_block_offset" :
+			"blockIdx.y + ppcg_block_offset";
 	print_iterators(out, type, kernel->block_ids, block_dims);
 	print_iterators(out, type, kernel->thread_ids, thread_dims);
 }
@@ -408,10 +1686,15 @@ static __isl_give isl_printer *print_kernel_var(__isl_take isl_printer *p,
 	p = isl_printer_start_line(p);
 	if (var->type == ppcg_access_shared)
 		p = isl_printer_print_str(p, "__shared__ ");
+	if (var->align) {
+		p = isl_printer_print_str(p, "__align__(");
+		p = isl_printer_print_int(p, var->align);
+		p = isl_printer_print_str(p, ") ");
+	}
 	p = isl_printer_print_str(p, var->array->type);
 	p = isl_printer_print_str(p, " ");
 	p = isl_printer_print_str(p,  var->name);
-	for (j = 0; j < var->array->n_index; ++j) {
+	for (j = 0; j < isl_vec_size(var->size); ++j) {
 		isl_val *v;
 
 		p = isl_printer_print_str(p, "[");
@@ -467,23 +1750,87 @@ static __isl_give isl_printer *print_kernel_stmt(__isl_take isl_printer *p,
 
 	switch (stmt->type) {
 	case ppcg_kernel_copy:
+		if (stmt->u.c.vector_width > 1)
+			return ppcg_kernel_print_vector_copy(p, stmt,
+								NULL, NULL);
 		return ppcg_kernel_print_copy(p, stmt);
 	case ppcg_kernel_sync:
 		return print_sync(p, stmt);
 	case ppcg_kernel_domain:
+		if (stmt->u.d.stmt->reduction)
+			return ppcg_kernel_print_atomic_domain(p, stmt);
 		return ppcg_kernel_print_domain(p, stmt);
 	}
 
 	return p;
 }
 
+/* Print the start of the loop that has been moved inside "kernel",
+ * preceded by definitions of the macros that may appear
+ * in its bounds and increment.
+ */
+static __isl_give isl_printer *print_persistent_loop_start(
+	__isl_take isl_printer *p, struct gpu_prog *prog,
+	struct ppcg_kernel *kernel)
+{
+	const char *type = isl_options_get_ast_iterator_type(prog->ctx);
+
+	p = ppcg_ast_expr_print_macros(kernel->persistent_init, p);
+	p = ppcg_ast_expr_print_macros(kernel->persistent_cond, p);
+	p = ppcg_ast_expr_print_macros(kernel->persistent_inc, p);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "for (");
+	p = isl_printer_print_str(p, type);
+	p = isl_printer_print_str(p, " ");
+	p = isl_printer_print_ast_expr(p, kernel->persistent_iterator);
+	p = isl_printer_print_str(p, " = ");
+	p = isl_printer_print_ast_expr(p, kernel->persistent_init);
+	p = isl_printer_print_str(p, "; ");
+	p = isl_printer_print_ast_expr(p, kernel->persistent_cond);
+	p = isl_printer_print_str(p, "; ");
+	p = isl_printer_print_ast_expr(p, kernel->persistent_iterator);
+	p = isl_printer_print_str(p, " += ");
+	p = isl_printer_print_ast_expr(p, kernel->persistent_inc);
+	p = isl_printer_print_str(p, ") {");
+	p = isl_printer_end_line(p);
+	p = isl_printer_indent(p, 2);
+
+	return p;
+}
+
+/* Print the end of the loop that has been moved inside "kernel".
+ * Each iteration ends with a grid-wide synchronization such that
+ * all writes of the current iteration are visible to all blocks
+ * in the next iteration.
+ */
+static __isl_give isl_printer *print_persistent_loop_end(
+	__isl_take isl_printer *p)
+{
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "cooperative_groups::this_grid().sync();");
+	p = isl_printer_end_line(p);
+	p = isl_printer_indent(p, -2);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "}");
+	p = isl_printer_end_line(p);
+
+	return p;
+}
+
+/* Print the device code of "kernel" to cuda->kernel_c.
+ * If the innermost host loop around the kernel launch
+ * has been moved inside the kernel, then the kernel body
+ * is wrapped in this loop.
+ */
 static void print_kernel(struct gpu_prog *prog, struct ppcg_kernel *kernel,
 	struct cuda_info *cuda)
 {
 	isl_ctx *ctx = isl_ast_node_get_ctx(kernel->tree);
 	isl_ast_print_options *print_options;
 	isl_printer *p;
+	struct ppcg_timer timer;
 
+	ppcg_timer_start(&timer);
 	print_kernel_headers(prog, kernel, cuda);
 	fprintf(cuda->kernel_c, "{\n");
 	print_kernel_iterators(cuda->kernel_c, kernel);
@@ -500,35 +1847,158 @@ static void print_kernel(struct gpu_prog *prog, struct ppcg_kernel *kernel,
 	print_options = isl_ast_print_options_alloc(ctx);
 	print_options = isl_ast_print_options_set_print_user(print_options,
 						    &print_kernel_stmt, NULL);
+	if (kernel->persistent_iterator)
+		p = print_persistent_loop_start(p, prog, kernel);
 	p = isl_ast_node_print(kernel->tree, p, print_options);
+	if (kernel->persistent_iterator)
+		p = print_persistent_loop_end(p);
 	isl_printer_free(p);
 
 	fprintf(cuda->kernel_c, "}\n");
+	ppcg_timer_report(&timer, kernel->options, "kernel printing",
+			"kernel", kernel->id);
+}
+
+/* Print code for obtaining the identifier of the current device
+ * in ppcg_device, for use in migrating managed memory.
+ */
+static __isl_give isl_printer *get_device(__isl_take isl_printer *p)
+{
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "int ppcg_device;");
+	p = isl_printer_end_line(p);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p,
+				"cudaCheckReturn(cudaGetDevice(&ppcg_device));");
+	p = isl_printer_end_line(p);
+
+	return p;
+}
+
+/* Print code storing the number of devices that kernels are split across
+ * in ppcg_num_devices, i.e., the number of available devices,
+ * up to the number specified by the --num-devices option.
+ */
+static __isl_give isl_printer *get_num_devices(__isl_take isl_printer *p,
+	struct ppcg_options *options)
+{
+	p = print_str_new_line(p, "int ppcg_num_devices;");
+	p = print_str_new_line(p,
+		"cudaCheckReturn(cudaGetDeviceCount(&ppcg_num_devices));");
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "if (ppcg_num_devices > ");
+	p = isl_printer_print_int(p, options->num_devices);
+	p = isl_printer_print_str(p, ")");
+	p = isl_printer_end_line(p);
+	p = isl_printer_indent(p, 2);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "ppcg_num_devices = ");
+	p = isl_printer_print_int(p, options->num_devices);
+	p = isl_printer_print_str(p, ";");
+	p = isl_printer_end_line(p);
+	p = isl_printer_indent(p, -2);
+
+	return p;
 }
 
 /* Print code for initializing the device for execution of the transformed
  * code.  This includes declaring locally defined variables as well as
- * declaring and allocating the required copies of arrays on the device.
+ * declaring and allocating the required copies of arrays on the device,
+ * if requested, page-locking the corresponding host arrays and,
+ * if asynchronous transfers are used, creating the streams and events.
+ * If managed memory is used, then also obtain the current device and,
+ * if kernels are split across multiple devices, the number of devices.
+ * If the host code is captured in a CUDA graph ("capture" is set),
+ * then start the capture.
  */
 static __isl_give isl_printer *init_device(__isl_take isl_printer *p,
-	struct gpu_prog *prog)
+	struct gpu_prog *prog, int capture)
 {
 	p = print_cuda_macros(p);
 
 	p = gpu_print_local_declarations(p, prog);
 	p = declare_device_arrays(p, prog);
+	if (prog->scop->options->managed_memory)
+		p = get_device(p);
+	if (use_multi_device(prog->scop->options))
+		p = get_num_devices(p, prog->scop->options);
 	p = allocate_device_arrays(p, prog);
+	if (prog->scop->options->pinned_host_memory)
+		p = register_host_arrays(p, prog, 1);
+	if (use_async_transfers(prog->scop->options))
+		p = create_streams(p, prog);
+	if (capture)
+		p = begin_capture(p);
+
+	return p;
+}
+
+/* Print code for hashing the host contents of the arrays that
+ * have been copied back from their persistent device copies.
+ */
+static __isl_give isl_printer *hash_copied_out_arrays(
+	__isl_take isl_printer *p, struct gpu_prog *prog)
+{
+	int i;
+
+	for (i = 0; i < prog->n_array; ++i) {
+		struct gpu_array_info *array = &prog->array[i];
+		char size[100];
+
+		if (!gpu_array_requires_device_allocation(array))
+			continue;
+		snprintf(size, sizeof(size), "ppcg_resident_%s", array->name);
+
+		p = isl_printer_start_line(p);
+		p = isl_printer_print_str(p, "if (ppcg_pending_");
+		p = isl_printer_print_str(p, array->name);
+		p = isl_printer_print_str(p, ") {");
+		p = isl_printer_end_line(p);
+		p = isl_printer_indent(p, 2);
+		p = isl_printer_start_line(p);
+		p = print_residency_assignment(p, "hash", array, "");
+		p = print_hash(p, array, size);
+		p = isl_printer_print_str(p, ";");
+		p = isl_printer_end_line(p);
+		p = isl_printer_start_line(p);
+		p = print_residency_assignment(p, "pending", array, "0;");
+		p = isl_printer_end_line(p);
+		p = isl_printer_indent(p, -2);
+		p = isl_printer_start_line(p);
+		p = isl_printer_print_str(p, "}");
+		p = isl_printer_end_line(p);
+	}
 
 	return p;
 }
 
 /* Print code for clearing the device after execution of the transformed code.
- * In particular, free the memory that was allocated on the device.
+ * In particular, free the memory that was allocated on the device
+ * and release any page-locked host arrays.
+ * If asynchronous transfers are used, then first wait for
+ * all transfers to complete.
+ * If the host code is captured in a CUDA graph ("capture" is set),
+ * then first end the capture and launch the graph.
+ * If the device arrays persist across executions of the scop,
+ * then they are not freed, but the contents of the arrays
+ * that have been copied back are hashed instead.
+ * If they are kept in managed memory, then only the window buffers
+ * are freed.
  */
 static __isl_give isl_printer *clear_device(__isl_take isl_printer *p,
-	struct gpu_prog *prog)
+	struct gpu_prog *prog, int capture)
 {
-	p = free_device_arrays(p, prog);
+	if (capture)
+		p = end_capture(p);
+	if (use_async_transfers(prog->scop->options))
+		p = destroy_streams(p, prog);
+	if (use_persistent_device_data(prog->scop->options))
+		p = hash_copied_out_arrays(p, prog);
+	else
+		p = free_device_arrays(p, prog,
+				use_static_device_arrays(prog->scop->options));
+	if (prog->scop->options->pinned_host_memory)
+		p = register_host_arrays(p, prog, 0);
 
 	return p;
 }
@@ -541,17 +2011,28 @@ static __isl_give isl_printer *clear_device(__isl_take isl_printer *p,
  * that needs to be copied.
  * The node for initializing the device is called "init_device".
  * The node for clearing the device is called "clear_device".
+ * A node setting up the window buffer of an array is called
+ * "window_device_<array name>".
+ *
+ * If only a slab of the array needs to be copied (see
+ * copy_statement_extension in gpu.c), then the statement has two arguments,
+ * the minimal and maximal outermost index of the elements
+ * that need to be copied.
  *
  * Extract the array (if any) from the identifier and call
- * init_device, clear_device, copy_array_to_device or copy_array_from_device.
+ * init_device, clear_device, copy_array_to_device, set_up_window or
+ * copy_array_from_device.
+ * "capture" is set if the host code is captured in a CUDA graph.
  */
 static __isl_give isl_printer *print_device_node(__isl_take isl_printer *p,
-	__isl_keep isl_ast_node *node, struct gpu_prog *prog)
+	__isl_keep isl_ast_node *node, struct gpu_prog *prog, int capture)
 {
 	isl_ast_expr *expr, *arg;
+	isl_ast_expr *lo = NULL, *hi = NULL;
 	isl_id *id;
 	const char *name;
 	struct gpu_array_info *array;
+	struct ppcg_options *options = prog->scop->options;
 
 	expr = isl_ast_node_user_get_expr(node);
 	arg = isl_ast_expr_get_op_arg(expr, 0);
@@ -560,28 +2041,303 @@ static __isl_give isl_printer *print_device_node(__isl_take isl_printer *p,
 	array = isl_id_get_user(id);
 	isl_id_free(id);
 	isl_ast_expr_free(arg);
+	if (isl_ast_expr_get_op_n_arg(expr) == 3) {
+		lo = isl_ast_expr_get_op_arg(expr, 1);
+		hi = isl_ast_expr_get_op_arg(expr, 2);
+	}
 	isl_ast_expr_free(expr);
 
 	if (!name)
-		return isl_printer_free(p);
-	if (!strcmp(name, "init_device"))
-		return init_device(p, prog);
-	if (!strcmp(name, "clear_device"))
-		return clear_device(p, prog);
-	if (!array)
-		return isl_printer_free(p);
-
-	if (!prefixcmp(name, "to_device"))
-		return copy_array_to_device(p, array);
+		p = isl_printer_free(p);
+	else if (!strcmp(name, "init_device"))
+		p = init_device(p, prog, capture);
+	else if (!strcmp(name, "clear_device"))
+		p = clear_device(p, prog, capture);
+	else if (!array)
+		p = isl_printer_free(p);
+	else if (!prefixcmp(name, "to_device"))
+		p = copy_array_to_device(p, array, lo, hi, options, capture);
+	else if (!prefixcmp(name, "window_device"))
+		p = set_up_window(p, array, lo, hi, options);
 	else
-		return copy_array_from_device(p, array);
+		p = copy_array_from_device(p, array, lo, hi, options, capture);
+
+	isl_ast_expr_free(lo);
+	isl_ast_expr_free(hi);
+	return p;
+}
+
+/* For each array accessed by "kernel" that has been allocated
+ * on the device, call "fn" on the event "<event>_<array name>"
+ * and the kernel stream.
+ */
+static __isl_give isl_printer *print_kernel_events(__isl_take isl_printer *p,
+	struct gpu_prog *prog, struct ppcg_kernel *kernel, const char *event,
+	__isl_give isl_printer *(*fn)(__isl_take isl_printer *p,
+		const char *event, struct gpu_array_info *array,
+		struct gpu_array_info *on))
+{
+	int i;
+
+	for (i = 0; i < prog->n_array; ++i) {
+		int required;
+
+		if (!gpu_array_requires_device_allocation(&prog->array[i]))
+			continue;
+		required = ppcg_kernel_requires_array_argument(kernel, i);
+		if (required < 0)
+			return isl_printer_free(p);
+		if (!required)
+			continue;
+		p = fn(p, event, &prog->array[i], NULL);
+	}
+
+	return p;
+}
+
+/* Print code recording the event of the current window buffer
+ * of each array accessed by "kernel" that is only held in window buffers
+ * on the kernel stream.
+ */
+static __isl_give isl_printer *record_window_events(
+	__isl_take isl_printer *p, struct gpu_prog *prog,
+	struct ppcg_kernel *kernel)
+{
+	int i;
+
+	for (i = 0; i < prog->n_array; ++i) {
+		int required;
+
+		if (!prog->array[i].windowed)
+			continue;
+		required = ppcg_kernel_requires_array_argument(kernel, i);
+		if (required < 0)
+			return isl_printer_free(p);
+		if (!required)
+			continue;
+		p = isl_printer_start_line(p);
+		p = isl_printer_print_str(p,
+					"cudaCheckReturn(cudaEventRecord(");
+		p = print_window_var(p, "used", &prog->array[i]);
+		p = isl_printer_print_str(p, ", ");
+		p = print_stream(p, NULL);
+		p = isl_printer_print_str(p, "));");
+		p = isl_printer_end_line(p);
+	}
+
+	return p;
+}
+
+/* Print code marking the contents of the persistent device copies
+ * of the arrays that may be written by "kernel" as unknown.
+ * Copying the arrays back to the host makes them known again.
+ */
+static __isl_give isl_printer *invalidate_written_arrays(
+	__isl_take isl_printer *p, struct gpu_prog *prog,
+	struct ppcg_kernel *kernel)
+{
+	int i;
+
+	for (i = 0; i < prog->n_array; ++i) {
+		int required;
+
+		if (!gpu_array_requires_device_allocation(&prog->array[i]))
+			continue;
+		required = ppcg_kernel_requires_array_argument(kernel, i);
+		if (required < 0)
+			return isl_printer_free(p);
+		if (!required || kernel->array[i].read_only)
+			continue;
+		p = print_invalidate_residency(p, &prog->array[i]);
+	}
+
+	return p;
 }
 
+/* Data used while printing the host code.
+ *
+ * "capture" is set if the host code is captured in a CUDA graph.
+ */
 struct print_host_user_data {
 	struct cuda_info *cuda;
 	struct gpu_prog *prog;
+	int capture;
 };
 
+/* Print the name "k<id><suffix>" of a host variable
+ * associated to "kernel".
+ */
+static __isl_give isl_printer *print_kernel_host_var(__isl_take isl_printer *p,
+	struct ppcg_kernel *kernel, const char *suffix)
+{
+	p = isl_printer_print_str(p, "k");
+	p = isl_printer_print_int(p, kernel->id);
+	p = isl_printer_print_str(p, suffix);
+
+	return p;
+}
+
+/* Print a statement "k<id><field> = <value>;" for "kernel",
+ * where "value" is either of the form "k<id><var>" (if "var" is set)
+ * or "value".
+ */
+static __isl_give isl_printer *print_launch_config_field(
+	__isl_take isl_printer *p, struct ppcg_kernel *kernel,
+	const char *field, const char *var, const char *value)
+{
+	p = isl_printer_start_line(p);
+	p = print_kernel_host_var(p, kernel, field);
+	p = isl_printer_print_str(p, " = ");
+	if (var)
+		p = print_kernel_host_var(p, kernel, var);
+	else
+		p = isl_printer_print_str(p, value);
+	p = isl_printer_print_str(p, ";");
+	p = isl_printer_end_line(p);
+
+	return p;
+}
+
+/* Print code for launching "kernel", on ppcg_stream if "on_stream" is set,
+ * and for checking that the launch succeeded.
+ */
+static __isl_give isl_printer *print_launch(__isl_take isl_printer *p,
+	struct gpu_prog *prog, struct ppcg_kernel *kernel, int on_stream)
+{
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "kernel");
+	p = isl_printer_print_int(p, kernel->id);
+	p = isl_printer_print_str(p, " <<<");
+	p = print_kernel_host_var(p, kernel, "_dimGrid");
+	p = isl_printer_print_str(p, ", ");
+	p = print_kernel_host_var(p, kernel, "_dimBlock");
+	if (on_stream)
+		p = isl_printer_print_str(p, ", 0, ppcg_stream");
+	p = isl_printer_print_str(p, ">>> (");
+	p = print_kernel_arguments(p, prog, kernel, 0);
+	p = isl_printer_print_str(p, ");");
+	p = isl_printer_end_line(p);
+
+	p = print_str_new_line(p, "cudaCheckKernel();");
+
+	return p;
+}
+
+/* Print code for launching "kernel" across ppcg_num_devices devices.
+ * The blocks in the outermost block dimension (the last component
+ * of the grid) are distributed evenly over the devices and
+ * the kernel on each device is passed the first block it executes
+ * in this dimension as ppcg_block_offset.
+ * Since the data is kept in managed memory, it is migrated
+ * to the devices that access it by the CUDA runtime.
+ * The host waits for the kernels on all devices to complete,
+ * such that subsequent operations see all their results, and
+ * finally switches back to the device that was current
+ * before the launch.
+ */
+static __isl_give isl_printer *print_multi_device_launch(
+	__isl_take isl_printer *p, struct gpu_prog *prog,
+	struct ppcg_kernel *kernel)
+{
+	const char *dim = kernel->n_grid == 1 ? ".x" : ".y";
+
+	p = ppcg_start_block(p);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "long long ppcg_blocks = ");
+	p = print_kernel_host_var(p, kernel, "_dimGrid");
+	p = isl_printer_print_str(p, dim);
+	p = isl_printer_print_str(p, ";");
+	p = isl_printer_end_line(p);
+	p = print_str_new_line(p, "int ppcg_saved_device;");
+	p = print_str_new_line(p,
+			"cudaCheckReturn(cudaGetDevice(&ppcg_saved_device));");
+	p = print_str_new_line(p, "for (int ppcg_d = 0; "
+				"ppcg_d < ppcg_num_devices; ++ppcg_d) {");
+	p = isl_printer_indent(p, 2);
+	p = print_str_new_line(p, "int ppcg_block_offset = "
+				"ppcg_blocks * ppcg_d / ppcg_num_devices;");
+	p = isl_printer_start_line(p);
+	p = print_kernel_host_var(p, kernel, "_dimGrid");
+	p = isl_printer_print_str(p, dim);
+	p = isl_printer_print_str(p, " = ppcg_blocks * (ppcg_d + 1) / "
+				"ppcg_num_devices - ppcg_block_offset;");
+	p = isl_printer_end_line(p);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "if (");
+	p = print_kernel_host_var(p, kernel, "_dimGrid");
+	p = isl_printer_print_str(p, dim);
+	p = isl_printer_print_str(p, " == 0)");
+	p = isl_printer_end_line(p);
+	p = isl_printer_indent(p, 2);
+	p = print_str_new_line(p, "continue;");
+	p = isl_printer_indent(p, -2);
+	p = print_str_new_line(p, "cudaCheckReturn(cudaSetDevice(ppcg_d));");
+	p = print_launch(p, prog, kernel, 0);
+	p = isl_printer_indent(p, -2);
+	p = print_str_new_line(p, "}");
+	p = print_str_new_line(p, "for (int ppcg_d = 0; "
+				"ppcg_d < ppcg_num_devices; ++ppcg_d) {");
+	p = isl_printer_indent(p, 2);
+	p = print_str_new_line(p, "cudaCheckReturn(cudaSetDevice(ppcg_d));");
+	p = print_str_new_line(p,
+				"cudaCheckReturn(cudaDeviceSynchronize());");
+	p = isl_printer_indent(p, -2);
+	p = print_str_new_line(p, "}");
+	p = print_str_new_line(p,
+			"cudaCheckReturn(cudaSetDevice(ppcg_saved_device));");
+	p = ppcg_end_block(p);
+
+	return p;
+}
+
+/* Print code for launching "kernel" as a cooperative kernel,
+ * on ppcg_stream if "on_stream" is set.
+ * The launch fails if not all blocks of the grid can be
+ * resident on the device at the same time.
+ */
+static __isl_give isl_printer *print_cooperative_launch(
+	__isl_take isl_printer *p, struct gpu_prog *prog,
+	struct ppcg_kernel *kernel, int on_stream)
+{
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "cudaLaunchAttribute ");
+	p = print_kernel_host_var(p, kernel, "_attr");
+	p = isl_printer_print_str(p, "[1];");
+	p = isl_printer_end_line(p);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "cudaLaunchConfig_t ");
+	p = print_kernel_host_var(p, kernel, "_config");
+	p = isl_printer_print_str(p, " = {};");
+	p = isl_printer_end_line(p);
+	p = print_launch_config_field(p, kernel, "_attr[0].id", NULL,
+					"cudaLaunchAttributeCooperative");
+	p = print_launch_config_field(p, kernel, "_attr[0].val.cooperative",
+					NULL, "1");
+	p = print_launch_config_field(p, kernel, "_config.gridDim",
+					"_dimGrid", NULL);
+	p = print_launch_config_field(p, kernel, "_config.blockDim",
+					"_dimBlock", NULL);
+	p = print_launch_config_field(p, kernel, "_config.attrs",
+					"_attr", NULL);
+	p = print_launch_config_field(p, kernel, "_config.numAttrs",
+					NULL, "1");
+	if (on_stream)
+		p = print_launch_config_field(p, kernel, "_config.stream",
+						NULL, "ppcg_stream");
+
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "cudaCheckReturn(cudaLaunchKernelEx(&");
+	p = print_kernel_host_var(p, kernel, "_config");
+	p = isl_printer_print_str(p, ", kernel");
+	p = isl_printer_print_int(p, kernel->id);
+	p = isl_printer_print_str(p, ", ");
+	p = print_kernel_arguments(p, prog, kernel, 0);
+	p = isl_printer_print_str(p, "));");
+	p = isl_printer_end_line(p);
+
+	return p;
+}
+
 /* Print the user statement of the host code to "p".
  *
  * The host code may contain original user statements, kernel launches,
@@ -594,6 +2350,23 @@ struct print_host_user_data {
  *
  * In case of a kernel launch, print a block of statements that
  * defines the grid and the block and then launches the kernel.
+ * If asynchronous transfers are used, then the kernel is launched
+ * on ppcg_stream after waiting for the arrays it accesses
+ * to have been copied to the device, and the completion of the kernel
+ * is recorded for each of those arrays.
+ * If the host code is captured in a CUDA graph, then the kernel
+ * is also launched on ppcg_stream.
+ * If a host loop has been moved inside the kernel, then the kernel
+ * is launched as a cooperative kernel through print_cooperative_launch
+ * since it performs grid-wide synchronization.
+ * Otherwise, if the kernel is split across multiple devices,
+ * then it is launched through print_multi_device_launch.
+ * If the --device-timing option is set, then the launch is timed.
+ * If the device arrays persist across executions of the scop,
+ * then the contents of those written by the kernel become unknown.
+ * If asynchronous transfers are used, then the completion of the kernel
+ * is recorded in the events of the arrays it accesses and
+ * in those of the current window buffers.
  */
 static __isl_give isl_printer *print_host_user(__isl_take isl_printer *p,
 	__isl_take isl_ast_print_options *print_options,
@@ -601,9 +2374,11 @@ static __isl_give isl_printer *print_host_user(__isl_take isl_printer *p,
 {
 	isl_id *id;
 	int is_user;
+	int async;
 	struct ppcg_kernel *kernel;
 	struct ppcg_kernel_stmt *stmt;
 	struct print_host_user_data *data;
+	struct ppcg_options *options;
 
 	isl_ast_print_options_free(print_options);
 
@@ -611,7 +2386,7 @@ static __isl_give isl_printer *print_host_user(__isl_take isl_printer *p,
 
 	id = isl_ast_node_get_annotation(node);
 	if (!id)
-		return print_device_node(p, node, data->prog);
+		return print_device_node(p, node, data->prog, data->capture);
 
 	is_user = !strcmp(isl_id_get_name(id), "user");
 	kernel = is_user ? NULL : isl_id_get_user(id);
@@ -634,21 +2409,35 @@ static __isl_give isl_printer *print_host_user(__isl_take isl_printer *p,
 
 	p = print_grid(p, kernel);
 
-	p = isl_printer_start_line(p);
-	p = isl_printer_print_str(p, "kernel");
-	p = isl_printer_print_int(p, kernel->id);
-	p = isl_printer_print_str(p, " <<<k");
-	p = isl_printer_print_int(p, kernel->id);
-	p = isl_printer_print_str(p, "_dimGrid, k");
-	p = isl_printer_print_int(p, kernel->id);
-	p = isl_printer_print_str(p, "_dimBlock>>> (");
-	p = print_kernel_arguments(p, data->prog, kernel, 0);
-	p = isl_printer_print_str(p, ");");
-	p = isl_printer_end_line(p);
+	options = data->prog->scop->options;
+	async = use_async_transfers(options);
+	if (async)
+		p = print_kernel_events(p, data->prog, kernel,
+					"ppcg_copied", &print_wait_event);
+
+	p = print_timing_start(p, options, async, NULL);
+
+	if (kernel->persistent_iterator) {
+		p = print_cooperative_launch(p, data->prog, kernel,
+						async || data->capture);
+		p = print_str_new_line(p, "cudaCheckKernel();");
+	} else if (kernel_uses_multi_device(kernel)) {
+		p = print_multi_device_launch(p, data->prog, kernel);
+	} else {
+		p = print_launch(p, data->prog, kernel,
+					async || data->capture);
+	}
 
-	p = isl_printer_start_line(p);
-	p = isl_printer_print_str(p, "cudaCheckKernel();");
-	p = isl_printer_end_line(p);
+	p = print_timing_end(p, options, async, NULL, "kernel", kernel,
+				NULL, NULL);
+	if (use_persistent_device_data(options))
+		p = invalidate_written_arrays(p, data->prog, kernel);
+
+	if (async)
+		p = print_kernel_events(p, data->prog, kernel,
+					"ppcg_used", &print_record_event);
+	if (async)
+		p = record_window_events(p, data->prog, kernel);
 
 	p = ppcg_end_block(p);
 
@@ -660,6 +2449,54 @@ static __isl_give isl_printer *print_host_user(__isl_take isl_printer *p,
 	return p;
 }
 
+/* This function is called for each node in the host AST.
+ * Set *found if "node" is an original user statement,
+ * i.e., a statement that is executed on the host.
+ */
+static isl_bool is_host_statement(__isl_keep isl_ast_node *node, void *user)
+{
+	int *found = user;
+	isl_id *id;
+
+	if (isl_ast_node_get_type(node) != isl_ast_node_user)
+		return isl_bool_true;
+
+	id = isl_ast_node_get_annotation(node);
+	if (id && !strcmp(isl_id_get_name(id), "user"))
+		*found = 1;
+	isl_id_free(id);
+
+	return isl_bool_false;
+}
+
+/* Should the host code in "tree" be captured in a CUDA graph?
+ * This requires the cuda_graphs option to be set and
+ * managed memory not to be used, since the migration hints are issued
+ * on the default stream.
+ * Moreover, the host code should not contain any original user statements,
+ * since those would be executed during the capture, before any
+ * of the captured operations.
+ * Timing the operations (--device-timing) also requires
+ * the host to synchronize with the device, which cannot be done
+ * during a capture.
+ */
+static int use_cuda_graph(struct gpu_prog *prog, __isl_keep isl_ast_node *tree)
+{
+	int found = 0;
+
+	if (!prog->scop->options->cuda_graphs)
+		return 0;
+	if (prog->scop->options->managed_memory)
+		return 0;
+	if (prog->scop->options->device_timing)
+		return 0;
+	if (isl_ast_node_foreach_descendant_top_down(tree,
+					&is_host_statement, &found) < 0)
+		return -1;
+
+	return !found;
+}
+
 static __isl_give isl_printer *print_host_code(__isl_take isl_printer *p,
 	struct gpu_prog *prog, __isl_keep isl_ast_node *tree,
 	struct cuda_info *cuda)
@@ -668,6 +2505,10 @@ static __isl_give isl_printer *print_host_code(__isl_take isl_printer *p,
 	isl_ctx *ctx = isl_ast_node_get_ctx(tree);
 	struct print_host_user_data data = { cuda, prog };
 
+	data.capture = use_cuda_graph(prog, tree);
+	if (data.capture < 0)
+		return isl_printer_free(p);
+
 	print_options = isl_ast_print_options_alloc(ctx);
 	print_options = isl_ast_print_options_set_print_user(print_options,
 						&print_host_user, &data);
@@ -692,7 +2533,14 @@ static __isl_give isl_printer *print_cuda(__isl_take isl_printer *p,
 
 	kernel = isl_printer_to_file(isl_printer_get_ctx(p), cuda->kernel_c);
 	kernel = isl_printer_set_output_format(kernel, ISL_FORMAT_C);
+	if (prog->scop->options->persistent_kernels) {
+		kernel = isl_printer_start_line(kernel);
+		kernel = isl_printer_print_str(kernel,
+					"#include <cooperative_groups.h>");
+		kernel = isl_printer_end_line(kernel);
+	}
 	kernel = gpu_print_types(kernel, types, prog);
+	kernel = gpu_print_atomic_add_macro(kernel, prog, "atomicAdd");
 	isl_printer_free(kernel);
 
 	if (!kernel)
@@ -703,6 +2551,49 @@ static __isl_give isl_printer *print_cuda(__isl_take isl_printer *p,
 	return p;
 }
 
+/* Print the definition of the ppcg_hash function used for checking
+ * whether the host contents of an array have changed since
+ * they were last known to be equal to those of the persistent
+ * device copy.
+ * The contents are hashed on 8-byte words, with the state passed
+ * through a multiply-xorshift mix after each word,
+ * such that a change in any bit affects all bits of the state.
+ * Without this mix, changes in the most significant bit
+ * of two distinct words would cancel each other out.
+ */
+static __isl_give isl_printer *print_hash_support(__isl_take isl_printer *p)
+{
+	const char *support =
+		"#include <string.h>\n\n"
+		"static unsigned long long ppcg_hash_mix("
+		"unsigned long long h)\n"
+		"{\n"
+		"  h ^= h >> 33;\n"
+		"  h *= 0xff51afd7ed558ccdULL;\n"
+		"  h ^= h >> 33;\n"
+		"  h *= 0xc4ceb9fe1a85ec53ULL;\n"
+		"  h ^= h >> 33;\n"
+		"  return h;\n"
+		"}\n\n"
+		"static unsigned long long ppcg_hash(const void *data, "
+		"size_t size)\n"
+		"{\n"
+		"  const unsigned char *bytes = (const unsigned char *) data;\n"
+		"  unsigned long long hash = 14695981039346656037ULL;\n"
+		"  unsigned long long word;\n"
+		"  size_t i;\n\n"
+		"  for (i = 0; i + sizeof(word) <= size; i += sizeof(word)) {\n"
+		"    memcpy(&word, bytes + i, sizeof(word));\n"
+		"    hash = ppcg_hash_mix(hash ^ word);\n"
+		"  }\n"
+		"  for (; i < size; ++i)\n"
+		"    hash = ppcg_hash_mix(hash ^ bytes[i]);\n"
+		"  return hash;\n"
+		"}\n\n";
+
+	return isl_printer_print_str(p, support);
+}
+
 /* Transform the code in the file called "input" by replacing
  * all scops by corresponding CUDA code.
  * The names of the output files are derived from "input".
@@ -710,7 +2601,8 @@ static __isl_give isl_printer *print_cuda(__isl_take isl_printer *p,
  * We let generate_gpu do all the hard work and then let it call
  * us back for printing the AST in print_cuda.
  *
- * To prepare for this printing, we first open the output files
+ * To prepare for this printing, we first open the output files,
+ * print any support code required by the generated host code,
  * and we close them after generate_gpu has finished.
  */
 int generate_cuda(isl_ctx *ctx, struct ppcg_options *options,
@@ -720,6 +2612,18 @@ int generate_cuda(isl_ctx *ctx, struct ppcg_options *options,
 	int r;
 
 	cuda_open_files(&cuda, input);
+	if (options->managed_memory)
+		fprintf(cuda.host_c, "#include <string.h>\n\n");
+	if (options->device_timing || use_persistent_device_data(options)) {
+		isl_printer *p;
+
+		p = isl_printer_to_file(ctx, cuda.host_c);
+		if (options->device_timing)
+			p = gpu_print_timing_support(p);
+		if (use_persistent_device_data(options))
+			p = print_hash_support(p);
+		isl_printer_free(p);
+	}
 
 	r = generate_gpu(ctx, input, cuda.host_c, options, &print_cuda, &cuda);
 
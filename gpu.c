@@ -12,6 +12,7 @@
  */
 
 #include <assert.h>
+#include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -30,6 +31,7 @@
 #include "gpu_array_tile.h"
 #include "gpu_group.h"
 #include "gpu_hybrid.h"
+#include "gpu_report.h"
 #include "gpu_tree.h"
 #include "hybrid.h"
 #include "schedule.h"
@@ -132,6 +134,27 @@ static __isl_give isl_set *compute_extent(struct pet_array *array,
 	return extent;
 }
 
+/* Is the array "array" being extracted the target of any reduction?
+ */
+static int is_reduction_target(struct gpu_array_info *array,
+	struct gpu_prog *prog)
+{
+	isl_set *space;
+	isl_union_map *write;
+	int empty;
+
+	write = isl_union_map_copy(prog->scop->reductions);
+	space = isl_set_universe(isl_space_copy(array->space));
+	write = isl_union_map_intersect_range(write,
+						isl_union_set_from_set(space));
+	empty = isl_union_map_is_empty(write);
+	isl_union_map_free(write);
+
+	if (empty < 0)
+		return -1;
+	return !empty;
+}
+
 /* Is the array "array" being extracted a read-only scalar?
  *
  * That is, is "array" a scalar that is never possibly written to.
@@ -205,6 +228,9 @@ static int extract_array_info(struct gpu_prog *prog,
 	info->local = pa->declared && !pa->exposed;
 	info->has_compound_element = pa->element_is_record;
 	info->read_only_scalar = is_read_only_scalar(info, prog);
+	info->reduction = is_reduction_target(info, prog);
+	if (info->reduction < 0)
+		return -1;
 
 	info->declared_extent = isl_set_copy(pa->extent);
 	accessed = isl_union_set_extract_set(arrays,
@@ -301,7 +327,8 @@ void collect_order_dependences(struct gpu_prog *prog)
 		uset = isl_union_map_domain(
 		    isl_union_map_intersect_range(isl_union_map_copy(accesses),
 						    uset));
-		order = isl_union_map_copy(prog->scop->tagged_dep_order);
+		order = isl_union_map_copy(
+				ppcg_scop_get_tagged_dep_order(prog->scop));
 		order = isl_union_map_intersect_domain(order, uset);
 		order = isl_union_map_zip(order);
 		order = isl_union_set_unwrap(isl_union_map_domain(order));
@@ -405,12 +432,14 @@ int gpu_array_is_scalar(struct gpu_array_info *array)
 /* Can "array" be mapped to private memory?
  * That is, is it only accessed as individual elements with
  * constant index expressions?
+ * The target of a reduction is updated atomically by several threads
+ * and can therefore not be mapped to private memory.
  */
 isl_bool gpu_array_can_be_private(struct gpu_array_info *array)
 {
 	if (!array)
 		return isl_bool_error;
-	return array->only_fixed_element;
+	return array->only_fixed_element && !array->reduction;
 }
 
 /* Is "array" a read-only scalar?
@@ -466,89 +495,21 @@ __isl_give isl_set *gpu_array_positive_size_guard(struct gpu_array_info *array)
 	return guard;
 }
 
-/* Internal data structure for extract_size_of_type.
- * "type" specifies the name of the space that we want to extract.
- * "res" is used to store the subset of that space.
- */
-struct ppcg_extract_size_data {
-	const char *type;
-	isl_set *res;
-};
-
-/* This function is called for each set in a union_set.
- * If the name of the set matches data->type, we store the
- * set in data->res.
- */
-static isl_stat extract_size_of_type(__isl_take isl_set *size, void *user)
-{
-	struct ppcg_extract_size_data *data = user;
-	const char *name;
-
-	name = isl_set_get_tuple_name(size);
-	if (name && !strcmp(name, data->type)) {
-		data->res = size;
-		return isl_stat_error;
-	}
-
-	isl_set_free(size);
-	return isl_stat_ok;
-}
-
-/* Given a union map { kernel[i] -> *[...] },
- * return the range in the space called "type" for the kernel with
+/* Return the sizes in the space called "type" for the kernel with
  * sequence number "id".
+ * Sizes specified through the --sizes option take precedence
+ * over those recorded in the tuning database.
  */
-static __isl_give isl_set *extract_sizes(__isl_keep isl_union_map *sizes,
-	const char *type, int id)
+static __isl_give isl_set *get_sizes(struct gpu_gen *gen, const char *type,
+	int id)
 {
-	isl_space *space;
-	isl_set *dom;
-	isl_union_set *local_sizes;
-	struct ppcg_extract_size_data data = { type, NULL };
-
-	if (!sizes)
-		return NULL;
-
-	space = isl_union_map_get_space(sizes);
-	space = isl_space_set_from_params(space);
-	space = isl_space_add_dims(space, isl_dim_set, 1);
-	space = isl_space_set_tuple_name(space, isl_dim_set, "kernel");
-	dom = isl_set_universe(space);
-	dom = isl_set_fix_si(dom, isl_dim_set, 0, id);
-
-	local_sizes = isl_union_set_apply(isl_union_set_from_set(dom),
-					isl_union_map_copy(sizes));
-	isl_union_set_foreach_set(local_sizes, &extract_size_of_type, &data);
-	isl_union_set_free(local_sizes);
-	return data.res;
-}
-
-/* Given a singleton set, extract the first (at most *len) elements
- * of the single integer tuple into *sizes and update *len if needed.
- */
-static void read_sizes_from_set(__isl_take isl_set *set, int *sizes, int *len)
-{
-	int i;
-	int dim;
-
-	if (!set)
-		return;
-
-	dim = isl_set_dim(set, isl_dim_set);
-	if (dim < *len)
-		*len = dim;
-
-	for (i = 0; i < *len; ++i) {
-		isl_val *v;
-
-		v = isl_set_plain_get_val_if_fixed(set, isl_dim_set, i);
-		assert(v);
+	isl_set *size;
 
-		sizes[i] = isl_val_get_num_si(v);
-		isl_val_free(v);
-	}
+	size = ppcg_extract_sizes(gen->sizes, "kernel", type, id);
+	if (!size)
+		size = ppcg_extract_sizes(gen->tuned_sizes, "kernel", type, id);
 
-	isl_set_free(set);
+	return size;
 }
 
 /* Add the map { kernel[id] -> type[sizes] } to gen->used_sizes,
@@ -557,37 +518,20 @@ static void read_sizes_from_set(__isl_take isl_set *set, int *sizes, int *len)
 static void set_used_sizes(struct gpu_gen *gen, const char *type, int id,
 	int *sizes, int len)
 {
-	int i;
-	isl_space *space;
-	isl_map *map;
-
 	if (!gen->options->debug->dump_sizes)
 		return;
 
-	space = isl_union_map_get_space(gen->used_sizes);
-	space = isl_space_set_from_params(space);
-	space = isl_space_add_dims(space, isl_dim_set, 1);
-	space = isl_space_set_tuple_name(space, isl_dim_set, "kernel");
-	space = isl_space_from_domain(space);
-	space = isl_space_add_dims(space, isl_dim_out, len);
-	space = isl_space_set_tuple_name(space, isl_dim_out, type);
-
-	map = isl_map_universe(space);
-	map = isl_map_fix_si(map, isl_dim_in, 0, id);
-	for (i = 0; i < len; ++i)
-		map = isl_map_fix_si(map, isl_dim_out, i, sizes[i]);
-
-	gen->used_sizes = isl_union_map_add_map(gen->used_sizes, map);
+	gen->used_sizes = ppcg_add_used_sizes(gen->used_sizes, "kernel",
+						type, id, sizes, len);
 }
 
-/* Extract user specified "tile" sizes from the "sizes" command line option,
- * defaulting to option->tile_size in each dimension.
+/* Extract user specified "tile" sizes from the "sizes" command line option
+ * or the tuning database, defaulting to option->tile_size in each dimension.
  * *tile_len contains the maximum number of tile sizes needed.
  * Update *tile_len to the number of specified tile sizes, if any, and
  * return a pointer to the tile sizes (or NULL on error).
- * Add the effectively used sizes to gen->used_sizes.
  */
-static int *read_tile_sizes(struct gpu_gen *gen, int *tile_len)
+static int *extract_tile_sizes(struct gpu_gen *gen, int *tile_len)
 {
 	int n;
 	int *tile_size;
@@ -599,18 +543,31 @@ static int *read_tile_sizes(struct gpu_gen *gen, int *tile_len)
 	for (n = 0; n < *tile_len; ++n)
 		tile_size[n] = gen->options->tile_size;
 
-	size = extract_sizes(gen->sizes, "tile", gen->kernel_id);
-	read_sizes_from_set(size, tile_size, tile_len);
-	set_used_sizes(gen, "tile", gen->kernel_id, tile_size, *tile_len);
+	size = get_sizes(gen, "tile", gen->kernel_id);
+	ppcg_read_sizes_from_set(size, tile_size, tile_len);
 
 	return tile_size;
 }
 
-/* Extract user specified "block" sizes from the "sizes" command line option,
- * after filling in some potentially useful defaults.
+/* Extract user specified "tile" sizes as in extract_tile_sizes and
+ * add the effectively used sizes to gen->used_sizes.
+ */
+static int *read_tile_sizes(struct gpu_gen *gen, int *tile_len)
+{
+	int *tile_size;
+
+	tile_size = extract_tile_sizes(gen, tile_len);
+	if (tile_size)
+		set_used_sizes(gen, "tile", gen->kernel_id,
+				tile_size, *tile_len);
+
+	return tile_size;
+}
+
+/* Extract user specified "block" sizes from the "sizes" command line option
+ * or the tuning database, after filling in some potentially useful defaults.
  */
-static void read_block_sizes(struct ppcg_kernel *kernel,
-	__isl_keep isl_union_map *sizes)
+static void read_block_sizes(struct ppcg_kernel *kernel, struct gpu_gen *gen)
 {
 	isl_set *size;
 
@@ -631,15 +588,14 @@ static void read_block_sizes(struct ppcg_kernel *kernel,
 		break;
 	}
 
-	size = extract_sizes(sizes, "block", kernel->id);
-	read_sizes_from_set(size, kernel->block_dim, &kernel->n_block);
+	size = get_sizes(gen, "block", kernel->id);
+	ppcg_read_sizes_from_set(size, kernel->block_dim, &kernel->n_block);
 }
 
-/* Extract user specified "grid" sizes from the "sizes" command line option,
- * after filling in some potentially useful defaults.
+/* Extract user specified "grid" sizes from the "sizes" command line option
+ * or the tuning database, after filling in some potentially useful defaults.
  */
-static void read_grid_sizes(struct ppcg_kernel *kernel,
-	__isl_keep isl_union_map *sizes)
+static void read_grid_sizes(struct ppcg_kernel *kernel, struct gpu_gen *gen)
 {
 	isl_set *size;
 
@@ -655,26 +611,43 @@ static void read_grid_sizes(struct ppcg_kernel *kernel,
 		break;
 	}
 
-	size = extract_sizes(sizes, "grid", kernel->id);
-	read_sizes_from_set(size, kernel->grid_dim, &kernel->n_grid);
+	size = get_sizes(gen, "grid", kernel->id);
+	ppcg_read_sizes_from_set(size, kernel->grid_dim, &kernel->n_grid);
 }
 
 /* Extract user specified grid and block sizes from the gen->sizes
- * command line option after filling in some potentially useful defaults.
+ * command line option or the tuning database (gen->tuned_sizes)
+ * after filling in some potentially useful defaults.
  * Store the extracted sizes in "kernel".
  * Add the effectively used sizes to gen->used_sizes.
  */
 static void read_grid_and_block_sizes(struct ppcg_kernel *kernel,
 	struct gpu_gen *gen)
 {
-	read_block_sizes(kernel, gen->sizes);
-	read_grid_sizes(kernel, gen->sizes);
+	read_block_sizes(kernel, gen);
+	read_grid_sizes(kernel, gen);
 	set_used_sizes(gen, "block", kernel->id,
 					    kernel->block_dim, kernel->n_block);
 	set_used_sizes(gen, "grid", kernel->id,
 					    kernel->grid_dim, kernel->n_grid);
 }
 
+/* Free the list of accesses of "stmt".
+ */
+static void free_stmt_accesses(struct gpu_stmt *stmt)
+{
+	struct gpu_stmt_access *access, *next;
+
+	for (access = stmt->accesses; access; access = next) {
+		next = access->next;
+		isl_id_free(access->ref_id);
+		isl_map_free(access->access);
+		isl_map_free(access->tagged_access);
+		free(access);
+	}
+	stmt->accesses = NULL;
+}
+
 static void *free_stmts(struct gpu_stmt *stmts, int n)
 {
 	int i;
@@ -683,16 +656,7 @@ static void *free_stmts(struct gpu_stmt *stmts, int n)
 		return NULL;
 
 	for (i = 0; i < n; ++i) {
-		struct gpu_stmt_access *access, *next;
-
-		for (access = stmts[i].accesses; access; access = next) {
-			next = access->next;
-			isl_id_free(access->ref_id);
-			isl_map_free(access->access);
-			isl_map_free(access->tagged_access);
-			free(access);
-		}
-
+		free_stmt_accesses(&stmts[i]);
 		isl_id_free(stmts[i].id);
 	}
 	free(stmts);
@@ -700,6 +664,27 @@ static void *free_stmts(struct gpu_stmt *stmts, int n)
 	return NULL;
 }
 
+/* Free the access relations of "prog" and of its statements.
+ * They are only used while constructing the schedule tree and
+ * the AST of "prog" and not while printing the AST.
+ * This is called as soon as the AST has been generated
+ * such that these relations are not kept alive
+ * while the (possibly large) AST is being printed.
+ */
+static void gpu_prog_free_access_data(struct gpu_prog *prog)
+{
+	int i;
+
+	prog->read = isl_union_map_free(prog->read);
+	prog->may_write = isl_union_map_free(prog->may_write);
+	prog->must_write = isl_union_map_free(prog->must_write);
+	prog->tagged_must_kill = isl_union_map_free(prog->tagged_must_kill);
+	prog->array_order = isl_union_map_free(prog->array_order);
+	prog->may_persist = isl_union_set_free(prog->may_persist);
+	for (i = 0; i < prog->n_stmts; ++i)
+		free_stmt_accesses(&prog->stmts[i]);
+}
+
 /* Add parameters p[i] with identifiers "ids" to "set",
  * with bounds to 0 <= p[i] < size[i].
  */
@@ -926,6 +911,8 @@ static __isl_give isl_pw_multi_aff *compute_sched_to_copy(
  * We apply a greedy approach and discard (keep in global memory)
  * those groups that would result in a total memory size that
  * is larger than the maximum.
+ * The size of a shared memory tile includes its padding, if any.
+ * If a padded tile does not fit, then the padding is dropped first.
  *
  * This function should be called after any function that may
  * affect the decision on whether to place a reference group
@@ -947,6 +934,7 @@ static void check_shared_memory_bound(struct ppcg_kernel *kernel)
 
 		for (j = 0; j < local->n_group; ++j) {
 			struct gpu_array_ref_group *group;
+			struct gpu_array_tile *tile;
 			enum ppcg_group_access_type type;
 
 			group = local->groups[j];
@@ -954,8 +942,15 @@ static void check_shared_memory_bound(struct ppcg_kernel *kernel)
 			if (type != ppcg_access_shared)
 				continue;
 
-			size = gpu_array_tile_size(group->shared_tile);
+			tile = group->shared_tile;
+			size = gpu_array_tile_size(tile);
 			size = isl_val_mul_ui(size, local->array->size);
+			if (!isl_val_le(size, left) && tile->pad) {
+				isl_val_free(size);
+				tile->pad = 0;
+				size = gpu_array_tile_size(tile);
+				size = isl_val_mul_ui(size, local->array->size);
+			}
 
 			if (isl_val_le(size, left)) {
 				left = isl_val_sub(left, size);
@@ -971,6 +966,355 @@ static void check_shared_memory_bound(struct ppcg_kernel *kernel)
 	isl_val_free(left);
 }
 
+/* Return the amount of shared memory used by "group",
+ * or zero if it is not mapped to shared memory.
+ */
+static __isl_give isl_val *group_shared_memory(isl_ctx *ctx,
+	struct gpu_array_ref_group *group)
+{
+	isl_val *size;
+
+	if (gpu_array_ref_group_type(group) != ppcg_access_shared)
+		return isl_val_zero(ctx);
+
+	size = gpu_array_tile_size(group->shared_tile);
+	size = isl_val_mul_ui(size, group->array->size);
+	if (group->shared_tile->double_buffer)
+		size = isl_val_mul_ui(size, 2);
+
+	return size;
+}
+
+/* Return a map from each element of "dom" to the lexicographically
+ * smallest element of "dom" that has the same values for
+ * the first "depth - 1" dimensions and a greater value
+ * for the dimension at position "depth - 1".
+ * That is, map each iteration of the loop at position "depth - 1"
+ * to the next iteration of that loop.
+ */
+static __isl_give isl_map *next_iteration(__isl_take isl_set *dom, int depth)
+{
+	int i;
+	isl_map *map;
+
+	map = isl_map_from_domain_and_range(isl_set_copy(dom), dom);
+	for (i = 0; i < depth - 1; ++i)
+		map = isl_map_equate(map, isl_dim_in, i, isl_dim_out, i);
+	map = isl_map_order_lt(map, isl_dim_in, depth - 1,
+				isl_dim_out, depth - 1);
+
+	return isl_map_lexmin(map);
+}
+
+/* Return the prefix schedule of the core computation of "kernel"
+ * at the descendant of the kernel node "node" at schedule depth "depth"
+ * as a set of schedule instances.
+ */
+static __isl_give isl_set *core_prefix_instances(struct ppcg_kernel *kernel,
+	__isl_keep isl_schedule_node *node, int depth)
+{
+	isl_union_map *prefix;
+
+	node = isl_schedule_node_copy(node);
+	node = gpu_tree_move_down_to_depth(node, depth, kernel->core);
+	prefix = isl_schedule_node_get_prefix_schedule_union_map(node);
+	isl_schedule_node_free(node);
+	prefix = isl_union_map_intersect_domain(prefix,
+					isl_union_set_copy(kernel->core));
+
+	return isl_set_from_union_set(isl_union_map_range(prefix));
+}
+
+/* Return the distance between the values of the schedule dimension
+ * at position "depth - 1" in consecutive iterations of the corresponding
+ * loop that are executed by the core computation of "kernel",
+ * where "node" points to the kernel node.
+ * Return zero if this distance is not a positive constant or
+ * if the loop never executes more than one iteration.
+ *
+ * Note that the distance is typically equal to the tile size
+ * since the tile loops are scaled by default.
+ */
+static __isl_give isl_val *iteration_stride(struct ppcg_kernel *kernel,
+	__isl_keep isl_schedule_node *node, int depth)
+{
+	isl_set *dom, *deltas;
+	isl_local_space *ls;
+	isl_aff *obj;
+	isl_val *min, *max;
+	int constant;
+
+	dom = core_prefix_instances(kernel, node, depth);
+	deltas = isl_map_deltas(next_iteration(dom, depth));
+	ls = isl_local_space_from_space(isl_set_get_space(deltas));
+	obj = isl_aff_var_on_domain(ls, isl_dim_set, depth - 1);
+	min = isl_set_min_val(deltas, obj);
+	max = isl_set_max_val(deltas, obj);
+	isl_aff_free(obj);
+	isl_set_free(deltas);
+
+	if (!min || !max) {
+		isl_val_free(min);
+		isl_val_free(max);
+		return NULL;
+	}
+	constant = isl_val_is_int(min) && isl_val_is_pos(min) &&
+		    isl_val_eq(min, max);
+	isl_val_free(max);
+	if (constant)
+		return min;
+	isl_val_free(min);
+
+	return isl_val_zero(kernel->ctx);
+}
+
+/* Can the shared memory tile of "group" be double buffered?
+ * "kernel_depth" is the schedule depth of the kernel.
+ *
+ * Only tiles of arrays that are only read can be double buffered,
+ * since the next tile is copied in before the current tile
+ * has been completely used.
+ * Furthermore, the copying needs to be performed inside the kernel,
+ * i.e., inside some loop that is not mapped to blocks,
+ * since otherwise there is no next tile to be copied in.
+ */
+static int can_double_buffer(struct gpu_array_ref_group *group,
+	int kernel_depth)
+{
+	if (gpu_array_ref_group_type(group) != ppcg_access_shared)
+		return 0;
+	if (group->write || gpu_array_is_scalar(group->array))
+		return 0;
+	return group->shared_tile->depth > kernel_depth;
+}
+
+/* If the "double_buffer" option is set, then mark the shared memory
+ * tiles of the array reference groups in "kernel" that can be
+ * double buffered as such, provided the total amount of shared memory
+ * does not exceed max_shared_memory (if not set to infinity (-1)).
+ * "node" points to the kernel node.
+ *
+ * As in check_shared_memory_bound, a greedy approach is applied.
+ *
+ * A tile can only be double buffered if consecutive iterations
+ * of the loop at position tile->depth - 1 differ by a constant amount
+ * such that the buffer can be selected by the parity of
+ * the iteration count.  This is checked before the tile is marked
+ * double buffered, since marking it doubles its shared memory usage.
+ */
+static void mark_double_buffered(struct ppcg_kernel *kernel,
+	__isl_keep isl_schedule_node *node)
+{
+	int i, j;
+	int kernel_depth;
+	isl_val *left;
+
+	if (!kernel->options->double_buffer)
+		return;
+
+	kernel_depth = isl_schedule_node_get_schedule_depth(node);
+	left = isl_val_int_from_si(kernel->ctx,
+				    kernel->options->max_shared_memory);
+	for (i = 0; i < kernel->n_array; ++i) {
+		struct gpu_local_array_info *local = &kernel->array[i];
+
+		for (j = 0; j < local->n_group; ++j)
+			left = isl_val_sub(left,
+				    group_shared_memory(kernel->ctx,
+						    local->groups[j]));
+	}
+
+	for (i = 0; i < kernel->n_array; ++i) {
+		struct gpu_local_array_info *local = &kernel->array[i];
+
+		for (j = 0; j < local->n_group; ++j) {
+			struct gpu_array_ref_group *group;
+			struct gpu_array_tile *tile;
+			isl_val *size, *stride;
+
+			group = local->groups[j];
+			if (!can_double_buffer(group, kernel_depth))
+				continue;
+			size = group_shared_memory(kernel->ctx, group);
+			if (kernel->options->max_shared_memory >= 0 &&
+			    !isl_val_le(size, left)) {
+				isl_val_free(size);
+				continue;
+			}
+			tile = group->shared_tile;
+			stride = iteration_stride(kernel, node, tile->depth);
+			if (!stride || isl_val_is_zero(stride)) {
+				isl_val_free(stride);
+				isl_val_free(size);
+				continue;
+			}
+			left = isl_val_sub(left, size);
+			tile->double_buffer = 1;
+			tile->buffer_stride = stride;
+		}
+	}
+
+	isl_val_free(left);
+}
+
+#define ARRAY_SIZE(array) (sizeof(array)/sizeof(*array))
+
+/* Is there a vector type with elements of type "type"
+ * for which a vector of "width" elements of size "size" can be loaded
+ * at once?
+ * The vector types are those that are available in both CUDA and OpenCL.
+ */
+static int has_vector_type(const char *type, int size, int width)
+{
+	int i;
+	const char *vector_types[] = { "char", "short", "int", "long",
+					"float", "double" };
+
+	if (width != 2 && width != 4)
+		return 0;
+	if (width * size > 16)
+		return 0;
+	for (i = 0; i < ARRAY_SIZE(vector_types); ++i)
+		if (!strcmp(type, vector_types[i]))
+			return 1;
+	return 0;
+}
+
+/* Is "v" a multiple of "width"?
+ */
+static isl_bool val_is_multiple(__isl_keep isl_val *v, int width)
+{
+	isl_val *w;
+	isl_bool multiple;
+
+	w = isl_val_int_from_si(isl_val_get_ctx(v), width);
+	multiple = isl_val_is_divisible_by(v, w);
+	isl_val_free(w);
+
+	return multiple;
+}
+
+/* Is "pa" a multiple of "width" on "dom"?
+ */
+static isl_bool pw_aff_is_multiple(__isl_take isl_pw_aff *pa, int width,
+	__isl_take isl_set *dom)
+{
+	isl_ctx *ctx;
+	isl_set *non_zero;
+	isl_bool multiple;
+
+	ctx = isl_pw_aff_get_ctx(pa);
+	pa = isl_pw_aff_mod_val(pa, isl_val_int_from_si(ctx, width));
+	non_zero = isl_pw_aff_non_zero_set(pa);
+	non_zero = isl_set_intersect(non_zero, dom);
+	multiple = isl_set_is_empty(non_zero);
+	isl_set_free(non_zero);
+
+	return multiple;
+}
+
+/* Can the elements of the shared memory tile of "group" be read
+ * from global memory in vectors of "width" elements?
+ *
+ * The tile should not be a privatized copy of a reduction target,
+ * which is initialized to zero rather than read from global memory.
+ * The tile should not be padded or strided in the innermost dimension and
+ * "width" consecutive elements in the innermost dimension of both
+ * the tile and the global array should be properly aligned.
+ * That is, the size of the innermost dimension of the tile,
+ * the offset of the tile in that dimension and the size of
+ * the innermost dimension of the global array should all be multiples
+ * of "width".
+ * The latter ensures that rows of the global array are aligned and
+ * that the vectors do not extend beyond the end of the global array.
+ * These conditions only need to hold for the parameter values
+ * in the context of "kernel" and, in case of the offset,
+ * for the values of the outer tile->depth schedule dimensions
+ * at which the core computation of "kernel" is executed.
+ * "node" points to the kernel node.
+ */
+static isl_bool can_vectorize(struct ppcg_kernel *kernel,
+	__isl_keep isl_schedule_node *node, struct gpu_array_ref_group *group,
+	int width)
+{
+	struct gpu_array_tile *tile;
+	struct gpu_array_bound *bound;
+	isl_multi_pw_aff *array_bound;
+	isl_set *context, *dom;
+	isl_pw_aff *pa;
+	isl_bool ok;
+	int n;
+
+	if (gpu_array_ref_group_type(group) != ppcg_access_shared)
+		return isl_bool_false;
+	if (group->histogram)
+		return isl_bool_false;
+	if (gpu_array_is_scalar(group->array))
+		return isl_bool_false;
+	if (!has_vector_type(group->array->type, group->array->size, width))
+		return isl_bool_false;
+	tile = group->shared_tile;
+	n = tile->n;
+	bound = &tile->bound[n - 1];
+	if (tile->pad || bound->shift)
+		return isl_bool_false;
+
+	context = isl_set_params(isl_set_copy(kernel->context));
+	ok = val_is_multiple(bound->size, width);
+	if (ok == isl_bool_true) {
+		pa = isl_pw_aff_from_aff(isl_aff_copy(bound->lb));
+		dom = core_prefix_instances(kernel, node, tile->depth);
+		dom = isl_set_intersect_params(dom, isl_set_copy(context));
+		ok = pw_aff_is_multiple(pa, width, dom);
+	}
+	if (ok == isl_bool_true) {
+		array_bound = group->local_array->bound;
+		pa = isl_multi_pw_aff_get_pw_aff(array_bound, n - 1);
+		ok = pw_aff_is_multiple(pa, width, isl_set_copy(context));
+	}
+	isl_set_free(context);
+
+	return ok;
+}
+
+/* If the "vector_width" option is set to a value greater than one,
+ * then mark the shared memory tiles of the array reference groups
+ * in "kernel" that can be read from global memory in vectors
+ * of that many elements.
+ *
+ * "node" points to the kernel node.
+ *
+ * This function needs to be called after check_shared_memory_bound
+ * since the latter may remove the padding from a tile.
+ */
+static isl_stat mark_vectorized(struct ppcg_kernel *kernel,
+	__isl_keep isl_schedule_node *node)
+{
+	int i, j;
+	int width = kernel->options->vector_width;
+
+	if (width <= 1)
+		return isl_stat_ok;
+
+	for (i = 0; i < kernel->n_array; ++i) {
+		struct gpu_local_array_info *local = &kernel->array[i];
+
+		for (j = 0; j < local->n_group; ++j) {
+			struct gpu_array_ref_group *group;
+			isl_bool ok;
+
+			group = local->groups[j];
+			ok = can_vectorize(kernel, node, group, width);
+			if (ok < 0)
+				return isl_stat_error;
+			if (ok)
+				group->shared_tile->vector_width = width;
+		}
+	}
+
+	return isl_stat_ok;
+}
+
 /* Mark all arrays of "kernel" that have an array reference group
  * that is not mapped to private or shared memory as
  * accessing the corresponding global device memory.
@@ -1163,6 +1507,10 @@ struct ppcg_kernel *ppcg_kernel_free(struct ppcg_kernel *kernel)
 	isl_union_pw_multi_aff_free(kernel->contraction);
 	isl_union_set_free(kernel->expanded_domain);
 	isl_space_free(kernel->space);
+	isl_ast_expr_free(kernel->persistent_iterator);
+	isl_ast_expr_free(kernel->persistent_init);
+	isl_ast_expr_free(kernel->persistent_cond);
+	isl_ast_expr_free(kernel->persistent_inc);
 	isl_ast_node_free(kernel->tree);
 	isl_union_set_free(kernel->block_filter);
 	isl_union_set_free(kernel->thread_filter);
@@ -1192,6 +1540,38 @@ struct ppcg_kernel *ppcg_kernel_free(struct ppcg_kernel *kernel)
 	return NULL;
 }
 
+/* Free the fields of "kernel" that are only needed during
+ * the construction of its schedule tree and its AST.
+ * This is called as soon as the AST of the kernel has been generated
+ * such that these relations are not kept alive until the entire AST
+ * has been printed.
+ * The fields that are needed for printing the kernel and its launch
+ * (in particular, kernel->arrays, kernel->space and the AST expressions)
+ * are kept.
+ */
+static void ppcg_kernel_free_construction_data(struct ppcg_kernel *kernel)
+{
+	int i, j;
+
+	kernel->core = isl_union_set_free(kernel->core);
+	kernel->contraction =
+		isl_union_pw_multi_aff_free(kernel->contraction);
+	kernel->expanded_domain = isl_union_set_free(kernel->expanded_domain);
+	kernel->block_filter = isl_union_set_free(kernel->block_filter);
+	kernel->thread_filter = isl_union_set_free(kernel->thread_filter);
+	kernel->copy_schedule =
+		isl_union_pw_multi_aff_free(kernel->copy_schedule);
+	kernel->sync_writes = isl_union_set_free(kernel->sync_writes);
+
+	for (i = 0; i < kernel->n_array; ++i) {
+		struct gpu_local_array_info *array = &kernel->array[i];
+
+		for (j = 0; j < array->n_group; ++j)
+			gpu_array_ref_group_free_construction_data(
+							array->groups[j]);
+	}
+}
+
 /* Wrapper around ppcg_kernel_free for use as a isl_id_set_free_user callback.
  */
 static void ppcg_kernel_free_wrap(void *user)
@@ -1204,7 +1584,7 @@ static void ppcg_kernel_free_wrap(void *user)
 static void create_kernel_var(isl_ctx *ctx, struct gpu_array_ref_group *group,
 	struct ppcg_kernel_var *var)
 {
-	int j;
+	int j, n;
 	struct gpu_array_tile *tile;
 	isl_printer *p;
 
@@ -1218,11 +1598,16 @@ static void create_kernel_var(isl_ctx *ctx, struct gpu_array_ref_group *group,
 	var->name = isl_printer_get_str(p);
 	isl_printer_free(p);
 
-	var->size = isl_vec_alloc(ctx, group->array->n_index);
+	n = tile->double_buffer;
+	var->size = isl_vec_alloc(ctx, n + group->array->n_index);
 
+	if (tile->double_buffer)
+		var->size = isl_vec_set_element_si(var->size, 0, 2);
+	if (tile->vector_width > 1)
+		var->align = tile->vector_width * group->array->size;
 	for (j = 0; j < group->array->n_index; ++j)
-		var->size = isl_vec_set_element_val(var->size, j,
-					    isl_val_copy(tile->bound[j].size));
+		var->size = isl_vec_set_element_val(var->size, n + j,
+					    gpu_array_tile_dim_size(tile, j));
 }
 
 static int create_kernel_vars(struct ppcg_kernel *kernel)
@@ -1337,13 +1722,32 @@ static void localize_bounds(struct ppcg_kernel *kernel,
 	isl_set_free(context);
 }
 
-/* Create the array of gpu_local_array_info structures "array"
- * inside "kernel".  The number of elements in this array is
- * the same as the number of arrays in "prog".
- * Initialize the "array" field of each local array to point
- * to the corresponding array in "prog".
+/* Mark the arrays accessed by "kernel" that are not written
+ * by any reference group of the kernel as read-only.
  */
-static struct ppcg_kernel *ppcg_kernel_create_local_arrays(
+static void mark_read_only_arrays(struct ppcg_kernel *kernel)
+{
+	int i, j;
+
+	for (i = 0; i < kernel->n_array; ++i) {
+		struct gpu_local_array_info *local = &kernel->array[i];
+
+		if (local->n_group == 0)
+			continue;
+		local->read_only = 1;
+		for (j = 0; j < local->n_group; ++j)
+			if (local->groups[j]->write)
+				local->read_only = 0;
+	}
+}
+
+/* Create the array of gpu_local_array_info structures "array"
+ * inside "kernel".  The number of elements in this array is
+ * the same as the number of arrays in "prog".
+ * Initialize the "array" field of each local array to point
+ * to the corresponding array in "prog".
+ */
+static struct ppcg_kernel *ppcg_kernel_create_local_arrays(
 	struct ppcg_kernel *kernel, struct gpu_prog *prog)
 {
 	int i;
@@ -1648,7 +2052,7 @@ static __isl_give isl_multi_pw_aff *transform_index(
 					    tile->depth, dim - tile->depth);
 	pma = isl_pw_multi_aff_product(sched2depth, pma);
 	tiling = isl_multi_pw_aff_from_multi_aff(
-				    isl_multi_aff_copy(tile->tiling));
+				    gpu_array_tile_get_index(tile));
 	tiling = isl_multi_pw_aff_pullback_pw_multi_aff(tiling, pma);
 
 	index = tile_outer(index, tiling);
@@ -1781,6 +2185,61 @@ __isl_give isl_ast_expr *gpu_local_array_info_linearize_index(
 	return res;
 }
 
+/* Should the accesses to the global array "local" in "kernel"
+ * be loaded through the read-only data cache?
+ * This is only possible on the CUDA target and only for arrays
+ * that are not written by the kernel.
+ * Furthermore, __ldg is only available for the basic types.
+ */
+static int use_read_only_cache(struct ppcg_kernel *kernel,
+	struct gpu_local_array_info *local)
+{
+	int i;
+	const char *types[] = { "char", "short", "int", "long", "long long",
+		"unsigned char", "unsigned short", "unsigned int",
+		"unsigned long", "unsigned long long", "float", "double" };
+
+	if (!kernel->options->read_only_memory)
+		return 0;
+	if (kernel->options->target != PPCG_TARGET_CUDA)
+		return 0;
+	if (!local->read_only)
+		return 0;
+	for (i = 0; i < ARRAY_SIZE(types); ++i)
+		if (!strcmp(local->array->type, types[i]))
+			return 1;
+	return 0;
+}
+
+/* Replace the array element access "expr" by a call to __ldg
+ * on the address of the element.
+ * Other expressions, e.g., accesses to entire arrays or to members
+ * of structures, are left untouched.
+ */
+static __isl_give isl_ast_expr *load_through_read_only_cache(
+	__isl_take isl_ast_expr *expr)
+{
+	isl_ctx *ctx;
+	isl_ast_expr *arg0, *fn;
+	isl_ast_expr_list *args;
+	int is_id;
+
+	if (isl_ast_expr_get_type(expr) != isl_ast_expr_op ||
+	    isl_ast_expr_get_op_type(expr) != isl_ast_op_access)
+		return expr;
+	arg0 = isl_ast_expr_get_op_arg(expr, 0);
+	is_id = isl_ast_expr_get_type(arg0) == isl_ast_expr_id;
+	isl_ast_expr_free(arg0);
+	if (!is_id)
+		return expr;
+
+	ctx = isl_ast_expr_get_ctx(expr);
+	fn = isl_ast_expr_from_id(isl_id_alloc(ctx, "__ldg", NULL));
+	args = isl_ast_expr_list_from_ast_expr(isl_ast_expr_address_of(expr));
+
+	return isl_ast_expr_call(fn, args);
+}
+
 /* AST expression transformation callback for pet_stmt_build_ast_exprs.
  *
  * If the AST expression refers to an array that is not accessed
@@ -1793,6 +2252,8 @@ __isl_give isl_ast_expr *gpu_local_array_info_linearize_index(
  *
  * If the AST expression refers to an access to a global array,
  * then we linearize the access exploiting the bounds in data->local_array.
+ * If the array is only read by the kernel and if the read-only data cache
+ * should be used, then the access is furthermore loaded through __ldg.
  */
 static __isl_give isl_ast_expr *transform_expr(__isl_take isl_ast_expr *expr,
 	__isl_keep isl_id *id, void *user)
@@ -1814,10 +2275,13 @@ static __isl_give isl_ast_expr *transform_expr(__isl_take isl_ast_expr *expr,
 		return expr;
 	if (data->array->n_index == 0)
 		return dereference(expr);
-	if (!data->array->linearize)
-		return expr;
+	if (data->array->linearize)
+		expr = gpu_local_array_info_linearize_index(data->local_array,
+							    expr);
+	if (use_read_only_cache(data->kernel, data->local_array))
+		expr = load_through_read_only_cache(expr);
 
-	return gpu_local_array_info_linearize_index(data->local_array, expr);
+	return expr;
 }
 
 /* This function is called for each instance of a user statement
@@ -1832,6 +2296,8 @@ static __isl_give isl_ast_expr *transform_expr(__isl_take isl_ast_expr *expr,
  * elements in terms of the generated loops, and sched2copy,
  * which expresses the outer copy_schedule_dim dimensions of
  * the kernel schedule computed by PPCG in terms of the generated loops.
+ *
+ * If "gpu_stmt" is a reduction, then this is recorded in "kernel".
  */
 static __isl_give isl_ast_node *create_domain_leaf(
 	struct ppcg_kernel *kernel, __isl_take isl_ast_node *node,
@@ -1865,6 +2331,8 @@ static __isl_give isl_ast_node *create_domain_leaf(
 
 	stmt->type = ppcg_kernel_domain;
 	stmt->u.d.stmt = gpu_stmt;
+	if (kernel && gpu_stmt->reduction)
+		kernel->any_reduction = 1;
 
 	data.kernel = kernel;
 	data.accesses = stmt->u.d.stmt->accesses;
@@ -1953,13 +2421,16 @@ static __isl_give isl_ast_node *create_access_leaf(struct ppcg_kernel *kernel,
 
 	tile = gpu_array_ref_group_tile(group);
 	pma2 = isl_pw_multi_aff_from_multi_aff(
-					    isl_multi_aff_copy(tile->tiling));
+					    gpu_array_tile_get_index(tile));
 	pma2 = isl_pw_multi_aff_pullback_pw_multi_aff(pma2, pma);
 	expr = isl_ast_build_access_from_pw_multi_aff(build, pma2);
 	stmt->u.c.local_index = expr;
 
 	stmt->u.c.array = group->array;
 	stmt->u.c.local_array = group->local_array;
+	stmt->u.c.histogram = group->histogram;
+	if (stmt->u.c.read)
+		stmt->u.c.vector_width = tile->vector_width;
 	stmt->type = ppcg_kernel_copy;
 
 	id = isl_id_alloc(kernel->ctx, "copy", stmt);
@@ -2039,10 +2510,12 @@ static __isl_give isl_ast_node *build_array_bounds(
  * "kernel" points to the kernel to which the current schedule node
  * belongs.  It is set by before_mark and reset by after_mark.
  * It may be NULL if we are outside any kernel.
+ * "timer" measures the time spent generating the AST of the current kernel.
  */
 struct ppcg_at_domain_data {
 	struct gpu_prog *prog;
 	struct ppcg_kernel *kernel;
+	struct ppcg_timer timer;
 };
 
 /* This function is called for each instance of a user statement
@@ -2059,7 +2532,8 @@ struct ppcg_at_domain_data {
  * build_array_bounds.  Otherwise, we check if it is a copy or synchronization
  * statement and call the appropriate functions.  Statements that copy an array
  * to/from the device do not need any further treatment.
- * Neither does "clear_device".
+ * Neither do the statements that set up a window buffer for an array or
+ * "clear_device".
  */
 static __isl_give isl_ast_node *at_domain(__isl_take isl_ast_node *node,
 	__isl_keep isl_ast_build *build, void *user)
@@ -2087,7 +2561,9 @@ static __isl_give isl_ast_node *at_domain(__isl_take isl_ast_node *node,
 	if (gpu_stmt)
 		return create_domain_leaf(data->kernel, node, build, gpu_stmt);
 
-	if (!prefixcmp(name, "to_device_") || !prefixcmp(name, "from_device_"))
+	if (!prefixcmp(name, "to_device_") ||
+	    !prefixcmp(name, "from_device_") ||
+	    !prefixcmp(name, "window_device_"))
 		return node;
 	if (!strcmp(name, "init_device"))
 		return build_array_bounds(node, data->prog, build);
@@ -2388,6 +2864,7 @@ static isl_stat before_mark(__isl_keep isl_id *mark,
 		return isl_stat_error;
 	if (!strcmp(isl_id_get_name(mark), "kernel")) {
 		data->kernel = isl_id_get_user(mark);
+		ppcg_timer_start(&data->timer);
 		if (build_grid_and_local_array_sizes(data->kernel, build) < 0)
 			return isl_stat_error;
 	}
@@ -2403,6 +2880,8 @@ static isl_stat before_mark(__isl_keep isl_id *mark,
  * The original "node" is stored inside the kernel object so that
  * it can be used to print the device code.
  * Note that this assumes that a kernel is only launched once.
+ * Since the AST of the kernel is complete at this point,
+ * the data that was only needed to construct it is freed.
  * Also clear data->kernel.
  */
 static __isl_give isl_ast_node *after_mark(__isl_take isl_ast_node *node,
@@ -2428,6 +2907,9 @@ static __isl_give isl_ast_node *after_mark(__isl_take isl_ast_node *node,
 	kernel->space = isl_ast_build_get_schedule_space(build);
 	kernel->tree = isl_ast_node_mark_get_node(node);
 	isl_ast_node_free(node);
+	ppcg_kernel_free_construction_data(kernel);
+	ppcg_timer_report(&data->timer, kernel->options,
+			"kernel AST generation", "kernel", kernel->id);
 
 	expr = isl_ast_expr_from_id(isl_id_copy(id));
 	list = isl_ast_expr_list_alloc(ctx, 0);
@@ -2452,6 +2934,170 @@ static isl_bool update_depth(__isl_keep isl_schedule_node *node, void *user)
 	return isl_bool_false;
 }
 
+/* If "node" is the launch of a kernel, i.e., a user node constructed
+ * by after_mark, then return the kernel.  Otherwise, return NULL.
+ */
+static struct ppcg_kernel *get_kernel_launch(__isl_keep isl_ast_node *node)
+{
+	isl_id *id;
+	struct ppcg_kernel *kernel = NULL;
+
+	if (isl_ast_node_get_type(node) != isl_ast_node_user)
+		return NULL;
+	id = isl_ast_node_get_annotation(node);
+	if (id && !strcmp(isl_id_get_name(id), "kernel"))
+		kernel = isl_id_get_user(id);
+	isl_id_free(id);
+
+	return kernel;
+}
+
+/* Does "expr" only refer to identifiers that are available inside "kernel"
+ * and is it independent of "excluded" (if not NULL)?
+ * The identifiers that are available inside the kernel are
+ * the parameters that are passed to the kernel and
+ * the outer schedule dimensions in kernel->space.
+ */
+static isl_bool ast_expr_available_in_kernel(__isl_keep isl_ast_expr *expr,
+	struct ppcg_kernel *kernel, __isl_keep isl_id *excluded)
+{
+	int i, n;
+	isl_id *id;
+	isl_space *space;
+	isl_bool available;
+
+	switch (isl_ast_expr_get_type(expr)) {
+	case isl_ast_expr_int:
+		return isl_bool_true;
+	case isl_ast_expr_id:
+		id = isl_ast_expr_get_id(expr);
+		isl_id_free(id);
+		if (!id)
+			return isl_bool_error;
+		if (id == excluded)
+			return isl_bool_false;
+		space = isl_union_set_get_space(kernel->arrays);
+		available = isl_space_find_dim_by_id(space,
+						isl_dim_param, id) >= 0;
+		isl_space_free(space);
+		if (!available)
+			available = isl_space_find_dim_by_name(kernel->space,
+				    isl_dim_set, isl_id_get_name(id)) >= 0;
+		return available;
+	case isl_ast_expr_op:
+		n = isl_ast_expr_get_op_n_arg(expr);
+		for (i = 0; i < n; ++i) {
+			isl_ast_expr *arg;
+
+			arg = isl_ast_expr_get_op_arg(expr, i);
+			available = ast_expr_available_in_kernel(arg, kernel,
+								excluded);
+			isl_ast_expr_free(arg);
+			if (available < 0 || !available)
+				return available;
+		}
+		return isl_bool_true;
+	case isl_ast_expr_error:
+		return isl_bool_error;
+	}
+
+	return isl_bool_false;
+}
+
+/* Can the for loop "node" with iterator "iterator" around the launch
+ * of "kernel" be moved inside "kernel"?
+ *
+ * The iterator needs to be the innermost outer schedule dimension
+ * of the kernel, such that it does not get passed to the kernel and
+ * is declared by the loop inside the kernel instead.
+ * The loop bounds need to be expressible inside the kernel and
+ * the grid size should not depend on the iterator since the kernel
+ * is only launched once.
+ */
+static isl_bool can_be_persistent(struct ppcg_kernel *kernel,
+	__isl_keep isl_ast_node *node, __isl_keep isl_ast_expr *iterator)
+{
+	int n;
+	const char *name;
+	isl_id *id;
+	isl_ast_expr *expr;
+	isl_bool ok;
+
+	n = isl_space_dim(kernel->space, isl_dim_set);
+	if (n <= 0)
+		return isl_bool_false;
+	id = isl_ast_expr_get_id(iterator);
+	isl_id_free(id);
+	if (!id)
+		return isl_bool_error;
+	name = isl_space_get_dim_name(kernel->space, isl_dim_set, n - 1);
+	if (!name || strcmp(name, isl_id_get_name(id)))
+		return isl_bool_false;
+
+	ok = ast_expr_available_in_kernel(kernel->grid_size_expr, kernel, id);
+	if (ok < 0 || !ok)
+		return ok;
+	expr = isl_ast_node_for_get_init(node);
+	ok = ast_expr_available_in_kernel(expr, kernel, id);
+	isl_ast_expr_free(expr);
+	if (ok < 0 || !ok)
+		return ok;
+	expr = isl_ast_node_for_get_cond(node);
+	ok = ast_expr_available_in_kernel(expr, kernel, NULL);
+	isl_ast_expr_free(expr);
+	if (ok < 0 || !ok)
+		return ok;
+	expr = isl_ast_node_for_get_inc(node);
+	ok = ast_expr_available_in_kernel(expr, kernel, NULL);
+	isl_ast_expr_free(expr);
+
+	return ok;
+}
+
+/* This function is called after the AST generator has constructed
+ * a for node in the host code, if the persistent_kernels option is set.
+ *
+ * If the body of the for node consists of a single kernel launch and
+ * if the loop can be moved inside the kernel, then replace "node"
+ * by the kernel launch and store the loop in the kernel,
+ * such that the kernel is only launched once and iterates
+ * over the loop itself, separating the iterations by
+ * grid-wide synchronization.
+ */
+static __isl_give isl_ast_node *after_for(__isl_take isl_ast_node *node,
+	__isl_keep isl_ast_build *build, void *user)
+{
+	isl_ast_node *body;
+	isl_ast_expr *iterator;
+	struct ppcg_kernel *kernel;
+	isl_bool ok;
+
+	body = isl_ast_node_for_get_body(node);
+	kernel = get_kernel_launch(body);
+	if (!kernel || kernel->persistent_iterator) {
+		isl_ast_node_free(body);
+		return node;
+	}
+
+	iterator = isl_ast_node_for_get_iterator(node);
+	ok = can_be_persistent(kernel, node, iterator);
+	if (ok < 0 || !ok) {
+		isl_ast_expr_free(iterator);
+		isl_ast_node_free(body);
+		if (ok < 0)
+			return isl_ast_node_free(node);
+		return node;
+	}
+
+	kernel->persistent_iterator = iterator;
+	kernel->persistent_init = isl_ast_node_for_get_init(node);
+	kernel->persistent_cond = isl_ast_node_for_get_cond(node);
+	kernel->persistent_inc = isl_ast_node_for_get_inc(node);
+	isl_ast_node_free(node);
+
+	return body;
+}
+
 /* Use isl to generate code for both the host and the device
  * from "schedule".
  * The device code is marked by "kernel" mark nodes in the schedule tree,
@@ -2459,6 +3105,9 @@ static isl_bool update_depth(__isl_keep isl_schedule_node *node, void *user)
  * The returned AST only contains the AST for the host code.
  * The ASTs for the device code are embedded in ppcg_kernel objects
  * attached to the leaf nodes that call "kernel".
+ * If the persistent_kernels option is set (CUDA target only),
+ * then host loops that only launch a single kernel are moved
+ * inside the kernel by after_for.
  */
 static __isl_give isl_ast_node *generate_code(struct gpu_gen *gen,
 	__isl_take isl_schedule *schedule)
@@ -2482,6 +3131,10 @@ static __isl_give isl_ast_node *generate_code(struct gpu_gen *gen,
 	build = isl_ast_build_set_at_each_domain(build, &at_domain, &data);
 	build = isl_ast_build_set_before_each_mark(build, &before_mark, &data);
 	build = isl_ast_build_set_after_each_mark(build, &after_mark, &data);
+	if (gen->options->persistent_kernels &&
+	    gen->options->target == PPCG_TARGET_CUDA)
+		build = isl_ast_build_set_after_each_for(build,
+							&after_for, &data);
 	if (gen->prog->scop->options->debug->dump_final_schedule)
 		isl_schedule_dump(schedule);
 	tree = isl_ast_build_node_from_schedule(build, schedule);
@@ -2497,6 +3150,129 @@ __isl_give isl_union_map *extract_sizes_from_str(isl_ctx *ctx, const char *str)
 	return isl_union_map_read_from_str(ctx, str);
 }
 
+/* Parse the semicolon separated list of parameter sets in "str".
+ * Only semicolons outside of braces separate the sets.
+ * Return NULL if "str" is NULL or if any of the sets cannot be parsed.
+ */
+static __isl_give isl_set_list *extract_versions_from_str(isl_ctx *ctx,
+	const char *str)
+{
+	isl_set_list *list;
+	int depth = 0;
+	size_t start = 0, i;
+
+	if (!str)
+		return NULL;
+
+	list = isl_set_list_alloc(ctx, 1);
+	for (i = 0; list; ++i) {
+		char *piece;
+		isl_set *set;
+
+		if (str[i] == '{')
+			depth++;
+		if (str[i] == '}')
+			depth--;
+		if (str[i] && (str[i] != ';' || depth > 0))
+			continue;
+		if (strspn(str + start, " \t\n") < i - start) {
+			piece = isl_alloc_array(ctx, char, i - start + 1);
+			if (!piece)
+				return isl_set_list_free(list);
+			memcpy(piece, str + start, i - start);
+			piece[i - start] = '\0';
+			set = isl_set_read_from_str(ctx, piece);
+			if (!set)
+				fprintf(stderr, "unable to parse version '%s'\n",
+					piece);
+			free(piece);
+			list = isl_set_list_add(list, set);
+		}
+		if (!str[i])
+			break;
+		start = i + 1;
+	}
+
+	return list;
+}
+
+/* Read a line from "file", dropping the trailing newline, if any.
+ * Return NULL if there are no more lines or if an error occurred.
+ */
+static char *read_line(isl_ctx *ctx, FILE *file)
+{
+	int c;
+	size_t len = 0, size = 128;
+	char *line, *grown;
+
+	line = isl_alloc_array(ctx, char, size);
+	if (!line)
+		return NULL;
+	while ((c = fgetc(file)) != EOF && c != '\n') {
+		if (len + 1 >= size) {
+			size *= 2;
+			grown = isl_realloc_array(ctx, line, char, size);
+			if (!grown) {
+				free(line);
+				return NULL;
+			}
+			line = grown;
+		}
+		line[len++] = c;
+	}
+	if (c == EOF && len == 0) {
+		free(line);
+		return NULL;
+	}
+	line[len] = '\0';
+
+	return line;
+}
+
+/* Read the tile, grid and block sizes for the kernels in "input"
+ * from the tuning database called "db", if any.
+ * Each line in the database is of the form
+ *
+ *	<name> <sizes>
+ *
+ * with <name> the base name of an input file and <sizes> a union map
+ * in the same format as the argument of the --sizes option.
+ * Lines that do not start with the base name of "input"
+ * (e.g., comment lines starting with '#') are ignored.
+ * If there are several entries for "input", then the last one is used.
+ */
+static __isl_give isl_union_map *extract_sizes_from_tuning_db(isl_ctx *ctx,
+	const char *db, const char *input)
+{
+	FILE *file;
+	char *line;
+	const char *base;
+	size_t len;
+	isl_union_map *sizes = NULL;
+
+	if (!db || !input)
+		return NULL;
+
+	file = fopen(db, "r");
+	if (!file) {
+		fprintf(stderr, "Unable to open '%s' for reading\n", db);
+		return NULL;
+	}
+
+	base = ppcg_base_name(input);
+	len = strlen(base);
+	while ((line = read_line(ctx, file)) != NULL) {
+		if (!strncmp(line, base, len) && isspace(line[len])) {
+			isl_union_map_free(sizes);
+			sizes = isl_union_map_read_from_str(ctx, line + len);
+		}
+		free(line);
+	}
+	fclose(file);
+
+	return sizes;
+}
+
 /* Can "node" be tiled and then mapped to block and thread identifiers?
  * That is, is it permutable with at least one coincident dimension?
  */
@@ -3167,6 +3943,10 @@ static __isl_give isl_schedule_node *add_sync(struct ppcg_kernel *kernel,
  *	S -> [D -> A]
  *
  * with D the outer schedule dimensions at "node".
+ *
+ * If "group" is a privatized copy of a reduction target, then
+ * no accesses are removed since all updates of the copy need
+ * to be added to global memory.
  */
 static __isl_give isl_union_map *anchored_non_local_accesses(
 	struct ppcg_kernel *kernel, struct gpu_array_ref_group *group,
@@ -3179,8 +3959,9 @@ static __isl_give isl_union_map *anchored_non_local_accesses(
 	prefix = isl_union_map_preimage_domain_union_pw_multi_aff(prefix,
 			    isl_union_pw_multi_aff_copy(kernel->contraction));
 	access = gpu_array_ref_group_access_relation(group, read, !read);
-	access = remove_local_accesses_group(kernel, group, access, prefix,
-						read);
+	if (!group->histogram)
+		access = remove_local_accesses_group(kernel, group, access,
+							prefix, read);
 	access = isl_union_map_range_product(prefix, access);
 
 	return access;
@@ -3379,45 +4160,13 @@ static __isl_give isl_schedule_node *add_copies_group_private(
 	return node;
 }
 
-/* Add copy statements to the schedule tree of "node"
- * for reading from global memory to shared memory (if "read" is set) or
- * for writing back from shared memory to global memory
- * (if "read" is not set) for the array reference group "group" that
- * is mapped to shared memory.
- * On input, "node" points to the kernel node, and it is moved
- * back there on output.
- *
- * The copies are performed in the order of the corresponding shared
- * memory tile.
- * The copy statement instances include a reference to the outer
- * tile->depth dimensions of the kernel schedule for ease of
- * combining them with the group tiling.
- *
- * If we are performing a read from global memory to shared memory and
- * if the array involved is not a scalar, then we copy
- * the entire tile to shared memory.  This may result in some extra
- * elements getting copied, but it should lead to simpler code
- * (which means that fewer registers may be needed) and less divergence.
- *
- * Otherwise, we only copy the elements that will be read or have been written
- * in the kernel.
- *
- * That is, the extra schedule is of the form
- *
- *	type[D -> A] -> T
- *
- * where D corresponds to the outer tile->depth dimensions of
- * the kernel schedule, A to the global array and T is the corresponding
- * shared memory tile.
- *
- * The copying is inserted in the schedule tree through an extension
- * of the form
+/* Construct a graft for copying the shared memory tile of "group"
+ * based on the extension "extension" of the form
  *
  *	D -> type[D -> A]
  *
- * where the extra domain elements type[D -> A] are those accessed
- * by the group.  In the case of read from a non-scalar, this set
- * is replaced by the entire shared memory tile.
+ * and the schedule "mupa" of the form type[D -> A] -> T,
+ * mapping the copy instances to the position in the tile.
  *
  * If the "unroll_copy_shared" option is set, then the AST generator
  * is instructed to unroll the copying code.
@@ -3435,83 +4184,19 @@ static __isl_give isl_schedule_node *add_copies_group_private(
  * the dimension of the block, then the initial thread identifiers
  * are equated to zero and the remaining thread identifiers are
  * matched to the memory tile.
- *
- * The extension is inserted before the core computation in case of a read
- * and after the core computation in case of a write.
- * In the case of a read, we first need to make sure there is some
- * synchronization before the core computation such that we can put the read
- * from global memory to shared memory before that synchronization.
- * This ensures that all threads have finished copying into shared memory
- * before the shared memory is used.
- * We also need to make sure that there is a synchronization node after
- * the core computation to ensure that the next load into shared memory
- * only happens after all data has been used.  There is no need for
- * this synchronization if we are at the outer level since then there
- * won't be a next load.
- * In the case of a write, we need to make sure there is some synchronization
- * after the core computation such taht we can put the write from shared
- * memory to global memory after that synchronization.
- * Unless we are at the outer level, we also need a synchronization node
- * after the write to ensure the data is saved to global memory
- * before the next iteration write to the same shared memory.
- * It also makes sure the data has arrived in global memory before
- * it is read in a subsequent iteration.
  */
-static __isl_give isl_schedule_node *add_copies_group_shared(
+static __isl_give isl_schedule_node *create_shared_copy_graft(
 	struct ppcg_kernel *kernel, struct gpu_array_ref_group *group,
-	__isl_take isl_schedule_node *node, int read)
+	__isl_take isl_union_map *extension,
+	__isl_take isl_multi_union_pw_aff *mupa)
 {
 	struct gpu_array_tile *tile;
-	isl_union_map *access;
-	isl_union_set *domain;
-	isl_multi_aff *ma;
-	isl_multi_aff *from_access;
-	isl_multi_pw_aff *mpa;
-	isl_multi_union_pw_aff *mupa;
 	isl_schedule_node *graft;
 	isl_union_set *filter;
 	int skip;
-	int kernel_depth;
-	int empty;
 
 	tile = gpu_array_ref_group_tile(group);
-	kernel_depth = isl_schedule_node_get_schedule_depth(node);
-	node = gpu_tree_move_down_to_depth(node, tile->depth, kernel->core);
-
-	access = anchored_non_local_accesses(kernel, group, node, read);
-	empty = isl_union_map_is_empty(access);
-	if (empty < 0 || empty) {
-		isl_union_map_free(access);
-		if (empty < 0)
-			return isl_schedule_node_free(node);
-		return gpu_tree_move_up_to_kernel(node);
-	}
-
-	group->array->global = 1;
-	group->local_array->global = 1;
-
-	from_access = create_from_access(kernel->ctx, group, read);
-
-	ma = isl_multi_aff_copy(tile->tiling);
-	ma = isl_multi_aff_pullback_multi_aff(ma,
-					    isl_multi_aff_copy(from_access));
-	mpa = isl_multi_pw_aff_from_multi_aff(ma);
-	mupa = isl_multi_union_pw_aff_from_multi_pw_aff(mpa);
-
-	domain = isl_union_map_range(access);
-
-	if (read && !gpu_array_is_scalar(group->array)) {
-		isl_map *map;
-		isl_union_set_free(domain);
-		map = group_tile(group);
-		domain = isl_union_set_from_set(isl_map_wrap(map));
-	}
-
-	domain = isl_union_set_preimage_multi_aff(domain, from_access);
-	access = isl_union_set_wrapped_domain_map(domain);
-	access = isl_union_map_reverse(access);
-	access = isl_union_map_coalesce(access);
-	graft = isl_schedule_node_from_extension(access);
+	graft = isl_schedule_node_from_extension(extension);
 
 	graft = isl_schedule_node_child(graft, 0);
 
@@ -3540,6 +4225,279 @@ static __isl_give isl_schedule_node *add_copies_group_shared(
 	while (graft && isl_schedule_node_has_parent(graft))
 		graft = isl_schedule_node_parent(graft);
 
+	return graft;
+}
+
+/* Return a map from the first "depth - 1" dimensions of the elements
+ * of "dom" to the lexicographically smallest element of "dom"
+ * with those values for the first "depth - 1" dimensions.
+ * That is, map each instance of the loop at position "depth - 1"
+ * to the first iteration of that loop.
+ */
+static __isl_give isl_map *first_iteration(__isl_take isl_set *dom, int depth)
+{
+	int i;
+	isl_set *outer;
+	isl_map *map;
+
+	outer = isl_set_project_out(isl_set_copy(dom), isl_dim_set,
+					depth - 1, 1);
+	map = isl_map_from_domain_and_range(outer, dom);
+	for (i = 0; i < depth - 1; ++i)
+		map = isl_map_equate(map, isl_dim_in, i, isl_dim_out, i);
+
+	return isl_map_lexmin(map);
+}
+
+/* Add copy statements for reading the double buffered shared memory tile
+ * of "group" from global memory.
+ * "node" points to the core computation at depth tile->depth,
+ * "access" is the extension of the form
+ *
+ *	D -> type[D -> A]
+ *
+ * and "mupa" is the corresponding copy schedule.
+ *
+ * The tile is stored in one of two buffers, selected by the parity
+ * of the iteration count of the innermost dimension of D
+ * (see gpu_array_tile_get_index).
+ * During each iteration of the loop at position tile->depth - 1,
+ * the tile required by the next iteration is copied into
+ * the other buffer before the core computation, such that
+ * the loads are in flight while the core computation reads
+ * from the current buffer.
+ * The core computation is followed by a synchronization, which makes sure
+ * the next tile is available in the next iteration and that
+ * the current tile has been used completely before it gets overwritten
+ * in the next iteration.
+ * The tile required by the first iteration is copied in before the loop,
+ * followed by a synchronization.
+ *
+ * The next and first iterations are computed from the instances
+ * of the loop that are actually executed by the core computation.
+ * mark_double_buffered has already checked that consecutive iterations
+ * are a constant tile->buffer_stride apart, such that
+ * they are assigned different buffers.
+ */
+static __isl_give isl_schedule_node *add_double_buffered_copies(
+	struct ppcg_kernel *kernel, struct gpu_array_ref_group *group,
+	__isl_take isl_schedule_node *node, __isl_take isl_union_map *access,
+	__isl_take isl_multi_union_pw_aff *mupa)
+{
+	struct gpu_array_tile *tile;
+	isl_union_map *prefix;
+	isl_union_map *ext;
+	isl_set *dom;
+	isl_map *next, *first;
+	isl_schedule_node *graft;
+
+	tile = gpu_array_ref_group_tile(group);
+	prefix = isl_schedule_node_get_prefix_schedule_union_map(node);
+	prefix = isl_union_map_intersect_domain(prefix,
+					isl_union_set_copy(kernel->core));
+	dom = isl_set_from_union_set(isl_union_map_range(prefix));
+	next = next_iteration(isl_set_copy(dom), tile->depth);
+	first = first_iteration(dom, tile->depth);
+
+	ext = isl_union_map_from_map(next);
+	ext = isl_union_map_apply_range(ext, isl_union_map_copy(access));
+	graft = create_shared_copy_graft(kernel, group, ext,
+					isl_multi_union_pw_aff_copy(mupa));
+	node = isl_schedule_node_graft_before(node, graft);
+	node = gpu_tree_ensure_following_sync(node, kernel);
+	node = gpu_tree_move_up_to_kernel(node);
+
+	ext = isl_union_map_from_map(first);
+	ext = isl_union_map_apply_range(ext, access);
+	graft = create_shared_copy_graft(kernel, group, ext, mupa);
+	node = gpu_tree_move_down_to_depth(node, tile->depth - 1, kernel->core);
+	node = gpu_tree_move_left_to_sync(node, kernel);
+	node = isl_schedule_node_graft_before(node, graft);
+
+	return gpu_tree_move_up_to_kernel(node);
+}
+
+/* Divide the innermost output of "tiling" by "width".
+ */
+static __isl_give isl_multi_aff *scale_down_innermost(
+	__isl_take isl_multi_aff *tiling, int width)
+{
+	int n;
+	isl_aff *aff;
+
+	n = isl_multi_aff_dim(tiling, isl_dim_out);
+	aff = isl_multi_aff_get_aff(tiling, n - 1);
+	aff = isl_aff_scale_down_ui(aff, width);
+	aff = isl_aff_floor(aff);
+	tiling = isl_multi_aff_set_aff(tiling, n - 1, aff);
+
+	return tiling;
+}
+
+/* Replace the innermost array index in the range of "map"
+ * by the largest multiple of "width" that is smaller than or equal to it.
+ * That is, replace each accessed array element by the first element
+ * of the vector of "width" elements that contains it.
+ */
+static __isl_give isl_map *round_down_to_vector(__isl_take isl_map *map,
+	int width)
+{
+	int n;
+	isl_ctx *ctx;
+	isl_space *space;
+	isl_multi_aff *ma;
+	isl_aff *aff;
+
+	ctx = isl_map_get_ctx(map);
+	n = isl_map_dim(map, isl_dim_out);
+	space = isl_space_range(isl_map_get_space(map));
+	ma = isl_multi_aff_identity(isl_space_map_from_set(space));
+	aff = isl_multi_aff_get_aff(ma, n - 1);
+	aff = isl_aff_scale_down_ui(aff, width);
+	aff = isl_aff_floor(aff);
+	aff = isl_aff_scale_val(aff, isl_val_int_from_si(ctx, width));
+	ma = isl_multi_aff_set_aff(ma, n - 1, aff);
+
+	return isl_map_apply_range(map, isl_map_from_multi_aff(ma));
+}
+
+/* Add copy statements to the schedule tree of "node"
+ * for reading from global memory to shared memory (if "read" is set) or
+ * for writing back from shared memory to global memory
+ * (if "read" is not set) for the array reference group "group" that
+ * is mapped to shared memory.
+ * On input, "node" points to the kernel node, and it is moved
+ * back there on output.
+ *
+ * The copies are performed in the order of the corresponding shared
+ * memory tile.
+ * The copy statement instances include a reference to the outer
+ * tile->depth dimensions of the kernel schedule for ease of
+ * combining them with the group tiling.
+ *
+ * If we are performing a read from global memory to shared memory and
+ * if the array involved is not a scalar or if the tile is a privatized
+ * copy of a reduction target, then we copy
+ * the entire tile to shared memory.
+ * In the latter case, the "copy" initializes the tile to zero,
+ * while the write back atomically adds the updated elements
+ * to global memory.  This may result in some extra
+ * elements getting copied, but it should lead to simpler code
+ * (which means that fewer registers may be needed) and less divergence.
+ *
+ * Otherwise, we only copy the elements that will be read or have been written
+ * in the kernel.
+ *
+ * That is, the extra schedule is of the form
+ *
+ *	type[D -> A] -> T
+ *
+ * where D corresponds to the outer tile->depth dimensions of
+ * the kernel schedule, A to the global array and T is the corresponding
+ * shared memory tile.
+ *
+ * The copying is inserted in the schedule tree through an extension
+ * of the form
+ *
+ *	D -> type[D -> A]
+ *
+ * where the extra domain elements type[D -> A] are those accessed
+ * by the group.  In the case of read from a non-scalar, this set
+ * is replaced by the entire shared memory tile.
+ * The actual copy code is constructed by create_shared_copy_graft.
+ *
+ * If the tile is read in vectors of tile->vector_width elements,
+ * then only the first element of each vector is kept in this set and
+ * the innermost dimension of T is divided by the vector width
+ * such that consecutive vectors get assigned to consecutive threads.
+ *
+ * If the shared memory tile of a read is double buffered,
+ * then the copying is handled by add_double_buffered_copies instead.
+ *
+ * The extension is inserted before the core computation in case of a read
+ * and after the core computation in case of a write.
+ * In the case of a read, we first need to make sure there is some
+ * synchronization before the core computation such that we can put the read
+ * from global memory to shared memory before that synchronization.
+ * This ensures that all threads have finished copying into shared memory
+ * before the shared memory is used.
+ * We also need to make sure that there is a synchronization node after
+ * the core computation to ensure that the next load into shared memory
+ * only happens after all data has been used.  There is no need for
+ * this synchronization if we are at the outer level since then there
+ * won't be a next load.
+ * In the case of a write, we need to make sure there is some synchronization
+ * after the core computation such taht we can put the write from shared
+ * memory to global memory after that synchronization.
+ * Unless we are at the outer level, we also need a synchronization node
+ * after the write to ensure the data is saved to global memory
+ * before the next iteration write to the same shared memory.
+ * It also makes sure the data has arrived in global memory before
+ * it is read in a subsequent iteration.
+ */
+static __isl_give isl_schedule_node *add_copies_group_shared(
+	struct ppcg_kernel *kernel, struct gpu_array_ref_group *group,
+	__isl_take isl_schedule_node *node, int read)
+{
+	struct gpu_array_tile *tile;
+	isl_union_map *access;
+	isl_union_set *domain;
+	isl_multi_aff *ma;
+	isl_multi_aff *from_access;
+	isl_multi_pw_aff *mpa;
+	isl_multi_union_pw_aff *mupa;
+	isl_schedule_node *graft;
+	int kernel_depth;
+	int empty;
+
+	tile = gpu_array_ref_group_tile(group);
+	kernel_depth = isl_schedule_node_get_schedule_depth(node);
+	node = gpu_tree_move_down_to_depth(node, tile->depth, kernel->core);
+
+	access = anchored_non_local_accesses(kernel, group, node, read);
+	empty = isl_union_map_is_empty(access);
+	if (empty < 0 || empty) {
+		isl_union_map_free(access);
+		if (empty < 0)
+			return isl_schedule_node_free(node);
+		return gpu_tree_move_up_to_kernel(node);
+	}
+
+	group->array->global = 1;
+	group->local_array->global = 1;
+
+	from_access = create_from_access(kernel->ctx, group, read);
+
+	ma = isl_multi_aff_copy(tile->tiling);
+	if (read && tile->vector_width > 1)
+		ma = scale_down_innermost(ma, tile->vector_width);
+	ma = isl_multi_aff_pullback_multi_aff(ma,
+					    isl_multi_aff_copy(from_access));
+	mpa = isl_multi_pw_aff_from_multi_aff(ma);
+	mupa = isl_multi_union_pw_aff_from_multi_pw_aff(mpa);
+
+	domain = isl_union_map_range(access);
+
+	if (read && (group->histogram || !gpu_array_is_scalar(group->array))) {
+		isl_map *map;
+		isl_union_set_free(domain);
+		map = group_tile(group);
+		if (tile->vector_width > 1)
+			map = round_down_to_vector(map, tile->vector_width);
+		domain = isl_union_set_from_set(isl_map_wrap(map));
+	}
+
+	domain = isl_union_set_preimage_multi_aff(domain, from_access);
+	access = isl_union_set_wrapped_domain_map(domain);
+	access = isl_union_map_reverse(access);
+	access = isl_union_map_coalesce(access);
+
+	if (read && tile->double_buffer)
+		return add_double_buffered_copies(kernel, group, node,
+						access, mupa);
+
+	graft = create_shared_copy_graft(kernel, group, access, mupa);
+
 	if (read) {
 		if (kernel_depth < tile->depth)
 			node = gpu_tree_ensure_sync_after_core(node, kernel);
@@ -3818,6 +4776,7 @@ __isl_give isl_schedule_node *gpu_create_kernel(struct gpu_gen *gen,
 	isl_set *host_domain;
 	isl_union_set *domain, *expanded;
 	int single_statement;
+	struct ppcg_timer timer;
 
 	node = gpu_tree_insert_shared_before_thread(node);
 	if (!node)
@@ -3904,14 +4863,23 @@ __isl_give isl_schedule_node *gpu_create_kernel(struct gpu_gen *gen,
 
 	node = gpu_tree_move_up_to_kernel(node);
 
+	ppcg_timer_start(&timer);
 	if (gpu_group_references(kernel, node) < 0)
 		node = isl_schedule_node_free(node);
+	ppcg_timer_report(&timer, kernel->options, "gpu_group_references",
+			"kernel", kernel->id);
 	localize_bounds(kernel, host_domain);
 	isl_set_free(host_domain);
+	mark_read_only_arrays(kernel);
 
 	check_shared_memory_bound(kernel);
+	mark_double_buffered(kernel, node);
+	if (mark_vectorized(kernel, node) < 0)
+		node = isl_schedule_node_free(node);
 	mark_global_arrays(kernel);
 	compute_group_tilings(kernel);
+	if (gen->report)
+		gpu_report_kernel(gen->report, kernel);
 
 	node = gpu_tree_move_down_to_thread(node, kernel->core);
 	node = isl_schedule_node_child(node, 0);
@@ -3998,10 +4966,13 @@ static __isl_give isl_schedule_node *insert_empty_permutable_band(
  * than are available.  In this case, the remaining schedule dimensions
  * are split off and the dependence distances should be computed
  * after these dimensions have been split off.
+ * The tile sizes are only added to gen->used_sizes after
+ * gpu_hybrid_tile has had a chance to enlarge them.
  */
 static __isl_give isl_schedule_node *try_hybrid_tile(struct gpu_gen *gen,
 	__isl_take isl_schedule_node *node)
 {
+	int id;
 	int tile_len;
 	int *tile_size;
 	isl_bool ok;
@@ -4014,31 +4985,348 @@ static __isl_give isl_schedule_node *try_hybrid_tile(struct gpu_gen *gen,
 	if (!ok)
 		return orig;
 
-	tile_len = 1 + isl_schedule_node_band_n_member(node);
-	tile_size = read_tile_sizes(gen, &tile_len);
-	if (!tile_size)
-		return isl_schedule_node_free(node);
+	id = gen->kernel_id;
+	tile_len = 1 + isl_schedule_node_band_n_member(node);
+	tile_size = extract_tile_sizes(gen, &tile_len);
+	if (!tile_size)
+		return isl_schedule_node_free(node);
+
+	node = isl_schedule_node_copy(node);
+	node = split_band(node, tile_len - 1);
+	node = isl_schedule_node_parent(node);
+	bounds = ppcg_ht_compute_bounds(gen->prog->scop, node);
+	node = isl_schedule_node_child(node, 0);
+
+	ok = ppcg_ht_bounds_is_valid(bounds);
+	if (ok >= 0 && ok)
+		node = gpu_hybrid_tile(gen, node, bounds, tile_size);
+	else
+		ppcg_ht_bounds_free(bounds);
+	set_used_sizes(gen, "tile", id, tile_size, tile_len);
+	free(tile_size);
+
+	if (ok >= 0 && !ok) {
+		isl_schedule_node_free(node);
+		return orig;
+	}
+	isl_schedule_node_free(orig);
+	if (ok < 0)
+		return isl_schedule_node_free(node);
+	return node;
+}
+
+/* Estimate the amount of shared memory (in bytes) needed
+ * by a tile of the band with the "tile_len" tile sizes "tile_size"
+ * if all arrays accessed by the instances in "arrays" are mapped
+ * to shared memory.
+ * Scalars are ignored since they are mapped to private memory.
+ * The footprint of an array with n indices is approximated by
+ * the size of an element times the product of the innermost
+ * (at most) n tile sizes.
+ */
+static long estimate_tile_footprint(struct gpu_prog *prog,
+	__isl_keep isl_union_set *arrays, int *tile_size, int tile_len)
+{
+	int i, j;
+	long footprint = 0;
+
+	for (i = 0; i < prog->n_array; ++i) {
+		struct gpu_array_info *array = &prog->array[i];
+		isl_set *accessed;
+		long size;
+		int empty;
+		int n;
+
+		if (gpu_array_is_scalar(array))
+			continue;
+		accessed = isl_union_set_extract_set(arrays,
+						isl_space_copy(array->space));
+		empty = isl_set_plain_is_empty(accessed);
+		isl_set_free(accessed);
+		if (empty < 0)
+			return -1;
+		if (empty)
+			continue;
+
+		n = array->n_index < tile_len ? array->n_index : tile_len;
+		size = array->size;
+		for (j = tile_len - n; j < tile_len; ++j)
+			size *= tile_size[j];
+		footprint += size;
+	}
+
+	return footprint;
+}
+
+/* Adjust the default tile sizes "tile_size" of the band node "node"
+ * such that the estimated shared memory footprint of a tile
+ * fits within the maximal amount of shared memory.
+ * The tile sizes are halved one at a time, each time picking
+ * the largest one and preferring outer dimensions in case of ties,
+ * such that the innermost tile size, which determines the coalescing
+ * of global memory accesses, is only reduced when needed.
+ * Only tile sizes that affect the estimated footprint are considered,
+ * i.e., those for which halving reduces the footprint.
+ * If none of them does, then the tile sizes are kept as they are.
+ * If shared memory is not used, then the default tile sizes are kept.
+ */
+static int model_tile_sizes(struct gpu_gen *gen,
+	__isl_keep isl_schedule_node *node, int *tile_size, int tile_len)
+{
+	isl_union_set *domain, *arrays;
+	isl_union_pw_multi_aff *contraction;
+	long footprint;
+
+	if (!gen->options->use_shared_memory || tile_len == 0)
+		return 0;
+
+	domain = isl_schedule_node_get_domain(node);
+	contraction = isl_schedule_node_get_subtree_contraction(node);
+	domain = isl_union_set_preimage_union_pw_multi_aff(domain,
+							contraction);
+	arrays = accessed_by_domain(domain, gen->prog);
+
+	footprint = estimate_tile_footprint(gen->prog, arrays,
+						tile_size, tile_len);
+	while (footprint > gen->options->max_shared_memory) {
+		int i, max = -1;
+		long new_footprint = footprint;
+
+		for (i = 0; i < tile_len; ++i) {
+			int size = tile_size[i];
+			long halved;
+
+			if (size <= 1 || (max >= 0 && size <= tile_size[max]))
+				continue;
+			tile_size[i] = size / 2;
+			halved = estimate_tile_footprint(gen->prog, arrays,
+							tile_size, tile_len);
+			tile_size[i] = size;
+			if (halved < 0) {
+				new_footprint = -1;
+				break;
+			}
+			if (halved >= footprint)
+				continue;
+			max = i;
+			new_footprint = halved;
+		}
+		if (new_footprint < 0) {
+			footprint = -1;
+			break;
+		}
+		if (max < 0)
+			break;
+		tile_size[max] /= 2;
+		footprint = new_footprint;
+	}
+	isl_union_set_free(arrays);
+
+	return footprint < 0 ? -1 : 0;
+}
+
+/* Extract the tile sizes for the band node "node" from the "sizes"
+ * command line option or the tuning database,
+ * similarly to read_tile_sizes.
+ * If no sizes have been specified for the current kernel and
+ * the "analytical_tile_size" option is set, then derive the tile sizes
+ * from the estimated shared memory footprint of a tile instead
+ * of using option->tile_size in each dimension.
+ */
+static int *read_band_tile_sizes(struct gpu_gen *gen,
+	__isl_keep isl_schedule_node *node, int *tile_len)
+{
+	int n;
+	int *tile_size;
+	isl_set *size;
+
+	if (!gen->options->analytical_tile_size)
+		return read_tile_sizes(gen, tile_len);
+	size = get_sizes(gen, "tile", gen->kernel_id);
+	if (size) {
+		isl_set_free(size);
+		return read_tile_sizes(gen, tile_len);
+	}
+
+	tile_size = isl_alloc_array(gen->ctx, int, *tile_len);
+	if (!tile_size)
+		return NULL;
+	for (n = 0; n < *tile_len; ++n)
+		tile_size[n] = gen->options->tile_size;
+	if (model_tile_sizes(gen, node, tile_size, *tile_len) < 0) {
+		free(tile_size);
+		return NULL;
+	}
+	set_used_sizes(gen, "tile", gen->kernel_id, tile_size, *tile_len);
+
+	return tile_size;
+}
+
+/* Apply thread coarsening to the point band "node", if requested
+ * through the user specified "coarsen" sizes of the current kernel.
+ * These sizes default to 1, meaning that no coarsening is applied.
+ *
+ * If any of these sizes is greater than 1, then the point band is tiled
+ * with the coarsening factors.  The resulting tile band is the one
+ * that will get mapped to threads, such that each thread executes
+ * a block of consecutive points, as expressed by the point band
+ * of this tiling.  The AST generator is instructed to unroll
+ * this inner point band such that the array elements that are reused
+ * by a thread and that get mapped to private memory
+ * by add_copies_group_private can be kept in registers.
+ *
+ * Return a pointer to the band that needs to be mapped to threads.
+ */
+static __isl_give isl_schedule_node *coarsen_band(struct gpu_gen *gen,
+	__isl_take isl_schedule_node *node)
+{
+	int i, n, len;
+	int any = 0;
+	int *factor;
+	isl_multi_val *sizes;
+
+	n = isl_schedule_node_band_n_member(node);
+	factor = isl_alloc_array(gen->ctx, int, n);
+	if (n > 0 && !factor)
+		return isl_schedule_node_free(node);
+	for (i = 0; i < n; ++i)
+		factor[i] = 1;
+	len = n;
+	ppcg_read_sizes_from_set(get_sizes(gen, "coarsen", gen->kernel_id),
+				factor, &len);
+	for (i = 0; i < n; ++i)
+		if (factor[i] > 1)
+			any = 1;
+	if (!any) {
+		free(factor);
+		return node;
+	}
+
+	set_used_sizes(gen, "coarsen", gen->kernel_id, factor, n);
+	sizes = construct_band_tiles_sizes(node, factor);
+	free(factor);
+	node = tile_band(node, sizes);
+	node = isl_schedule_node_child(node, 0);
+	node = ppcg_set_schedule_node_type(node, isl_ast_loop_unroll);
+	node = isl_schedule_node_parent(node);
+
+	return node;
+}
+
+/* Compute the full tiles of the tile band "node" obtained by tile_band
+ * with tile sizes "sizes".
+ * That is, compute the elements
+ *
+ *	[O; T]
+ *
+ * with O the outer schedule dimensions and T the tile dimensions
+ * such that every point P with 0 <= P < sizes of the point band
+ * (the child of "node") appears in the schedule.
+ * Since tile_band shifts the point loops to start at zero,
+ * these are the tiles that do not touch the boundary of the domain.
+ */
+static __isl_give isl_set *compute_full_tiles(
+	__isl_keep isl_schedule_node *node, __isl_keep isl_multi_val *sizes)
+{
+	int i, n;
+	isl_schedule_node *child;
+	isl_union_set *domain;
+	isl_union_map *prefix, *tile, *point;
+	isl_set *tiles;
+	isl_map *el, *box;
+
+	domain = isl_schedule_node_get_domain(node);
+	prefix = isl_schedule_node_get_prefix_schedule_union_map(node);
+	tile = isl_schedule_node_band_get_partial_schedule_union_map(node);
+	prefix = isl_union_map_flat_range_product(prefix, tile);
+	child = isl_schedule_node_get_child(node, 0);
+	point = isl_schedule_node_band_get_partial_schedule_union_map(child);
+	isl_schedule_node_free(child);
+	prefix = isl_union_map_range_product(prefix, point);
+	domain = isl_union_set_apply(domain, prefix);
+	el = isl_set_unwrap(isl_set_from_union_set(domain));
+	el = isl_map_coalesce(el);
+
+	tiles = isl_map_domain(isl_map_copy(el));
+	box = isl_map_universe(isl_map_get_space(el));
+	box = isl_map_intersect_domain(box, isl_set_copy(tiles));
+	n = isl_map_dim(box, isl_dim_out);
+	for (i = 0; i < n; ++i) {
+		isl_val *v;
+
+		v = isl_multi_val_get_val(sizes, i);
+		box = isl_map_lower_bound_si(box, isl_dim_out, i, 0);
+		box = isl_map_upper_bound_si(box, isl_dim_out, i,
+						isl_val_get_num_si(v) - 1);
+		isl_val_free(v);
+	}
+	box = isl_map_subtract(box, el);
+
+	return isl_set_subtract(tiles, isl_map_domain(box));
+}
+
+/* Add "isolate" as an isolate option to the band node "node".
+ */
+static __isl_give isl_schedule_node *band_add_isolate(
+	__isl_take isl_schedule_node *node, __isl_take isl_set *isolate)
+{
+	isl_union_set *opt;
+
+	isolate = isl_set_set_tuple_name(isolate, "isolate");
+	opt = isl_schedule_node_band_get_ast_build_options(node);
+	opt = isl_union_set_add_set(opt, isolate);
+	return isl_schedule_node_band_set_ast_build_options(node, opt);
+}
+
+/* Isolate the full tiles "full", computed by compute_full_tiles,
+ * from the partial tiles in the kernel.
+ * "node" points to the band that will be mapped to threads, which
+ * is a child of the tile band that will be mapped to blocks.
+ *
+ * The tile band is instructed to generate the full tiles separately,
+ * with the same AST loop types, such that the loops inside
+ * the full tiles do not need any boundary guards.
+ * The thread band receives an isolate option that covers all its
+ * iterations within a full tile such that, if "unroll" is set,
+ * only the loops of the full tiles get unrolled, while
+ * the partial tiles keep the guarded loops.
+ */
+static __isl_give isl_schedule_node *isolate_full_gpu_tiles(
+	__isl_take isl_schedule_node *node, __isl_take isl_set *full,
+	int unroll)
+{
+	int i, n, depth;
+	isl_map *map;
+
+	n = isl_schedule_node_band_n_member(node);
+	map = isl_map_from_domain(isl_set_copy(full));
+	map = isl_map_add_dims(map, isl_dim_out, n);
+	node = band_add_isolate(node, isl_map_wrap(map));
+	for (i = 0; i < n; ++i) {
+		enum isl_ast_loop_type type = isl_ast_loop_unroll;
+
+		if (!unroll)
+			type = isl_schedule_node_band_member_get_ast_loop_type(
+								node, i);
+		node = isl_schedule_node_band_member_set_isolate_ast_loop_type(
+								node, i, type);
+	}
 
-	node = isl_schedule_node_copy(node);
-	node = split_band(node, tile_len - 1);
 	node = isl_schedule_node_parent(node);
-	bounds = ppcg_ht_compute_bounds(gen->prog->scop, node);
-	node = isl_schedule_node_child(node, 0);
-
-	ok = ppcg_ht_bounds_is_valid(bounds);
-	if (ok >= 0 && ok)
-		node = gpu_hybrid_tile(gen, node, bounds, tile_size);
-	else
-		ppcg_ht_bounds_free(bounds);
-	free(tile_size);
+	depth = isl_schedule_node_get_schedule_depth(node);
+	n = isl_schedule_node_band_n_member(node);
+	map = isl_map_from_range(full);
+	map = isl_map_move_dims(map, isl_dim_in, 0, isl_dim_out, 0, depth);
+	node = band_add_isolate(node, isl_map_wrap(map));
+	for (i = 0; i < n; ++i) {
+		enum isl_ast_loop_type type;
 
-	if (ok >= 0 && !ok) {
-		isl_schedule_node_free(node);
-		return orig;
+		type = isl_schedule_node_band_member_get_ast_loop_type(node, i);
+		node = isl_schedule_node_band_member_set_isolate_ast_loop_type(
+								node, i, type);
 	}
-	isl_schedule_node_free(orig);
-	if (ok < 0)
-		return isl_schedule_node_free(node);
+	node = isl_schedule_node_child(node, 0);
+
 	return node;
 }
 
@@ -4057,11 +5345,16 @@ static __isl_give isl_schedule_node *try_hybrid_tile(struct gpu_gen *gen,
  * but one without any coincident dimension.  In this case,
  * the extra node ensures that this original node does not get tiled.
  *
- * Tile "node" using user specified tile sizes, after splitting the band
+ * Tile "node" using user specified (or modeled) tile sizes,
+ * after splitting the band
  * if the number of specified tile sizes is smaller than the dimension
- * of the band.  Mark the point band of this tiling as the band that
+ * of the band.  Mark the point band of this tiling (or the outer band
+ * of its coarsening, see coarsen_band) as the band that
  * needs to be mapped to threads and instruct the AST generator to unroll
  * the band if the "unroll_gpu_tile" option is set.
+ * If the "isolate_full_tiles" option is set, then the full tiles
+ * are isolated from the partial tiles and only the full tiles
+ * are unrolled.
  * Create a kernel representing the domain instances that reach "node" and
  * insert a mark node pointing to the ppcg_kernel before the band node.
  */
@@ -4075,6 +5368,7 @@ static __isl_give isl_schedule_node *mark_outer_permutable(
 	int *tile_size;
 	isl_id *id;
 	isl_multi_val *sizes;
+	isl_set *full = NULL;
 
 	outer = is_outer_tilable(node);
 	if (outer < 0)
@@ -4095,15 +5389,24 @@ static __isl_give isl_schedule_node *mark_outer_permutable(
 		node = insert_empty_permutable_band(node);
 
 	tile_len = isl_schedule_node_band_n_member(node);
-	tile_size = read_tile_sizes(gen, &tile_len);
+	tile_size = read_band_tile_sizes(gen, node, &tile_len);
 	if (!tile_size)
 		return isl_schedule_node_free(node);
 	if (tile_len < isl_schedule_node_band_n_member(node))
 		node = isl_schedule_node_band_split(node, tile_len);
 	sizes = construct_band_tiles_sizes(node, tile_size);
 	node = tile_band(node, isl_multi_val_copy(sizes));
+	if (gen->options->isolate_full_tiles && tile_len > 0) {
+		full = compute_full_tiles(node, sizes);
+		if (!full)
+			node = isl_schedule_node_free(node);
+	}
 	node = isl_schedule_node_child(node, 0);
-	if (gen->options->unroll_gpu_tile)
+	node = coarsen_band(gen, node);
+	if (full)
+		node = isolate_full_gpu_tiles(node, full,
+					gen->options->unroll_gpu_tile);
+	else if (gen->options->unroll_gpu_tile)
 		node = ppcg_set_schedule_node_type(node, isl_ast_loop_unroll);
 	id = isl_id_alloc(gen->ctx, "thread", NULL);
 	node = isl_schedule_node_insert_mark(node, id);
@@ -4264,8 +5567,80 @@ static __isl_give isl_schedule_node *isolate_permutable_subtrees(
 	return node;
 }
 
+/* Should only a slab of "array" be copied to or from the device?
+ * That is, is the "partial_transfers" option set or does the device
+ * only hold a window of the array (see plan_out_of_core)
+ * and does the array have at least one index?
+ */
+static int use_slab_transfers(struct gpu_prog *prog,
+	struct gpu_array_info *array)
+{
+	if (array->n_index == 0)
+		return 0;
+	return prog->scop->options->partial_transfers || array->windowed;
+}
+
+/* Return the elements of "extent" of which the outermost index
+ * lies between the minimal and the maximal outermost index
+ * of the elements in "accessed" for the same prefix schedule value.
+ * "accessed" maps prefix schedule values to elements of
+ * an array with at least one index and "extent" lives
+ * in the space of this array.
+ */
+static __isl_give isl_map *outer_slab(__isl_take isl_map *accessed,
+	__isl_take isl_set *extent)
+{
+	int n;
+	isl_id *id;
+	isl_space *space;
+	isl_set *domain;
+	isl_map *lo, *hi, *slab;
+
+	n = isl_map_dim(accessed, isl_dim_out);
+	domain = isl_map_domain(isl_map_copy(accessed));
+	accessed = isl_map_project_out(accessed, isl_dim_out, 1, n - 1);
+	space = isl_space_range(isl_map_get_space(accessed));
+	lo = isl_map_lexmin(isl_map_copy(accessed));
+	hi = isl_map_lexmax(accessed);
+	lo = isl_map_apply_range(lo, isl_map_lex_le(isl_space_copy(space)));
+	hi = isl_map_apply_range(hi, isl_map_lex_ge(space));
+	slab = isl_map_intersect(lo, hi);
+	slab = isl_map_add_dims(slab, isl_dim_out, n - 1);
+	id = isl_set_get_tuple_id(extent);
+	slab = isl_map_set_tuple_id(slab, isl_dim_out, id);
+	slab = isl_map_intersect_range(slab, extent);
+
+	return isl_map_intersect_domain(slab, domain);
+}
+
+/* Return the part of the extent of "array" that needs to be copied out
+ * if the elements in "accessed" may be written, for each prefix
+ * schedule value in the domain of "accessed".
+ * That is, return the entire extent, unless only a slab of the array
+ * should be transferred (see use_slab_transfers).
+ * In the latter case, only return the slab of elements between
+ * the minimal and maximal outermost index of the elements in "accessed".
+ * Note that the elements in this slab that are not definitely written
+ * will then also be copied in by add_to_from_device.
+ */
+static __isl_give isl_map *copy_out_extent(struct gpu_prog *prog,
+	struct gpu_array_info *array, __isl_take isl_map *accessed)
+{
+	isl_set *extent;
+
+	extent = isl_set_copy(array->extent);
+	if (!use_slab_transfers(prog, array)) {
+		isl_set *domain = isl_map_domain(accessed);
+		return isl_map_from_domain_and_range(domain, extent);
+	}
+
+	return outer_slab(accessed, extent);
+}
+
 /* Replace any reference to an array element in the range of "copy"
- * by a reference to all array elements (defined by the extent of the array).
+ * by a reference to all array elements (defined by the extent of the array)
+ * or, if only a slab of the array is transferred, by a reference
+ * to the slab of array elements computed by copy_out_extent.
  */
 static __isl_give isl_union_map *approximate_copy_out(
 	__isl_take isl_union_map *copy, struct gpu_prog *prog)
@@ -4277,19 +5652,25 @@ static __isl_give isl_union_map *approximate_copy_out(
 
 	for (i = 0; i < prog->n_array; ++i) {
 		isl_space *space;
-		isl_set *set;
 		isl_union_map *copy_i;
-		isl_union_set *extent, *domain;
+		isl_union_set *extent;
+		isl_map *map;
+		isl_bool empty;
 
 		space = isl_space_copy(prog->array[i].space);
 		extent = isl_union_set_from_set(isl_set_universe(space));
 		copy_i = isl_union_map_copy(copy);
 		copy_i = isl_union_map_intersect_range(copy_i, extent);
-		set = isl_set_copy(prog->array[i].extent);
-		extent = isl_union_set_from_set(set);
-		domain = isl_union_map_domain(copy_i);
-		copy_i = isl_union_map_from_domain_and_range(domain, extent);
-		res = isl_union_map_union(res, copy_i);
+		empty = isl_union_map_is_empty(copy_i);
+		if (empty < 0 || empty) {
+			isl_union_map_free(copy_i);
+			if (empty < 0)
+				res = isl_union_map_free(res);
+			continue;
+		}
+		map = isl_map_from_union_map(copy_i);
+		map = copy_out_extent(prog, &prog->array[i], map);
+		res = isl_union_map_add_map(res, map);
 	}
 
 	isl_union_map_free(copy);
@@ -4336,12 +5717,16 @@ static __isl_give isl_schedule_node *mark_kernels(struct gpu_gen *gen,
  * There is no need for a per array handling of the other two sets
  * as there should be no flow or external false dependence on local
  * variables that can be filtered out.
+ *
+ * In both cases, the dependences between reduction statement instances
+ * updating the same element are removed from the coincidence constraints
+ * since these updates are performed atomically inside a kernel.
  */
 static __isl_give isl_schedule_constraints *construct_schedule_constraints(
 	struct gpu_prog *prog)
 {
 	isl_union_set *domain;
-	isl_union_map *dep_raw, *dep;
+	isl_union_map *dep_raw, *dep, *order, *forced;
 	isl_union_map *validity, *proximity, *coincidence;
 	isl_schedule_constraints *sc;
 
@@ -4350,13 +5735,15 @@ static __isl_give isl_schedule_constraints *construct_schedule_constraints(
 	sc = isl_schedule_constraints_set_context(sc,
 				isl_set_copy(prog->scop->context));
 	if (prog->scop->options->live_range_reordering) {
+		order = ppcg_scop_get_tagged_dep_order(prog->scop);
 		sc = isl_schedule_constraints_set_conditional_validity(sc,
 			isl_union_map_copy(prog->scop->tagged_dep_flow),
-			isl_union_map_copy(prog->scop->tagged_dep_order));
+			isl_union_map_copy(order));
+		forced = ppcg_scop_get_dep_forced(prog->scop);
 		proximity = isl_union_map_copy(prog->scop->dep_flow);
 		validity = isl_union_map_copy(proximity);
 		validity = isl_union_map_union(validity,
-			    isl_union_map_copy(prog->scop->dep_forced));
+			    isl_union_map_copy(forced));
 		proximity = isl_union_map_union(proximity,
 			    isl_union_map_copy(prog->scop->dep_false));
 		coincidence = isl_union_map_copy(validity);
@@ -4373,6 +5760,8 @@ static __isl_give isl_schedule_constraints *construct_schedule_constraints(
 		coincidence = isl_union_map_copy(dep);
 		validity = dep;
 	}
+	coincidence = isl_union_map_subtract(coincidence,
+			ppcg_scop_reduction_dependences(prog->scop));
 	sc = isl_schedule_constraints_set_validity(sc, validity);
 	sc = isl_schedule_constraints_set_coincidence(sc, coincidence);
 	sc = isl_schedule_constraints_set_proximity(sc, proximity);
@@ -4380,6 +5769,9 @@ static __isl_give isl_schedule_constraints *construct_schedule_constraints(
 	return sc;
 }
 
+static __isl_give isl_schedule *determine_properties_original_schedule(
+	struct gpu_gen *gen);
+
 /* Compute an appropriate schedule based on the accesses in
  * gen->read and gen->write.
  *
@@ -4388,6 +5780,8 @@ static __isl_give isl_schedule_constraints *construct_schedule_constraints(
  * in each tilable band.
  * During the schedule construction, some statement instances
  * may be grouped first based on the input schedule.
+ * If the scheduler exceeds its budget, then fall back
+ * to the original schedule.
  */
 static __isl_give isl_schedule *compute_schedule(struct gpu_gen *gen)
 {
@@ -4397,6 +5791,8 @@ static __isl_give isl_schedule *compute_schedule(struct gpu_gen *gen)
 	sc = construct_schedule_constraints(gen->prog);
 	schedule = gen->prog->scop->schedule;
 	schedule = ppcg_compute_schedule(sc, schedule, gen->options);
+	if (!schedule && ppcg_schedule_out_of_budget(gen->ctx))
+		return determine_properties_original_schedule(gen);
 
 	return schedule;
 }
@@ -4413,23 +5809,21 @@ static __isl_give isl_schedule_node *band_set_permutable(
 	return node;
 }
 
-/* Return the coincidence constraints between pairs of instances
+/* Return the dependences in "dep" between pairs of instances
  * that are scheduled together by the ancestors of "node".
- * That is, select those coincidence constraints that relate
+ * That is, select those dependences that relate
  * pairs of instances that have the same value for the prefix schedule.
  * If the schedule depth is zero, then the prefix schedule does not
  * contain any information, so we intersect domain and range
- * of the schedule constraints with the reaching domain elements instead.
+ * of the dependences with the reaching domain elements instead.
  */
-static __isl_give isl_union_map *get_local_coincidence(
-	__isl_keep isl_schedule_node *node,
-	__isl_keep isl_schedule_constraints *sc)
+static __isl_give isl_union_map *get_local_dependences(
+	__isl_keep isl_schedule_node *node, __isl_take isl_union_map *dep)
 {
-	isl_union_map *coincidence;
+	isl_union_map *coincidence = dep;
 	isl_multi_union_pw_aff *prefix;
 	isl_union_pw_multi_aff *contraction;
 
-	coincidence = isl_schedule_constraints_get_coincidence(sc);
 	contraction = isl_schedule_node_get_subtree_contraction(node);
 	if (isl_schedule_node_get_schedule_depth(node) == 0) {
 		isl_union_set *domain;
@@ -4450,6 +5844,19 @@ static __isl_give isl_union_map *get_local_coincidence(
 	return isl_union_map_eq_at_multi_union_pw_aff(coincidence, prefix);
 }
 
+/* Return the coincidence constraints between pairs of instances
+ * that are scheduled together by the ancestors of "node".
+ */
+static __isl_give isl_union_map *get_local_coincidence(
+	__isl_keep isl_schedule_node *node,
+	__isl_keep isl_schedule_constraints *sc)
+{
+	isl_union_map *coincidence;
+
+	coincidence = isl_schedule_constraints_get_coincidence(sc);
+	return get_local_dependences(node, coincidence);
+}
+
 /* For each member in the band node "node", determine whether
  * it is coincident with respect to the outer nodes and mark
  * it accordingly.
@@ -4569,6 +5976,422 @@ static __isl_give isl_schedule *get_schedule(struct gpu_gen *gen)
 				&compute_or_set_properties, gen);
 }
 
+/* Internal data structure for fuse_kernels.
+ *
+ * "sc" contains the schedule constraints of the program.
+ * "validity" contains all dependences that need to be respected
+ * by a fused band, including the array order dependences
+ * if live range reordering is allowed.
+ */
+struct ppcg_fuse_data {
+	isl_schedule_constraints *sc;
+	isl_union_map *validity;
+};
+
+/* Does "node" have any ancestor that is a suitably permutable band?
+ */
+static isl_bool has_permutable_ancestor(__isl_keep isl_schedule_node *node)
+{
+	isl_bool permutable = isl_bool_false;
+	isl_schedule_node *ancestor;
+
+	ancestor = isl_schedule_node_copy(node);
+	while (!permutable && isl_schedule_node_has_parent(ancestor)) {
+		ancestor = isl_schedule_node_parent(ancestor);
+		permutable = is_permutable(ancestor);
+		if (permutable < 0)
+			break;
+	}
+	isl_schedule_node_free(ancestor);
+
+	return permutable;
+}
+
+/* Is child "pos" of the sequence node "node" a filter with
+ * a suitably permutable band as its child?
+ * If so and if "n_member" is negative, then set "n_member"
+ * to the number of members of this band.
+ * Otherwise, the band is required to have exactly "n_member" members.
+ */
+static isl_bool is_fusion_candidate(__isl_keep isl_schedule_node *node,
+	int pos, int *n_member)
+{
+	isl_bool candidate;
+	int n;
+
+	node = isl_schedule_node_get_child(node, pos);
+	node = isl_schedule_node_child(node, 0);
+	candidate = is_permutable(node);
+	if (candidate == isl_bool_true) {
+		n = isl_schedule_node_band_n_member(node);
+		if (*n_member < 0)
+			*n_member = n;
+		else if (n != *n_member)
+			candidate = isl_bool_false;
+	}
+	isl_schedule_node_free(node);
+
+	return candidate;
+}
+
+/* Return the filter of child "pos" of the sequence node "node",
+ * pulled back to the original statement instances using "contraction".
+ */
+static __isl_give isl_union_set *child_instances(
+	__isl_keep isl_schedule_node *node, int pos,
+	__isl_keep isl_union_pw_multi_aff *contraction)
+{
+	isl_union_set *filter;
+
+	node = isl_schedule_node_get_child(node, pos);
+	filter = isl_schedule_node_filter_get_filter(node);
+	isl_schedule_node_free(node);
+	filter = isl_union_set_preimage_union_pw_multi_aff(filter,
+				isl_union_pw_multi_aff_copy(contraction));
+
+	return filter;
+}
+
+/* Return the union of the partial schedules of the bands
+ * underneath the "n" children of the sequence node "node"
+ * starting at child "first".
+ */
+static __isl_give isl_multi_union_pw_aff *fused_partial_schedule(
+	__isl_keep isl_schedule_node *node, int first, int n)
+{
+	int i;
+	isl_multi_union_pw_aff *fused = NULL;
+
+	for (i = first; i < first + n; ++i) {
+		isl_schedule_node *child;
+		isl_multi_union_pw_aff *partial;
+
+		child = isl_schedule_node_get_child(node, i);
+		child = isl_schedule_node_child(child, 0);
+		partial = isl_schedule_node_band_get_partial_schedule(child);
+		isl_schedule_node_free(child);
+		if (!fused)
+			fused = partial;
+		else
+			fused = isl_multi_union_pw_aff_union_add(fused,
+								partial);
+	}
+
+	return fused;
+}
+
+/* Does "upa" assign a value to the target of each dependence in "dep"
+ * that is at least as large as the value assigned to its source
+ * (if "zero" is not set) or equal to the value assigned to its source
+ * (if "zero" is set)?
+ */
+static isl_bool respects_dependences(__isl_keep isl_union_map *dep,
+	__isl_take isl_union_pw_aff *upa, int zero)
+{
+	isl_bool empty;
+	isl_space *space;
+	isl_set *violated;
+	isl_union_map *map, *dist;
+	isl_union_set *deltas;
+
+	map = isl_union_map_from_union_pw_aff(upa);
+	dist = isl_union_map_apply_domain(isl_union_map_copy(dep),
+					isl_union_map_copy(map));
+	dist = isl_union_map_apply_range(dist, map);
+	deltas = isl_union_map_deltas(dist);
+
+	space = isl_union_set_get_space(deltas);
+	space = isl_space_set_from_params(space);
+	space = isl_space_add_dims(space, isl_dim_set, 1);
+	violated = isl_set_upper_bound_si(isl_set_universe(space),
+					isl_dim_set, 0, -1);
+	if (zero) {
+		isl_set *pos;
+
+		pos = isl_set_universe(isl_set_get_space(violated));
+		pos = isl_set_lower_bound_si(pos, isl_dim_set, 0, 1);
+		violated = isl_set_union(violated, pos);
+	}
+	deltas = isl_union_set_intersect(deltas,
+					isl_union_set_from_set(violated));
+	empty = isl_union_set_is_empty(deltas);
+	isl_union_set_free(deltas);
+
+	return empty;
+}
+
+/* Can the bands underneath the "n" children of the sequence node "node"
+ * starting at child "first" be fused into a single band?
+ *
+ * The fused band needs to be permutable, meaning that each of
+ * its members needs to respect the validity dependences between
+ * pairs of instances that are scheduled together by the outer nodes.
+ * Dependences between instances in the same child already
+ * satisfy this condition since the original bands are permutable
+ * and instances with the same values for the fused band
+ * are still executed in the order of the children.
+ * Furthermore, in order to preserve the parallelism of the kernel,
+ * the first member of the fused band is required to be coincident.
+ */
+static isl_bool is_legal_fusion(__isl_keep isl_schedule_node *node,
+	int first, int n, struct ppcg_fuse_data *data)
+{
+	int i, n_member;
+	isl_bool legal = isl_bool_true;
+	isl_union_pw_multi_aff *contraction;
+	isl_multi_union_pw_aff *fused;
+	isl_union_set *domain;
+	isl_union_map *validity, *coincidence;
+
+	contraction = isl_schedule_node_get_subtree_contraction(node);
+	domain = child_instances(node, first, contraction);
+	for (i = first + 1; i < first + n; ++i)
+		domain = isl_union_set_union(domain,
+				child_instances(node, i, contraction));
+	fused = fused_partial_schedule(node, first, n);
+	fused = isl_multi_union_pw_aff_pullback_union_pw_multi_aff(fused,
+								contraction);
+
+	validity = isl_union_map_copy(data->validity);
+	validity = get_local_dependences(node, validity);
+	validity = isl_union_map_intersect_domain(validity,
+						isl_union_set_copy(domain));
+	validity = isl_union_map_intersect_range(validity,
+						isl_union_set_copy(domain));
+	coincidence = get_local_coincidence(node, data->sc);
+	coincidence = isl_union_map_intersect_domain(coincidence,
+						isl_union_set_copy(domain));
+	coincidence = isl_union_map_intersect_range(coincidence, domain);
+
+	n_member = isl_multi_union_pw_aff_dim(fused, isl_dim_set);
+	for (i = 0; legal == isl_bool_true && i < n_member; ++i) {
+		isl_union_pw_aff *upa;
+
+		upa = isl_multi_union_pw_aff_get_union_pw_aff(fused, i);
+		legal = respects_dependences(validity, upa, 0);
+	}
+	if (legal == isl_bool_true) {
+		isl_union_pw_aff *upa;
+
+		upa = isl_multi_union_pw_aff_get_union_pw_aff(fused, 0);
+		legal = respects_dependences(coincidence, upa, 1);
+	}
+
+	isl_union_map_free(validity);
+	isl_union_map_free(coincidence);
+	isl_multi_union_pw_aff_free(fused);
+
+	return legal;
+}
+
+/* Look for a sequence of at least two consecutive children
+ * of the sequence node "node" with suitably permutable bands
+ * that can be fused into a single band.
+ * If such a sequence is found, then return isl_bool_true and
+ * set "first" and "n" to the position of the first child
+ * and the number of children in the sequence.
+ * The sequence is extended as far as possible.
+ */
+static isl_bool find_fusion_run(__isl_keep isl_schedule_node *node,
+	struct ppcg_fuse_data *data, int *first, int *n)
+{
+	int i, j, n_children;
+
+	n_children = isl_schedule_node_n_children(node);
+	for (i = 0; i + 1 < n_children; ++i) {
+		int n_member = -1;
+		isl_bool ok;
+
+		ok = is_fusion_candidate(node, i, &n_member);
+		if (ok < 0)
+			return isl_bool_error;
+		if (!ok)
+			continue;
+		for (j = i + 1; j < n_children; ++j) {
+			ok = is_fusion_candidate(node, j, &n_member);
+			if (ok == isl_bool_true)
+				ok = is_legal_fusion(node, i, j - i + 1, data);
+			if (ok < 0)
+				return isl_bool_error;
+			if (!ok)
+				break;
+		}
+		if (j - i >= 2) {
+			*first = i;
+			*n = j - i;
+			return isl_bool_true;
+		}
+	}
+
+	return isl_bool_false;
+}
+
+/* Return the union of the filters of the children of the sequence
+ * node "node" in the range [first, last).
+ */
+static __isl_give isl_union_set *children_filter(
+	__isl_keep isl_schedule_node *node, int first, int last)
+{
+	int i;
+	isl_union_set *filter = NULL;
+
+	for (i = first; i < last; ++i) {
+		isl_schedule_node *child;
+		isl_union_set *filter_i;
+
+		child = isl_schedule_node_get_child(node, i);
+		filter_i = isl_schedule_node_filter_get_filter(child);
+		isl_schedule_node_free(child);
+		if (!filter)
+			filter = filter_i;
+		else
+			filter = isl_union_set_union(filter, filter_i);
+	}
+
+	return filter;
+}
+
+/* Fuse the bands underneath all the children of the sequence node "node"
+ * into a single band that is inserted on top of the sequence node.
+ * Return a pointer to the new band.
+ */
+static __isl_give isl_schedule_node *fuse_sequence_bands(
+	__isl_take isl_schedule_node *node, struct ppcg_fuse_data *data)
+{
+	int i, n;
+	isl_multi_union_pw_aff *fused;
+
+	n = isl_schedule_node_n_children(node);
+	fused = fused_partial_schedule(node, 0, n);
+	for (i = 0; i < n; ++i) {
+		node = isl_schedule_node_child(node, i);
+		node = isl_schedule_node_child(node, 0);
+		node = isl_schedule_node_delete(node);
+		node = isl_schedule_node_parent(node);
+		node = isl_schedule_node_parent(node);
+	}
+	node = isl_schedule_node_insert_partial_schedule(node, fused);
+	node = isl_schedule_node_band_set_permutable(node, 1);
+	node = band_set_coincident(node, data->sc);
+
+	return node;
+}
+
+/* Fuse the bands underneath the "n" children of the sequence node "node"
+ * starting at child "first" into a single band.
+ * The children in front of and after these children are first
+ * split off into separate sequences.
+ * Return a pointer to the fused band.
+ */
+static __isl_give isl_schedule_node *fuse_run(
+	__isl_take isl_schedule_node *node, int first, int n,
+	struct ppcg_fuse_data *data)
+{
+	int n_children;
+	isl_union_set *filter;
+
+	n_children = isl_schedule_node_n_children(node);
+	if (first + n < n_children) {
+		filter = children_filter(node, first + n, n_children);
+		node = isl_schedule_node_order_after(node, filter);
+	}
+	if (first > 0) {
+		filter = children_filter(node, 0, first);
+		node = isl_schedule_node_order_before(node, filter);
+	}
+
+	return fuse_sequence_bands(node, data);
+}
+
+/* If "node" is a sequence node outside of any kernel,
+ * then fuse consecutive children with suitably permutable bands
+ * into a single band whenever this is allowed by the dependences,
+ * such that they end up in the same kernel.
+ * The children that follow a fused sequence of children
+ * are split off into a separate sequence (by fuse_run),
+ * which is then considered in turn.
+ * Since the subtree is modified, it is required not to be anchored.
+ */
+static __isl_give isl_schedule_node *fuse_at_sequence(
+	__isl_take isl_schedule_node *node, void *user)
+{
+	struct ppcg_fuse_data *data = user;
+	int depth0, depth;
+	isl_bool skip;
+
+	if (!node)
+		return NULL;
+	if (isl_schedule_node_get_type(node) != isl_schedule_node_sequence)
+		return node;
+	skip = isl_schedule_node_is_subtree_anchored(node);
+	if (skip == isl_bool_false)
+		skip = has_permutable_ancestor(node);
+	if (skip < 0)
+		return isl_schedule_node_free(node);
+	if (skip)
+		return node;
+
+	depth0 = isl_schedule_node_get_tree_depth(node);
+	depth = depth0;
+	for (;;) {
+		int first, n, n_children;
+		isl_bool found;
+
+		if (isl_schedule_node_get_type(node) !=
+		    isl_schedule_node_sequence)
+			break;
+		found = find_fusion_run(node, data, &first, &n);
+		if (found < 0)
+			return isl_schedule_node_free(node);
+		if (!found)
+			break;
+		n_children = isl_schedule_node_n_children(node);
+		node = fuse_run(node, first, n, data);
+		if (!node || first + n >= n_children)
+			break;
+		node = isl_schedule_node_ancestor(node,
+			isl_schedule_node_get_tree_depth(node) - depth);
+		node = isl_schedule_node_child(node, 1);
+		node = isl_schedule_node_child(node, 0);
+		depth = isl_schedule_node_get_tree_depth(node);
+	}
+
+	if (!node)
+		return NULL;
+	depth = isl_schedule_node_get_tree_depth(node);
+	node = isl_schedule_node_ancestor(node, depth - depth0);
+
+	return node;
+}
+
+/* Fuse consecutive outermost permutable bands in the subtree at "node"
+ * that are separated only by a sequence node, such that they are mapped
+ * to a single kernel by mark_kernels.
+ * This avoids the launch of separate kernels and allows intermediate
+ * results to be passed along in shared or private memory rather than
+ * through global memory.
+ * Bands are only fused if they have the same number of members and
+ * if the fused band is permutable with a coincident first member.
+ */
+static __isl_give isl_schedule_node *fuse_kernels(struct gpu_gen *gen,
+	__isl_take isl_schedule_node *node)
+{
+	struct ppcg_fuse_data data;
+
+	data.sc = construct_schedule_constraints(gen->prog);
+	data.validity = isl_schedule_constraints_get_validity(data.sc);
+	if (gen->options->live_range_reordering)
+		data.validity = isl_union_map_union(data.validity,
+			isl_union_map_copy(
+				ppcg_scop_get_dep_order(gen->prog->scop)));
+	node = isl_schedule_node_map_descendant_bottom_up(node,
+						&fuse_at_sequence, &data);
+	isl_union_map_free(data.validity);
+	isl_schedule_constraints_free(data.sc);
+
+	return node;
+}
+
 /* Construct the string "<a>_<b>".
  */
 static char *concat(isl_ctx *ctx, const char *a, const char *b)
@@ -4576,28 +6399,85 @@ static char *concat(isl_ctx *ctx, const char *a, const char *b)
 	isl_printer *p;
 	char *s;
 
-	p = isl_printer_to_str(ctx);
-	p = isl_printer_print_str(p, a);
-	p = isl_printer_print_str(p, "_");
-	p = isl_printer_print_str(p, b);
-	s = isl_printer_get_str(p);
-	isl_printer_free(p);
+	p = isl_printer_to_str(ctx);
+	p = isl_printer_print_str(p, a);
+	p = isl_printer_print_str(p, "_");
+	p = isl_printer_print_str(p, b);
+	s = isl_printer_get_str(p);
+	isl_printer_free(p);
+
+	return s;
+}
+
+/* Construct the mapping from prefix schedule values to
+ * statement instances for copying the elements in "accessed"
+ * of the array "array", with statement identifier "id".
+ * "accessed" maps prefix schedule values to the array elements
+ * that need to be copied at those values.
+ * That is, return a mapping from all prefix schedule values
+ * to a zero-dimensional statement instance, unless only a slab
+ * of the array is transferred (see use_slab_transfers).
+ * In the latter case, return the mapping
+ *
+ *	{ P -> id[l, h] }
+ *
+ * with l and h the minimal and maximal outermost index of the elements
+ * in "accessed" at prefix schedule value P, such that only
+ * the elements with outermost index between l and h get copied.
+ * Since these elements are stored contiguously, they can be copied
+ * in one go.
+ * The values of l and h appear as the arguments of the corresponding
+ * statement in the generated AST.
+ */
+static __isl_give isl_map *copy_statement_extension(struct gpu_prog *prog,
+	struct gpu_array_info *array, __isl_take isl_map *accessed,
+	__isl_take isl_id *id)
+{
+	int n;
+	isl_space *space;
+	isl_set *domain;
+	isl_map *lo, *hi, *extension;
+
+	if (!use_slab_transfers(prog, array)) {
+		space = isl_space_domain(isl_map_get_space(accessed));
+		isl_map_free(accessed);
+		domain = isl_set_universe(space);
+		space = isl_space_set_alloc(prog->ctx, 0, 0);
+		space = isl_space_set_tuple_id(space, isl_dim_set, id);
+		return isl_map_from_domain_and_range(domain,
+						isl_set_universe(space));
+	}
+
+	n = isl_map_dim(accessed, isl_dim_out);
+	accessed = isl_map_intersect_range(accessed,
+					isl_set_copy(array->extent));
+	accessed = isl_map_project_out(accessed, isl_dim_out, 1, n - 1);
+	lo = isl_map_lexmin(isl_map_copy(accessed));
+	hi = isl_map_lexmax(accessed);
+	extension = isl_map_flat_range_product(lo, hi);
+	extension = isl_map_set_tuple_id(extension, isl_dim_out, id);
 
-	return s;
+	return extension;
 }
 
-/* For each array in "prog" of which an element appears in "accessed" and
- * that is not a read only scalar, create a zero-dimensional universe set
+/* For each array in "prog" of which an element appears in the range
+ * of "accessed" and that is not a read only scalar, create a mapping
+ * from prefix schedule values to copy statement instances
+ * (see copy_statement_extension)
  * of which the tuple id has name "<prefix>_<name of array>" and a user
  * pointer pointing to the array (gpu_array_info).
+ * "accessed" maps prefix schedule values to the array elements
+ * that need to be copied.
+ * Collect the union of these mappings in "extension".
  *
  * If the array is local to "prog", then make sure it will be declared
  * in the host code.
  *
- * Return the list of these universe sets.
+ * Return the list of the sets of copy statement instances.
  */
 static __isl_give isl_union_set_list *create_copy_filters(struct gpu_prog *prog,
-	const char *prefix, __isl_take isl_union_set *accessed)
+	const char *prefix, __isl_take isl_union_map *accessed,
+	isl_union_map **extension)
 {
 	int i;
 	isl_ctx *ctx;
@@ -4608,25 +6488,31 @@ static __isl_give isl_union_set_list *create_copy_filters(struct gpu_prog *prog,
 	for (i = 0; i < prog->n_array; ++i) {
 		struct gpu_array_info *array = &prog->array[i];
 		isl_space *space;
-		isl_set *accessed_i;
-		int empty;
+		isl_union_set *universe;
+		isl_union_map *accessed_i;
+		isl_map *extension_i;
+		isl_bool empty;
 		char *name;
 		isl_id *id;
-		isl_union_set *uset;
 
 		if (gpu_array_is_read_only_scalar(array))
 			continue;
 
 		space = isl_space_copy(array->space);
-		accessed_i = isl_union_set_extract_set(accessed, space);
-		empty = isl_set_plain_is_empty(accessed_i);
-		isl_set_free(accessed_i);
+		universe = isl_union_set_from_set(isl_set_universe(space));
+		accessed_i = isl_union_map_copy(accessed);
+		accessed_i = isl_union_map_intersect_range(accessed_i,
+							universe);
+		empty = isl_union_map_is_empty(accessed_i);
 		if (empty < 0) {
+			isl_union_map_free(accessed_i);
 			filters = isl_union_set_list_free(filters);
 			break;
 		}
-		if (empty)
+		if (empty) {
+			isl_union_map_free(accessed_i);
 			continue;
+		}
 
 		array->global = 1;
 		if (array->local)
@@ -4635,13 +6521,14 @@ static __isl_give isl_union_set_list *create_copy_filters(struct gpu_prog *prog,
 		name = concat(ctx, prefix, array->name);
 		id = name ? isl_id_alloc(ctx, name, array) : NULL;
 		free(name);
-		space = isl_space_set_alloc(ctx, 0, 0);
-		space = isl_space_set_tuple_id(space, isl_dim_set, id);
-		uset = isl_union_set_from_set(isl_set_universe(space));
-
-		filters = isl_union_set_list_add(filters, uset);
+		extension_i = copy_statement_extension(prog, array,
+				isl_map_from_union_map(accessed_i), id);
+		filters = isl_union_set_list_add(filters,
+			isl_union_set_from_set(isl_map_range(
+						isl_map_copy(extension_i))));
+		*extension = isl_union_map_add_map(*extension, extension_i);
 	}
-	isl_union_set_free(accessed);
+	isl_union_map_free(accessed);
 
 	return filters;
 }
@@ -4696,35 +6583,32 @@ static __isl_give isl_schedule_node *insert_positive_size_guards(
  * Each statement is called "<prefix>_<name of array>" and
  * the identifier has a user pointer pointing to the array.
  * The graft will be added at the position specified by "node".
- * "copy" contains the array elements that need to be copied.
+ * "copy" maps the prefix schedule values at this position
+ * to the array elements that need to be copied.
  * Only arrays of which some elements need to be copied
  * will have a corresponding statement in the graph.
- * Note though that each such statement will copy the entire array.
+ * Note though that each such statement will copy the entire array,
+ * unless only a slab of the array is transferred
+ * (see use_slab_transfers), in which case it copies a slab of the array.
  */
 static __isl_give isl_schedule_node *create_copy_device(struct gpu_prog *prog,
 	__isl_keep isl_schedule_node *node, const char *prefix,
-	__isl_take isl_union_set *copy)
+	__isl_take isl_union_map *copy)
 {
 	int depth;
-	isl_ctx *ctx;
-	isl_space *space;
-	isl_union_set *all, *domain;
 	isl_union_set_list *filters;
 	isl_union_map *extension;
 	isl_schedule_node *graft;
 
-	ctx = prog->ctx;
 	depth = isl_schedule_node_get_schedule_depth(node);
-	filters = create_copy_filters(prog, prefix, copy);
-	all = isl_union_set_list_union(isl_union_set_list_copy(filters));
-
-	space = depth < 0 ? NULL : isl_space_set_alloc(ctx, 0, depth);
-	domain = isl_union_set_from_set(isl_set_universe(space));
-	extension = isl_union_map_from_domain_and_range(domain, all);
+	extension = isl_union_map_empty(isl_union_map_get_space(copy));
+	filters = create_copy_filters(prog, prefix, copy, &extension);
 	graft = isl_schedule_node_from_extension(extension);
 
-	if (!filters)
+	if (!filters || depth < 0) {
+		isl_union_set_list_free(filters);
 		return isl_schedule_node_free(graft);
+	}
 	if (isl_union_set_list_n_union_set(filters) == 0) {
 		isl_union_set_list_free(filters);
 		return graft;
@@ -5100,6 +6984,53 @@ static __isl_give isl_union_set *node_may_persist(
 	return persist;
 }
 
+/* Is any array of "prog" only held in window buffers on the device?
+ */
+static int has_windowed_arrays(struct gpu_prog *prog)
+{
+	int i;
+
+	for (i = 0; i < prog->n_array; ++i)
+		if (prog->array[i].windowed)
+			return 1;
+
+	return 0;
+}
+
+/* Return a mapping from the prefix schedule values in the range
+ * of "prefix" to the outer array elements accessed by the statement
+ * instances in "domain" for the arrays that are only held
+ * in window buffers on the device.
+ */
+static __isl_give isl_union_map *window_accesses(struct gpu_prog *prog,
+	__isl_keep isl_union_set *domain, __isl_keep isl_union_map *prefix)
+{
+	int i;
+	isl_union_set *windowed;
+	isl_union_map *access;
+
+	windowed = isl_union_set_empty(isl_set_get_space(prog->context));
+	for (i = 0; i < prog->n_array; ++i) {
+		isl_space *space;
+
+		if (!prog->array[i].windowed)
+			continue;
+		space = isl_space_copy(prog->array[i].space);
+		windowed = isl_union_set_add_set(windowed,
+						isl_set_universe(space));
+	}
+
+	access = isl_union_map_union(isl_union_map_copy(prog->read),
+				    isl_union_map_copy(prog->may_write));
+	access = isl_union_map_intersect_domain(access,
+				    isl_union_set_copy(domain));
+	access = isl_union_map_apply_range(access,
+				    isl_union_map_copy(prog->to_outer));
+	access = isl_union_map_intersect_range(access, windowed);
+
+	return isl_union_map_apply_domain(access, isl_union_map_copy(prefix));
+}
+
 /* Add nodes for copying outer arrays in and out of the device
  * before and after the subtree "node", which contains one or more kernels.
  * "domain" contains the original statement instances, i.e.,
@@ -5138,11 +7069,23 @@ static __isl_give isl_union_set *node_may_persist(
  * If an element from a local array is read without first being written,
  * then there is no point in copying it in since it cannot have been
  * written prior to the scop.  Warn about the uninitialized read instead.
+ *
+ * The elements that need to be copied are computed for each value
+ * of the prefix schedule, such that only a slab of an array
+ * may be copied for each iteration of the outer band nodes
+ * if only a slab of the array is transferred (see use_slab_transfers).
+ * If any array is only held in window buffers on the device,
+ * then the window for the accessed slab of such arrays is first
+ * set up by a "window_device_<array name>" statement.
+ *
+ * If a resource report is being written, then the arrays that
+ * are copied in and out are added to the report.
  */
 static __isl_give isl_schedule_node *add_to_from_device(
 	__isl_take isl_schedule_node *node, __isl_take isl_union_set *domain,
-	__isl_take isl_union_map *prefix, struct gpu_prog *prog)
+	__isl_take isl_union_map *prefix, struct gpu_gen *gen)
 {
+	struct gpu_prog *prog = gen->prog;
 	isl_union_set *local;
 	isl_union_set *may_persist;
 	isl_union_map *may_write, *must_write, *copy_out, *not_written;
@@ -5151,6 +7094,14 @@ static __isl_give isl_schedule_node *add_to_from_device(
 	isl_union_map *local_uninitialized;
 	isl_schedule_node *graft;
 
+	if (has_windowed_arrays(prog)) {
+		isl_union_map *window;
+
+		window = window_accesses(prog, domain, prefix);
+		graft = create_copy_device(prog, node, "window_device", window);
+		node = isl_schedule_node_graft_before(node, graft);
+	}
+
 	tagged = isl_union_map_copy(prog->scop->tagged_reads);
 	tagged = isl_union_map_union(tagged,
 			    isl_union_map_copy(prog->scop->tagged_may_writes));
@@ -5198,11 +7149,11 @@ static __isl_give isl_schedule_node *add_to_from_device(
 	copy_in = isl_union_map_apply_range(copy_in,
 				    isl_union_map_copy(prog->to_outer));
 
-	graft = create_copy_device(prog, node, "to_device",
-						isl_union_map_range(copy_in));
+	if (gen->report)
+		gpu_report_transfers(gen->report, prog, copy_in, copy_out);
+	graft = create_copy_device(prog, node, "to_device", copy_in);
 	node = isl_schedule_node_graft_before(node, graft);
-	graft = create_copy_device(prog, node, "from_device",
-						isl_union_map_range(copy_out));
+	graft = create_copy_device(prog, node, "from_device", copy_out);
 	node = isl_schedule_node_graft_after(node, graft);
 
 	return node;
@@ -5238,6 +7189,367 @@ static __isl_give isl_schedule_node *add_init_clear_device(
 	return node;
 }
 
+/* Should the outermost tile loop of a kernel be split into chunks
+ * that are executed one after the other with only the data
+ * accessed by a chunk being held on the device?
+ * This is only supported for the CUDA target if the device arrays
+ * are allocated explicitly for a single execution of the scop and
+ * the host code around the kernels is kept on the host.
+ */
+static int use_out_of_core(struct ppcg_options *options)
+{
+	if (options->max_device_memory <= 0)
+		return 0;
+	if (options->target != PPCG_TARGET_CUDA)
+		return 0;
+	if (options->managed_memory || options->persistent_device_data)
+		return 0;
+	if (options->cuda_graphs || options->persistent_kernels)
+		return 0;
+	return !options->hybrid;
+}
+
+/* Return the maximal value of set dimension "pos" of "set"
+ * over all values of the parameters that satisfy "context".
+ * The result is infinity if this value is unbounded and
+ * NaN if "set" is empty.
+ */
+static __isl_give isl_val *max_over_context(__isl_take isl_set *set, int pos,
+	__isl_keep isl_set *context)
+{
+	int nparam;
+	isl_local_space *ls;
+	isl_aff *obj;
+	isl_val *max;
+
+	set = isl_set_intersect_params(set, isl_set_copy(context));
+	nparam = isl_set_dim(set, isl_dim_param);
+	set = isl_set_project_out(set, isl_dim_param, 0, nparam);
+	ls = isl_local_space_from_space(isl_set_get_space(set));
+	obj = isl_aff_var_on_domain(ls, isl_dim_set, pos);
+	max = isl_set_max_val(set, obj);
+	isl_aff_free(obj);
+	isl_set_free(set);
+
+	return max;
+}
+
+/* Return an upper bound on the number of bytes occupied by the elements
+ * of "array" that share the same outermost index.
+ */
+static __isl_give isl_val *row_size(struct gpu_prog *prog,
+	struct gpu_array_info *array)
+{
+	int i;
+	isl_val *size;
+
+	size = isl_val_int_from_si(prog->ctx, array->size);
+	for (i = 1; i < array->n_index; ++i) {
+		isl_val *max;
+
+		max = max_over_context(isl_set_copy(array->extent), i,
+					prog->context);
+		size = isl_val_mul(size, isl_val_add_ui(max, 1));
+	}
+
+	return size;
+}
+
+/* Return an upper bound on the number of bytes of a window buffer
+ * of "array", where "access" maps chunk numbers to the elements
+ * of "array" accessed by the corresponding chunk.
+ * That is, multiply the size of a row of the array by
+ * the maximal number of outermost indices accessed by a single chunk.
+ */
+static __isl_give isl_val *window_size(struct gpu_prog *prog,
+	struct gpu_array_info *array, __isl_take isl_map *access)
+{
+	int n;
+	isl_map *pairs;
+	isl_set *width;
+	isl_val *max;
+
+	n = isl_map_dim(access, isl_dim_out);
+	access = isl_map_intersect_range(access, isl_set_copy(array->extent));
+	access = isl_map_project_out(access, isl_dim_out, 1, n - 1);
+	pairs = isl_map_apply_range(isl_map_reverse(isl_map_copy(access)),
+					access);
+	width = isl_map_deltas(pairs);
+	max = max_over_context(width, 0, prog->context);
+	max = isl_val_add_ui(max, 1);
+
+	return isl_val_mul(max, row_size(prog, array));
+}
+
+/* Return an upper bound on the amount of device memory (in bytes)
+ * required for executing the statement instances in the domain
+ * of "access" in chunks defined by "chunk".
+ * "access" maps these statement instances to the outer array elements
+ * they access.
+ * Each array with at least one index is held in "n_buffer" window buffers
+ * (see window_size), while the other arrays are allocated entirely.
+ */
+static __isl_give isl_val *chunk_footprint(struct gpu_prog *prog,
+	__isl_keep isl_union_map *access,
+	__isl_take isl_multi_union_pw_aff *chunk, int n_buffer)
+{
+	int i;
+	isl_union_map *chunk_access;
+	isl_val *total;
+
+	chunk_access = isl_union_map_from_multi_union_pw_aff(chunk);
+	chunk_access = isl_union_map_apply_domain(isl_union_map_copy(access),
+						chunk_access);
+
+	total = isl_val_zero(prog->ctx);
+	for (i = 0; i < prog->n_array; ++i) {
+		struct gpu_array_info *array = &prog->array[i];
+		isl_space *space;
+		isl_union_set *universe;
+		isl_union_map *access_i;
+		isl_bool empty;
+		isl_val *size;
+
+		if (gpu_array_is_read_only_scalar(array))
+			continue;
+
+		space = isl_space_copy(array->space);
+		universe = isl_union_set_from_set(isl_set_universe(space));
+		access_i = isl_union_map_copy(chunk_access);
+		access_i = isl_union_map_intersect_range(access_i, universe);
+		empty = isl_union_map_is_empty(access_i);
+		if (empty < 0 || empty) {
+			isl_union_map_free(access_i);
+			if (empty < 0)
+				total = isl_val_free(total);
+			continue;
+		}
+
+		if (array->n_index == 0) {
+			isl_union_map_free(access_i);
+			size = isl_val_int_from_si(prog->ctx, array->size);
+		} else {
+			size = window_size(prog, array,
+					isl_map_from_union_map(access_i));
+			size = isl_val_mul_ui(size, n_buffer);
+		}
+		total = isl_val_add(total, size);
+	}
+
+	isl_union_map_free(chunk_access);
+
+	return total;
+}
+
+/* Return the chunks of "outer" of "size" consecutive values, i.e.,
+ * floor(outer/size).
+ */
+static __isl_give isl_multi_union_pw_aff *chunks_of_size(
+	__isl_keep isl_multi_union_pw_aff *outer, int size)
+{
+	isl_ctx *ctx;
+	isl_multi_union_pw_aff *chunk;
+
+	ctx = isl_multi_union_pw_aff_get_ctx(outer);
+	chunk = isl_multi_union_pw_aff_copy(outer);
+	chunk = isl_multi_union_pw_aff_scale_down_val(chunk,
+						isl_val_int_from_si(ctx, size));
+	return isl_multi_union_pw_aff_floor(chunk);
+}
+
+/* Mark the arrays with at least one index of which elements are
+ * accessed in the range of "access" as only being held
+ * in "n_buffer" window buffers on the device.
+ */
+static isl_stat mark_windowed_arrays(struct gpu_prog *prog,
+	__isl_keep isl_union_map *access, int n_buffer)
+{
+	int i;
+	isl_union_set *accessed;
+
+	accessed = isl_union_map_range(isl_union_map_copy(access));
+	for (i = 0; i < prog->n_array; ++i) {
+		struct gpu_array_info *array = &prog->array[i];
+		isl_space *space;
+		isl_set *accessed_i;
+		isl_bool empty;
+
+		if (array->n_index == 0)
+			continue;
+		space = isl_space_copy(array->space);
+		accessed_i = isl_union_set_extract_set(accessed, space);
+		empty = isl_set_is_empty(accessed_i);
+		isl_set_free(accessed_i);
+		if (empty < 0)
+			break;
+		if (!empty)
+			array->windowed = n_buffer;
+	}
+	isl_union_set_free(accessed);
+
+	return i < prog->n_array ? isl_stat_error : isl_stat_ok;
+}
+
+/* Try and split the outermost member of the permutable band "node"
+ * into chunks such that the data accessed by a single chunk
+ * fits in the amount of device memory specified by
+ * the --max-device-memory option.
+ * Set *inserted if a band node performing this split
+ * has been inserted in front of "node".
+ * In this case, the returned node points to this new band node.
+ *
+ * If the data accessed by the entire band fits in the device memory,
+ * then the band is not split.  Otherwise, the chunk size is taken
+ * to be the largest power of two for which the data fits.
+ * If no such chunk size can be found, e.g., because the footprint
+ * cannot be bounded in terms of the context, then a warning
+ * is printed and the band is not split either.
+ * When the band is split, each array with at least one index
+ * is only held in window buffers on the device, one for each chunk
+ * that may be in flight.  If asynchronous transfers are used,
+ * then two buffers are used such that the data of the next chunk
+ * can be copied in while the current chunk is being executed.
+ *
+ * The new band is not permutable so that the kernel is still
+ * created for "node".
+ */
+static __isl_give isl_schedule_node *insert_chunk_band(struct gpu_gen *gen,
+	__isl_take isl_schedule_node *node, int *inserted)
+{
+	struct gpu_prog *prog = gen->prog;
+	int log, best;
+	int n, n_buffer;
+	isl_bool fits;
+	isl_val *budget, *footprint;
+	isl_union_set *domain;
+	isl_union_map *access;
+	isl_union_pw_multi_aff *contraction;
+	isl_multi_union_pw_aff *outer, *original;
+
+	n_buffer = gen->options->async_transfers ? 2 : 1;
+	budget = isl_val_int_from_si(gen->ctx, gen->options->max_device_memory);
+	budget = isl_val_mul_ui(budget, 1 << 20);
+
+	contraction = isl_schedule_node_get_subtree_contraction(node);
+	domain = isl_schedule_node_get_domain(node);
+	domain = isl_union_set_preimage_union_pw_multi_aff(domain,
+				    isl_union_pw_multi_aff_copy(contraction));
+	access = isl_union_map_union(isl_union_map_copy(prog->read),
+				    isl_union_map_copy(prog->may_write));
+	access = isl_union_map_intersect_domain(access, domain);
+	access = isl_union_map_apply_range(access,
+				    isl_union_map_copy(prog->to_outer));
+
+	n = isl_schedule_node_band_n_member(node);
+	outer = isl_schedule_node_band_get_partial_schedule(node);
+	outer = isl_multi_union_pw_aff_drop_dims(outer, isl_dim_set, 1, n - 1);
+	original = isl_multi_union_pw_aff_copy(outer);
+	original = isl_multi_union_pw_aff_pullback_union_pw_multi_aff(original,
+							contraction);
+
+	footprint = chunk_footprint(prog, access,
+		isl_multi_union_pw_aff_scale_val(
+			isl_multi_union_pw_aff_copy(original),
+			isl_val_zero(gen->ctx)), n_buffer);
+	fits = isl_val_le(footprint, budget);
+	isl_val_free(footprint);
+
+	best = -1;
+	for (log = 0; fits == isl_bool_false && log < 31; ++log) {
+		isl_bool ok;
+
+		footprint = chunk_footprint(prog, access,
+				chunks_of_size(original, 1 << log), n_buffer);
+		ok = isl_val_le(footprint, budget);
+		isl_val_free(footprint);
+		if (ok < 0)
+			fits = isl_bool_error;
+		if (ok != isl_bool_true)
+			break;
+		best = log;
+	}
+
+	if (fits == isl_bool_false && best < 0)
+		fprintf(stderr, "unable to split kernel into chunks that fit "
+			"in %d MiB of device memory\n",
+			gen->options->max_device_memory);
+	if (fits == isl_bool_false && best >= 0) {
+		node = isl_schedule_node_insert_partial_schedule(node,
+					chunks_of_size(outer, 1 << best));
+		if (mark_windowed_arrays(prog, access, n_buffer) < 0)
+			node = isl_schedule_node_free(node);
+		*inserted = 1;
+	}
+
+	isl_multi_union_pw_aff_free(original);
+	isl_multi_union_pw_aff_free(outer);
+	isl_union_map_free(access);
+	isl_val_free(budget);
+
+	if (fits < 0)
+		return isl_schedule_node_free(node);
+	return node;
+}
+
+/* If the outermost tile loop of a kernel should be split into chunks
+ * (see use_out_of_core), then look for the outermost permutable band
+ * along the branch of band nodes starting at "node" and
+ * try and insert a band node splitting it into chunks
+ * (see insert_chunk_band).
+ * Only a single kernel is streamed in this way.
+ * If there is no such branch, then no splitting is performed.
+ *
+ * Return the updated node, pointing to the same position as "node", and
+ * set *depth to the number of steps from "node" to the inserted band node,
+ * or to -1 if no band node was inserted.
+ */
+static __isl_give isl_schedule_node *plan_out_of_core(struct gpu_gen *gen,
+	__isl_take isl_schedule_node *node, int *depth)
+{
+	int i, n;
+	int inserted = 0;
+	isl_bool permutable;
+
+	*depth = -1;
+	if (!use_out_of_core(gen->options))
+		return node;
+
+	for (n = 0; ; ++n) {
+		permutable = is_permutable(node);
+		if (permutable < 0)
+			return isl_schedule_node_free(node);
+		if (permutable)
+			break;
+		if (isl_schedule_node_get_type(node) !=
+		    isl_schedule_node_band)
+			break;
+		node = isl_schedule_node_child(node, 0);
+	}
+
+	if (permutable)
+		node = insert_chunk_band(gen, node, &inserted);
+	if (inserted)
+		*depth = n;
+
+	for (i = 0; i < n; ++i)
+		node = isl_schedule_node_parent(node);
+
+	return node;
+}
+
+/* Move "node" down "n" times to its first child.
+ */
+static __isl_give isl_schedule_node *move_down(
+	__isl_take isl_schedule_node *node, int n)
+{
+	int i;
+
+	for (i = 0; i < n; ++i)
+		node = isl_schedule_node_child(node, 0);
+
+	return node;
+}
+
 /* Update "schedule" for mapping to a GPU device.
  *
  * In particular, insert a context node, create kernels for
@@ -5248,6 +7560,11 @@ static __isl_give isl_schedule_node *add_init_clear_device(
  * are separated from the other children and are not mapped to
  * the device.
  *
+ * If a band node splitting a kernel into chunks has been inserted
+ * (see plan_out_of_core), then the nodes for copying arrays
+ * are introduced inside this band node instead, such that
+ * the arrays are copied in and out for each chunk.
+ *
  * The GPU code is generated in a context where at least one
  * statement instance is executed.  The corresponding guard is inserted
  * around the entire schedule.
@@ -5255,6 +7572,7 @@ static __isl_give isl_schedule_node *add_init_clear_device(
 static __isl_give isl_schedule *map_to_device(struct gpu_gen *gen,
 	__isl_take isl_schedule *schedule)
 {
+	int i, depth;
 	isl_schedule_node *node;
 	isl_set *context;
 	isl_set *guard;
@@ -5277,6 +7595,10 @@ static __isl_give isl_schedule *map_to_device(struct gpu_gen *gen,
 	node = isl_schedule_node_child(node, 0);
 	node = isl_schedule_node_child(node, 0);
 	node = isolate_permutable_subtrees(node, gen->prog);
+	if (gen->options->fuse_kernels)
+		node = fuse_kernels(gen, node);
+	node = plan_out_of_core(gen, node, &depth);
+	node = move_down(node, depth + 1);
 	domain = isl_schedule_node_get_domain(node);
 	contraction = isl_schedule_node_get_subtree_contraction(node);
 	domain = isl_union_set_preimage_union_pw_multi_aff(domain,
@@ -5284,8 +7606,11 @@ static __isl_give isl_schedule *map_to_device(struct gpu_gen *gen,
 	prefix = isl_schedule_node_get_prefix_schedule_union_map(node);
 	prefix = isl_union_map_preimage_domain_union_pw_multi_aff(prefix,
 				    contraction);
+	for (i = 0; i < depth + 1; ++i)
+		node = isl_schedule_node_parent(node);
 	node = mark_kernels(gen, node);
-	node = add_to_from_device(node, domain, prefix, gen->prog);
+	node = move_down(node, depth + 1);
+	node = add_to_from_device(node, domain, prefix, gen);
 	node = isl_schedule_node_root(node);
 	node = isl_schedule_node_child(node, 0);
 	node = isl_schedule_node_child(node, 0);
@@ -5552,6 +7877,9 @@ static struct gpu_stmt *extract_stmts(isl_ctx *ctx, struct ppcg_scop *scop,
 
 		s->id = isl_set_get_tuple_id(scop->pet->stmts[i]->domain);
 		s->stmt = scop->pet->stmts[i];
+		s->reduction = ppcg_scop_is_reduction(scop, s->stmt);
+		if (s->reduction < 0)
+			return free_stmts(stmts, i + 1);
 		killed = is_stmt_killed(scop, scop->pet->stmts[i]);
 		if (killed < 0)
 			return free_stmts(stmts, i + 1);
@@ -5564,7 +7892,8 @@ static struct gpu_stmt *extract_stmts(isl_ctx *ctx, struct ppcg_scop *scop,
 	return stmts;
 }
 
-/* Generate CUDA code for "scop" and print it to "p".
+/* Generate CUDA code for "scop" and print it to "p",
+ * assuming the parameters satisfy the constraints in "version".
  * After generating an AST for the transformed scop as explained below,
  * we call "gen->print" to print the AST in the desired output format
  * to "p".
@@ -5623,22 +7952,24 @@ static struct gpu_stmt *extract_stmts(isl_ctx *ctx, struct ppcg_scop *scop,
  * aside and replaced by kernel calls.  The result is printed as host code
  * while the saved subtrees are printed as device code.
  */
-static __isl_give isl_printer *generate(__isl_take isl_printer *p,
+static __isl_give isl_printer *generate_version(__isl_take isl_printer *p,
 	struct gpu_gen *gen, struct ppcg_scop *scop,
-	struct ppcg_options *options)
+	struct ppcg_options *options, __isl_take isl_set *version)
 {
 	struct gpu_prog *prog;
 	isl_ctx *ctx;
 	isl_schedule *schedule;
 	isl_bool any_permutable;
+	struct ppcg_timer timer;
 
-	if (!scop)
-		return isl_printer_free(p);
+	if (!scop || !version)
+		goto error;
 
 	ctx = isl_printer_get_ctx(p);
 	prog = gpu_prog_alloc(ctx, scop);
 	if (!prog)
-		return isl_printer_free(p);
+		goto error;
+	prog->context = isl_set_intersect_params(prog->context, version);
 
 	gen->prog = prog;
 	schedule = get_schedule(gen);
@@ -5651,17 +7982,139 @@ static __isl_give isl_printer *generate(__isl_take isl_printer *p,
 			p = print_cpu(p, scop, options);
 		isl_schedule_free(schedule);
 	} else {
+		ppcg_timer_start(&timer);
 		schedule = map_to_device(gen, schedule);
+		ppcg_timer_report(&timer, options, "map_to_device",
+				"scop", scop->start);
+		ppcg_timer_start(&timer);
 		gen->tree = generate_code(gen, schedule);
+		gpu_prog_free_access_data(prog);
+		ppcg_timer_report(&timer, options, "AST generation",
+				"scop", scop->start);
+		ppcg_timer_start(&timer);
 		p = ppcg_set_macro_names(p);
 		p = ppcg_print_exposed_declarations(p, prog->scop);
 		p = gen->print(p, gen->prog, gen->tree, &gen->types,
 				    gen->print_user);
+		ppcg_timer_report(&timer, options, "printing",
+				"scop", scop->start);
 		isl_ast_node_free(gen->tree);
 	}
 
 	gpu_prog_free(prog);
 
+	return p;
+error:
+	isl_set_free(version);
+	return isl_printer_free(p);
+}
+
+/* Print the condition "version" on the parameters of "scop"
+ * as an AST expression, simplified with respect to the context.
+ */
+static __isl_give isl_printer *print_version_condition(
+	__isl_take isl_printer *p, struct ppcg_scop *scop,
+	__isl_take isl_set *version)
+{
+	isl_ast_build *build;
+	isl_ast_expr *cond;
+
+	version = isl_set_gist_params(version, isl_set_copy(scop->context));
+	build = isl_ast_build_from_context(isl_set_copy(scop->context));
+	cond = isl_ast_build_expr_from_set(build, version);
+	isl_ast_build_free(build);
+
+	p = ppcg_ast_expr_print_macros(cond, p);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "if (");
+	p = isl_printer_print_ast_expr(p, cond);
+	p = isl_printer_print_str(p, ")");
+	p = isl_printer_end_line(p);
+	isl_ast_expr_free(cond);
+
+	return p;
+}
+
+/* Does "scop" declare any arrays that are exposed to the code
+ * after the scop?
+ */
+static int any_exposed_declarations(struct ppcg_scop *scop)
+{
+	int i;
+
+	for (i = 0; i < scop->pet->n_array; ++i)
+		if (scop->pet->arrays[i]->declared &&
+		    scop->pet->arrays[i]->exposed)
+			return 1;
+
+	return 0;
+}
+
+/* Generate code for "scop" and print it to "p".
+ *
+ * If the user has specified any versions, then a separate version
+ * of the code is generated for each of the corresponding parameter sets
+ * that is compatible with the context, with the context of the version
+ * restricted to the parameter set.  This allows the AST generator
+ * to drop boundary conditions that are implied by the parameter set,
+ * for example, if the parameter set ensures that all tiles are full.
+ * Since kernels are numbered consecutively over all versions,
+ * the kernels in each version can be assigned their own sizes.
+ * The versions are selected at run time in the order in which
+ * they were specified, with the generic code as the final alternative.
+ * Versions are not generated if the scop declares any arrays
+ * that are exposed to the code after the scop since the declarations
+ * would otherwise end up in the scope of a single version.
+ */
+static __isl_give isl_printer *generate(__isl_take isl_printer *p,
+	struct gpu_gen *gen, struct ppcg_scop *scop,
+	struct ppcg_options *options)
+{
+	int i, n;
+	int n_open = 0;
+	isl_space *space;
+
+	if (!scop)
+		return isl_printer_free(p);
+
+	n = gen->versions ? isl_set_list_n_set(gen->versions) : 0;
+	if (any_exposed_declarations(scop))
+		n = 0;
+	for (i = 0; i < n; ++i) {
+		isl_set *version, *context;
+		isl_bool empty;
+
+		version = isl_set_list_get_set(gen->versions, i);
+		context = isl_set_copy(scop->context);
+		context = isl_set_intersect_params(context,
+						isl_set_copy(version));
+		empty = isl_set_is_empty(context);
+		isl_set_free(context);
+		if (empty < 0) {
+			isl_set_free(version);
+			return isl_printer_free(p);
+		}
+		if (empty) {
+			isl_set_free(version);
+			continue;
+		}
+		p = print_version_condition(p, scop, isl_set_copy(version));
+		p = ppcg_start_block(p);
+		p = generate_version(p, gen, scop, options, version);
+		p = ppcg_end_block(p);
+		p = isl_printer_start_line(p);
+		p = isl_printer_print_str(p, "else");
+		p = isl_printer_end_line(p);
+		p = ppcg_start_block(p);
+		n_open++;
+	}
+
+	space = isl_set_get_space(scop->context);
+	p = generate_version(p, gen, scop, options, isl_set_universe(space));
+
+	for (i = 0; i < n_open; ++i)
+		p = ppcg_end_block(p);
+
 	return p;
 }
 
@@ -5689,13 +8142,26 @@ int generate_gpu(isl_ctx *ctx, const char *input, FILE *out,
 	int i;
 
 	gen.ctx = ctx;
+	gen.versions = extract_versions_from_str(ctx, options->versions);
+	if (options->versions && !gen.versions)
+		return -1;
 	gen.sizes = extract_sizes_from_str(ctx, options->sizes);
+	gen.tuned_sizes = extract_sizes_from_tuning_db(ctx, options->tuning_db,
+							input);
 	gen.options = options;
 	gen.kernel_id = 0;
 	gen.print = print;
 	gen.print_user = user;
 	gen.types.n = 0;
 	gen.types.name = NULL;
+	gen.report = NULL;
+
+	if (options->kernel_report) {
+		gen.report = fopen(options->kernel_report, "a");
+		if (!gen.report)
+			fprintf(stderr, "Unable to open '%s' for writing\n",
+				options->kernel_report);
+	}
 
 	if (options->debug->dump_sizes) {
 		isl_space *space = isl_space_params_alloc(ctx, 0);
@@ -5709,7 +8175,11 @@ int generate_gpu(isl_ctx *ctx, const char *input, FILE *out,
 		isl_union_map_free(gen.used_sizes);
 	}
 
+	if (gen.report)
+		fclose(gen.report);
 	isl_union_map_free(gen.sizes);
+	isl_union_map_free(gen.tuned_sizes);
+	isl_set_list_free(gen.versions);
 	for (i = 0; i < gen.types.n; ++i)
 		free(gen.types.name[i]);
 	free(gen.types.name);
@@ -47,10 +47,14 @@ struct gpu_stmt_access {
  * If the statement has been killed, i.e., if it will not be scheduled,
  * then this linked list may be empty even if the actual statement does
  * perform accesses.
+ * The linked list is also freed as soon as the AST has been generated.
+ * "reduction" is set if the statement has been identified as a reduction
+ * and should therefore be performed atomically.
  */
 struct gpu_stmt {
 	isl_id *id;
 	struct pet_stmt *stmt;
+	int reduction;
 
 	struct gpu_stmt_access *accesses;
 };
@@ -81,7 +85,9 @@ struct gpu_array_info {
 	 */
 	isl_ast_expr *bound_expr;
 
-	/* All references to this array; point to elements of a linked list. */
+	/* All references to this array; point to elements of a linked list.
+	 * The elements are no longer available after AST generation.
+	 */
 	int n_ref;
 	struct gpu_stmt_access **refs;
 
@@ -97,6 +103,9 @@ struct gpu_array_info {
 	/* Are the elements only accessed through constant index expressions? */
 	int only_fixed_element;
 
+	/* Is the array the target of any reduction? */
+	int reduction;
+
 	/* Is the array local to the scop? */
 	int local;
 	/* Is the array local and should it be declared on the host? */
@@ -108,6 +117,13 @@ struct gpu_array_info {
 	/* Should the array be linearized? */
 	int linearize;
 
+	/* The number of window buffers holding the slabs of the array
+	 * accessed by a chunk of an out-of-core execution
+	 * (see --max-device-memory) or 0 if the entire array
+	 * is allocated on the device.
+	 */
+	int windowed;
+
 	/* Order dependences on this array.
 	 * Only used if live_range_reordering option is set.
 	 * It is set to NULL otherwise.
@@ -124,6 +140,9 @@ struct gpu_array_info {
  * must be mapped to a register.
  * "global" is set if the global device memory corresponding
  * to this array is accessed by the kernel.
+ * "read_only" is set if the array is not written by the kernel.
+ * "constant" is set if the global array is placed in constant memory
+ * (OpenCL target).
  * "bound" is equal to array->bound specialized to the current kernel.
  * "bound_expr" is the corresponding access AST expression.
  */
@@ -135,6 +154,8 @@ struct gpu_local_array_info {
 
 	int force_private;
 	int global;
+	int read_only;
+	int constant;
 
 	unsigned n_index;
 	isl_multi_pw_aff *bound;
@@ -218,11 +239,20 @@ struct gpu_gen {
 	/* User specified tile, grid and block sizes for each kernel */
 	isl_union_map *sizes;
 
+	/* Tile, grid and block sizes for each kernel from the tuning database */
+	isl_union_map *tuned_sizes;
+
 	/* Effectively used tile, grid and block sizes for each kernel */
 	isl_union_map *used_sizes;
 
+	/* File to which the resource report is written, NULL if none. */
+	FILE *report;
+
 	/* Identifier of the next kernel. */
 	int kernel_id;
+
+	/* Parameter sets for which specialized code is generated. */
+	isl_set_list *versions;
 };
 
 enum ppcg_group_access_type {
@@ -254,6 +284,11 @@ enum ppcg_kernel_stmt_type {
  * array refers to the original array being copied
  * local_array is a pointer to the appropriate element in the "array"
  *	array of the ppcg_kernel to which this copy access belongs
+ * vector_width is the number of consecutive elements copied
+ *	by the statement, if greater than one
+ * histogram is set if the tile is a privatized copy of a reduction target,
+ *	in which case a read initializes the local element to zero and
+ *	a write atomically adds it to the global element
  *
  *
  * for ppcg_kernel_domain statements we have
@@ -273,6 +308,8 @@ struct ppcg_kernel_stmt {
 			isl_ast_expr *local_index;
 			struct gpu_array_info *array;
 			struct gpu_local_array_info *local_array;
+			int vector_width;
+			int histogram;
 		} c;
 		struct {
 			struct gpu_stmt *stmt;
@@ -282,12 +319,17 @@ struct ppcg_kernel_stmt {
 };
 
 /* Representation of a local variable in a kernel.
+ * "size" contains the size of each dimension of the variable.
+ * A double buffered variable has an extra initial dimension of size 2.
+ * "align" is the alignment in bytes required by vector accesses
+ * to the variable or zero if there are no such accesses.
  */
 struct ppcg_kernel_var {
 	struct gpu_array_info *array;
 	enum ppcg_group_access_type type;
 	char *name;
 	isl_vec *size;
+	int align;
 };
 
 /* Representation of a kernel.
@@ -335,6 +377,12 @@ struct ppcg_kernel_var {
  * space is the schedule space of the AST context.  That is, it represents
  * the loops of the generated host code containing the kernel launch.
  *
+ * If the innermost host loop around the kernel launch has been moved
+ * inside the kernel, then persistent_iterator, persistent_init,
+ * persistent_cond and persistent_inc are the iterator, initialization,
+ * condition and increment of this loop.  The iterator then corresponds
+ * to the last dimension of "space".  Otherwise, these fields are NULL.
+ *
  * n_array is the total number of arrays in the input program and also
  * the number of element in the array array.
  * array contains information about each array that is local
@@ -343,6 +391,9 @@ struct ppcg_kernel_var {
  *
  * any_force_private is set if any array in the kernel is marked force_private
  *
+ * any_reduction is set if the kernel contains any reduction statement.
+ * It is only set once the AST of the kernel has been constructed.
+ *
  * block_filter contains constraints on the domain elements in the kernel
  * that encode the mapping to block identifiers, where the block identifiers
  * are represented by "n_grid" parameters with as names the elements
@@ -393,6 +444,11 @@ struct ppcg_kernel {
 
 	isl_space *space;
 
+	isl_ast_expr *persistent_iterator;
+	isl_ast_expr *persistent_init;
+	isl_ast_expr *persistent_cond;
+	isl_ast_expr *persistent_inc;
+
 	int n_array;
 	struct gpu_local_array_info *array;
 
@@ -400,6 +456,7 @@ struct ppcg_kernel {
 	struct ppcg_kernel_var *var;
 
 	int any_force_private;
+	int any_reduction;
 
 	isl_union_set *block_filter;
 	isl_union_set *thread_filter;
@@ -17,6 +17,7 @@ struct gpu_array_tile *gpu_array_tile_free(struct gpu_array_tile *tile)
 		isl_aff_free(tile->bound[j].shift);
 	}
 	free(tile->bound);
+	isl_val_free(tile->buffer_stride);
 	isl_multi_aff_free(tile->tiling);
 	free(tile);
 
@@ -51,8 +52,27 @@ struct gpu_array_tile *gpu_array_tile_create(isl_ctx *ctx, int n_index)
 	return tile;
 }
 
+/* Return the size of dimension "pos" of the tile specified by "tile",
+ * including any padding.
+ */
+__isl_give isl_val *gpu_array_tile_dim_size(struct gpu_array_tile *tile,
+	int pos)
+{
+	isl_val *size;
+
+	if (!tile)
+		return NULL;
+
+	size = isl_val_copy(tile->bound[pos].size);
+	if (pos == tile->n - 1 && tile->pad)
+		size = isl_val_add_ui(size, tile->pad);
+
+	return size;
+}
+
 /* Compute the size of the tile specified by "tile"
- * in number of elements and return the result.
+ * in number of elements, including any padding,
+ * and return the result.
  */
 __isl_give isl_val *gpu_array_tile_size(struct gpu_array_tile *tile)
 {
@@ -65,7 +85,50 @@ __isl_give isl_val *gpu_array_tile_size(struct gpu_array_tile *tile)
 	size = isl_val_one(tile->ctx);
 
 	for (i = 0; i < tile->n; ++i)
-		size = isl_val_mul(size, isl_val_copy(tile->bound[i].size));
+		size = isl_val_mul(size, gpu_array_tile_dim_size(tile, i));
 
 	return size;
 }
+
+/* Return the mapping from the outer schedule dimensions and
+ * the global array to the index in the local memory copy of "tile".
+ * That is, return tile->tiling, extended with an initial index
+ * selecting one of the two buffers if the tile is double buffered.
+ * In the latter case, the buffer is selected by the parity
+ * of the iteration count of the innermost of the outer schedule dimensions,
+ * resulting in
+ *
+ *	{ [D[i] -> A[a]] -> T[floor(i_{depth-1}/s) mod 2, t] }
+ *
+ * with s equal to tile->buffer_stride.
+ */
+__isl_give isl_multi_aff *gpu_array_tile_get_index(
+	struct gpu_array_tile *tile)
+{
+	isl_id *id;
+	isl_space *space;
+	isl_local_space *ls;
+	isl_aff *parity;
+	isl_multi_aff *index;
+
+	if (!tile)
+		return NULL;
+
+	index = isl_multi_aff_copy(tile->tiling);
+	if (!tile->double_buffer)
+		return index;
+
+	id = isl_multi_aff_get_tuple_id(index, isl_dim_out);
+	space = isl_space_domain(isl_multi_aff_get_space(index));
+	ls = isl_local_space_from_space(space);
+	parity = isl_aff_var_on_domain(ls, isl_dim_set, tile->depth - 1);
+	parity = isl_aff_scale_down_val(parity,
+					isl_val_copy(tile->buffer_stride));
+	parity = isl_aff_floor(parity);
+	parity = isl_aff_mod_val(parity, isl_val_int_from_si(tile->ctx, 2));
+	index = isl_multi_aff_flat_range_product(
+				isl_multi_aff_from_aff(parity), index);
+	index = isl_multi_aff_set_tuple_id(index, isl_dim_out, id);
+
+	return index;
+}
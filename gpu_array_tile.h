@@ -41,10 +41,29 @@ struct gpu_array_bound {
  *
  * where D represents the initial "depth" dimensions
  * of the computed schedule.
+ *
+ * pad is the number of unused elements that are added
+ * to the innermost dimension of the (shared memory) tile in order
+ * to avoid bank conflicts.
+ *
+ * vector_width is the number of consecutive elements in the innermost
+ * dimension that are read from global memory at once, if greater than one.
+ *
+ * double_buffer is set if the (shared memory) tile is stored in
+ * two buffers, selected by the parity of the iteration count
+ * of schedule dimension depth - 1, such that the next tile can be
+ * copied in while the current tile is being used.
+ * buffer_stride is the (constant) distance between the values
+ * of that schedule dimension in consecutive iterations.
+ * It is only set if double_buffer is set.
  */
 struct gpu_array_tile {
 	isl_ctx *ctx;
 	int requires_unroll;
+	int pad;
+	int vector_width;
+	int double_buffer;
+	isl_val *buffer_stride;
 	int depth;
 	int n;
 	struct gpu_array_bound *bound;
@@ -54,6 +73,10 @@ struct gpu_array_tile {
 struct gpu_array_tile *gpu_array_tile_create(isl_ctx *ctx, int n_index);
 struct gpu_array_tile *gpu_array_tile_free(struct gpu_array_tile *tile);
 
+__isl_give isl_val *gpu_array_tile_dim_size(struct gpu_array_tile *tile,
+	int pos);
 __isl_give isl_val *gpu_array_tile_size(struct gpu_array_tile *tile);
+__isl_give isl_multi_aff *gpu_array_tile_get_index(
+	struct gpu_array_tile *tile);
 
 #endif
@@ -566,6 +566,85 @@ static int access_is_coalesced(struct gpu_group_data *data,
 	return coalesced;
 }
 
+/* Would the shared memory copy of the array accessed by "access"
+ * suffer from bank conflicts?
+ * That is, do consecutive threads (in the dimension that will get
+ * wrapped over the last thread index) access elements in different
+ * rows of the array, i.e., elements that differ in some index
+ * other than the last?  If so, the elements accessed by those threads
+ * are separated by a multiple of the row size of the shared memory tile.
+ *
+ * This function is only called for kernels with at least one
+ * thread identifier.
+ */
+static int access_has_bank_conflicts(struct gpu_group_data *data,
+	__isl_keep isl_union_map *access)
+{
+	int i, dim;
+	isl_space *space;
+	isl_map *access_map;
+	isl_map *next_thread_x;
+	isl_map *same_row;
+	isl_map *map;
+	int same;
+
+	access = isl_union_map_copy(access);
+	access = isl_union_map_apply_domain(access,
+				isl_union_map_copy(data->full_sched));
+	access_map = isl_map_from_union_map(access);
+
+	dim = isl_map_dim(access_map, isl_dim_out);
+	if (dim < 2) {
+		isl_map_free(access_map);
+		return dim < 0 ? -1 : 0;
+	}
+
+	space = isl_map_get_space(access_map);
+	space = isl_space_range(space);
+	same_row = isl_map_universe(isl_space_map_from_set(space));
+	for (i = 0; i + 1 < dim; ++i)
+		same_row = isl_map_equate(same_row, isl_dim_in, i,
+					isl_dim_out, i);
+
+	space = isl_map_get_space(access_map);
+	space = isl_space_domain(space);
+	next_thread_x = next(space, data->thread_depth + data->n_thread - 1);
+
+	map = isl_map_apply_domain(next_thread_x, isl_map_copy(access_map));
+	map = isl_map_apply_range(map, access_map);
+
+	same = isl_map_is_subset(map, same_row);
+
+	isl_map_free(same_row);
+	isl_map_free(map);
+
+	return same < 0 ? -1 : !same;
+}
+
+/* Pad the innermost dimension of the shared memory tile "tile"
+ * of an array that is accessed in a way that would result
+ * in bank conflicts.
+ * Padding by a single element ensures that the row size is odd and
+ * therefore relatively prime to the number of banks.
+ * If the row size is already odd, then no padding is needed.
+ */
+static isl_stat pad_tile(struct gpu_array_tile *tile)
+{
+	isl_val *size, *two;
+	isl_bool even;
+
+	size = tile->bound[tile->n - 1].size;
+	two = isl_val_int_from_si(tile->ctx, 2);
+	even = isl_val_is_divisible_by(size, two);
+	isl_val_free(two);
+	if (even < 0)
+		return isl_stat_error;
+	if (even)
+		tile->pad = 1;
+
+	return isl_stat_ok;
+}
+
 /* Replace the host schedule dimensions in the access relation "access"
  * by parameters, so that they are treated as fixed when checking for reuse
  * (within a kernel) or whether two consecutive elements are accessed
@@ -851,6 +930,7 @@ static int populate_array_references(struct gpu_local_array_info *local,
 		group->write = access->write;
 		group->exact_write = access->exact_write;
 		group->slice = access->n_index < local->array->n_index;
+		group->coalesced = -1;
 		group->refs = &local->array->refs[i];
 		group->n_ref = 1;
 
@@ -874,12 +954,26 @@ struct gpu_array_ref_group *gpu_array_ref_group_free(
 	gpu_array_tile_free(group->shared_tile);
 	gpu_array_tile_free(group->private_tile);
 	isl_map_free(group->access);
+	isl_basic_set_free(group->range_hull);
 	if (group->n_ref > 1)
 		free(group->refs);
 	free(group);
 	return NULL;
 }
 
+/* Free the fields of "group" that are only used during the construction
+ * of the groups and of the schedule tree of the kernel.
+ * The group can still be printed afterwards.
+ */
+void gpu_array_ref_group_free_construction_data(
+	struct gpu_array_ref_group *group)
+{
+	if (!group)
+		return;
+	group->access = isl_map_free(group->access);
+	group->range_hull = isl_basic_set_free(group->range_hull);
+}
+
 /* Check if the access relations of group1 and group2 overlap within
  * copy_sched.
  */
@@ -895,6 +989,76 @@ static int accesses_overlap(struct gpu_array_ref_group *group1,
 	return !disjoint;
 }
 
+/* Check if the access relations of group1 and group2 overlap within
+ * copy_sched, given simple hulls "hull1" and "hull2" of these
+ * access relations.
+ * If the hulls do not overlap, then neither do the access relations.
+ * If both access relations consist of a single basic map,
+ * then they are equal to their hulls and no further test is needed.
+ */
+static int hulls_and_accesses_overlap(struct gpu_array_ref_group *group1,
+	__isl_keep isl_basic_map *hull1, struct gpu_array_ref_group *group2,
+	__isl_keep isl_basic_map *hull2)
+{
+	isl_basic_map *test;
+	int empty;
+
+	test = isl_basic_map_intersect(isl_basic_map_copy(hull1),
+					isl_basic_map_copy(hull2));
+	empty = isl_basic_map_is_empty(test);
+	isl_basic_map_free(test);
+	if (empty < 0)
+		return -1;
+	if (empty)
+		return 0;
+	if (isl_map_n_basic_map(group1->access) == 1 &&
+	    isl_map_n_basic_map(group2->access) == 1)
+		return 1;
+
+	return accesses_overlap(group1, group2);
+}
+
+/* Return a simple hull of the array elements accessed by "group",
+ * computing it first if needed.
+ */
+static __isl_keep isl_basic_set *group_range_hull(
+	struct gpu_array_ref_group *group)
+{
+	isl_set *range;
+
+	if (!group->range_hull) {
+		range = isl_map_range(isl_map_copy(group->access));
+		group->range_hull = isl_set_simple_hull(range);
+	}
+
+	return group->range_hull;
+}
+
+/* Is it possible for group1 and group2 to access the same array elements?
+ * This is a cheap test that only considers the array elements
+ * accessed by the entire kernel, performed before the more expensive
+ * tests that take into account the schedule.
+ */
+static int ranges_may_overlap(struct gpu_array_ref_group *group1,
+	struct gpu_array_ref_group *group2)
+{
+	isl_basic_set *hull1, *hull2, *test;
+	int empty;
+
+	hull1 = group_range_hull(group1);
+	hull2 = group_range_hull(group2);
+	if (!hull1 || !hull2)
+		return -1;
+	test = isl_basic_set_intersect(isl_basic_set_copy(hull1),
+					isl_basic_set_copy(hull2));
+	empty = isl_basic_set_is_empty(test);
+	isl_basic_set_free(test);
+	if (empty < 0)
+		return -1;
+
+	return !empty;
+}
+
 /* Combine the given two groups into a single group, containing
  * the references of both groups.
  */
@@ -920,6 +1084,7 @@ static struct gpu_array_ref_group *join_groups(
 	group->write = group1->write || group2->write;
 	group->exact_write = group1->exact_write && group2->exact_write;
 	group->slice = group1->slice || group2->slice;
+	group->coalesced = -1;
 	group->n_ref = group1->n_ref + group2->n_ref;
 	group->refs = isl_alloc_array(ctx, struct gpu_stmt_access *,
 					group->n_ref);
@@ -1018,6 +1183,75 @@ static __isl_give isl_map *shared_access(struct gpu_array_ref_group *group,
 	return isl_map_from_union_map(shared);
 }
 
+/* Is every reference in "group" an access to a reduction target
+ * from a reduction statement?
+ */
+static isl_bool is_histogram_group(struct ppcg_kernel *kernel,
+	struct gpu_array_ref_group *group)
+{
+	int i;
+	isl_union_map *reductions = kernel->prog->scop->reductions;
+
+	for (i = 0; i < group->n_ref; ++i) {
+		isl_union_map *access;
+		isl_bool subset;
+
+		access = isl_union_map_from_map(
+				isl_map_copy(group->refs[i]->access));
+		subset = isl_union_map_is_subset(access, reductions);
+		isl_union_map_free(access);
+		if (subset < 0 || !subset)
+			return subset;
+	}
+
+	return isl_bool_true;
+}
+
+/* Compute a shared memory tile for the array reference group "group"
+ * of the reduction target "array" if the "shared_histograms" option
+ * is set and "use_shared" is set.
+ * Return 0 on success and -1 on error.
+ *
+ * The group can only be privatized if all its references
+ * belong to reduction statements.  The reductions then update
+ * a shared memory copy of the elements of the tile that is initialized
+ * to zero and that is atomically added to global memory afterwards.
+ * Since the shared memory copy does not need to contain the values
+ * in global memory, the group does not need to have exact writes and
+ * references to several elements are not an issue either.
+ */
+static int compute_histogram_bounds(struct ppcg_kernel *kernel,
+	struct gpu_array_ref_group *group, struct gpu_group_data *data,
+	int use_shared)
+{
+	isl_ctx *ctx = isl_space_get_ctx(group->array->space);
+	isl_union_map *access;
+	isl_map *acc;
+	isl_bool histogram;
+
+	if (!use_shared || !kernel->options->shared_histograms)
+		return 0;
+	histogram = is_histogram_group(kernel, group);
+	if (histogram < 0)
+		return -1;
+	if (!histogram)
+		return 0;
+
+	group->shared_tile = gpu_array_tile_create(ctx, group->array->n_index);
+	if (!group->shared_tile)
+		return -1;
+	access = gpu_array_ref_group_access_relation(group, 1, 1);
+	acc = shared_access(group, access, data);
+	isl_union_map_free(access);
+	if (!can_tile(acc, group->shared_tile))
+		group->shared_tile = gpu_array_tile_free(group->shared_tile);
+	else
+		group->histogram = 1;
+	isl_map_free(acc);
+
+	return 0;
+}
+
 /* Compute the private and/or shared memory tiles for the array
  * reference group "group" of array "array".
  * Return 0 on success and -1 on error.
@@ -1041,6 +1275,8 @@ static __isl_give isl_map *shared_access(struct gpu_array_ref_group *group,
  * We only try to compute a shared memory tile if there is any reuse
  * or if the access is not coalesced.
  * Reuse and coalescing are checked within the given kernel.
+ * If the "pad_shared_memory" option is set and if the shared memory copy
+ * would suffer from bank conflicts, then the shared memory tile is padded.
  *
  * For computing a private memory tile, we also require that there is
  * some reuse.  Moreover, we require that the access is private
@@ -1081,6 +1317,10 @@ static __isl_give isl_map *shared_access(struct gpu_array_ref_group *group,
  * without performing some kind of expansion on those arrays
  * that are forcibly mapped to private memory.
  *
+ * The targets of reductions are updated atomically in global memory and
+ * are therefore not mapped to shared or private memory,
+ * except through compute_histogram_bounds.
+ *
  * If the array is marked force_private, then we bypass all checks
  * and assume we can (and should) use registers only.
  *
@@ -1095,6 +1335,7 @@ static int compute_group_bounds_core(struct ppcg_kernel *kernel,
 	isl_union_map *access, *local;
 	int n_index = group->array->n_index;
 	int no_reuse, coalesced;
+	int conflicts = 0;
 	isl_map *acc;
 	int force_private = group->local_array->force_private;
 	int use_shared = !force_private && kernel->options->use_shared_memory &&
@@ -1108,6 +1349,9 @@ static int compute_group_bounds_core(struct ppcg_kernel *kernel,
 		return 0;
 	if (gpu_array_is_read_only_scalar(group->array))
 		return 0;
+	if (group->array->reduction)
+		return compute_histogram_bounds(kernel, group, data,
+						use_shared);
 	if (!force_private && !group->exact_write)
 		return 0;
 	if (group->slice)
@@ -1118,8 +1362,14 @@ static int compute_group_bounds_core(struct ppcg_kernel *kernel,
 	no_reuse = isl_union_map_is_injective(local);
 	if (no_reuse < 0)
 		r = -1;
-	if (use_shared && no_reuse)
+	if (use_shared && no_reuse) {
 		coalesced = access_is_coalesced(data, local);
+		group->coalesced = coalesced;
+	}
+	if (use_shared && kernel->options->pad_shared_memory)
+		conflicts = access_has_bank_conflicts(data, local);
+	if (conflicts < 0)
+		r = -1;
 	isl_union_map_free(local);
 
 	if (r >= 0 && kernel->options->debug->verbose &&
@@ -1135,6 +1385,8 @@ static int compute_group_bounds_core(struct ppcg_kernel *kernel,
 		else if (!can_tile(acc, group->shared_tile))
 			group->shared_tile =
 					gpu_array_tile_free(group->shared_tile);
+		else if (conflicts && pad_tile(group->shared_tile) < 0)
+			r = -1;
 		isl_map_free(acc);
 	}
 
@@ -1260,21 +1512,168 @@ static int group_writes(struct ppcg_kernel *kernel,
 	return n;
 }
 
+/* Return the representative of the set containing "i"
+ * in the union-find data structure "parent",
+ * compressing the path to the representative along the way.
+ */
+static int find_root(int *parent, int i)
+{
+	while (parent[i] != i) {
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+
+	return i;
+}
+
+/* Replace the groups in "groups" by the unions of the groups
+ * in each set of the union-find data structure "parent".
+ * Each union is stored in the position of the first group in the set.
+ *
+ * Return the updated number of groups.
+ * Return -1 on error.
+ */
+static int join_sets(int n, struct gpu_array_ref_group **groups,
+	int *parent)
+{
+	int i, j, root;
+	int *first;
+	isl_ctx *ctx;
+
+	if (n == 0)
+		return 0;
+	ctx = isl_map_get_ctx(groups[0]->access);
+	first = isl_alloc_array(ctx, int, n);
+	if (!first)
+		return -1;
+	for (i = 0; i < n; ++i)
+		first[i] = -1;
+	for (i = 0; i < n; ++i) {
+		root = find_root(parent, i);
+		if (first[root] < 0) {
+			first[root] = i;
+			continue;
+		}
+		j = first[root];
+		groups[j] = join_groups_and_free(groups[j], groups[i]);
+		groups[i] = NULL;
+		if (!groups[j])
+			break;
+	}
+	free(first);
+	if (i < n)
+		return -1;
+
+	for (i = 0, j = 0; i < n; ++i)
+		if (groups[i])
+			groups[j++] = groups[i];
+	for (i = j; i < n; ++i)
+		groups[i] = NULL;
+
+	return j;
+}
+
 /* If two groups have overlapping access relations (within the innermost
  * loop) and if one of them involves a write, then merge the two groups
  * into one.
  *
+ * Since the access relation of a merged group is the union of those
+ * of its members, the merged group overlaps with another group
+ * if any of its members does, such that the merging can be performed
+ * on the initial groups using a union-find data structure.
+ * "write" keeps track of whether any member of each set involves a write.
+ * Pairs within the same set do not need to be tested and
+ * the pairs that have been found not to overlap are recorded in "disjoint"
+ * such that each pair is tested at most once.
+ * Pairs involving only reads may need to be considered again
+ * when one of the groups gets merged with a write.
+ * The overlap test itself first checks the simple hulls of
+ * the access relations.  The merged groups are only constructed
+ * at the end.
+ *
  * Return the updated number of groups.
+ * Return -1 on error.
  */
 static int group_overlapping_writes(struct ppcg_kernel *kernel,
 	int n, struct gpu_array_ref_group **groups,
 	struct gpu_group_data *data)
 {
-	return group_writes(kernel, n, groups, &accesses_overlap, 0, data);
+	int i, j, ri, rj;
+	int changed;
+	int n_hull = n;
+	int *parent = NULL;
+	char *write = NULL, *disjoint = NULL;
+	isl_basic_map **hull = NULL;
+	isl_ctx *ctx;
+
+	if (n <= 1)
+		return n;
+
+	ctx = isl_map_get_ctx(groups[0]->access);
+	parent = isl_alloc_array(ctx, int, n);
+	write = isl_alloc_array(ctx, char, n);
+	disjoint = isl_calloc_array(ctx, char, n * n);
+	hull = isl_calloc_array(ctx, isl_basic_map *, n);
+	if (!parent || !write || !disjoint || !hull)
+		goto error;
+	for (i = 0; i < n; ++i) {
+		parent[i] = i;
+		write[i] = groups[i]->write;
+		hull[i] = isl_map_simple_hull(isl_map_copy(groups[i]->access));
+		if (!hull[i])
+			goto error;
+	}
+
+	do {
+		changed = 0;
+		for (i = 0; i < n; ++i) {
+			for (j = i + 1; j < n; ++j) {
+				int overlap;
+
+				ri = find_root(parent, i);
+				rj = find_root(parent, j);
+				if (ri == rj || disjoint[i * n + j])
+					continue;
+				if (!write[ri] && !write[rj])
+					continue;
+				overlap = hulls_and_accesses_overlap(groups[i],
+						hull[i], groups[j], hull[j]);
+				if (overlap < 0)
+					goto error;
+				if (!overlap) {
+					disjoint[i * n + j] = 1;
+					continue;
+				}
+				parent[rj] = ri;
+				write[ri] = 1;
+				changed = 1;
+			}
+		}
+	} while (changed);
+
+	n = join_sets(n, groups, parent);
+
+	for (i = 0; i < n_hull; ++i)
+		isl_basic_map_free(hull[i]);
+	free(hull);
+	free(disjoint);
+	free(write);
+	free(parent);
+	return n;
+error:
+	for (i = 0; hull && i < n_hull; ++i)
+		isl_basic_map_free(hull[i]);
+	free(hull);
+	free(disjoint);
+	free(write);
+	free(parent);
+	return -1;
 }
 
 /* Check if the access relations of group1 and group2 overlap within
  * the outermost min(group1->min_depth, group2->min_depth) loops.
+ * The groups cannot overlap if they access disjoint sets of array elements,
+ * which is checked first since it does not depend on the depth.
  */
 static int depth_accesses_overlap(struct gpu_array_ref_group *group1,
 	struct gpu_array_ref_group *group2)
@@ -1282,8 +1681,13 @@ static int depth_accesses_overlap(struct gpu_array_ref_group *group1,
 	int depth;
 	int dim;
 	int empty;
+	int may_overlap;
 	isl_map *map_i, *map_j, *map;
 
+	may_overlap = ranges_may_overlap(group1, group2);
+	if (may_overlap <= 0)
+		return may_overlap;
+
 	depth = group1->min_depth;
 	if (group2->min_depth < depth)
 		depth = group2->min_depth;
@@ -28,12 +28,25 @@ struct gpu_array_ref_group {
 	 * slice is set if there is at least one access in the group
 	 * that refers to more than one element
 	 * "min_depth" is the minimum of the tile depths and thread_depth.
+	 * "range_hull" is a simple hull of the accessed array elements,
+	 * computed on demand to quickly detect groups that cannot overlap.
+	 * "coalesced" is set to 1 or 0 if the accesses were found
+	 * to be coalesced or not while deciding whether to map the group
+	 * to shared memory and to -1 if this was not checked.
 	 */
 	isl_map *access;
 	int write;
 	int exact_write;
 	int slice;
 	int min_depth;
+	isl_basic_set *range_hull;
+	int coalesced;
+
+	/* Is the shared memory tile a privatized copy of a reduction target?
+	 * If so, the tile is initialized to zero and
+	 * atomically added to global memory.
+	 */
+	int histogram;
 
 	/* The shared memory tile, NULL if none. */
 	struct gpu_array_tile *shared_tile;
@@ -61,5 +74,7 @@ struct gpu_array_tile *gpu_array_ref_group_tile(
 	struct gpu_array_ref_group *group);
 struct gpu_array_ref_group *gpu_array_ref_group_free(
 	struct gpu_array_ref_group *group);
+void gpu_array_ref_group_free_construction_data(
+	struct gpu_array_ref_group *group);
 
 #endif
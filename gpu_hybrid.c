@@ -113,6 +113,8 @@ static __isl_give isl_schedule_node *update_phase(
  * as the sum of the dimensions of the parent and the child node.
  *
  * Convert the tile_sizes to an isl_multi_val in the right space,
+ * enlarge the base of the hexagon if it is too narrow for "bounds" and
+ * the hybrid_auto_sizes option is set, updating "tile_sizes" accordingly,
  * insert the hybrid tiling and then create a kernel inside each phase.
  * Finally, remove the phase marks.
  */
@@ -131,6 +133,15 @@ __isl_give isl_schedule_node *gpu_hybrid_tile(struct gpu_gen *gen,
 	space = isl_schedule_node_band_get_space(node);
 	space = isl_space_product(space, space2);
 	mv = ppcg_multi_val_from_int_list(space, tile_sizes);
+	if (gen->options->hybrid_auto_sizes) {
+		isl_val *v;
+
+		mv = ppcg_ht_bounds_widen_sizes(bounds, mv);
+		v = isl_multi_val_get_val(mv, 1);
+		if (v && isl_val_is_int(v))
+			tile_sizes[1] = isl_val_get_num_si(v);
+		isl_val_free(v);
+	}
 
 	node = ppcg_ht_bounds_insert_tiling(bounds, mv, node, gen->options);
 
@@ -39,14 +39,15 @@ __isl_give isl_printer *gpu_print_local_declarations(__isl_take isl_printer *p,
 	return p;
 }
 
-/* Print an expression for the size of "array" in bytes.
+/* Print an expression for the size in bytes of the elements of "array"
+ * with fixed values for the first "first" indices.
  */
-__isl_give isl_printer *gpu_array_info_print_size(__isl_take isl_printer *prn,
-	struct gpu_array_info *array)
+static __isl_give isl_printer *print_inner_size(__isl_take isl_printer *prn,
+	struct gpu_array_info *array, int first)
 {
 	int i;
 
-	for (i = 0; i < array->n_index; ++i) {
+	for (i = first; i < array->n_index; ++i) {
 		isl_ast_expr *bound;
 
 		prn = isl_printer_print_str(prn, "(");
@@ -62,6 +63,54 @@ __isl_give isl_printer *gpu_array_info_print_size(__isl_take isl_printer *prn,
 	return prn;
 }
 
+/* Print an expression for the size of "array" in bytes.
+ */
+__isl_give isl_printer *gpu_array_info_print_size(__isl_take isl_printer *prn,
+	struct gpu_array_info *array)
+{
+	return print_inner_size(prn, array, 0);
+}
+
+/* Print an expression for the offset in bytes of the elements of "array"
+ * with outermost index "lo" with respect to the start of the array.
+ * If "lo" is NULL, then print an offset of zero.
+ */
+__isl_give isl_printer *gpu_array_info_print_slab_offset(
+	__isl_take isl_printer *prn, struct gpu_array_info *array,
+	__isl_keep isl_ast_expr *lo)
+{
+	if (!lo)
+		return isl_printer_print_str(prn, "0");
+
+	prn = isl_printer_print_str(prn, "(");
+	prn = isl_printer_print_ast_expr(prn, lo);
+	prn = isl_printer_print_str(prn, ") * ");
+	prn = print_inner_size(prn, array, 1);
+
+	return prn;
+}
+
+/* Print an expression for the size in bytes of the elements of "array"
+ * with outermost index between "lo" and "hi" (inclusive).
+ * If "lo" and "hi" are NULL, then print the size of the entire array.
+ */
+__isl_give isl_printer *gpu_array_info_print_slab_size(
+	__isl_take isl_printer *prn, struct gpu_array_info *array,
+	__isl_keep isl_ast_expr *lo, __isl_keep isl_ast_expr *hi)
+{
+	if (!lo || !hi)
+		return gpu_array_info_print_size(prn, array);
+
+	prn = isl_printer_print_str(prn, "((");
+	prn = isl_printer_print_ast_expr(prn, hi);
+	prn = isl_printer_print_str(prn, ") - (");
+	prn = isl_printer_print_ast_expr(prn, lo);
+	prn = isl_printer_print_str(prn, ") + 1) * ");
+	prn = print_inner_size(prn, array, 1);
+
+	return prn;
+}
+
 /* Print the declaration of a non-linearized array argument.
  */
 static __isl_give isl_printer *print_non_linearized_declaration_argument(
@@ -163,12 +212,32 @@ static __isl_give isl_printer *stmt_print_global_index(
  * while a write copy statement is printed as
  *
  *	global = local;
+ *
+ * If the tile is a privatized copy of a reduction target, then
+ * these are printed as
+ *
+ *	local = 0;
+ *
+ * and
+ *
+ *	ppcg_atomic_add(global, local);
+ *
+ * instead.
  */
 __isl_give isl_printer *ppcg_kernel_print_copy(__isl_take isl_printer *p,
 	struct ppcg_kernel_stmt *stmt)
 {
 	p = isl_printer_start_line(p);
-	if (stmt->u.c.read) {
+	if (stmt->u.c.histogram && stmt->u.c.read) {
+		p = stmt_print_local_index(p, stmt);
+		p = isl_printer_print_str(p, " = 0");
+	} else if (stmt->u.c.histogram) {
+		p = isl_printer_print_str(p, "ppcg_atomic_add(");
+		p = stmt_print_global_index(p, stmt);
+		p = isl_printer_print_str(p, ", ");
+		p = stmt_print_local_index(p, stmt);
+		p = isl_printer_print_str(p, ")");
+	} else if (stmt->u.c.read) {
 		p = stmt_print_local_index(p, stmt);
 		p = isl_printer_print_str(p, " = ");
 		p = stmt_print_global_index(p, stmt);
@@ -183,12 +252,272 @@ __isl_give isl_printer *ppcg_kernel_print_copy(__isl_take isl_printer *p,
 	return p;
 }
 
+/* Print the address of the local and global element of "stmt"
+ * for "local" being set and not set, respectively,
+ * cast to a pointer to a vector of stmt->u.c.vector_width elements.
+ * "space" is the address space qualifier of the pointer, if any.
+ */
+static __isl_give isl_printer *print_vector_pointer(__isl_take isl_printer *p,
+	struct ppcg_kernel_stmt *stmt, int local, const char *space)
+{
+	p = isl_printer_print_str(p, "*((");
+	if (space) {
+		p = isl_printer_print_str(p, space);
+		p = isl_printer_print_str(p, " ");
+	}
+	p = isl_printer_print_str(p, stmt->u.c.array->type);
+	p = isl_printer_print_int(p, stmt->u.c.vector_width);
+	p = isl_printer_print_str(p, " *) &");
+	if (local)
+		p = stmt_print_local_index(p, stmt);
+	else
+		p = stmt_print_global_index(p, stmt);
+	p = isl_printer_print_str(p, ")");
+
+	return p;
+}
+
+/* Print a read copy statement that copies stmt->u.c.vector_width
+ * consecutive elements at once.
+ * "global_space" and "local_space" are the address space qualifiers of
+ * the global and shared memory, if any.
+ * The statement is printed as
+ *
+ *	*((local_space typeN *) &local) = *((global_space typeN *) &global);
+ */
+__isl_give isl_printer *ppcg_kernel_print_vector_copy(
+	__isl_take isl_printer *p, struct ppcg_kernel_stmt *stmt,
+	const char *global_space, const char *local_space)
+{
+	p = isl_printer_start_line(p);
+	p = print_vector_pointer(p, stmt, 1, local_space);
+	p = isl_printer_print_str(p, " = ");
+	p = print_vector_pointer(p, stmt, 0, global_space);
+	p = isl_printer_print_str(p, ";");
+	p = isl_printer_end_line(p);
+
+	return p;
+}
+
 __isl_give isl_printer *ppcg_kernel_print_domain(__isl_take isl_printer *p,
 	struct ppcg_kernel_stmt *stmt)
 {
 	return pet_stmt_print_body(stmt->u.d.stmt->stmt, p, stmt->u.d.ref2expr);
 }
 
+/* Replace the "+=" operation "expr" of a reduction statement
+ * by a call to ppcg_atomic_add with the same two arguments.
+ */
+static __isl_give pet_expr *atomic_add(__isl_take pet_expr *expr, void *user)
+{
+	pet_expr *call;
+
+	if (pet_expr_get_type(expr) != pet_expr_op ||
+	    pet_expr_op_get_type(expr) != pet_op_add_assign)
+		return expr;
+
+	call = pet_expr_new_call(pet_expr_get_ctx(expr), "ppcg_atomic_add", 2);
+	call = pet_expr_set_arg(call, 0, pet_expr_get_arg(expr, 0));
+	call = pet_expr_set_arg(call, 1, pet_expr_get_arg(expr, 1));
+	pet_expr_free(expr);
+
+	return call;
+}
+
+/* Print the body of the reduction statement "stmt" inside a kernel
+ * such that the update is performed atomically.
+ * In particular, the update "a += b" is printed as
+ *
+ *	ppcg_atomic_add(a, b);
+ *
+ * where ppcg_atomic_add is defined by gpu_print_atomic_add_macro.
+ */
+__isl_give isl_printer *ppcg_kernel_print_atomic_domain(
+	__isl_take isl_printer *p, struct ppcg_kernel_stmt *stmt)
+{
+	struct pet_stmt *ps;
+	pet_tree *tree;
+
+	ps = stmt->u.d.stmt->stmt;
+	tree = pet_tree_copy(ps->body);
+	ps->body = pet_tree_map_expr(ps->body, &atomic_add, NULL);
+	p = ppcg_kernel_print_domain(p, stmt);
+	pet_tree_free(ps->body);
+	ps->body = tree;
+
+	return p;
+}
+
+/* Print a definition of the ppcg_atomic_add macro used
+ * by ppcg_kernel_print_atomic_domain in terms of the target specific
+ * atomic addition function "fn", provided "prog" contains any reductions.
+ */
+__isl_give isl_printer *gpu_print_atomic_add_macro(__isl_take isl_printer *p,
+	struct gpu_prog *prog, const char *fn)
+{
+	isl_bool empty;
+
+	empty = isl_union_map_is_empty(prog->scop->reductions);
+	if (empty < 0)
+		return isl_printer_free(p);
+	if (empty)
+		return p;
+
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "#define ppcg_atomic_add(x, y) ");
+	p = isl_printer_print_str(p, fn);
+	p = isl_printer_print_str(p, "(&(x), y)");
+	p = isl_printer_end_line(p);
+
+	return p;
+}
+
+/* Print the support code used by the generated host code
+ * for recording the time taken by kernel launches and transfers
+ * in case the --device-timing option is set.
+ * Each call to ppcg_timing_add accumulates a measurement
+ * in the entry with the same kind, name and launch configuration.
+ * The first call registers ppcg_timing_report, which writes
+ * one comma separated line per entry on exit to the file named
+ * by the PPCG_TIMING_REPORT environment variable or to stderr
+ * if this variable is not set.
+ */
+__isl_give isl_printer *gpu_print_timing_support(__isl_take isl_printer *p)
+{
+	const char *support =
+		"#include <stdlib.h>\n"
+		"#include <string.h>\n\n"
+		"struct ppcg_timing_entry {\n"
+		"  const char *kind;\n"
+		"  const char *name;\n"
+		"  long dim[6];\n"
+		"  long count;\n"
+		"  double bytes;\n"
+		"  double ms;\n"
+		"  struct ppcg_timing_entry *next;\n"
+		"};\n\n"
+		"static struct ppcg_timing_entry *ppcg_timing_entries;\n\n"
+		"static void ppcg_timing_report(void)\n"
+		"{\n"
+		"  const char *name = getenv(\"PPCG_TIMING_REPORT\");\n"
+		"  FILE *file = name ? fopen(name, \"w\") : stderr;\n"
+		"  struct ppcg_timing_entry *e;\n\n"
+		"  if (!file)\n"
+		"    return;\n"
+		"  fprintf(file, \"kind,name,grid_x,grid_y,grid_z,"
+		"block_x,block_y,block_z,count,bytes,time_ms\\n\");\n"
+		"  for (e = ppcg_timing_entries; e; e = e->next)\n"
+		"    fprintf(file, \"%s,%s,%ld,%ld,%ld,%ld,%ld,%ld,"
+		"%ld,%.0f,%f\\n\",\n"
+		"      e->kind, e->name, e->dim[0], e->dim[1], e->dim[2],\n"
+		"      e->dim[3], e->dim[4], e->dim[5], e->count, e->bytes, "
+		"e->ms);\n"
+		"  if (name)\n"
+		"    fclose(file);\n"
+		"}\n\n"
+		"static void ppcg_timing_add(const char *kind, "
+		"const char *name,\n"
+		"  long grid_x, long grid_y, long grid_z,\n"
+		"  long block_x, long block_y, long block_z,\n"
+		"  double bytes, double ms)\n"
+		"{\n"
+		"  long dim[6] = { grid_x, grid_y, grid_z, "
+		"block_x, block_y, block_z };\n"
+		"  struct ppcg_timing_entry *e;\n\n"
+		"  for (e = ppcg_timing_entries; e; e = e->next)\n"
+		"    if (!strcmp(e->kind, kind) && !strcmp(e->name, name) &&\n"
+		"        !memcmp(e->dim, dim, sizeof(dim)))\n"
+		"      break;\n"
+		"  if (!e) {\n"
+		"    e = (struct ppcg_timing_entry *) calloc(1, sizeof(*e));\n"
+		"    if (!e)\n"
+		"      return;\n"
+		"    if (!ppcg_timing_entries)\n"
+		"      atexit(&ppcg_timing_report);\n"
+		"    e->kind = kind;\n"
+		"    e->name = name;\n"
+		"    memcpy(e->dim, dim, sizeof(dim));\n"
+		"    e->next = ppcg_timing_entries;\n"
+		"    ppcg_timing_entries = e;\n"
+		"  }\n"
+		"  e->count++;\n"
+		"  e->bytes += bytes;\n"
+		"  e->ms += ms;\n"
+		"}\n\n";
+
+	return isl_printer_print_str(p, support);
+}
+
+/* Print the grid sizes of "kernel" (if "block" is not set) or
+ * its block sizes (if "block" is set) as arguments of ppcg_timing_add,
+ * padding them with 1 up to three sizes.
+ */
+static __isl_give isl_printer *print_timing_sizes(__isl_take isl_printer *p,
+	struct ppcg_kernel *kernel, int block)
+{
+	int i, n;
+
+	n = block ? kernel->n_block : kernel->n_grid;
+	for (i = 0; i < 3; ++i) {
+		isl_ast_expr *bound;
+
+		p = isl_printer_print_str(p, ", ");
+		if (i >= n) {
+			p = isl_printer_print_str(p, "1");
+		} else if (block) {
+			p = isl_printer_print_int(p, kernel->block_dim[i]);
+		} else {
+			bound = isl_ast_expr_get_op_arg(kernel->grid_size_expr,
+							1 + i);
+			p = isl_printer_print_str(p, "(long) (");
+			p = isl_printer_print_ast_expr(p, bound);
+			p = isl_printer_print_str(p, ")");
+			isl_ast_expr_free(bound);
+		}
+	}
+
+	return p;
+}
+
+/* Print a call to ppcg_timing_add (see gpu_print_timing_support)
+ * recording that an operation of kind "kind" took the number
+ * of milliseconds stored in the variable "ms" of the generated code.
+ * If "kernel" is not NULL, then the operation is a launch of "kernel"
+ * and its grid and block sizes are recorded.
+ * Otherwise, the operation transfers the slab of "array"
+ * between "lo" and "hi" and the number of transferred bytes is recorded.
+ */
+__isl_give isl_printer *gpu_print_timing_add(__isl_take isl_printer *p,
+	const char *kind, struct ppcg_kernel *kernel,
+	struct gpu_array_info *array, __isl_keep isl_ast_expr *lo,
+	__isl_keep isl_ast_expr *hi, const char *ms)
+{
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "ppcg_timing_add(\"");
+	p = isl_printer_print_str(p, kind);
+	p = isl_printer_print_str(p, "\", \"");
+	if (kernel) {
+		p = isl_printer_print_str(p, "kernel");
+		p = isl_printer_print_int(p, kernel->id);
+		p = isl_printer_print_str(p, "\"");
+		p = print_timing_sizes(p, kernel, 0);
+		p = print_timing_sizes(p, kernel, 1);
+		p = isl_printer_print_str(p, ", 0");
+	} else {
+		p = isl_printer_print_str(p, array->name);
+		p = isl_printer_print_str(p, "\", 0, 0, 0, 0, 0, 0, ");
+		p = isl_printer_print_str(p, "(double) (");
+		p = gpu_array_info_print_slab_size(p, array, lo, hi);
+		p = isl_printer_print_str(p, ")");
+	}
+	p = isl_printer_print_str(p, ", ");
+	p = isl_printer_print_str(p, ms);
+	p = isl_printer_print_str(p, ");");
+	p = isl_printer_end_line(p);
+
+	return p;
+}
+
 /* This function is called for each node in a GPU AST.
  * In case of a user node, print the macro definitions required
  * for printing the AST expressions in the annotation, if any.
@@ -14,6 +14,12 @@ __isl_give isl_printer *gpu_print_macros(__isl_take isl_printer *p,
 
 __isl_give isl_printer *gpu_array_info_print_size(__isl_take isl_printer *prn,
 	struct gpu_array_info *array);
+__isl_give isl_printer *gpu_array_info_print_slab_offset(
+	__isl_take isl_printer *prn, struct gpu_array_info *array,
+	__isl_keep isl_ast_expr *lo);
+__isl_give isl_printer *gpu_array_info_print_slab_size(
+	__isl_take isl_printer *prn, struct gpu_array_info *array,
+	__isl_keep isl_ast_expr *lo, __isl_keep isl_ast_expr *hi);
 __isl_give isl_printer *gpu_array_info_print_declaration_argument(
 	__isl_take isl_printer *p, struct gpu_array_info *array,
 	const char *memory_space);
@@ -22,7 +28,19 @@ __isl_give isl_printer *gpu_array_info_print_call_argument(
 
 __isl_give isl_printer *ppcg_kernel_print_copy(__isl_take isl_printer *p,
 	struct ppcg_kernel_stmt *stmt);
+__isl_give isl_printer *ppcg_kernel_print_vector_copy(
+	__isl_take isl_printer *p, struct ppcg_kernel_stmt *stmt,
+	const char *global_space, const char *local_space);
 __isl_give isl_printer *ppcg_kernel_print_domain(__isl_take isl_printer *p,
 	struct ppcg_kernel_stmt *stmt);
+__isl_give isl_printer *ppcg_kernel_print_atomic_domain(
+	__isl_take isl_printer *p, struct ppcg_kernel_stmt *stmt);
+__isl_give isl_printer *gpu_print_atomic_add_macro(__isl_take isl_printer *p,
+	struct gpu_prog *prog, const char *fn);
+__isl_give isl_printer *gpu_print_timing_support(__isl_take isl_printer *p);
+__isl_give isl_printer *gpu_print_timing_add(__isl_take isl_printer *p,
+	const char *kind, struct ppcg_kernel *kernel,
+	struct gpu_array_info *array, __isl_keep isl_ast_expr *lo,
+	__isl_keep isl_ast_expr *hi, const char *ms);
 
 #endif
@@ -0,0 +1,548 @@
+/*
+ * Use of this software is governed by the MIT license
+ */
+
+#include <isl/aff.h>
+#include <isl/ilp.h>
+#include <isl/set.h>
+#include <isl/map.h>
+#include <isl/union_set.h>
+#include <isl/union_map.h>
+#include <isl/printer.h>
+
+#include "gpu.h"
+#include "gpu_array_tile.h"
+#include "gpu_group.h"
+#include "gpu_report.h"
+
+/* The functions in this file print a machine-readable report
+ * of the static resource usage of the generated code
+ * (see the --kernel-report option).
+ * Each kernel and each set of host/device transfers is reported
+ * as a single JSON object on a line of its own.
+ * Sizes that cannot be determined statically are reported as null.
+ */
+
+/* Print "key" as the key of a JSON object member.
+ */
+static __isl_give isl_printer *print_key(__isl_take isl_printer *p,
+	const char *key)
+{
+	p = isl_printer_print_str(p, "\"");
+	p = isl_printer_print_str(p, key);
+	p = isl_printer_print_str(p, "\": ");
+	return p;
+}
+
+/* Print "s" as a JSON string.
+ * The strings printed in this file do not contain any characters
+ * that need to be escaped.
+ */
+static __isl_give isl_printer *print_string(__isl_take isl_printer *p,
+	const char *s)
+{
+	p = isl_printer_print_str(p, "\"");
+	p = isl_printer_print_str(p, s);
+	p = isl_printer_print_str(p, "\"");
+	return p;
+}
+
+/* Print "b" as a JSON boolean.
+ */
+static __isl_give isl_printer *print_bool(__isl_take isl_printer *p, int b)
+{
+	return isl_printer_print_str(p, b ? "true" : "false");
+}
+
+/* Print "v" as a JSON number or as null if "v" is not an integer.
+ */
+static __isl_give isl_printer *print_val(__isl_take isl_printer *p,
+	__isl_take isl_val *v)
+{
+	if (v && isl_val_is_int(v))
+		p = isl_printer_print_val(p, v);
+	else
+		p = isl_printer_print_str(p, "null");
+	isl_val_free(v);
+	return p;
+}
+
+/* Print the "n" integers in "list" as a JSON array.
+ */
+static __isl_give isl_printer *print_int_list(__isl_take isl_printer *p,
+	int n, int *list)
+{
+	int i;
+
+	p = isl_printer_print_str(p, "[");
+	for (i = 0; i < n; ++i) {
+		if (i)
+			p = isl_printer_print_str(p, ", ");
+		p = isl_printer_print_int(p, list[i]);
+	}
+	p = isl_printer_print_str(p, "]");
+	return p;
+}
+
+/* Print "mpa" in isl notation as a JSON string.
+ */
+static __isl_give isl_printer *print_multi_pw_aff(__isl_take isl_printer *p,
+	__isl_keep isl_multi_pw_aff *mpa)
+{
+	p = isl_printer_print_str(p, "\"");
+	p = isl_printer_print_multi_pw_aff(p, mpa);
+	p = isl_printer_print_str(p, "\"");
+	return p;
+}
+
+/* Return the maximal value attained by "pa" over all parameter values,
+ * or a non-integer value if there is no (finite) maximum.
+ */
+static __isl_give isl_val *pw_aff_max(__isl_take isl_pw_aff *pa)
+{
+	isl_set *set;
+	isl_local_space *ls;
+	isl_aff *obj;
+	isl_val *max;
+
+	set = isl_map_range(isl_map_from_pw_aff(pa));
+	ls = isl_local_space_from_space(isl_set_get_space(set));
+	obj = isl_aff_var_on_domain(ls, isl_dim_set, 0);
+	max = isl_set_max_val(set, obj);
+	isl_aff_free(obj);
+	isl_set_free(set);
+
+	return max;
+}
+
+/* Return the maximal number of elements, over all parameter values,
+ * in dimension "pos" of a box around "set",
+ * or NaN if "set" is not bounded in this dimension.
+ */
+static __isl_give isl_val *box_extent(__isl_keep isl_set *set, int pos)
+{
+	isl_pw_aff *min, *max;
+
+	if (!isl_set_dim_has_lower_bound(set, isl_dim_set, pos) ||
+	    !isl_set_dim_has_upper_bound(set, isl_dim_set, pos))
+		return isl_val_nan(isl_set_get_ctx(set));
+
+	min = isl_set_dim_min(isl_set_copy(set), pos);
+	max = isl_set_dim_max(isl_set_copy(set), pos);
+	max = isl_pw_aff_sub(max, min);
+
+	return isl_val_add_ui(pw_aff_max(max), 1);
+}
+
+/* Return an estimate of the number of bytes occupied by a box
+ * around the array elements in "set", of "size" bytes each.
+ * Return zero if "set" is empty and NaN if the box is not bounded.
+ */
+static __isl_give isl_val *box_bytes(__isl_take isl_set *set, int size)
+{
+	int i, n;
+	isl_ctx *ctx;
+	isl_bool empty;
+	isl_val *bytes;
+
+	empty = isl_set_is_empty(set);
+	if (empty < 0) {
+		isl_set_free(set);
+		return NULL;
+	}
+	ctx = isl_set_get_ctx(set);
+	bytes = isl_val_int_from_si(ctx, empty ? 0 : size);
+	n = empty ? 0 : isl_set_dim(set, isl_dim_set);
+	for (i = 0; i < n; ++i) {
+		isl_val *extent;
+
+		extent = box_extent(set, i);
+		if (!extent || !isl_val_is_int(extent)) {
+			isl_val_free(bytes);
+			bytes = extent;
+			break;
+		}
+		bytes = isl_val_mul(bytes, extent);
+	}
+	isl_set_free(set);
+
+	return bytes;
+}
+
+/* Return the array elements accessed by "group" in the kernel.
+ */
+static __isl_give isl_set *group_accessed(struct gpu_array_ref_group *group)
+{
+	return isl_map_range(isl_map_copy(group->access));
+}
+
+/* Return the elements of the array of "local" accessed
+ * by any of its groups in the kernel.
+ */
+static __isl_give isl_set *local_accessed(struct gpu_local_array_info *local)
+{
+	int i;
+	isl_set *accessed;
+
+	accessed = isl_set_empty(isl_space_copy(local->array->space));
+	for (i = 0; i < local->n_group; ++i)
+		accessed = isl_set_union(accessed,
+					group_accessed(local->groups[i]));
+
+	return accessed;
+}
+
+/* Return the number of bytes of the (shared or private memory) tile
+ * of "group", taking into account double buffering,
+ * or zero if the group is accessed from global memory.
+ */
+static __isl_give isl_val *group_tile_bytes(isl_ctx *ctx,
+	struct gpu_array_ref_group *group)
+{
+	struct gpu_array_tile *tile;
+	isl_val *size;
+
+	tile = gpu_array_ref_group_tile(group);
+	if (!tile)
+		return isl_val_zero(ctx);
+
+	size = gpu_array_tile_size(tile);
+	size = isl_val_mul_ui(size, group->array->size);
+	if (tile->double_buffer)
+		size = isl_val_mul_ui(size, 2);
+
+	return size;
+}
+
+/* Does any of the references in "group" read from the array?
+ */
+static int group_is_read(struct gpu_array_ref_group *group)
+{
+	int i;
+
+	for (i = 0; i < group->n_ref; ++i)
+		if (group->refs[i]->read)
+			return 1;
+
+	return 0;
+}
+
+/* Print a JSON description of the array reference group "group".
+ * This consists of the kind of memory the group is mapped to,
+ * whether it reads and/or writes the array, the outcome
+ * of the coalescing check that was performed while deciding
+ * whether to map the group to shared memory (or null if the check
+ * was not performed), the size of its tile and an estimate
+ * of the number of bytes it accesses, based on a box around
+ * the accessed elements.
+ * For groups mapped to shared memory, the padding and
+ * double buffering of the tile are printed as well.
+ */
+static __isl_give isl_printer *print_group(__isl_take isl_printer *p,
+	isl_ctx *ctx, struct gpu_array_ref_group *group)
+{
+	enum ppcg_group_access_type type;
+	struct gpu_array_tile *tile;
+	const char *memory = "global";
+
+	type = gpu_array_ref_group_type(group);
+	if (type == ppcg_access_shared)
+		memory = "shared";
+	else if (type == ppcg_access_private)
+		memory = "private";
+	tile = gpu_array_ref_group_tile(group);
+
+	p = isl_printer_print_str(p, "{");
+	p = print_key(p, "nr");
+	p = isl_printer_print_int(p, group->nr);
+	p = isl_printer_print_str(p, ", ");
+	p = print_key(p, "memory");
+	p = print_string(p, memory);
+	p = isl_printer_print_str(p, ", ");
+	p = print_key(p, "read");
+	p = print_bool(p, group_is_read(group));
+	p = isl_printer_print_str(p, ", ");
+	p = print_key(p, "write");
+	p = print_bool(p, group->write);
+	p = isl_printer_print_str(p, ", ");
+	p = print_key(p, "coalesced");
+	if (group->coalesced < 0)
+		p = isl_printer_print_str(p, "null");
+	else
+		p = print_bool(p, group->coalesced);
+	p = isl_printer_print_str(p, ", ");
+	p = print_key(p, "tile_bytes");
+	p = print_val(p, group_tile_bytes(ctx, group));
+	p = isl_printer_print_str(p, ", ");
+	p = print_key(p, "footprint_bytes");
+	p = print_val(p, box_bytes(group_accessed(group), group->array->size));
+	if (type == ppcg_access_shared) {
+		p = isl_printer_print_str(p, ", ");
+		p = print_key(p, "padding");
+		p = isl_printer_print_int(p, tile->pad);
+		p = isl_printer_print_str(p, ", ");
+		p = print_key(p, "double_buffer");
+		p = print_bool(p, tile->double_buffer);
+	}
+	p = isl_printer_print_str(p, "}");
+
+	return p;
+}
+
+/* Print a JSON description of the local array "local" of a kernel.
+ * "global" is set if the global device memory of the array is accessed
+ * by some groups, i.e., if not all of them were mapped to
+ * private or shared memory.
+ * "footprint_bytes" is an estimate of the number of bytes of the array
+ * that are accessed by the kernel, based on a box around
+ * the elements accessed by any of the groups.
+ * "extent" is the extent of the array, as declared.
+ */
+static __isl_give isl_printer *print_local_array(__isl_take isl_printer *p,
+	isl_ctx *ctx, struct gpu_local_array_info *local)
+{
+	int i;
+
+	p = isl_printer_print_str(p, "{");
+	p = print_key(p, "name");
+	p = print_string(p, local->array->name);
+	p = isl_printer_print_str(p, ", ");
+	p = print_key(p, "global");
+	p = print_bool(p, local->global);
+	p = isl_printer_print_str(p, ", ");
+	p = print_key(p, "footprint_bytes");
+	p = print_val(p, box_bytes(local_accessed(local), local->array->size));
+	if (local->bound) {
+		p = isl_printer_print_str(p, ", ");
+		p = print_key(p, "extent");
+		p = print_multi_pw_aff(p, local->bound);
+	}
+	p = isl_printer_print_str(p, ", ");
+	p = print_key(p, "groups");
+	p = isl_printer_print_str(p, "[");
+	for (i = 0; i < local->n_group; ++i) {
+		if (i)
+			p = isl_printer_print_str(p, ", ");
+		p = print_group(p, ctx, local->groups[i]);
+	}
+	p = isl_printer_print_str(p, "]}");
+
+	return p;
+}
+
+/* Return the total amount of shared memory (in bytes) used by "kernel".
+ */
+static __isl_give isl_val *kernel_shared_memory(struct ppcg_kernel *kernel)
+{
+	int i, j;
+	isl_val *total;
+
+	total = isl_val_zero(kernel->ctx);
+	for (i = 0; i < kernel->n_array; ++i) {
+		struct gpu_local_array_info *local = &kernel->array[i];
+
+		for (j = 0; j < local->n_group; ++j) {
+			struct gpu_array_ref_group *group = local->groups[j];
+
+			if (gpu_array_ref_group_type(group) !=
+			    ppcg_access_shared)
+				continue;
+			total = isl_val_add(total,
+					group_tile_bytes(kernel->ctx, group));
+		}
+	}
+
+	return total;
+}
+
+/* Return an estimate of the number of bytes of global memory
+ * accessed by "kernel", i.e., the sum of the footprints
+ * of all its arrays, or NaN if any of these footprints
+ * cannot be determined statically.
+ */
+static __isl_give isl_val *kernel_footprint(struct ppcg_kernel *kernel)
+{
+	int i;
+	isl_val *total;
+
+	total = isl_val_zero(kernel->ctx);
+	for (i = 0; i < kernel->n_array; ++i) {
+		struct gpu_local_array_info *local = &kernel->array[i];
+		isl_val *bytes;
+
+		if (local->n_group == 0)
+			continue;
+		bytes = box_bytes(local_accessed(local), local->array->size);
+		total = isl_val_add(total, bytes);
+	}
+
+	return total;
+}
+
+/* Print a JSON description of the resources used by "kernel" to "out".
+ * This function is called after all decisions on the placement
+ * of the array reference groups have been made, i.e., after
+ * check_shared_memory_bound has dropped the shared memory tiles
+ * that do not fit and after mark_global_arrays has marked
+ * the arrays that are accessed from global memory and before
+ * the access relations of the groups are freed.
+ *
+ * The description consists of the effective grid and block sizes,
+ * the (possibly parametric) number of blocks that actually execute code,
+ * the total amount of shared memory used by the kernel,
+ * an estimate of the number of bytes of global memory it accesses and
+ * a description of each of its arrays.
+ */
+void gpu_report_kernel(FILE *out, struct ppcg_kernel *kernel)
+{
+	int i;
+	isl_printer *p;
+
+	if (!out || !kernel)
+		return;
+
+	p = isl_printer_to_file(kernel->ctx, out);
+	p = isl_printer_print_str(p, "{");
+	p = print_key(p, "kernel");
+	p = isl_printer_print_int(p, kernel->id);
+	p = isl_printer_print_str(p, ", ");
+	p = print_key(p, "grid");
+	p = print_int_list(p, kernel->n_grid, kernel->grid_dim);
+	p = isl_printer_print_str(p, ", ");
+	p = print_key(p, "grid_size");
+	if (kernel->grid_size)
+		p = print_multi_pw_aff(p, kernel->grid_size);
+	else
+		p = isl_printer_print_str(p, "null");
+	p = isl_printer_print_str(p, ", ");
+	p = print_key(p, "block");
+	p = print_int_list(p, kernel->n_block, kernel->block_dim);
+	p = isl_printer_print_str(p, ", ");
+	p = print_key(p, "shared_memory_bytes");
+	p = print_val(p, kernel_shared_memory(kernel));
+	p = isl_printer_print_str(p, ", ");
+	p = print_key(p, "footprint_bytes");
+	p = print_val(p, kernel_footprint(kernel));
+	p = isl_printer_print_str(p, ", ");
+	p = print_key(p, "arrays");
+	p = isl_printer_print_str(p, "[");
+	for (i = 0; i < kernel->n_array; ++i) {
+		if (i)
+			p = isl_printer_print_str(p, ", ");
+		p = print_local_array(p, kernel->ctx, &kernel->array[i]);
+	}
+	p = isl_printer_print_str(p, "]}\n");
+	isl_printer_free(p);
+}
+
+/* Return the elements of "array" in the range of "copy".
+ */
+static __isl_give isl_set *copied_elements(__isl_keep isl_union_map *copy,
+	struct gpu_array_info *array)
+{
+	isl_union_set *range;
+	isl_set *set;
+
+	range = isl_union_map_range(isl_union_map_copy(copy));
+	set = isl_union_set_extract_set(range, isl_space_copy(array->space));
+	isl_union_set_free(range);
+
+	return set;
+}
+
+/* Return an estimate of the number of bytes of "array"
+ * copied according to "copy", based on a box around the copied elements,
+ * after setting *copied to whether any elements are copied at all.
+ */
+static __isl_give isl_val *copied_bytes(__isl_keep isl_union_map *copy,
+	struct gpu_array_info *array, isl_bool *copied)
+{
+	isl_set *set;
+
+	set = copied_elements(copy, array);
+	*copied = isl_bool_not(isl_set_is_empty(set));
+
+	return box_bytes(set, array->size);
+}
+
+/* Print a JSON description of the host/device transfers of
+ * the arrays in "prog" to "out", where "copy_in" and "copy_out"
+ * map prefix schedule values to the outer array elements that
+ * are copied to and from the device.
+ * The number of transferred bytes of an array in each direction
+ * is estimated by the size of a box around the copied elements,
+ * which is an upper bound on the amount of data copied
+ * by any single transfer.  The reported number of bytes
+ * of the array is the largest of these two estimates.
+ */
+void gpu_report_transfers(FILE *out, struct gpu_prog *prog,
+	__isl_keep isl_union_map *copy_in, __isl_keep isl_union_map *copy_out)
+{
+	int i;
+	int first = 1;
+	isl_printer *p;
+	isl_val *to_device, *from_device;
+
+	if (!out || !prog)
+		return;
+
+	to_device = isl_val_zero(prog->ctx);
+	from_device = isl_val_zero(prog->ctx);
+	p = isl_printer_to_file(prog->ctx, out);
+	p = isl_printer_print_str(p, "{");
+	p = print_key(p, "transfers");
+	p = isl_printer_print_str(p, "[");
+	for (i = 0; i < prog->n_array; ++i) {
+		struct gpu_array_info *array = &prog->array[i];
+		isl_bool to, from;
+		isl_val *bytes, *to_bytes, *from_bytes;
+
+		to_bytes = copied_bytes(copy_in, array, &to);
+		from_bytes = copied_bytes(copy_out, array, &from);
+		if (to < 0 || from < 0 || !to_bytes || !from_bytes) {
+			isl_val_free(to_bytes);
+			isl_val_free(from_bytes);
+			break;
+		}
+		if (!to && !from) {
+			isl_val_free(to_bytes);
+			isl_val_free(from_bytes);
+			continue;
+		}
+		to_device = isl_val_add(to_device, isl_val_copy(to_bytes));
+		from_device = isl_val_add(from_device,
+					isl_val_copy(from_bytes));
+		if (isl_val_is_nan(to_bytes) || isl_val_is_nan(from_bytes))
+			bytes = isl_val_nan(prog->ctx);
+		else
+			bytes = isl_val_max(isl_val_copy(to_bytes),
+					    isl_val_copy(from_bytes));
+		isl_val_free(to_bytes);
+		isl_val_free(from_bytes);
+
+		if (!first)
+			p = isl_printer_print_str(p, ", ");
+		first = 0;
+		p = isl_printer_print_str(p, "{");
+		p = print_key(p, "array");
+		p = print_string(p, array->name);
+		p = isl_printer_print_str(p, ", ");
+		p = print_key(p, "to_device");
+		p = print_bool(p, to);
+		p = isl_printer_print_str(p, ", ");
+		p = print_key(p, "from_device");
+		p = print_bool(p, from);
+		p = isl_printer_print_str(p, ", ");
+		p = print_key(p, "bytes");
+		p = print_val(p, bytes);
+		p = isl_printer_print_str(p, "}");
+	}
+	p = isl_printer_print_str(p, "], ");
+	p = print_key(p, "to_device_bytes");
+	p = print_val(p, to_device);
+	p = isl_printer_print_str(p, ", ");
+	p = print_key(p, "from_device_bytes");
+	p = print_val(p, from_device);
+	p = isl_printer_print_str(p, "}\n");
+	isl_printer_free(p);
+}
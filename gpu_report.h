@@ -0,0 +1,14 @@
+#ifndef GPU_REPORT_H
+#define GPU_REPORT_H
+
+#include <stdio.h>
+
+#include <isl/union_map.h>
+
+#include "gpu.h"
+
+void gpu_report_kernel(FILE *out, struct ppcg_kernel *kernel);
+void gpu_report_transfers(FILE *out, struct gpu_prog *prog,
+	__isl_keep isl_union_map *copy_in, __isl_keep isl_union_map *copy_out);
+
+#endif
@@ -6,6 +6,9 @@
  * Written by Sven Verdoolaege.
  */
 
+#include <stdint.h>
+#include <stdlib.h>
+
 #include <isl/ctx.h>
 #include <isl/id.h>
 #include <isl/val.h>
@@ -21,6 +24,15 @@
 #include "grouping.h"
 #include "schedule.h"
 
+/* A dependence relation "map" between the statements
+ * with identifiers "src" and "dst".
+ */
+struct ppcg_grouping_dep {
+	isl_id *src;
+	isl_id *dst;
+	isl_map *map;
+};
+
 /* Internal data structure for use during the detection of statements
  * that can be grouped.
  *
@@ -29,6 +41,12 @@
  * found so far.
  * "dep" contains the intersection of the validity and the proximity
  * constraints in "sc".  It may be NULL if it has not been computed yet.
+ * "deps" contains the "n_dep" maps in "dep", sorted by source statement,
+ * such that the dependences of a statement can be found without
+ * having to traverse all of "dep".  It is NULL if "dep" has not been
+ * computed yet or if some of its maps do not have a tuple identifier
+ * on both sides.
+ * "max_distance" is the value of the fusion_distance option.
  * "group_id" is the identifier for the next group that is extracted.
  *
  * "domain" is the set of statement instances that belong to any of the groups.
@@ -41,6 +59,9 @@ struct ppcg_grouping {
 	isl_schedule_constraints *sc;
 
 	isl_union_map *dep;
+	int n_dep;
+	struct ppcg_grouping_dep *deps;
+	int max_distance;
 	int group_id;
 
 	isl_union_set *domain;
@@ -52,15 +73,97 @@ struct ppcg_grouping {
  */
 static void ppcg_grouping_clear(struct ppcg_grouping *grouping)
 {
+	int i;
+
+	for (i = 0; grouping->deps && i < grouping->n_dep; ++i) {
+		isl_id_free(grouping->deps[i].src);
+		isl_id_free(grouping->deps[i].dst);
+		isl_map_free(grouping->deps[i].map);
+	}
+	free(grouping->deps);
 	isl_union_map_free(grouping->dep);
 	isl_union_set_free(grouping->domain);
 	isl_union_pw_multi_aff_free(grouping->contraction);
 	isl_schedule_free(grouping->schedule);
 }
 
+/* Compare the addresses "a" and "b".
+ */
+static int cmp_ptr(const void *a, const void *b)
+{
+	uintptr_t pa = (uintptr_t) a;
+	uintptr_t pb = (uintptr_t) b;
+
+	return pa < pb ? -1 : pa > pb ? 1 : 0;
+}
+
+/* Compare the source statements of the dependences "a" and "b".
+ */
+static int cmp_dep(const void *a, const void *b)
+{
+	const struct ppcg_grouping_dep *dep_a = a;
+	const struct ppcg_grouping_dep *dep_b = b;
+
+	return cmp_ptr(dep_a->src, dep_b->src);
+}
+
+/* Add "map" to grouping->deps, provided it has
+ * a tuple identifier on both sides.
+ */
+static isl_stat add_dep(__isl_take isl_map *map, void *user)
+{
+	struct ppcg_grouping *grouping = user;
+	struct ppcg_grouping_dep *dep;
+
+	if (!isl_map_has_tuple_id(map, isl_dim_in) ||
+	    !isl_map_has_tuple_id(map, isl_dim_out)) {
+		isl_map_free(map);
+		return isl_stat_error;
+	}
+	dep = &grouping->deps[grouping->n_dep++];
+	dep->src = isl_map_get_tuple_id(map, isl_dim_in);
+	dep->dst = isl_map_get_tuple_id(map, isl_dim_out);
+	dep->map = map;
+
+	return isl_stat_ok;
+}
+
+/* Construct grouping->deps from grouping->dep.
+ * If this fails, then grouping->deps is left NULL and
+ * the dependences are looked up in grouping->dep instead.
+ */
+static void index_dep(struct ppcg_grouping *grouping)
+{
+	int i, n;
+	isl_ctx *ctx;
+
+	n = isl_union_map_n_map(grouping->dep);
+	if (n <= 0)
+		return;
+	ctx = isl_union_map_get_ctx(grouping->dep);
+	grouping->deps = isl_calloc_array(ctx, struct ppcg_grouping_dep, n);
+	if (!grouping->deps)
+		return;
+	grouping->n_dep = 0;
+	if (isl_union_map_foreach_map(grouping->dep, &add_dep, grouping) < 0) {
+		for (i = 0; i < grouping->n_dep; ++i) {
+			isl_id_free(grouping->deps[i].src);
+			isl_id_free(grouping->deps[i].dst);
+			isl_map_free(grouping->deps[i].map);
+		}
+		free(grouping->deps);
+		grouping->deps = NULL;
+		grouping->n_dep = 0;
+		return;
+	}
+	qsort(grouping->deps, grouping->n_dep, sizeof(*grouping->deps),
+		&cmp_dep);
+}
+
 /* Compute the intersection of the proximity and validity dependences
  * in grouping->sc and store the result in grouping->dep, unless
  * this intersection has been computed before.
+ * Also construct an index of the dependences by source statement.
  */
 static isl_stat ppcg_grouping_compute_dep(struct ppcg_grouping *grouping)
 {
@@ -76,9 +179,30 @@ static isl_stat ppcg_grouping_compute_dep(struct ppcg_grouping *grouping)
 	if (!grouping->dep)
 		return isl_stat_error;
 
+	index_dep(grouping);
+
 	return isl_stat_ok;
 }
 
+/* Return the position of the first dependence in grouping->deps
+ * with source statement "id", or grouping->n_dep if there is none.
+ */
+static int first_dep(struct ppcg_grouping *grouping, __isl_keep isl_id *id)
+{
+	int lo = 0, hi = grouping->n_dep;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+
+		if (cmp_ptr(grouping->deps[mid].src, id) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
 /* Information extracted from one or more consecutive leaves
  * in the input schedule.
  *
@@ -161,9 +285,13 @@ struct ppcg_grouping_leaf *extract_leaves(__isl_keep isl_schedule_node *node,
  * under investigation for being merged.
  * "merge" is initially set to 0 and is set to 1 as soon as
  * it turns out that it is useful to merge the two leaves.
+ * "max_distance" is the maximal dependence distance for which
+ * two leaves are considered to reuse each other's data
+ * or -1 if this criterion should not be used.
  */
 struct ppcg_merge_leaves_data {
 	int merge;
+	int max_distance;
 	struct ppcg_grouping_leaf *src;
 	struct ppcg_grouping_leaf *dst;
 };
@@ -230,6 +358,133 @@ static isl_bool matches_prefix(__isl_keep isl_map *map,
 	return is_subset;
 }
 
+/* Given a relation "map" between instances of two statements A and B,
+ * does it relate every instance of B (according to the domain of "dst")
+ * to some instance of A?
+ */
+static isl_bool covers_dst(__isl_keep isl_map *map,
+	struct ppcg_grouping_leaf *dst)
+{
+	isl_space *space;
+	isl_set *set1, *set2;
+	isl_bool is_subset;
+
+	space = isl_space_range(isl_map_get_space(map));
+	set1 = isl_union_set_extract_set(dst->domain, space);
+	set2 = isl_map_range(isl_map_copy(map));
+	is_subset = isl_set_is_subset(set1, set2);
+	isl_set_free(set1);
+	isl_set_free(set2);
+
+	return is_subset;
+}
+
+/* Internal data structure for check_distance.
+ *
+ * "max_distance" is the maximal distance in each dimension.
+ * "nearby" is set to isl_bool_false as soon as a set is found
+ * that contains larger distances.
+ */
+struct ppcg_check_distance_data {
+	int max_distance;
+	isl_bool nearby;
+};
+
+/* Is "set" contained in the box [-max_distance, max_distance]
+ * in each dimension?
+ * If not, then set data->nearby to isl_bool_false and abort the search.
+ */
+static isl_stat check_distance(__isl_take isl_set *set, void *user)
+{
+	struct ppcg_check_distance_data *data = user;
+	int i, dim;
+	isl_set *box;
+	isl_bool is_subset;
+
+	dim = isl_set_dim(set, isl_dim_set);
+	box = isl_set_universe(isl_set_get_space(set));
+	for (i = 0; i < dim; ++i) {
+		box = isl_set_lower_bound_si(box, isl_dim_set, i,
+						-data->max_distance);
+		box = isl_set_upper_bound_si(box, isl_dim_set, i,
+						data->max_distance);
+	}
+	is_subset = isl_set_is_subset(set, box);
+	isl_set_free(set);
+	isl_set_free(box);
+
+	if (is_subset < 0)
+		return isl_stat_error;
+	if (!is_subset) {
+		data->nearby = isl_bool_false;
+		return isl_stat_error;
+	}
+	return isl_stat_ok;
+}
+
+/* Given a relation "map" between instances of two statements A and B,
+ * are the instances of B consumers of data produced by nearby instances
+ * of A in the input schedule?
+ * That is, does every instance of B depend on some instance of A and
+ * do the prefix schedules of the related instances differ by at most
+ * "max_distance" in each dimension?
+ * If so, then executing the two statements together
+ * in the outer loops of the input schedule allows the data produced
+ * by A to be reused by B while it is still in the cache.
+ */
+static isl_bool is_nearby(__isl_keep isl_map *map,
+	struct ppcg_grouping_leaf *src, struct ppcg_grouping_leaf *dst,
+	int max_distance)
+{
+	isl_union_map *umap;
+	isl_union_set *deltas;
+	isl_multi_union_pw_aff *prefix;
+	struct ppcg_check_distance_data data = { max_distance, isl_bool_true };
+	isl_bool ok;
+	isl_stat r;
+
+	ok = covers_dst(map, dst);
+	if (ok < 0 || !ok)
+		return ok;
+
+	if (isl_multi_union_pw_aff_dim(src->prefix, isl_dim_out) == 0)
+		return isl_bool_true;
+
+	umap = isl_union_map_from_map(isl_map_copy(map));
+	prefix = isl_multi_union_pw_aff_copy(src->prefix);
+	umap = isl_union_map_apply_domain(umap,
+			isl_union_map_from_multi_union_pw_aff(prefix));
+	prefix = isl_multi_union_pw_aff_copy(dst->prefix);
+	umap = isl_union_map_apply_range(umap,
+			isl_union_map_from_multi_union_pw_aff(prefix));
+	deltas = isl_union_map_deltas(umap);
+	if (!deltas)
+		return isl_bool_error;
+	r = isl_union_set_foreach_set(deltas, &check_distance, &data);
+	isl_union_set_free(deltas);
+
+	if (r < 0 && data.nearby)
+		return isl_bool_error;
+	return data.nearby;
+}
+
+/* Is "map" between statements in consecutive leaves
+ * a chain of dependences in the sense of check_merge?
+ */
+static isl_bool is_chain(__isl_keep isl_map *map,
+	struct ppcg_grouping_leaf *src, struct ppcg_grouping_leaf *dst)
+{
+	isl_bool ok;
+
+	ok = covers_src_and_dst(map, src, dst);
+	if (ok >= 0 && ok)
+		ok = isl_map_is_bijective(map);
+	if (ok >= 0 && ok)
+		ok = matches_prefix(map, src, dst);
+
+	return ok;
+}
+
 /* Given a set of validity and proximity schedule constraints "map"
  * between statements in consecutive leaves in a valid schedule,
  * should the two leaves be merged into one?
@@ -249,17 +504,22 @@ static isl_bool matches_prefix(__isl_keep isl_map *map,
  * In other words, it is both possible to execute the two instances
  * together (according to the input schedule) and desirable to do so
  * (according to the validity and proximity schedule constraints).
+ *
+ * If data->max_distance is non-negative, then the two are also merged
+ * if the second statement consumes data produced by nearby instances
+ * of the first statement.  Since the instances of a group are formed
+ * by the values of the prefix schedule, this keeps the two statements
+ * in the same iterations of the outer loops of the input schedule,
+ * which the scheduler would otherwise be free to distribute.
  */
 static isl_stat check_merge(__isl_take isl_map *map, void *user)
 {
 	struct ppcg_merge_leaves_data *data = user;
 	isl_bool ok;
 
-	ok = covers_src_and_dst(map, data->src, data->dst);
-	if (ok >= 0 && ok)
-		ok = isl_map_is_bijective(map);
-	if (ok >= 0 && ok)
-		ok = matches_prefix(map, data->src, data->dst);
+	ok = is_chain(map, data->src, data->dst);
+	if (ok >= 0 && !ok && data->max_distance >= 0)
+		ok = is_nearby(map, data->src, data->dst, data->max_distance);
 
 	isl_map_free(map);
 
@@ -297,7 +557,8 @@ static isl_stat merge_pair(int n, struct ppcg_grouping_leaf leaves[n], int pos)
 }
 
 /* Merge pairs of consecutive leaves in "leaves" taking into account
- * the intersection of validity and proximity schedule constraints "dep".
+ * the intersection of validity and proximity schedule constraints "dep",
+ * intersecting "dep" with the domains of each pair of leaves.
  *
  * If a leaf has been merged with the next leaf, then the combination
  * is checked again for merging with the next leaf.
@@ -312,12 +573,13 @@ static isl_stat merge_pair(int n, struct ppcg_grouping_leaf leaves[n], int pos)
  *
  * Return the final number of leaves in the sequence, or -1 on error.
  */
-static int merge_leaves(int n, struct ppcg_grouping_leaf leaves[n],
-	__isl_keep isl_union_map *dep)
+static int merge_leaves_unindexed(int n, struct ppcg_grouping_leaf leaves[n],
+	__isl_keep isl_union_map *dep, int max_distance)
 {
 	int i;
 	struct ppcg_merge_leaves_data data;
 
+	data.max_distance = max_distance;
 	for (i = n - 1; i >= 0; --i) {
 		isl_union_map *dep_i;
 		isl_stat ok;
@@ -348,6 +610,318 @@ static int merge_leaves(int n, struct ppcg_grouping_leaf leaves[n],
 	return n;
 }
 
+/* A statement with identifier "id" (not a copy)
+ * that appears in the original leaf at position "leaf".
+ */
+struct ppcg_grouping_stmt {
+	isl_id *id;
+	int leaf;
+};
+
+/* Compare the identifiers of the statements "a" and "b".
+ */
+static int cmp_stmt(const void *a, const void *b)
+{
+	const struct ppcg_grouping_stmt *stmt_a = a;
+	const struct ppcg_grouping_stmt *stmt_b = b;
+
+	return cmp_ptr(stmt_a->id, stmt_b->id);
+}
+
+/* Dependences "map" (not a copy) from statements in the original leaf
+ * at position "src" to statements in the original leaf at position "dst".
+ * "checked" is set if it has been determined that these dependences
+ * do not cause the leaves containing "src" and "dst" to be merged.
+ */
+struct ppcg_grouping_edge {
+	int src;
+	int dst;
+	isl_map *map;
+	int checked;
+};
+
+/* Compare the edges "a" and "b" by source and destination leaf.
+ */
+static int cmp_edge(const void *a, const void *b)
+{
+	const struct ppcg_grouping_edge *edge_a = a;
+	const struct ppcg_grouping_edge *edge_b = b;
+
+	if (edge_a->src != edge_b->src)
+		return edge_a->src - edge_b->src;
+	return edge_a->dst - edge_b->dst;
+}
+
+/* Internal data structure for merge_leaves.
+ *
+ * "n_stmt" statements in "stmt", sorted by identifier, with
+ * "leaf" the original leaf of the statements that are being added.
+ * "n_edge" edges in "edge", with "edge_start"[i] the position
+ * of the first edge with source leaf i once "edge" has been sorted.
+ * "start"[k] is the first original leaf of the current leaf at position k.
+ */
+struct ppcg_grouping_graph {
+	int n_stmt;
+	struct ppcg_grouping_stmt *stmt;
+	int leaf;
+
+	int n_edge;
+	struct ppcg_grouping_edge *edge;
+	int *edge_start;
+
+	int *start;
+};
+
+/* Free all memory allocated for "graph".
+ */
+static void ppcg_grouping_graph_clear(struct ppcg_grouping_graph *graph)
+{
+	free(graph->stmt);
+	free(graph->edge);
+	free(graph->edge_start);
+	free(graph->start);
+}
+
+/* Add the statement of "set" to graph->stmt,
+ * as belonging to leaf graph->leaf.
+ */
+static isl_stat add_stmt(__isl_take isl_set *set, void *user)
+{
+	struct ppcg_grouping_graph *graph = user;
+	struct ppcg_grouping_stmt *stmt;
+	isl_id *id;
+
+	if (!isl_set_has_tuple_id(set)) {
+		isl_set_free(set);
+		return isl_stat_error;
+	}
+	id = isl_set_get_tuple_id(set);
+	isl_set_free(set);
+	stmt = &graph->stmt[graph->n_stmt++];
+	stmt->id = id;
+	stmt->leaf = graph->leaf;
+	isl_id_free(id);
+
+	return isl_stat_ok;
+}
+
+/* Return the original leaf containing the statement "id"
+ * or -1 if none of the leaves contains the statement.
+ */
+static int find_leaf(struct ppcg_grouping_graph *graph, __isl_keep isl_id *id)
+{
+	struct ppcg_grouping_stmt key = { id };
+	struct ppcg_grouping_stmt *stmt;
+
+	stmt = bsearch(&key, graph->stmt, graph->n_stmt, sizeof(key),
+			&cmp_stmt);
+	return stmt ? stmt->leaf : -1;
+}
+
+/* Construct a dependence graph between the "n" leaves in "leaves"
+ * from the dependences in grouping->deps.
+ *
+ * Return 1 if the graph was constructed, 0 if it cannot be constructed
+ * because some statement appears in more than one leaf and
+ * -1 on error.
+ *
+ * The identifiers in graph->stmt are not copied since
+ * they are kept alive by "leaves".
+ * Similarly, the maps in graph->edge are kept alive by grouping->deps.
+ * Only dependences towards later leaves are kept
+ * since only those can lead to a merge.
+ * The edges are first counted such that graph->edge
+ * can be allocated in one go.
+ */
+static int build_graph(struct ppcg_grouping_graph *graph,
+	int n, struct ppcg_grouping_leaf leaves[n],
+	struct ppcg_grouping *grouping)
+{
+	int i, j, n_set, n_edge;
+	isl_ctx *ctx;
+
+	ctx = isl_union_map_get_ctx(grouping->dep);
+	n_set = 0;
+	for (i = 0; i < n; ++i)
+		n_set += isl_union_set_n_set(leaves[i].domain);
+	graph->stmt = isl_alloc_array(ctx, struct ppcg_grouping_stmt, n_set);
+	graph->start = isl_alloc_array(ctx, int, n);
+	graph->edge_start = isl_alloc_array(ctx, int, n + 1);
+	if ((n_set && !graph->stmt) || !graph->start || !graph->edge_start)
+		return -1;
+	for (i = 0; i < n; ++i) {
+		graph->start[i] = i;
+		graph->leaf = i;
+		if (isl_union_set_foreach_set(leaves[i].domain,
+						&add_stmt, graph) < 0)
+			return 0;
+	}
+	qsort(graph->stmt, graph->n_stmt, sizeof(*graph->stmt), &cmp_stmt);
+	for (i = 0; i + 1 < graph->n_stmt; ++i)
+		if (graph->stmt[i].id == graph->stmt[i + 1].id)
+			return 0;
+
+	n_edge = 0;
+	for (i = 0; i < graph->n_stmt; ++i) {
+		struct ppcg_grouping_stmt *stmt = &graph->stmt[i];
+
+		for (j = first_dep(grouping, stmt->id); j < grouping->n_dep &&
+		    grouping->deps[j].src == stmt->id; ++j)
+			if (find_leaf(graph, grouping->deps[j].dst) >
+			    stmt->leaf)
+				n_edge++;
+	}
+	graph->edge = isl_alloc_array(ctx, struct ppcg_grouping_edge, n_edge);
+	if (n_edge && !graph->edge)
+		return -1;
+
+	for (i = 0; i < graph->n_stmt; ++i) {
+		struct ppcg_grouping_stmt *stmt = &graph->stmt[i];
+
+		for (j = first_dep(grouping, stmt->id); j < grouping->n_dep &&
+		    grouping->deps[j].src == stmt->id; ++j) {
+			struct ppcg_grouping_edge *edge;
+			int dst;
+
+			dst = find_leaf(graph, grouping->deps[j].dst);
+			if (dst <= stmt->leaf)
+				continue;
+			edge = &graph->edge[graph->n_edge++];
+			edge->src = stmt->leaf;
+			edge->dst = dst;
+			edge->map = grouping->deps[j].map;
+			edge->checked = 0;
+		}
+	}
+	if (graph->n_edge)
+		qsort(graph->edge, graph->n_edge, sizeof(*graph->edge),
+			&cmp_edge);
+	for (i = 0, j = 0; i <= n; ++i) {
+		while (j < graph->n_edge && graph->edge[j].src < i)
+			++j;
+		graph->edge_start[i] = j;
+	}
+
+	return 1;
+}
+
+/* Should the (current) leaves at positions "k" and "k + 1" in "leaves"
+ * be merged, based on the edges in "graph"?
+ * "n" is the current number of leaves and "n_orig"
+ * the original number of leaves.
+ *
+ * Consider each edge from an original leaf in the leaf at position "k"
+ * to an original leaf in the leaf at position "k + 1" and
+ * restrict it to the domains of these leaves, as in merge_leaves_unindexed.
+ * Since each statement only belongs to a single original leaf and
+ * since check_merge only considers the domains and prefix schedules
+ * of the statements related by the map it is given,
+ * the outcome of check_merge for a given edge does not change
+ * when leaves get merged.  Edges that have been checked before
+ * therefore do not need to be checked again.
+ */
+static int should_merge(struct ppcg_grouping_graph *graph,
+	int n, int n_orig, struct ppcg_grouping_leaf leaves[n], int k,
+	int max_distance)
+{
+	int s, j, first_dst, last_dst;
+	struct ppcg_merge_leaves_data data;
+
+	data.max_distance = max_distance;
+	first_dst = graph->start[k + 1];
+	last_dst = k + 2 < n ? graph->start[k + 2] : n_orig;
+	data.src = &leaves[k];
+	data.dst = &leaves[k + 1];
+	for (s = graph->start[k]; s < first_dst; ++s) {
+		for (j = graph->edge_start[s]; j < graph->edge_start[s + 1];
+		    ++j) {
+			struct ppcg_grouping_edge *edge = &graph->edge[j];
+			isl_space *space;
+			isl_set *dom, *ran;
+			isl_map *map;
+
+			if (edge->dst >= last_dst)
+				break;
+			if (edge->dst < first_dst || edge->checked)
+				continue;
+			map = isl_map_copy(edge->map);
+			space = isl_space_domain(isl_map_get_space(map));
+			dom = isl_union_set_extract_set(leaves[k].domain,
+							space);
+			space = isl_space_range(isl_map_get_space(map));
+			ran = isl_union_set_extract_set(leaves[k + 1].domain,
+							space);
+			map = isl_map_intersect_domain(map, dom);
+			map = isl_map_intersect_range(map, ran);
+			data.merge = 0;
+			if (check_merge(map, &data) < 0)
+				return data.merge ? 1 : -1;
+			edge->checked = 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Merge pairs of consecutive leaves in "leaves" as in
+ * merge_leaves_unindexed, but using a dependence graph between
+ * the leaves constructed from the index of dependences in "grouping".
+ * This avoids having to intersect all dependences with each pair
+ * of leaves and allows the outcome of the checks to be reused
+ * after a merge.  The graph can only be constructed if each statement
+ * belongs to a single leaf.  Otherwise, fall back
+ * to merge_leaves_unindexed.
+ *
+ * "start" keeps track of the original leaves that have been
+ * merged into each current leaf.
+ *
+ * Return the final number of leaves in the sequence, or -1 on error.
+ */
+static int merge_leaves(int n, struct ppcg_grouping_leaf leaves[n],
+	struct ppcg_grouping *grouping)
+{
+	int i, k, n_orig = n;
+	int built;
+	struct ppcg_grouping_graph graph = { 0 };
+
+	if (!grouping->deps)
+		return merge_leaves_unindexed(n, leaves, grouping->dep,
+						grouping->max_distance);
+
+	built = build_graph(&graph, n, leaves, grouping);
+	if (built <= 0) {
+		ppcg_grouping_graph_clear(&graph);
+		if (built < 0)
+			return -1;
+		return merge_leaves_unindexed(n, leaves, grouping->dep,
+						grouping->max_distance);
+	}
+
+	for (k = n - 1; k >= 0; --k) {
+		int merge;
+
+		if (k + 1 >= n)
+			continue;
+		merge = should_merge(&graph, n, n_orig, leaves, k,
+					grouping->max_distance);
+		if (merge < 0)
+			break;
+		if (!merge)
+			continue;
+		if (merge_pair(n, leaves, k) < 0)
+			break;
+		for (i = k + 1; i + 1 < n; ++i)
+			graph.start[i] = graph.start[i + 1];
+		--n;
+		++k;
+	}
+
+	ppcg_grouping_graph_clear(&graph);
+	if (k >= 0)
+		return -1;
+	return n;
+}
+
 /* Construct a schedule with "domain" as domain, that executes
  * the elements of "list" in order (as a sequence).
  */
@@ -580,7 +1154,7 @@ static isl_stat group_subsequence(__isl_keep isl_schedule_node *node,
 	if (!leaves)
 		return isl_stat_error;
 
-	n_merge = merge_leaves(n, leaves, grouping->dep);
+	n_merge = merge_leaves(n, leaves, grouping);
 	if (n_merge >= 0 && n_merge < n &&
 	    add_groups(grouping, n_merge, leaves) < 0)
 		return isl_stat_error;
@@ -681,6 +1255,15 @@ static void complete_grouping(struct ppcg_grouping *grouping)
  * in this schedule and where all instances of the second depend on
  * the instance of the first that is executed in the same iteration
  * of outer band nodes are grouped together into a single statement.
+ * If options->fusion_distance is non-negative, then statements
+ * that are executed consecutively in a sequence and where
+ * all instances of the second depend on instances of the first
+ * that are executed at most that many iterations of the outer band nodes
+ * earlier are grouped together as well.
+ * Only sequences of leaves are considered, i.e., statements
+ * that are already fused in this schedule.  The grouping therefore
+ * only prevents the scheduler from distributing such statements;
+ * it never fuses statements in different loop nests.
  * The schedule constraints are then mapped to these groups of statements
  * and the resulting schedule is expanded again to refer to the original
  * statements.
@@ -694,6 +1277,7 @@ __isl_give isl_schedule *ppcg_compute_grouping_schedule(
 	isl_union_map *umap;
 	isl_schedule *res, *expansion;
 
+	grouping.max_distance = options->fusion_distance;
 	grouping.group_id = 0;
 	if (isl_schedule_foreach_schedule_node_top_down(schedule,
 			&detect_groups, &grouping) < 0)
@@ -43,10 +43,19 @@
  *
  * upper and lower are always non-negative.
  * Some of the values may be NaN if no bound could be found.
+ *
+ * space_upper contains upper bounds on the relative dependence distances
+ * in each of the space dimensions, i.e.,
+ *
+ *	d_i <= space_upper_i d_0
+ *
+ * Its first element is equal to upper.  The other elements
+ * are only needed for split tiling and are also non-negative or NaN.
  */
 struct ppcg_ht_bounds {
 	isl_val *upper;
 	isl_multi_val *lower;
+	isl_multi_val *space_upper;
 };
 
 /* Free "bounds" along with all its fields.
@@ -58,6 +67,7 @@ __isl_null ppcg_ht_bounds *ppcg_ht_bounds_free(
 		return NULL;
 	isl_val_free(bounds->upper);
 	isl_multi_val_free(bounds->lower);
+	isl_multi_val_free(bounds->space_upper);
 	free(bounds);
 
 	return NULL;
@@ -86,8 +96,9 @@ __isl_give ppcg_ht_bounds *ppcg_ht_bounds_alloc(__isl_take isl_space *space)
 		isl_val *v = isl_val_copy(bounds->upper);
 		bounds->lower = isl_multi_val_set_val(bounds->lower, i, v);
 	}
+	bounds->space_upper = isl_multi_val_copy(bounds->lower);
 
-	if (!bounds->lower || !bounds->upper)
+	if (!bounds->lower || !bounds->upper || !bounds->space_upper)
 		return ppcg_ht_bounds_free(bounds);
 
 	return bounds;
@@ -105,6 +116,8 @@ void ppcg_ht_bounds_dump(__isl_keep ppcg_ht_bounds *bounds)
 	isl_multi_val_dump(bounds->lower);
 	fprintf(stderr, "upper: ");
 	isl_val_dump(bounds->upper);
+	fprintf(stderr, "space upper: ");
+	isl_multi_val_dump(bounds->space_upper);
 }
 
 /* Return the upper bound on the relative dependence distances
@@ -163,6 +176,36 @@ error:
 	return NULL;
 }
 
+/* Return the upper bound on the relative dependence distances
+ * in space dimension "pos".
+ */
+static __isl_give isl_val *ppcg_ht_bounds_get_space_upper(
+	__isl_keep ppcg_ht_bounds *bounds, int pos)
+{
+	if (!bounds)
+		return NULL;
+	return isl_multi_val_get_val(bounds->space_upper, pos);
+}
+
+/* Replace the upper bound on the relative dependence distances
+ * in space dimension "pos" by "upper".
+ */
+static __isl_give ppcg_ht_bounds *ppcg_ht_bounds_set_space_upper(
+	__isl_take ppcg_ht_bounds *bounds, int pos, __isl_take isl_val *upper)
+{
+	if (!bounds || !upper)
+		goto error;
+	bounds->space_upper = isl_multi_val_set_val(bounds->space_upper,
+							pos, upper);
+	if (!bounds->space_upper)
+		return ppcg_ht_bounds_free(bounds);
+	return bounds;
+error:
+	ppcg_ht_bounds_free(bounds);
+	isl_val_free(upper);
+	return NULL;
+}
+
 /* Can the bounds on relative dependence distances recorded in "bounds"
  * be used to perform hybrid tiling?
  * In particular, have appropriate lower and upper bounds been found?
@@ -209,13 +252,22 @@ isl_bool ppcg_ht_bounds_is_valid(__isl_keep ppcg_ht_bounds *bounds)
  * The space of this schedule is [P -> C], where P is the space
  * of the parent node and C is the space of the child node.
  *
+ * "split" is set if the remaining space dimensions are split tiled
+ * rather than classically tiled.
+ * In case of split tiling, "split_base" contains the original tile sizes
+ * of the space dimensions, which form the base of the upright tiles.
+ * Otherwise, it is NULL.
+ *
  * "space_sizes" represent the total size of a tile for the space
  * dimensions, i.e., those corresponding to the child node.
  * The space of "space_sizes" is C.
  * If S_0 is the original tile size in the first space dimension,
  * then the first entry of "space_sizes" is equal to
  * W = 2*S_0 + floor(d_l h) + floor(d_u h).
- * The remaining entries are the same as in the original tile sizes.
+ * The remaining entries are the same as in the original tile sizes,
+ * except in case of split tiling, where they are equal to
+ * S_i + ceil(dl_i (2 S_t - 1)) + ceil(du_i (2 S_t - 1)),
+ * with S_t the original tile size corresponding to the parent node.
  *
  * The basic hexagonal tiling "hex" is defined
  * in a "ts" (time-space) space and corresponds to the phase-1 tiles.
@@ -243,6 +295,9 @@ struct ppcg_ht_tiling {
 	isl_schedule_node *input_node;
 	isl_multi_union_pw_aff *input_schedule;
 
+	int split;
+	isl_multi_val *split_base;
+
 	isl_multi_val *space_sizes;
 
 	isl_aff *time_tile;
@@ -283,6 +338,7 @@ static __isl_null ppcg_ht_tiling *ppcg_ht_tiling_free(
 	ppcg_ht_bounds_free(tiling->bounds);
 	isl_schedule_node_free(tiling->input_node);
 	isl_multi_union_pw_aff_free(tiling->input_schedule);
+	isl_multi_val_free(tiling->split_base);
 	isl_multi_val_free(tiling->space_sizes);
 	isl_aff_free(tiling->time_tile);
 	isl_aff_free(tiling->local_time);
@@ -340,9 +396,17 @@ isl_ctx *ppcg_ht_tiling_get_ctx(__isl_keep ppcg_ht_tiling *tiling)
  *
  *	[P[t] -> C[s_0, s_i]] -> C[shift_s + (-(2 * shift_s)*T) % W, dl_i * u]
  *
+ * In case of split tiling, dl_i * u is replaced by -ceil(du_i * u).
+ *
  * "space_tile" is the space tiling.  It is equal to
  *
  *	[P[t] -> C[s]] -> C[floor((s + space_shift)/space_size]
+ *
+ * "split_phase" is NULL, unless the remaining space dimensions
+ * are split tiled.  In this case, it maps each element of the input space
+ * to 0 or 1 in each of these space dimensions, depending on whether
+ * the element belongs to an upright or to an inverted tile
+ * in that dimension.
  */
 struct ppcg_ht_phase {
 	ppcg_ht_tiling *tiling;
@@ -354,6 +418,7 @@ struct ppcg_ht_phase {
 
 	isl_multi_aff *space_shift;
 	isl_multi_aff *space_tile;
+	isl_pw_multi_aff *split_phase;
 };
 
 /* Free "phase" along with all its fields.
@@ -371,6 +436,7 @@ static __isl_null ppcg_ht_phase *ppcg_ht_phase_free(
 	isl_set_free(phase->domain);
 	isl_multi_aff_free(phase->space_shift);
 	isl_multi_aff_free(phase->space_tile);
+	isl_pw_multi_aff_free(phase->split_phase);
 	free(phase);
 
 	return NULL;
@@ -691,6 +757,67 @@ static __isl_give isl_multi_val *compute_space_sizes(
 	return space_sizes;
 }
 
+/* Return
+ *
+ *	ceil(dl * h2) + ceil(du * h2)
+ *
+ * i.e., the total amount by which an upright tile in split tiling
+ * with relative dependence distance bounds "dl" and "du" shrinks
+ * from the bottom of a time tile to the top, at a local time of "h2".
+ */
+static __isl_give isl_val *split_shrink(__isl_keep isl_val *dl,
+	__isl_keep isl_val *du, __isl_keep isl_val *h2)
+{
+	isl_val *v, *v2;
+
+	v = isl_val_ceil(isl_val_mul(isl_val_copy(dl), isl_val_copy(h2)));
+	v2 = isl_val_ceil(isl_val_mul(isl_val_copy(du), isl_val_copy(h2)));
+
+	return isl_val_add(v, v2);
+}
+
+/* Return the largest local time within a time tile, i.e., 2 * st - 1.
+ */
+static __isl_give isl_val *max_local_time(__isl_keep isl_val *st)
+{
+	return isl_val_sub_ui(isl_val_mul_ui(isl_val_copy(st), 2), 1);
+}
+
+/* Adjust the total tile sizes "space_sizes" in the space dimensions
+ * other than the first for split tiling using "bounds".
+ * In particular, replace the original tile size S_i by
+ *
+ *	S_i + ceil(dl_i h2) + ceil(du_i h2)
+ *
+ * with h2 = 2 * st - 1 the largest local time within a time tile.
+ * The upright tiles have a base of S_i and the inverted tiles
+ * a base of ceil(dl_i h2) + ceil(du_i h2).
+ */
+static __isl_give isl_multi_val *compute_split_space_sizes(
+	__isl_take isl_multi_val *space_sizes,
+	__isl_keep ppcg_ht_bounds *bounds, __isl_keep isl_val *st)
+{
+	int i, n;
+	isl_val *h2;
+
+	h2 = max_local_time(st);
+	n = isl_multi_val_dim(space_sizes, isl_dim_set);
+	for (i = 1; i < n; ++i) {
+		isl_val *size, *dl, *du;
+
+		dl = ppcg_ht_bounds_get_lower(bounds, i);
+		du = ppcg_ht_bounds_get_space_upper(bounds, i);
+		size = isl_multi_val_get_val(space_sizes, i);
+		size = isl_val_add(size, split_shrink(dl, du, h2));
+		space_sizes = isl_multi_val_set_val(space_sizes, i, size);
+		isl_val_free(dl);
+		isl_val_free(du);
+	}
+	isl_val_free(h2);
+
+	return space_sizes;
+}
+
 /* Compute the offset of phase 1 with respect to phase 0
  * in the ts-space ("space").
  * In particular, return
@@ -872,12 +999,13 @@ static __isl_give ppcg_ht_tiling *ppcg_ht_tiling_set_project_ts(
  * "input_schedule" is the combined schedule of the parent and child
  * node in the input.
  * "tile_sizes" are the original, user specified tile sizes.
+ * "split" is set if the remaining space dimensions should be split tiled.
  */
 static __isl_give ppcg_ht_tiling *ppcg_ht_bounds_construct_tiling(
 	__isl_take ppcg_ht_bounds *bounds,
 	__isl_keep isl_schedule_node *input_node,
 	__isl_keep isl_multi_union_pw_aff *input_schedule,
-	__isl_keep isl_multi_val *tile_sizes)
+	__isl_keep isl_multi_val *tile_sizes, int split)
 {
 	isl_ctx *ctx;
 	ppcg_ht_tiling *tiling;
@@ -910,6 +1038,14 @@ static __isl_give ppcg_ht_tiling *ppcg_ht_bounds_construct_tiling(
 	local_ts = construct_local_ts_space(ctx);
 
 	space_sizes = compute_space_sizes(tile_sizes, dlh, duh);
+	if (split) {
+		tiling->split = 1;
+		tiling->split_base = isl_multi_val_copy(tile_sizes);
+		tiling->split_base =
+			isl_multi_val_factor_range(tiling->split_base);
+		space_sizes = compute_split_space_sizes(space_sizes,
+							bounds, st);
+	}
 	phase_shift = compute_phase_shift(ts, st, s0, duh);
 	time_tile = compute_time_tile(ts, st);
 	shift_space = compute_shift_space(time_tile, space_sizes, phase_shift);
@@ -937,7 +1073,8 @@ static __isl_give ppcg_ht_tiling *ppcg_ht_bounds_construct_tiling(
 	isl_val_free(h);
 
 	if (!tiling->input_schedule || !tiling->local_time || !tiling->hex ||
-	    !tiling->shift_space || !tiling->shift_phase)
+	    !tiling->shift_space || !tiling->shift_phase ||
+	    !tiling->space_sizes || (split && !tiling->split_base))
 		return ppcg_ht_tiling_free(tiling);
 
 	tiling = ppcg_ht_tiling_set_project_ts(tiling);
@@ -1107,7 +1244,7 @@ static __isl_give isl_map *collect_deps(struct ppcg_scop *scop,
 		isl_union_map *local, *non_local, *order, *adj;
 		isl_union_set *domain, *range;
 
-		other = isl_union_map_copy(scop->dep_forced);
+		other = isl_union_map_copy(ppcg_scop_get_dep_forced(scop));
 		other = isl_union_map_eq_at_multi_union_pw_aff(other,
 					isl_multi_union_pw_aff_copy(prefix));
 		local = isl_union_map_copy(flow);
@@ -1116,7 +1253,7 @@ static __isl_give isl_map *collect_deps(struct ppcg_scop *scop,
 		non_local = isl_union_map_copy(flow);
 		non_local = isl_union_map_subtract(non_local, local);
 
-		order = isl_union_map_copy(scop->dep_order);
+		order = isl_union_map_copy(ppcg_scop_get_dep_order(scop));
 		order = isl_union_map_eq_at_multi_union_pw_aff(order, prefix);
 		adj = isl_union_map_copy(order);
 		domain = isl_union_map_domain(isl_union_map_copy(non_local));
@@ -1309,8 +1446,9 @@ static __isl_give isl_val_list *min_max_dist(__isl_keep isl_set *dist, int pos)
  * This process is repeated for each of the schedule dimensions
  * of the inner node.  For the first dimension, both minimal and
  * maximal relative dependence distances are stored in the result.
- * For the other dimensions, only the minimal relative dependence
- * distance is stored.
+ * For the other dimensions, the maximal relative dependence distance
+ * is only stored in the space_upper field, since it is only needed
+ * for split tiling.
  */
 __isl_give ppcg_ht_bounds *ppcg_ht_compute_bounds(struct ppcg_scop *scop,
 	__isl_keep isl_schedule_node *node)
@@ -1344,12 +1482,16 @@ __isl_give ppcg_ht_bounds *ppcg_ht_compute_bounds(struct ppcg_scop *scop,
 	pair = min_max_dist(dist, 1);
 	bnd = ppcg_ht_bounds_set_lower(bnd, 0, isl_val_list_get_val(pair, 0));
 	bnd = ppcg_ht_bounds_set_upper(bnd, isl_val_list_get_val(pair, 1));
+	bnd = ppcg_ht_bounds_set_space_upper(bnd, 0,
+						isl_val_list_get_val(pair, 1));
 	isl_val_list_free(pair);
 
 	for (i = 1; i < dim; ++i) {
 		pair = min_max_dist(dist, 1 + i);
 		bnd = ppcg_ht_bounds_set_lower(bnd, i,
 						isl_val_list_get_val(pair, 0));
+		bnd = ppcg_ht_bounds_set_space_upper(bnd, i,
+						isl_val_list_get_val(pair, 1));
 		isl_val_list_free(pair);
 	}
 
@@ -1493,7 +1635,16 @@ static __isl_give ppcg_ht_phase *lift_phase(__isl_take ppcg_ht_phase *phase)
  *
  * In the other dimensions, the shift is equal to
  *
- *	dl_i * local_time.
+ *	dl_i * local_time
+ *
+ * in case of classical tiling, such that all dependence distances
+ * become non-negative, and to
+ *
+ *	-ceil(du_i * local_time)
+ *
+ * in case of split tiling, such that the left sides of the upright tiles,
+ * which move to the right at the rate of du_i, are aligned
+ * to a multiple of the tile size.
  */
 static __isl_give ppcg_ht_phase *compute_space_shift(
 	__isl_take ppcg_ht_phase *phase)
@@ -1523,9 +1674,16 @@ static __isl_give ppcg_ht_phase *compute_space_shift(
 		isl_val *v;
 		isl_aff *time;
 
-		v = ppcg_ht_bounds_get_lower(phase->tiling->bounds, i);
 		time = isl_aff_copy(phase->local_time);
-		time = isl_aff_scale_val(time, v);
+		if (!phase->tiling->split) {
+			v = ppcg_ht_bounds_get_lower(phase->tiling->bounds, i);
+			time = isl_aff_scale_val(time, v);
+		} else {
+			v = ppcg_ht_bounds_get_space_upper(
+						phase->tiling->bounds, i);
+			time = isl_aff_scale_val(time, v);
+			time = isl_aff_neg(isl_aff_ceil(time));
+		}
 		space_shift = isl_multi_aff_set_aff(space_shift, i, time);
 	}
 
@@ -1566,6 +1724,83 @@ static __isl_give ppcg_ht_phase *compute_space_tile(
 	return phase;
 }
 
+/* Compute the split phases of the remaining space dimensions
+ * in case of split tiling and store the result in phase->split_phase.
+ *
+ * Let u be the local time and let r_i be the position
+ * of an element within its tile in dimension i, i.e.,
+ *
+ *	r_i = (s_i + space_shift_i) % W_i
+ *
+ * with W_i the total tile size in that dimension.
+ * The upright tile of size S_i at the bottom of the time tile
+ * shrinks by ceil(du_i * u) on the left, which is taken care of
+ * by space_shift_i, and by ceil(dl_i * u) on the right.
+ * The remainder of the tile of size W_i forms an inverted tile.
+ * That is, the element belongs to an inverted tile, i.e., phase 1,
+ * if
+ *
+ *	r_i + ceil(dl_i * u) + ceil(du_i * u) >= S_i
+ *
+ * and to an upright tile, i.e., phase 0, otherwise.
+ */
+static __isl_give ppcg_ht_phase *compute_split_phase(
+	__isl_take ppcg_ht_phase *phase)
+{
+	int i, n;
+	isl_space *space, *range;
+	isl_multi_pw_aff *mpa;
+	ppcg_ht_tiling *tiling;
+
+	if (!phase)
+		return NULL;
+	tiling = phase->tiling;
+	if (!tiling->split)
+		return phase;
+
+	space = isl_aff_get_domain_space(phase->local_time);
+	n = isl_space_dim(space, isl_dim_set) - 1;
+	range = isl_space_params(isl_space_copy(space));
+	range = isl_space_set_from_params(range);
+	range = isl_space_add_dims(range, isl_dim_set, n - 1);
+	mpa = isl_multi_pw_aff_zero(isl_space_map_from_domain_and_range(
+							space, range));
+	for (i = 1; i < n; ++i) {
+		isl_local_space *ls;
+		isl_val *v;
+		isl_aff *r, *shift, *shrink, *time;
+		isl_set *inverted;
+
+		ls = isl_local_space_from_space(
+				isl_aff_get_domain_space(phase->local_time));
+		r = isl_aff_var_on_domain(ls, isl_dim_set, 1 + i);
+		shift = isl_multi_aff_get_aff(phase->space_shift, i);
+		r = isl_aff_add(r, shift);
+		v = isl_multi_val_get_val(tiling->space_sizes, i);
+		r = isl_aff_mod_val(r, v);
+
+		v = ppcg_ht_bounds_get_lower(tiling->bounds, i);
+		time = isl_aff_copy(phase->local_time);
+		shrink = isl_aff_ceil(isl_aff_scale_val(time, v));
+		r = isl_aff_add(r, shrink);
+		v = ppcg_ht_bounds_get_space_upper(tiling->bounds, i);
+		time = isl_aff_copy(phase->local_time);
+		shrink = isl_aff_ceil(isl_aff_scale_val(time, v));
+		r = isl_aff_add(r, shrink);
+		v = isl_multi_val_get_val(tiling->split_base, i);
+		r = isl_aff_add_constant_val(r, isl_val_neg(v));
+
+		inverted = isl_aff_nonneg_set(r);
+		mpa = isl_multi_pw_aff_set_pw_aff(mpa, i - 1,
+					isl_set_indicator_function(inverted));
+	}
+
+	phase->split_phase = isl_pw_multi_aff_from_multi_pw_aff(mpa);
+	if (!phase->split_phase)
+		return ppcg_ht_phase_free(phase);
+	return phase;
+}
+
 /* Construct a representation for one of the two phase for hybrid tiling
  * "tiling".  If "shift" is not set, then the phase is constructed
  * directly from the hexagonal tile shape in "tiling", which represents
@@ -1577,7 +1812,8 @@ static __isl_give ppcg_ht_phase *compute_space_tile(
  * the space of the input pattern.
  *
  * After the basic phase has been computed, also compute
- * the corresponding space shift.
+ * the corresponding space shift, the space tiling and,
+ * in case of split tiling, the split phases.
  */
 static __isl_give ppcg_ht_phase *ppcg_ht_tiling_compute_phase(
 	__isl_keep ppcg_ht_tiling *tiling, int shift)
@@ -1591,6 +1827,7 @@ static __isl_give ppcg_ht_phase *ppcg_ht_tiling_compute_phase(
 
 	phase = compute_space_shift(phase);
 	phase = compute_space_tile(phase);
+	phase = compute_split_phase(phase);
 
 	return phase;
 }
@@ -1670,24 +1907,46 @@ __isl_keep ppcg_ht_phase *ppcg_ht_phase_extract_from_mark(
 }
 
 /* Insert a mark node at "node" holding a pointer to "phase".
+ * In case of split tiling, also insert a band node on top of the mark
+ * node that iterates over the split phases of "phase" in the space
+ * dimensions other than the first.  The upright tiles in each dimension
+ * are independent of each other and so are the inverted tiles,
+ * but the inverted tiles depend on the adjacent upright tiles.
+ * This band node is not permutable and does not have any coincident
+ * members, but all tiles with the same split phase are independent.
+ * Return a pointer to the outermost inserted node.
  */
 static __isl_give isl_schedule_node *insert_phase(
 	__isl_take isl_schedule_node *node, __isl_take ppcg_ht_phase *phase)
 {
 	isl_ctx *ctx;
 	isl_id *id;
+	isl_multi_union_pw_aff *split = NULL;
 
-	if (!node)
+	if (!node || !phase)
 		goto error;
+	if (phase->split_phase) {
+		isl_pw_multi_aff *pma;
+
+		pma = isl_pw_multi_aff_copy(phase->split_phase);
+		split = isl_multi_union_pw_aff_copy(
+					phase->tiling->input_schedule);
+		split = isl_multi_union_pw_aff_apply_pw_multi_aff(split, pma);
+		if (!split)
+			goto error;
+	}
 	ctx = isl_schedule_node_get_ctx(node);
 	id = isl_id_alloc(ctx, ppcg_phase_name, phase);
 	if (!id)
 		goto error;
 	id = isl_id_set_free_user(id, &ppcg_ht_phase_free_wrap);
 	node = isl_schedule_node_insert_mark(node, id);
+	if (split)
+		node = isl_schedule_node_insert_partial_schedule(node, split);
 
 	return node;
 error:
+	isl_multi_union_pw_aff_free(split);
 	ppcg_ht_phase_free(phase);
 	isl_schedule_node_free(node);
 	return NULL;
@@ -1701,16 +1960,15 @@ error:
  *
  *	[[outer] -> [P -> C]] -> [[outer] -> [tile]]
  *
- * where tile is defined by a concatenation of the time_tile and
- * the space_tile.
+ * where tile is defined by a concatenation of the time_tile,
+ * the split_phase (in case of split tiling) and the space_tile.
  */
 static __isl_give isl_map *construct_tile_map(__isl_keep ppcg_ht_phase *phase)
 {
 	int depth;
 	isl_space *space;
 	isl_multi_aff *ma;
-	isl_multi_aff *tiling;
-	isl_map *el2tile;
+	isl_map *el2tile, *space_tile;
 
 	depth = isl_schedule_node_get_schedule_depth(
 						phase->tiling->input_node);
@@ -1721,10 +1979,17 @@ static __isl_give isl_map *construct_tile_map(__isl_keep ppcg_ht_phase *phase)
 	space = isl_space_map_from_set(space);
 	ma = isl_multi_aff_identity(space);
 
-	tiling = isl_multi_aff_flat_range_product(
-		isl_multi_aff_from_aff(isl_aff_copy(phase->time_tile)),
-		isl_multi_aff_copy(phase->space_tile));
-	el2tile = isl_map_from_multi_aff(tiling);
+	el2tile = isl_map_from_aff(isl_aff_copy(phase->time_tile));
+	if (phase->split_phase) {
+		isl_map *split;
+
+		split = isl_map_from_pw_multi_aff(
+				isl_pw_multi_aff_copy(phase->split_phase));
+		el2tile = isl_map_flat_range_product(el2tile, split);
+	}
+	space_tile = isl_map_from_multi_aff(
+				isl_multi_aff_copy(phase->space_tile));
+	el2tile = isl_map_flat_range_product(el2tile, space_tile);
 	el2tile = isl_map_intersect_domain(el2tile,
 						isl_set_copy(phase->domain));
 	el2tile = isl_map_product(isl_map_from_multi_aff(ma), el2tile);
@@ -1889,6 +2154,9 @@ static __isl_give isl_schedule_node *ppcg_ht_phase_isolate_full_tile_node(
  * The first tile dimension iterates over the hexagons in the same
  * phase, which are independent by construction.  The first dimension
  * is therefore marked coincident.
+ * In case of split tiling, the other dimensions iterate over tiles
+ * in the same split phase, which are also independent by construction.
+ * All dimensions are then marked coincident.
  * All dimensions are also marked for being generated as atomic loops
  * because separation is usually not desirable on tile loops.
  */
@@ -1896,6 +2164,7 @@ static __isl_give isl_schedule_node *insert_space_tiling(
 	__isl_keep ppcg_ht_phase *phase, __isl_take isl_schedule_node *node,
 	struct ppcg_options *options)
 {
+	int i, n;
 	isl_multi_aff *space_tile;
 	isl_multi_union_pw_aff *mupa;
 
@@ -1908,7 +2177,9 @@ static __isl_give isl_schedule_node *insert_space_tiling(
 	node = isl_schedule_node_insert_partial_schedule(node, mupa);
 	node = ppcg_set_schedule_node_type(node, isl_ast_loop_atomic);
 	node = ppcg_ht_phase_isolate_full_tile_node(phase, node, options);
-	node = isl_schedule_node_band_member_set_coincident(node, 0, 1);
+	n = phase->tiling->split ? isl_schedule_node_band_n_member(node) : 1;
+	for (i = 0; i < n; ++i)
+		node = isl_schedule_node_band_member_set_coincident(node, i, 1);
 
 	return node;
 }
@@ -1936,17 +2207,16 @@ __isl_give isl_schedule_node *ppcg_ht_phase_shift_space_point(
 	return node;
 }
 
-/* Does
+/* Return
  *
- *	s0 > delta + 2 * {delta * h} - 1
+ *	delta + 2 * {delta * h} - 1
  *
- * hold?
+ * i.e., the value that the base s0 of the hexagon needs to exceed.
  */
-static isl_bool wide_enough(__isl_keep isl_val *s0, __isl_keep isl_val *delta,
+static __isl_give isl_val *width_bound(__isl_keep isl_val *delta,
 	__isl_keep isl_val *h)
 {
 	isl_val *v, *v2;
-	isl_bool ok;
 
 	v = isl_val_mul(isl_val_copy(delta), isl_val_copy(h));
 	v2 = isl_val_floor(isl_val_copy(v));
@@ -1954,12 +2224,47 @@ static isl_bool wide_enough(__isl_keep isl_val *s0, __isl_keep isl_val *delta,
 	v = isl_val_mul_ui(v, 2);
 	v = isl_val_add(v, isl_val_copy(delta));
 	v = isl_val_sub_ui(v, 1);
+
+	return v;
+}
+
+/* Does
+ *
+ *	s0 > delta + 2 * {delta * h} - 1
+ *
+ * hold?
+ */
+static isl_bool wide_enough(__isl_keep isl_val *s0, __isl_keep isl_val *delta,
+	__isl_keep isl_val *h)
+{
+	isl_val *v;
+	isl_bool ok;
+
+	v = width_bound(delta, h);
 	ok = isl_val_gt(s0, v);
 	isl_val_free(v);
 
 	return ok;
 }
 
+/* Return the smallest integer base s0 of the hexagon that satisfies
+ *
+ *	s0 > delta + 2 * {delta * h} - 1
+ *
+ * i.e., floor(delta + 2 * {delta * h} - 1) + 1.
+ */
+static __isl_give isl_val *min_width(__isl_keep isl_val *delta,
+	__isl_keep isl_val *h)
+{
+	isl_val *v;
+
+	v = width_bound(delta, h);
+	v = isl_val_floor(v);
+	v = isl_val_add_ui(v, 1);
+
+	return v;
+}
+
 /* Is the tile size specified by "sizes" wide enough in the first space
  * dimension, i.e., the base of the hexagon?  This ensures that,
  * after hybrid tiling using "bounds" and these sizes,
@@ -2017,6 +2322,107 @@ isl_bool ppcg_ht_bounds_supports_sizes(__isl_keep ppcg_ht_bounds *bounds,
 	return ok;
 }
 
+/* Return a copy of "sizes" with the size in the first space dimension,
+ * i.e., the base of the hexagon, increased to the smallest value
+ * that is wide enough for "bounds" given the size in the time dimension,
+ * if the original size is not already wide enough.
+ * See ppcg_ht_bounds_supports_sizes for the conditions.
+ * Enlarging the base does not affect the size of the time dimension,
+ * so the result satisfies ppcg_ht_bounds_supports_sizes.
+ * If the bounds are not valid, then "sizes" is returned unchanged.
+ */
+__isl_give isl_multi_val *ppcg_ht_bounds_widen_sizes(
+	__isl_keep ppcg_ht_bounds *bounds, __isl_take isl_multi_val *sizes)
+{
+	isl_val *s0, *h, *delta, *w;
+	isl_bool valid;
+
+	if (!sizes)
+		return NULL;
+	valid = ppcg_ht_bounds_is_valid(bounds);
+	if (valid < 0)
+		return isl_multi_val_free(sizes);
+	if (!valid)
+		return sizes;
+
+	h = isl_val_sub_ui(isl_multi_val_get_val(sizes, 0), 1);
+	s0 = isl_multi_val_get_val(sizes, 1);
+
+	delta = ppcg_ht_bounds_get_lower(bounds, 0);
+	w = min_width(delta, h);
+	isl_val_free(delta);
+	s0 = isl_val_max(s0, w);
+
+	delta = ppcg_ht_bounds_get_upper(bounds);
+	w = min_width(delta, h);
+	isl_val_free(delta);
+	s0 = isl_val_max(s0, w);
+
+	isl_val_free(h);
+
+	return isl_multi_val_set_val(sizes, 1, s0);
+}
+
+/* Can the space dimensions other than the first be split tiled
+ * after hybrid tiling using "bounds" and the tile sizes "sizes"?
+ * The test is only meaningful if the bounds are valid.
+ *
+ * In split tiling, each time tile is further subdivided in each
+ * of these space dimensions into upright tiles, which shrink
+ * as time progresses and which are executed first, and inverted tiles,
+ * which fill up the space in between and which are executed next.
+ * This requires bounds on the relative dependence distances
+ * in both directions.
+ * Let S_i be the original tile size in dimension i, which forms
+ * the base of the upright tiles, and let h2 = 2 S_t - 1 be the largest
+ * local time within a time tile, with S_t half the size of the time tile.
+ * In order for the inverted tiles to be independent of each other,
+ * the upright tiles need to separate them at all times within
+ * the time tile, i.e.,
+ *
+ *	S_i > ceil(dl_i h2) + ceil(du_i h2)
+ *
+ * There need to be at least two space dimensions.
+ */
+static isl_bool ppcg_ht_bounds_supports_split(
+	__isl_keep ppcg_ht_bounds *bounds, __isl_keep isl_multi_val *sizes)
+{
+	int i, n;
+	isl_val *st, *h2;
+	isl_bool ok = isl_bool_false;
+
+	if (!bounds || !sizes)
+		return isl_bool_error;
+
+	n = isl_multi_val_dim(bounds->lower, isl_dim_set);
+	st = isl_multi_val_get_val(sizes, 0);
+	h2 = max_local_time(st);
+	isl_val_free(st);
+	for (i = 1; i < n; ++i) {
+		isl_val *dl, *du, *s, *v;
+
+		dl = ppcg_ht_bounds_get_lower(bounds, i);
+		du = ppcg_ht_bounds_get_space_upper(bounds, i);
+		ok = isl_bool_not(isl_val_is_nan(dl));
+		if (ok == isl_bool_true)
+			ok = isl_bool_not(isl_val_is_nan(du));
+		if (ok == isl_bool_true) {
+			s = isl_multi_val_get_val(sizes, 1 + i);
+			v = split_shrink(dl, du, h2);
+			ok = isl_val_gt(s, v);
+			isl_val_free(s);
+			isl_val_free(v);
+		}
+		isl_val_free(dl);
+		isl_val_free(du);
+		if (ok < 0 || !ok)
+			break;
+	}
+	isl_val_free(h2);
+
+	return ok;
+}
+
 /* Check that the tile will be wide enough in the first space
  * dimension, i.e., the base of the hexagon.  This ensures that
  * neighboring hexagons in the same phase are far enough apart
@@ -2049,7 +2455,8 @@ static isl_stat check_width(__isl_keep ppcg_ht_bounds *bounds,
  * The space of "sizes" should be the product of the spaces
  * of the schedules of the pair of parent and child nodes.
  * "options" determines whether full tiles should be separated
- * from partial tiles.
+ * from partial tiles and whether the remaining space dimensions
+ * should be split tiled.
  *
  * In particular, given an input of the form
  *
@@ -2070,6 +2477,18 @@ static isl_stat check_width(__isl_keep ppcg_ht_bounds *bounds,
  * to the corresponding phase.  The M0 and M1 marks contain a pointer
  * to a ppcg_ht_phase object that can be used to perform further changes.
  *
+ * If options->hybrid_split is set and the bounds and sizes
+ * allow it, then the space dimensions other than the first are
+ * split tiled instead of classically tiled.  In this case,
+ * the output has the form
+ *
+ *	        /- F0 - ST0 - M0 - CT0 - P - C - ...
+ *	PT - seq
+ *	        \- F1 - ST1 - M1 - CT1 - P - C - ...
+ *
+ * with ST0 and ST1 iterating over the split phases and
+ * all dimensions of CT0 and CT1 independent.
+ *
  * After checking that input satisfies the requirements,
  * a data structure is constructed that represents the tiling and
  * two additional data structures are constructed for the two phases
@@ -2093,17 +2512,23 @@ __isl_give isl_schedule_node *ppcg_ht_bounds_insert_tiling(
 	ppcg_ht_tiling *tiling;
 	ppcg_ht_phase *phase_0;
 	ppcg_ht_phase *phase_1;
+	isl_bool split = isl_bool_false;
 
 	if (!node || !sizes || !bounds)
 		goto error;
 	if (check_input_pattern(node) < 0 || check_width(bounds, sizes) < 0)
 		goto error;
+	if (options->hybrid_split)
+		split = ppcg_ht_bounds_supports_split(bounds, sizes);
+	if (split < 0)
+		goto error;
 
 	ctx = isl_schedule_node_get_ctx(node);
 
 	input = extract_input_schedule(node);
 
-	tiling = ppcg_ht_bounds_construct_tiling(bounds, node, input, sizes);
+	tiling = ppcg_ht_bounds_construct_tiling(bounds, node, input, sizes,
+						split);
 	phase_0 = ppcg_ht_tiling_compute_phase(tiling, 1);
 	phase_1 = ppcg_ht_tiling_compute_phase(tiling, 0);
 	time = combine_time_tile(phase_0, phase_1);
@@ -2150,6 +2575,33 @@ error:
 	return NULL;
 }
 
+/* Given a pointer "node" to one of the phase filters in the result
+ * of hybrid tiling, call "fn" on the phase marker node below it and
+ * return a pointer to the filter.
+ * In case of split tiling, the marker node is separated from
+ * the filter by the split phase band.
+ */
+static __isl_give isl_schedule_node *call_on_phase(
+	__isl_take isl_schedule_node *node,
+	__isl_give isl_schedule_node *(*fn)(__isl_take isl_schedule_node *node,
+		void *user), void *user)
+{
+	int depth0, depth;
+
+	depth0 = isl_schedule_node_get_tree_depth(node);
+	node = isl_schedule_node_child(node, 0);
+	while (node &&
+	    isl_schedule_node_get_type(node) != isl_schedule_node_mark)
+		node = isl_schedule_node_child(node, 0);
+	if (!node)
+		return NULL;
+	node = fn(node, user);
+	depth = isl_schedule_node_get_tree_depth(node);
+	node = isl_schedule_node_ancestor(node, depth - depth0);
+
+	return node;
+}
+
 /* Given a branch "node" that contains a sequence node with two phases
  * of hybrid tiling as input, call "fn" on each of the two phase marker
  * nodes.
@@ -2160,6 +2612,8 @@ error:
  *	... - seq
  *	         \- F1 - M1 - ...
  *
+ * (or with split phase bands ST0 and ST1 between the filters and
+ * the marks in case of split tiling)
  * and "fn" is called on M0 and on M1.
  */
 __isl_give isl_schedule_node *hybrid_tile_foreach_phase(
@@ -2176,17 +2630,9 @@ __isl_give isl_schedule_node *hybrid_tile_foreach_phase(
 		node = isl_schedule_node_child(node, 0);
 
 	node = isl_schedule_node_child(node, 0);
-	node = isl_schedule_node_child(node, 0);
-	if (!node)
-		return NULL;
-	node = fn(node, user);
-	node = isl_schedule_node_parent(node);
+	node = call_on_phase(node, fn, user);
 	node = isl_schedule_node_next_sibling(node);
-	node = isl_schedule_node_child(node, 0);
-	if (!node)
-		return NULL;
-	node = fn(node, user);
-	node = isl_schedule_node_parent(node);
+	node = call_on_phase(node, fn, user);
 	node = isl_schedule_node_parent(node);
 
 	depth = isl_schedule_node_get_tree_depth(node);
@@ -21,6 +21,8 @@ void ppcg_ht_bounds_dump(__isl_keep ppcg_ht_bounds *bounds);
 isl_bool ppcg_ht_bounds_is_valid(__isl_keep ppcg_ht_bounds *bounds);
 isl_bool ppcg_ht_bounds_supports_sizes(__isl_keep ppcg_ht_bounds *bounds,
 	__isl_keep isl_multi_val *sizes);
+__isl_give isl_multi_val *ppcg_ht_bounds_widen_sizes(
+	__isl_keep ppcg_ht_bounds *bounds, __isl_take isl_multi_val *sizes);
 __isl_give isl_schedule_node *ppcg_ht_bounds_insert_tiling(
 	__isl_take ppcg_ht_bounds *bounds, __isl_take isl_multi_val *sizes,
 	__isl_take isl_schedule_node *node, struct ppcg_options *options);
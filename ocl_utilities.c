@@ -1,5 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "ocl_utilities.h"
 
 /* Return the OpenCL error string for a given error number.
@@ -106,23 +108,204 @@ cl_device_id opencl_create_device(int use_gpu)
 	return dev;
 }
 
-/* Create an OpenCL program from a string and compile it.
+/* Does "dev" share its memory with the host?
+ * This is the case for CPU devices and for devices that report
+ * a unified memory subsystem, typically integrated GPUs.
  */
-cl_program opencl_build_program_from_string(cl_context ctx, cl_device_id dev,
-	const char *program_source, size_t program_size,
-	const char *opencl_options)
+int opencl_device_has_unified_memory(cl_device_id dev)
+{
+	cl_device_type type;
+	cl_bool unified;
+
+	if (clGetDeviceInfo(dev, CL_DEVICE_TYPE, sizeof(type), &type,
+			NULL) == CL_SUCCESS && (type & CL_DEVICE_TYPE_CPU))
+		return 1;
+	if (clGetDeviceInfo(dev, CL_DEVICE_HOST_UNIFIED_MEMORY,
+			sizeof(unified), &unified, NULL) != CL_SUCCESS)
+		return 0;
+	return unified == CL_TRUE;
+}
+
+/* Update the FNV-1a hash "hash" with the "size" bytes at "data".
+ */
+static unsigned long long hash_bytes(unsigned long long hash,
+	const void *data, size_t size)
+{
+	const unsigned char *bytes = data;
+	size_t i;
+
+	for (i = 0; i < size; ++i)
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
+
+	return hash;
+}
+
+/* Update "hash" with the string value of the device information "param"
+ * of "dev".
+ */
+static unsigned long long hash_device_info(unsigned long long hash,
+	cl_device_id dev, cl_device_info param)
+{
+	char info[1024];
+	size_t size;
+
+	if (clGetDeviceInfo(dev, param, sizeof(info), info, &size) < 0)
+		return hash;
+	if (size > sizeof(info))
+		size = sizeof(info);
+
+	return hash_bytes(hash, info, size);
+}
+
+/* Return the name of the file in which the binary of the program
+ * built from "program_source" with options "opencl_options" for "dev"
+ * is cached, or NULL if no binaries should be cached.
+ * Binaries are cached in the directory specified by
+ * the PPCG_OPENCL_CACHE environment variable, if it is set.
+ * The name of the file is derived from a hash of the device,
+ * the driver version, the options and the program source.
+ */
+static char *cache_file_name(cl_device_id dev, const char *program_source,
+	size_t program_size, const char *opencl_options)
+{
+	const char *dir;
+	char *name;
+	size_t len;
+	unsigned long long hash = 14695981039346656037ULL;
+
+	dir = getenv("PPCG_OPENCL_CACHE");
+	if (!dir || !*dir)
+		return NULL;
+
+	hash = hash_device_info(hash, dev, CL_DEVICE_VENDOR);
+	hash = hash_device_info(hash, dev, CL_DEVICE_NAME);
+	hash = hash_device_info(hash, dev, CL_DEVICE_VERSION);
+	hash = hash_device_info(hash, dev, CL_DRIVER_VERSION);
+	if (opencl_options)
+		hash = hash_bytes(hash, opencl_options,
+				strlen(opencl_options) + 1);
+	hash = hash_bytes(hash, program_source, program_size);
+
+	len = strlen(dir) + 32;
+	name = (char *) malloc(len);
+	if (!name)
+		return NULL;
+	snprintf(name, len, "%s/ppcg-%016llx.bin", dir, hash);
+
+	return name;
+}
+
+/* Read the contents of the file called "filename" into a newly
+ * allocated buffer and store its size in "size".
+ * Return NULL if the file cannot be read.
+ */
+static unsigned char *read_file(const char *filename, size_t *size)
+{
+	FILE *file;
+	long len;
+	unsigned char *data = NULL;
+
+	file = fopen(filename, "rb");
+	if (!file)
+		return NULL;
+	if (fseek(file, 0, SEEK_END) == 0 && (len = ftell(file)) > 0) {
+		rewind(file);
+		data = (unsigned char *) malloc(len);
+		if (data && fread(data, 1, len, file) != (size_t) len) {
+			free(data);
+			data = NULL;
+		}
+		*size = len;
+	}
+	fclose(file);
+
+	return data;
+}
+
+/* Try and create an OpenCL program for "dev" from the binary cached
+ * in the file called "cache" and build it with options "opencl_options".
+ * Return NULL if there is no (valid) cached binary.
+ */
+static cl_program load_cached_program(cl_context ctx, cl_device_id dev,
+	const char *cache, const char *opencl_options)
 {
 	int err;
+	cl_int status;
 	cl_program program;
+	unsigned char *binary;
+	size_t size;
+
+	binary = read_file(cache, &size);
+	if (!binary)
+		return NULL;
+	program = clCreateProgramWithBinary(ctx, 1, &dev, &size,
+			(const unsigned char **) &binary, &status, &err);
+	free(binary);
+	if (err < 0)
+		return NULL;
+	if (status < 0 ||
+	    clBuildProgram(program, 0, NULL, opencl_options, NULL, NULL) < 0) {
+		clReleaseProgram(program);
+		return NULL;
+	}
+
+	return program;
+}
+
+/* Store the binary of "program" in the file called "cache".
+ * The binary is first written to a uniquely named temporary file
+ * that is then renamed, such that concurrently running programs
+ * neither read a partially written binary nor write
+ * to the same temporary file.
+ * Failures are silently ignored since they only mean that
+ * the program will be built from source again by the next run.
+ */
+static void save_program_binary(cl_program program, const char *cache)
+{
+	FILE *file;
+	int fd;
+	char *tmp;
+	unsigned char *binary;
+	size_t size, written;
+
+	if (clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES,
+			sizeof(size), &size, NULL) < 0 || size == 0)
+		return;
+	binary = (unsigned char *) malloc(size);
+	tmp = (char *) malloc(strlen(cache) + 8);
+	if (!binary || !tmp)
+		goto done;
+	if (clGetProgramInfo(program, CL_PROGRAM_BINARIES,
+			sizeof(binary), &binary, NULL) < 0)
+		goto done;
+	sprintf(tmp, "%s.XXXXXX", cache);
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		goto done;
+	file = fdopen(fd, "wb");
+	if (!file) {
+		close(fd);
+		remove(tmp);
+		goto done;
+	}
+	written = fwrite(binary, 1, size, file);
+	if (fclose(file) != 0 || written != size || rename(tmp, cache) != 0)
+		remove(tmp);
+done:
+	free(binary);
+	free(tmp);
+}
+
+/* Build "program" for "dev" with options "opencl_options".
+ * Print the build log and exit on failure.
+ */
+static void build_program(cl_program program, cl_device_id dev,
+	const char *opencl_options)
+{
+	int err;
 	char *program_log;
 	size_t log_size;
 
-	program = clCreateProgramWithSource(ctx, 1,
-			&program_source, &program_size, &err);
-	if (err < 0) {
-		fprintf(stderr, "Could not create the program\n");
-		exit(1);
-	}
 	err = clBuildProgram(program, 0, NULL, opencl_options, NULL, NULL);
 	if (err < 0) {
 		fprintf(stderr, "Could not build the program.\n");
@@ -136,6 +319,74 @@ cl_program opencl_build_program_from_string(cl_context ctx, cl_device_id dev,
 		free(program_log);
 		exit(1);
 	}
+}
+
+/* Create an OpenCL program from a string and compile it.
+ */
+static cl_program build_program_from_source(cl_context ctx, cl_device_id dev,
+	const char *program_source, size_t program_size,
+	const char *opencl_options)
+{
+	int err;
+	cl_program program;
+
+	program = clCreateProgramWithSource(ctx, 1,
+			&program_source, &program_size, &err);
+	if (err < 0) {
+		fprintf(stderr, "Could not create the program\n");
+		exit(1);
+	}
+	build_program(program, dev, opencl_options);
+	return program;
+}
+
+/* Create an OpenCL program from SPIR-V and build it.
+ */
+static cl_program build_program_from_il(cl_context ctx, cl_device_id dev,
+	const void *il, size_t il_size, const char *opencl_options)
+{
+#ifdef CL_VERSION_2_1
+	int err;
+	cl_program program;
+
+	program = clCreateProgramWithIL(ctx, il, il_size, &err);
+	if (err < 0) {
+		fprintf(stderr, "Could not create the program\n");
+		exit(1);
+	}
+	build_program(program, dev, opencl_options);
+	return program;
+#else
+	fprintf(stderr, "Loading SPIR-V programs requires OpenCL 2.1\n");
+	exit(1);
+#endif
+}
+
+/* Create an OpenCL program from a string and compile it.
+ * If a binary of the program has been cached by a previous run
+ * (see cache_file_name), then the program is created from this binary
+ * instead.  Otherwise, the program is built from source and
+ * its binary is added to the cache.
+ */
+cl_program opencl_build_program_from_string(cl_context ctx, cl_device_id dev,
+	const char *program_source, size_t program_size,
+	const char *opencl_options)
+{
+	char *cache;
+	cl_program program = NULL;
+
+	cache = cache_file_name(dev, program_source, program_size,
+				opencl_options);
+	if (cache)
+		program = load_cached_program(ctx, dev, cache, opencl_options);
+	if (!program) {
+		program = build_program_from_source(ctx, dev, program_source,
+						program_size, opencl_options);
+		if (cache)
+			save_program_binary(program, cache);
+	}
+	free(cache);
+
 	return program;
 }
 
@@ -172,3 +423,29 @@ cl_program opencl_build_program_from_file(cl_context ctx, cl_device_id dev,
 
 	return program;
 }
+
+/* Create an OpenCL program from "il_size" bytes of SPIR-V at "il"
+ * and build it.
+ * If a binary of the program has been cached by a previous run
+ * (see cache_file_name), then the program is created from this binary
+ * instead.  Otherwise, the program binary is added to the cache.
+ */
+cl_program opencl_build_program_from_il(cl_context ctx, cl_device_id dev,
+	const void *il, size_t il_size, const char *opencl_options)
+{
+	char *cache;
+	cl_program program = NULL;
+
+	cache = cache_file_name(dev, il, il_size, opencl_options);
+	if (cache)
+		program = load_cached_program(ctx, dev, cache, opencl_options);
+	if (!program) {
+		program = build_program_from_il(ctx, dev, il, il_size,
+						opencl_options);
+		if (cache)
+			save_program_binary(program, cache);
+	}
+	free(cache);
+
+	return program;
+}
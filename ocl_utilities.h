@@ -18,12 +18,29 @@ const char *opencl_error_string(cl_int error);
  */
 cl_device_id opencl_create_device(int use_gpu);
 
+/* Does "dev" share its memory with the host?
+ * This is the case for CPU devices and for devices that report
+ * a unified memory subsystem, typically integrated GPUs.
+ */
+int opencl_device_has_unified_memory(cl_device_id dev);
+
 /* Create an OpenCL program from a string and compile it.
+ * If the PPCG_OPENCL_CACHE environment variable is set, then
+ * the program binary is cached in the directory it specifies and
+ * reused by subsequent runs on the same device and driver.
  */
 cl_program opencl_build_program_from_string(cl_context ctx, cl_device_id dev,
 	const char *program_source, size_t program_size,
 	const char *opencl_options);
 
+/* Create an OpenCL program from "il_size" bytes of SPIR-V at "il"
+ * and build it.  This requires OpenCL 2.1.
+ * The program binary is cached in the same way as
+ * in opencl_build_program_from_string.
+ */
+cl_program opencl_build_program_from_il(cl_context ctx, cl_device_id dev,
+	const void *il, size_t il_size, const char *opencl_options);
+
 /* Create an OpenCL program from a source file and compile it.
  */
 cl_program opencl_build_program_from_file(cl_context ctx, cl_device_id dev,
@@ -9,6 +9,7 @@
 
 #include <ctype.h>
 #include <limits.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <isl/aff.h>
@@ -30,6 +31,10 @@
  * output is the user-specified output file name and may be NULL
  *	if not specified by the user.
  * kernel_c_name is the name of the kernel_c file.
+ * If the kernels are compiled ahead of time (--opencl-offline-compiler),
+ * then kernel_il_name is the name of the file containing
+ * the result of this compilation and kernel_il_h_name is the name
+ * of the header file in which it is embedded.
  * kprinter is an isl_printer for the kernel file.
  * host_c is the generated source file for the host code.  kernel_c is
  * the generated source file for the kernel.
@@ -39,6 +44,8 @@ struct opencl_info {
 	const char *input;
 	const char *output;
 	char kernel_c_name[PATH_MAX];
+	char kernel_il_name[PATH_MAX];
+	char kernel_il_h_name[PATH_MAX];
 
 	isl_printer *kprinter;
 
@@ -58,11 +65,27 @@ static FILE *open_or_croak(const char *name)
 	return file;
 }
 
+/* Are transfers to and from the device performed through
+ * page-locked staging buffers?
+ * This is the case if the --pinned-host-memory option is set,
+ * unless the --opencl-zero-copy option is set as well,
+ * in which case the host arrays may be used by the device directly.
+ */
+static int use_staging_buffers(struct ppcg_options *options)
+{
+	return options->pinned_host_memory && !options->opencl_zero_copy;
+}
+
 /* Open the host .c file and the kernel .h and .cl files for writing.
  * Their names are derived from info->output (or info->input if
  * the user did not specify an output file name).
  * Add the necessary includes to these files, including those specified
- * by the user.
+ * by the user, as well as the support code for timing
+ * if the --device-timing option is set.
+ * The host code needs memcpy if staging buffers are used.
+ * If the kernels are compiled ahead of time, then the host code
+ * includes the header file in which the compiled kernels are embedded
+ * (see opencl_compile_kernel_file) instead of the kernel code.
  *
  * Return 0 on success and -1 on failure.
  */
@@ -90,17 +113,34 @@ static int opencl_open_files(struct opencl_info *info)
 	memcpy(info->kernel_c_name, name, len);
 	strcpy(info->kernel_c_name + len, "_kernel.cl");
 	info->kernel_c = open_or_croak(info->kernel_c_name);
+	memcpy(info->kernel_il_name, name, len);
+	strcpy(info->kernel_il_name + len, "_kernel.spv");
+	memcpy(info->kernel_il_h_name, name, len);
+	strcpy(info->kernel_il_h_name + len, "_kernel_il.h");
 
 	if (!info->host_c || !info->kernel_c)
 		return -1;
 
 	fprintf(info->host_c, "#include <assert.h>\n");
 	fprintf(info->host_c, "#include <stdio.h>\n");
+	if (use_staging_buffers(info->options))
+		fprintf(info->host_c, "#include <string.h>\n");
 	fprintf(info->host_c, "#include \"ocl_utilities.h\"\n");
-	if (info->options->opencl_embed_kernel_code) {
+	if (info->options->opencl_offline_compiler) {
+		fprintf(info->host_c, "#include \"%s\"\n\n",
+			info->kernel_il_h_name);
+	} else if (info->options->opencl_embed_kernel_code) {
 		fprintf(info->host_c, "#include \"%s\"\n\n",
 			info->kernel_c_name);
 	}
+	if (info->options->device_timing) {
+		isl_printer *p;
+
+		p = isl_printer_to_file(isl_printer_get_ctx(info->kprinter),
+					info->host_c);
+		p = gpu_print_timing_support(p);
+		isl_printer_free(p);
+	}
 
 	for (i = 0; i < info->options->opencl_n_include_file; ++i) {
 		info->kprinter = isl_printer_print_str(info->kprinter,
@@ -159,6 +199,9 @@ static void opencl_print_as_c_string(const char *str, FILE *file)
  * the code as a C string literal.  Start that string literal with an empty
  * line, such that line numbers reported by the OpenCL C compiler match those
  * of the kernel file.
+ * If the kernels are compiled ahead of time, then the kernel file
+ * always contains the plain kernel code since it is passed
+ * to the offline compiler.
  *
  * Return 0 on success and -1 on failure.
  */
@@ -169,7 +212,8 @@ static int opencl_write_kernel_file(struct opencl_info *opencl)
 	if (!raw)
 		return -1;
 
-	if (opencl->options->opencl_embed_kernel_code) {
+	if (opencl->options->opencl_embed_kernel_code &&
+	    !opencl->options->opencl_offline_compiler) {
 		fprintf(opencl->kernel_c,
 			"static const char kernel_code[] = \"\\n\"");
 		opencl_print_as_c_string(raw, opencl->kernel_c);
@@ -182,8 +226,90 @@ static int opencl_write_kernel_file(struct opencl_info *opencl)
 	return 0;
 }
 
+/* Embed the contents of the file called "name" in "out"
+ * as an array of bytes called "var".
+ *
+ * Return 0 on success and -1 on failure.
+ */
+static int embed_file(FILE *out, const char *name, const char *var)
+{
+	FILE *in;
+	int c;
+	long n = 0;
+
+	in = fopen(name, "rb");
+	if (!in) {
+		fprintf(stderr, "Failed to open \"%s\" for reading\n", name);
+		return -1;
+	}
+	fprintf(out, "static const unsigned char %s[] = {", var);
+	while ((c = getc(in)) != EOF) {
+		if (n++ % 12 == 0)
+			fprintf(out, "\n ");
+		fprintf(out, " 0x%02x,", c);
+	}
+	fprintf(out, "\n};\n");
+	fclose(in);
+
+	return n > 0 ? 0 : -1;
+}
+
+/* Compile the kernel file ahead of time using the offline compiler
+ * specified by the --opencl-offline-compiler option and embed
+ * the result in the header file included by the host code
+ * as the kernel_il array.
+ * The compiler is invoked as
+ *
+ *	<compiler> <OpenCL compiler options> <kernel file> -o <output file>
+ *
+ * and is expected to produce SPIR-V.
+ *
+ * Return 0 on success and -1 on failure.
+ */
+static int opencl_compile_kernel_file(struct opencl_info *info)
+{
+	FILE *header;
+	isl_ctx *ctx;
+	isl_printer *p;
+	char *command;
+	int r;
+
+	ctx = isl_printer_get_ctx(info->kprinter);
+	p = isl_printer_to_str(ctx);
+	p = isl_printer_print_str(p, info->options->opencl_offline_compiler);
+	if (info->options->opencl_compiler_options) {
+		p = isl_printer_print_str(p, " ");
+		p = isl_printer_print_str(p,
+				info->options->opencl_compiler_options);
+	}
+	p = isl_printer_print_str(p, " \"");
+	p = isl_printer_print_str(p, info->kernel_c_name);
+	p = isl_printer_print_str(p, "\" -o \"");
+	p = isl_printer_print_str(p, info->kernel_il_name);
+	p = isl_printer_print_str(p, "\"");
+	command = isl_printer_get_str(p);
+	isl_printer_free(p);
+	if (!command)
+		return -1;
+
+	r = system(command);
+	if (r != 0)
+		fprintf(stderr, "Offline compilation failed: %s\n", command);
+	free(command);
+	if (r != 0)
+		return -1;
+
+	header = open_or_croak(info->kernel_il_h_name);
+	if (!header)
+		return -1;
+	r = embed_file(header, info->kernel_il_name, "kernel_il");
+	fclose(header);
+
+	return r;
+}
+
 /* Close all output files.  Write the kernel contents to the kernel file before
- * closing it.
+ * closing it and compile it ahead of time if requested.
  *
  * Return 0 on success and -1 on failure.
  */
@@ -197,6 +323,8 @@ static int opencl_close_files(struct opencl_info *info)
 	}
 	if (info->host_c)
 		fclose(info->host_c);
+	if (r == 0 && info->kernel_c && info->options->opencl_offline_compiler)
+		r = opencl_compile_kernel_file(info);
 
 	return r;
 }
@@ -219,10 +347,14 @@ static __isl_give isl_printer *opencl_print_host_macros(
 	return p;
 }
 
+/* Declare the device arrays and, if staging buffers are used,
+ * the staging buffers and the host pointers to their mapped contents.
+ */
 static __isl_give isl_printer *opencl_declare_device_arrays(
 	__isl_take isl_printer *p, struct gpu_prog *prog)
 {
 	int i;
+	int staging = use_staging_buffers(prog->scop->options);
 
 	for (i = 0; i < prog->n_array; ++i) {
 		if (!gpu_array_requires_device_allocation(&prog->array[i]))
@@ -232,6 +364,18 @@ static __isl_give isl_printer *opencl_declare_device_arrays(
 		p = isl_printer_print_str(p, prog->array[i].name);
 		p = isl_printer_print_str(p, ";");
 		p = isl_printer_end_line(p);
+		if (!staging)
+			continue;
+		p = isl_printer_start_line(p);
+		p = isl_printer_print_str(p, "cl_mem staging_");
+		p = isl_printer_print_str(p, prog->array[i].name);
+		p = isl_printer_print_str(p, ";");
+		p = isl_printer_end_line(p);
+		p = isl_printer_start_line(p);
+		p = isl_printer_print_str(p, "char *staging_host_");
+		p = isl_printer_print_str(p, prog->array[i].name);
+		p = isl_printer_print_str(p, ";");
+		p = isl_printer_end_line(p);
 	}
 	p = isl_printer_start_line(p);
 	p = isl_printer_end_line(p);
@@ -252,56 +396,139 @@ static int is_array_positive_size_guard_trivial(struct gpu_array_info *array)
 	return is_trivial;
 }
 
-/* Allocate a device array for "array'.
- *
- * Emit a max-expression to ensure the device array can contain at least one
- * element if the array's positive size guard expression is not trivial.
+/* Print the macro definitions needed by print_buffer_size for "array".
  */
-static __isl_give isl_printer *allocate_device_array(__isl_take isl_printer *p,
+static __isl_give isl_printer *print_buffer_size_macros(
+	__isl_take isl_printer *p, struct gpu_array_info *array)
+{
+	if (!is_array_positive_size_guard_trivial(array))
+		p = ppcg_print_macro(isl_ast_op_max, p);
+
+	return ppcg_ast_expr_print_macros(array->bound_expr, p);
+}
+
+/* Print the size in bytes of a buffer holding "array".
+ * If the array's positive size guard expression is not trivial,
+ * then the size is at least that of a single element.
+ */
+static __isl_give isl_printer *print_buffer_size(__isl_take isl_printer *p,
 	struct gpu_array_info *array)
 {
 	int need_lower_bound;
 
 	need_lower_bound = !is_array_positive_size_guard_trivial(array);
+	if (need_lower_bound) {
+		p = isl_printer_print_str(p, ppcg_max);
+		p = isl_printer_print_str(p, "(sizeof(");
+		p = isl_printer_print_str(p, array->type);
+		p = isl_printer_print_str(p, "), ");
+	}
+	p = gpu_array_info_print_size(p, array);
 	if (need_lower_bound)
-		p = ppcg_print_macro(isl_ast_op_max, p);
+		p = isl_printer_print_str(p, ")");
 
-	p = ppcg_ast_expr_print_macros(array->bound_expr, p);
+	return p;
+}
+
+/* Allocate a device array for "array'.
+ *
+ * Emit a max-expression to ensure the device array can contain at least one
+ * element if the array's positive size guard expression is not trivial.
+ *
+ * If "zero_copy" is set, then the buffer uses the memory of the host array
+ * if the device turns out to share its memory with the host at run time
+ * (see opencl_setup).
+ */
+static __isl_give isl_printer *allocate_device_array(__isl_take isl_printer *p,
+	struct gpu_array_info *array, int zero_copy)
+{
+	p = print_buffer_size_macros(p, array);
 	p = ppcg_start_block(p);
 
 	p = isl_printer_start_line(p);
 	p = isl_printer_print_str(p, "dev_");
 	p = isl_printer_print_str(p, array->name);
 	p = isl_printer_print_str(p, " = clCreateBuffer(context, ");
-	p = isl_printer_print_str(p, "CL_MEM_READ_WRITE, ");
+	p = isl_printer_print_str(p, "CL_MEM_READ_WRITE");
+	if (zero_copy)
+		p = isl_printer_print_str(p, " | (ppcg_zero_copy ? "
+						"CL_MEM_USE_HOST_PTR : 0)");
+	p = isl_printer_print_str(p, ", ");
+	p = print_buffer_size(p, array);
 
-	if (need_lower_bound) {
-		p = isl_printer_print_str(p, ppcg_max);
-		p = isl_printer_print_str(p, "(sizeof(");
-		p = isl_printer_print_str(p, array->type);
-		p = isl_printer_print_str(p, "), ");
+	if (zero_copy) {
+		p = isl_printer_print_str(p, ", ppcg_zero_copy ? ");
+		if (gpu_array_is_scalar(array))
+			p = isl_printer_print_str(p, "(void *) &");
+		else
+			p = isl_printer_print_str(p, "(void *) ");
+		p = isl_printer_print_str(p, array->name);
+		p = isl_printer_print_str(p, " : NULL, &err);");
+	} else {
+		p = isl_printer_print_str(p, ", NULL, &err);");
 	}
-	p = gpu_array_info_print_size(p, array);
-	if (need_lower_bound)
-		p = isl_printer_print_str(p, ")");
+	p = isl_printer_end_line(p);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "openclCheckReturn(err);");
+	p = isl_printer_end_line(p);
+
+	p = ppcg_end_block(p);
+
+	return p;
+}
+
+/* Allocate a staging buffer for "array" of the same size
+ * as the device array in page-locked host memory and
+ * map it into the address space of the host for the entire
+ * execution of the transformed code.
+ * The copies to and from the device go through the mapped contents
+ * such that the OpenCL implementation can use direct memory access.
+ */
+static __isl_give isl_printer *allocate_staging_buffer(
+	__isl_take isl_printer *p, struct gpu_array_info *array)
+{
+	p = print_buffer_size_macros(p, array);
+	p = ppcg_start_block(p);
 
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "staging_");
+	p = isl_printer_print_str(p, array->name);
+	p = isl_printer_print_str(p, " = clCreateBuffer(context, "
+			"CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, ");
+	p = print_buffer_size(p, array);
 	p = isl_printer_print_str(p, ", NULL, &err);");
 	p = isl_printer_end_line(p);
 	p = isl_printer_start_line(p);
 	p = isl_printer_print_str(p, "openclCheckReturn(err);");
 	p = isl_printer_end_line(p);
 
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "staging_host_");
+	p = isl_printer_print_str(p, array->name);
+	p = isl_printer_print_str(p, " = clEnqueueMapBuffer(queue, staging_");
+	p = isl_printer_print_str(p, array->name);
+	p = isl_printer_print_str(p, ", CL_TRUE, "
+			"CL_MAP_READ | CL_MAP_WRITE, 0, ");
+	p = print_buffer_size(p, array);
+	p = isl_printer_print_str(p, ", 0, NULL, NULL, &err);");
+	p = isl_printer_end_line(p);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "openclCheckReturn(err);");
+	p = isl_printer_end_line(p);
+
 	p = ppcg_end_block(p);
 
 	return p;
 }
 
-/* Allocate accessed device arrays.
+/* Allocate accessed device arrays and, if needed,
+ * the corresponding staging buffers.
  */
 static __isl_give isl_printer *opencl_allocate_device_arrays(
 	__isl_take isl_printer *p, struct gpu_prog *prog)
 {
 	int i;
+	int staging = use_staging_buffers(prog->scop->options);
 
 	for (i = 0; i < prog->n_array; ++i) {
 		struct gpu_array_info *array = &prog->array[i];
@@ -309,7 +536,10 @@ static __isl_give isl_printer *opencl_allocate_device_arrays(
 		if (!gpu_array_requires_device_allocation(array))
 			continue;
 
-		p = allocate_device_array(p, array);
+		p = allocate_device_array(p, array,
+				prog->scop->options->opencl_zero_copy);
+		if (staging)
+			p = allocate_staging_buffer(p, array);
 	}
 	p = isl_printer_start_line(p);
 	p = isl_printer_end_line(p);
@@ -331,12 +561,37 @@ static __isl_give isl_printer *release_device_array(__isl_take isl_printer *p,
 	return p;
 }
 
-/* Free the accessed device arrays.
+/* Unmap and free the staging buffer corresponding to "array".
+ */
+static __isl_give isl_printer *release_staging_buffer(
+	__isl_take isl_printer *p, struct gpu_array_info *array)
+{
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "openclCheckReturn("
+				"clEnqueueUnmapMemObject(queue, staging_");
+	p = isl_printer_print_str(p, array->name);
+	p = isl_printer_print_str(p, ", staging_host_");
+	p = isl_printer_print_str(p, array->name);
+	p = isl_printer_print_str(p, ", 0, NULL, NULL));");
+	p = isl_printer_end_line(p);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "openclCheckReturn("
+					"clReleaseMemObject(staging_");
+	p = isl_printer_print_str(p, array->name);
+	p = isl_printer_print_str(p, "));");
+	p = isl_printer_end_line(p);
+
+	return p;
+}
+
+/* Free the accessed device arrays and, if needed,
+ * the corresponding staging buffers.
  */
 static __isl_give isl_printer *opencl_release_device_arrays(
 	__isl_take isl_printer *p, struct gpu_prog *prog)
 {
 	int i;
+	int staging = use_staging_buffers(prog->scop->options);
 
 	for (i = 0; i < prog->n_array; ++i) {
 		struct gpu_array_info *array = &prog->array[i];
@@ -344,12 +599,20 @@ static __isl_give isl_printer *opencl_release_device_arrays(
 			continue;
 
 		p = release_device_array(p, array);
+		if (staging)
+			p = release_staging_buffer(p, array);
 	}
 	return p;
 }
 
 /* Create an OpenCL device, context, command queue and build the kernel.
  * input is the name of the input file provided to ppcg.
+ * If the --device-timing option is set, then profiling is enabled
+ * on the command queue.
+ * If the --opencl-zero-copy option is set, then ppcg_zero_copy
+ * records whether the device shares its memory with the host.
+ * If the kernels have been compiled ahead of time, then the program
+ * is created from the embedded intermediate representation.
  */
 static __isl_give isl_printer *opencl_setup(__isl_take isl_printer *p,
 	const char *input, struct opencl_info *info)
@@ -374,6 +637,12 @@ static __isl_give isl_printer *opencl_setup(__isl_take isl_printer *p,
 	p = isl_printer_print_int(p, info->options->opencl_use_gpu);
 	p = isl_printer_print_str(p, ");");
 	p = isl_printer_end_line(p);
+	if (info->options->opencl_zero_copy) {
+		p = isl_printer_start_line(p);
+		p = isl_printer_print_str(p, "int ppcg_zero_copy = "
+				"opencl_device_has_unified_memory(device);");
+		p = isl_printer_end_line(p);
+	}
 	p = isl_printer_start_line(p);
 	p = isl_printer_print_str(p, "context = clCreateContext(NULL, 1, "
 		"&device, NULL, NULL, &err);");
@@ -383,7 +652,12 @@ static __isl_give isl_printer *opencl_setup(__isl_take isl_printer *p,
 	p = isl_printer_end_line(p);
 	p = isl_printer_start_line(p);
 	p = isl_printer_print_str(p, "queue = clCreateCommandQueue"
-					"(context, device, 0, &err);");
+					"(context, device, ");
+	if (info->options->device_timing)
+		p = isl_printer_print_str(p, "CL_QUEUE_PROFILING_ENABLE");
+	else
+		p = isl_printer_print_str(p, "0");
+	p = isl_printer_print_str(p, ", &err);");
 	p = isl_printer_end_line(p);
 	p = isl_printer_start_line(p);
 	p = isl_printer_print_str(p, "openclCheckReturn(err);");
@@ -392,7 +666,11 @@ static __isl_give isl_printer *opencl_setup(__isl_take isl_printer *p,
 	p = isl_printer_start_line(p);
 	p = isl_printer_print_str(p, "program = ");
 
-	if (info->options->opencl_embed_kernel_code) {
+	if (info->options->opencl_offline_compiler) {
+		p = isl_printer_print_str(p, "opencl_build_program_from_il("
+						"context, device, kernel_il, "
+						"sizeof(kernel_il), \"");
+	} else if (info->options->opencl_embed_kernel_code) {
 		p = isl_printer_print_str(p, "opencl_build_program_from_string("
 						"context, device, kernel_code, "
 						"sizeof(kernel_code), \"");
@@ -568,7 +846,8 @@ static __isl_give isl_printer *opencl_print_kernel_arguments(
 
 		if (types)
 			p = gpu_array_info_print_declaration_argument(p,
-				&prog->array[i], "__global");
+				&prog->array[i], kernel->array[i].constant ?
+				"__constant" : "__global");
 		else
 			p = gpu_array_info_print_call_argument(p,
 				&prog->array[i]);
@@ -613,14 +892,39 @@ static __isl_give isl_printer *opencl_print_kernel_arguments(
 	return p;
 }
 
+/* Print a reqd_work_group_size attribute for "kernel".
+ * The work-group dimensions that are not used by the kernel have size 1.
+ */
+static __isl_give isl_printer *print_reqd_work_group_size(
+	__isl_take isl_printer *p, struct ppcg_kernel *kernel)
+{
+	int i;
+
+	p = isl_printer_print_str(p, "__attribute__((reqd_work_group_size(");
+	for (i = 0; i < 3; ++i) {
+		if (i)
+			p = isl_printer_print_str(p, ", ");
+		p = isl_printer_print_int(p,
+			i < kernel->n_block ? kernel->block_dim[i] : 1);
+	}
+	p = isl_printer_print_str(p, "))) ");
+
+	return p;
+}
+
 /* Print the header of the given kernel.
+ * If the launch_bounds option is set, then the kernel is annotated
+ * with its work-group size.
  */
 static __isl_give isl_printer *opencl_print_kernel_header(
 	__isl_take isl_printer *p, struct gpu_prog *prog,
 	struct ppcg_kernel *kernel)
 {
 	p = isl_printer_start_line(p);
-	p = isl_printer_print_str(p, "__kernel void kernel");
+	p = isl_printer_print_str(p, "__kernel ");
+	if (prog->scop->options->launch_bounds)
+		p = print_reqd_work_group_size(p, kernel);
+	p = isl_printer_print_str(p, "void kernel");
 	p = isl_printer_print_int(p, kernel->id);
 	p = isl_printer_print_str(p, "(");
 	p = opencl_print_kernel_arguments(p, prog, kernel, 1);
@@ -695,13 +999,18 @@ static __isl_give isl_printer *opencl_print_kernel_var(
 	p = isl_printer_print_str(p, var->array->type);
 	p = isl_printer_print_str(p, " ");
 	p = isl_printer_print_str(p, var->name);
-	for (j = 0; j < var->array->n_index; ++j) {
+	for (j = 0; j < isl_vec_size(var->size); ++j) {
 		p = isl_printer_print_str(p, "[");
 		v = isl_vec_get_element_val(var->size, j);
 		p = isl_printer_print_val(p, v);
 		p = isl_printer_print_str(p, "]");
 		isl_val_free(v);
 	}
+	if (var->align) {
+		p = isl_printer_print_str(p, " __attribute__((aligned(");
+		p = isl_printer_print_int(p, var->align);
+		p = isl_printer_print_str(p, ")))");
+	}
 	p = isl_printer_print_str(p, ";");
 	p = isl_printer_end_line(p);
 
@@ -794,6 +1103,7 @@ static __isl_give pet_expr *map_opencl_call(__isl_take pet_expr *expr,
  * with a "f" suffix, then it needs to be replaced by a call to
  * the corresponding function without suffix after casting the argument
  * to a float.
+ * Reductions are furthermore printed as atomic updates.
  */
 static __isl_give isl_printer *print_opencl_kernel_domain(
 	__isl_take isl_printer *p, struct ppcg_kernel_stmt *stmt)
@@ -804,7 +1114,10 @@ static __isl_give isl_printer *print_opencl_kernel_domain(
 	ps = stmt->u.d.stmt->stmt;
 	tree = pet_tree_copy(ps->body);
 	ps->body = pet_tree_map_call_expr(ps->body, &map_opencl_call, NULL);
-	p = ppcg_kernel_print_domain(p, stmt);
+	if (stmt->u.d.stmt->reduction)
+		p = ppcg_kernel_print_atomic_domain(p, stmt);
+	else
+		p = ppcg_kernel_print_domain(p, stmt);
 	pet_tree_free(ps->body);
 	ps->body = tree;
 
@@ -830,6 +1143,10 @@ static __isl_give isl_printer *opencl_print_kernel_stmt(
 
 	switch (stmt->type) {
 	case ppcg_kernel_copy:
+		if (stmt->u.c.vector_width > 1)
+			return ppcg_kernel_print_vector_copy(p, stmt,
+				stmt->u.c.local_array->constant ?
+				"__constant" : "__global", "__local");
 		return ppcg_kernel_print_copy(p, stmt);
 	case ppcg_kernel_sync:
 		return opencl_print_sync(p, stmt);
@@ -902,16 +1219,92 @@ static __isl_give isl_printer *set_opencl_macros(__isl_take isl_printer *p)
 	return ppcg_set_macros(p, opencl_min, opencl_max);
 }
 
+/* Return the size in bytes of "array" if all its dimensions
+ * have a fixed size.  Otherwise, return NaN.
+ */
+static __isl_give isl_val *fixed_array_size(isl_ctx *ctx,
+	struct gpu_array_info *array)
+{
+	int i;
+	isl_val *size;
+
+	size = isl_val_int_from_si(ctx, array->size);
+	for (i = 0; i < array->n_index; ++i) {
+		isl_ast_expr *bound;
+
+		bound = isl_ast_expr_get_op_arg(array->bound_expr, 1 + i);
+		if (isl_ast_expr_get_type(bound) == isl_ast_expr_int)
+			size = isl_val_mul(size, isl_ast_expr_get_val(bound));
+		else
+			size = isl_val_set_nan(size);
+		isl_ast_expr_free(bound);
+	}
+
+	return size;
+}
+
+/* If the "read_only_memory" option is set, then mark the arrays
+ * of "kernel" that are only read by the kernel and that have a fixed size
+ * as being placed in constant memory, as long as their total size
+ * does not exceed max_constant_memory.
+ * Read-only scalars are passed by value and are therefore not considered.
+ *
+ * A greedy approach is applied, as in check_shared_memory_bound.
+ */
+static isl_stat mark_constant_arrays(struct ppcg_kernel *kernel)
+{
+	int i;
+	isl_val *left;
+
+	if (!kernel->options->read_only_memory)
+		return isl_stat_ok;
+
+	left = isl_val_int_from_si(kernel->ctx,
+				    kernel->options->max_constant_memory);
+	for (i = 0; i < kernel->n_array; ++i) {
+		struct gpu_local_array_info *local = &kernel->array[i];
+		isl_val *size;
+		int required;
+
+		required = ppcg_kernel_requires_array_argument(kernel, i);
+		if (required < 0)
+			left = isl_val_free(left);
+		if (!left)
+			break;
+		if (!required || !local->read_only ||
+		    gpu_array_is_read_only_scalar(local->array))
+			continue;
+		size = fixed_array_size(kernel->ctx, local->array);
+		if (!isl_val_is_nan(size) && isl_val_le(size, left)) {
+			left = isl_val_sub(left, size);
+			local->constant = 1;
+		} else {
+			isl_val_free(size);
+		}
+	}
+
+	if (!left)
+		return isl_stat_error;
+	isl_val_free(left);
+
+	return isl_stat_ok;
+}
+
 static __isl_give isl_printer *opencl_print_kernel(struct gpu_prog *prog,
 	struct ppcg_kernel *kernel, __isl_take isl_printer *p)
 {
 	isl_ctx *ctx = isl_ast_node_get_ctx(kernel->tree);
 	isl_ast_print_options *print_options;
+	struct ppcg_timer timer;
 
+	ppcg_timer_start(&timer);
 	print_options = isl_ast_print_options_alloc(ctx);
 	print_options = isl_ast_print_options_set_print_user(print_options,
 				&opencl_print_kernel_stmt, NULL);
 
+	if (mark_constant_arrays(kernel) < 0)
+		return isl_printer_free(p);
+
 	p = isl_printer_set_output_format(p, ISL_FORMAT_C);
 	p = opencl_print_kernel_header(p, prog, kernel);
 	p = isl_printer_print_str(p, "{");
@@ -928,6 +1321,8 @@ static __isl_give isl_printer *opencl_print_kernel(struct gpu_prog *prog,
 	p = isl_printer_start_line(p);
 	p = isl_printer_print_str(p, "}");
 	p = isl_printer_end_line(p);
+	ppcg_timer_report(&timer, kernel->options, "kernel printing",
+			"kernel", kernel->id);
 
 	return p;
 }
@@ -1024,12 +1419,228 @@ static __isl_give isl_printer *opencl_print_total_number_of_work_items_as_list(
 	return p;
 }
 
+/* Print code for starting to time an operation, in case
+ * the --device-timing option is set.
+ * The code is placed in a separate block that is closed
+ * by print_timing_end and it declares the event that should
+ * be associated to the operation.
+ */
+static __isl_give isl_printer *print_timing_start(__isl_take isl_printer *p,
+	struct ppcg_options *options)
+{
+	if (!options->device_timing)
+		return p;
+
+	p = ppcg_start_block(p);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "cl_event ppcg_timing_event;");
+	p = isl_printer_end_line(p);
+
+	return p;
+}
+
+/* Print code for waiting until the operation associated to the event
+ * declared by print_timing_start has completed and for recording
+ * its execution time, as measured by the profiling information
+ * of the event, as an operation of kind "kind"
+ * (see gpu_print_timing_add), in case the --device-timing option is set.
+ */
+static __isl_give isl_printer *print_timing_end(__isl_take isl_printer *p,
+	struct ppcg_options *options, const char *kind,
+	struct ppcg_kernel *kernel, struct gpu_array_info *array,
+	__isl_keep isl_ast_expr *lo, __isl_keep isl_ast_expr *hi)
+{
+	int i;
+	const char *query[] = {
+		"cl_ulong ppcg_timing_start, ppcg_timing_stop;",
+		"double ppcg_timing_ms;",
+		"openclCheckReturn(clWaitForEvents(1, &ppcg_timing_event));",
+		"openclCheckReturn(clGetEventProfilingInfo(ppcg_timing_event, "
+		"CL_PROFILING_COMMAND_START, sizeof(cl_ulong), "
+		"&ppcg_timing_start, NULL));",
+		"openclCheckReturn(clGetEventProfilingInfo(ppcg_timing_event, "
+		"CL_PROFILING_COMMAND_END, sizeof(cl_ulong), "
+		"&ppcg_timing_stop, NULL));",
+		"ppcg_timing_ms = "
+		"(ppcg_timing_stop - ppcg_timing_start) * 1e-6;",
+		NULL
+	};
+
+	if (!options->device_timing)
+		return p;
+
+	for (i = 0; query[i]; ++i) {
+		p = isl_printer_start_line(p);
+		p = isl_printer_print_str(p, query[i]);
+		p = isl_printer_end_line(p);
+	}
+	p = gpu_print_timing_add(p, kind, kernel, array, lo, hi,
+				"ppcg_timing_ms");
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "openclCheckReturn("
+					"clReleaseEvent(ppcg_timing_event));");
+	p = isl_printer_end_line(p);
+	p = ppcg_end_block(p);
+
+	return p;
+}
+
+/* Print the event argument of an enqueue operation, i.e.,
+ * a pointer to the event declared by print_timing_start
+ * if the --device-timing option is set and NULL otherwise.
+ */
+static __isl_give isl_printer *print_timing_event(__isl_take isl_printer *p,
+	struct ppcg_options *options)
+{
+	if (options->device_timing)
+		return isl_printer_print_str(p, "&ppcg_timing_event");
+	return isl_printer_print_str(p, "NULL");
+}
+
+/* Print the start of the code for copying "array" from the host
+ * to the device (to_host = 0) or back from the device to the host
+ * (to_host = 1) in case the --opencl-zero-copy option is set.
+ * If the device shares its memory with the host, then the buffer
+ * uses the memory of the host array, so that it suffices to map and
+ * unmap the copied elements to make sure the host and the device
+ * see each other's updates.  Otherwise, the elements are copied
+ * by the code that follows, which is closed by copy_array.
+ */
+static __isl_give isl_printer *map_array(__isl_take isl_printer *p,
+	struct gpu_array_info *array, int to_host, __isl_keep isl_ast_expr *lo,
+	__isl_keep isl_ast_expr *hi)
+{
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "if (ppcg_zero_copy) {");
+	p = isl_printer_end_line(p);
+	p = isl_printer_indent(p, 2);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "void *ppcg_map = clEnqueueMapBuffer("
+					"queue, dev_");
+	p = isl_printer_print_str(p, array->name);
+	if (to_host)
+		p = isl_printer_print_str(p, ", CL_TRUE, CL_MAP_READ, ");
+	else
+		p = isl_printer_print_str(p, ", CL_TRUE, CL_MAP_WRITE, ");
+	p = gpu_array_info_print_slab_offset(p, array, lo);
+	p = isl_printer_print_str(p, ", ");
+	p = gpu_array_info_print_slab_size(p, array, lo, hi);
+	p = isl_printer_print_str(p, ", 0, NULL, NULL, &err);");
+	p = isl_printer_end_line(p);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "openclCheckReturn(err);");
+	p = isl_printer_end_line(p);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "openclCheckReturn("
+				"clEnqueueUnmapMemObject(queue, dev_");
+	p = isl_printer_print_str(p, array->name);
+	p = isl_printer_print_str(p, ", ppcg_map, 0, NULL, NULL));");
+	p = isl_printer_end_line(p);
+	p = isl_printer_indent(p, -2);
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "} else {");
+	p = isl_printer_end_line(p);
+	p = isl_printer_indent(p, 2);
+
+	return p;
+}
+
+/* Print the address of the first element of the host array "array"
+ * with outermost index "lo", or of the entire array if "lo" is NULL.
+ */
+static __isl_give isl_printer *print_host_address(__isl_take isl_printer *p,
+	struct gpu_array_info *array, __isl_keep isl_ast_expr *lo)
+{
+	if (lo)
+		p = isl_printer_print_str(p, "(char *) ");
+	else if (gpu_array_is_scalar(array))
+		p = isl_printer_print_str(p, "&");
+	p = isl_printer_print_str(p, array->name);
+	if (lo) {
+		p = isl_printer_print_str(p, " + ");
+		p = gpu_array_info_print_slab_offset(p, array, lo);
+	}
+
+	return p;
+}
+
+/* Print the address of the element of the staging buffer of "array"
+ * that corresponds to the element of the host array with
+ * outermost index "lo", or to the first element if "lo" is NULL.
+ */
+static __isl_give isl_printer *print_staging_address(
+	__isl_take isl_printer *p, struct gpu_array_info *array,
+	__isl_keep isl_ast_expr *lo)
+{
+	p = isl_printer_print_str(p, "staging_host_");
+	p = isl_printer_print_str(p, array->name);
+	p = isl_printer_print_str(p, " + ");
+	p = gpu_array_info_print_slab_offset(p, array, lo);
+
+	return p;
+}
+
+/* Print a copy between the host array "array" and its staging buffer
+ * for the elements with outermost index between "lo" and "hi",
+ * or for all elements if "lo" and "hi" are NULL.
+ * The copy is from the staging buffer to the host array
+ * if "to_host" is set and in the other direction otherwise.
+ */
+static __isl_give isl_printer *copy_staging(__isl_take isl_printer *p,
+	struct gpu_array_info *array, int to_host, __isl_keep isl_ast_expr *lo,
+	__isl_keep isl_ast_expr *hi)
+{
+	p = isl_printer_start_line(p);
+	p = isl_printer_print_str(p, "memcpy(");
+	if (to_host)
+		p = print_host_address(p, array, lo);
+	else
+		p = print_staging_address(p, array, lo);
+	p = isl_printer_print_str(p, ", ");
+	if (to_host)
+		p = print_staging_address(p, array, lo);
+	else
+		p = print_host_address(p, array, lo);
+	p = isl_printer_print_str(p, ", ");
+	p = gpu_array_info_print_slab_size(p, array, lo, hi);
+	p = isl_printer_print_str(p, ");");
+	p = isl_printer_end_line(p);
+
+	return p;
+}
+
 /* Copy "array" from the host to the device (to_host = 0) or
  * back from the device to the host (to_host = 1).
+ * If "lo" and "hi" are not NULL, then only the elements with
+ * outermost index between "lo" and "hi" are copied.
+ * If the --device-timing option is set, then the copy is timed.
+ * If the --async-transfers option is set, then the copy is enqueued
+ * without waiting for its completion.  Since the command queue
+ * executes the commands in order, the copy is still performed
+ * after any earlier kernel launch and before any later one.
+ * The host waits for all copies back to the host to complete
+ * in clear_device.
+ * If the --opencl-zero-copy option is set, then the copy is only
+ * performed if the buffer does not use the memory of the host array
+ * (see map_array).
+ * If staging buffers are used, then the device array is copied
+ * from or to the staging buffer, which in turn is copied
+ * to or from the host array.  These copies are always blocking
+ * since the staging buffer is accessed by the host
+ * right before a copy to the device or right after a copy
+ * back to the host.
  */
 static __isl_give isl_printer *copy_array(__isl_take isl_printer *p,
-	struct gpu_array_info *array, int to_host)
+	struct gpu_array_info *array, int to_host, __isl_keep isl_ast_expr *lo,
+	__isl_keep isl_ast_expr *hi, struct ppcg_options *options)
 {
+	int staging = use_staging_buffers(options);
+
+	if (options->opencl_zero_copy)
+		p = map_array(p, array, to_host, lo, hi);
+	if (staging && !to_host)
+		p = copy_staging(p, array, 0, lo, hi);
+	p = print_timing_start(p, options);
 	p = isl_printer_start_line(p);
 	p = isl_printer_print_str(p, "openclCheckReturn(");
 	if (to_host)
@@ -1038,16 +1649,28 @@ static __isl_give isl_printer *copy_array(__isl_take isl_printer *p,
 		p = isl_printer_print_str(p, "clEnqueueWriteBuffer");
 	p = isl_printer_print_str(p, "(queue, dev_");
 	p = isl_printer_print_str(p, array->name);
-	p = isl_printer_print_str(p, ", CL_TRUE, 0, ");
-	p = gpu_array_info_print_size(p, array);
-
-	if (gpu_array_is_scalar(array))
-		p = isl_printer_print_str(p, ", &");
+	if (options->async_transfers && !staging)
+		p = isl_printer_print_str(p, ", CL_FALSE, ");
 	else
-		p = isl_printer_print_str(p, ", ");
-	p = isl_printer_print_str(p, array->name);
-	p = isl_printer_print_str(p, ", 0, NULL, NULL));");
+		p = isl_printer_print_str(p, ", CL_TRUE, ");
+	p = gpu_array_info_print_slab_offset(p, array, lo);
+	p = isl_printer_print_str(p, ", ");
+	p = gpu_array_info_print_slab_size(p, array, lo, hi);
+	p = isl_printer_print_str(p, ", ");
+	if (staging)
+		p = print_staging_address(p, array, lo);
+	else
+		p = print_host_address(p, array, lo);
+	p = isl_printer_print_str(p, ", 0, NULL, ");
+	p = print_timing_event(p, options);
+	p = isl_printer_print_str(p, "));");
 	p = isl_printer_end_line(p);
+	p = print_timing_end(p, options, to_host ? "from_device" : "to_device",
+				NULL, array, lo, hi);
+	if (staging && to_host)
+		p = copy_staging(p, array, 1, lo, hi);
+	if (options->opencl_zero_copy)
+		p = ppcg_end_block(p);
 
 	return p;
 }
@@ -1071,10 +1694,19 @@ static __isl_give isl_printer *init_device(__isl_take isl_printer *p,
 
 /* Print code for clearing the device after execution of the transformed code.
  * In particular, free the memory that was allocated on the device.
+ * If the --async-transfers option is set, then first wait
+ * for all enqueued commands, in particular the copies back to the host,
+ * to complete.
  */
 static __isl_give isl_printer *clear_device(__isl_take isl_printer *p,
 	struct gpu_prog *prog, struct opencl_info *opencl)
 {
+	if (opencl->options->async_transfers) {
+		p = isl_printer_start_line(p);
+		p = isl_printer_print_str(p,
+					"openclCheckReturn(clFinish(queue));");
+		p = isl_printer_end_line(p);
+	}
 	p = opencl_release_device_arrays(p, prog);
 	p = opencl_release_cl_objects(p, opencl);
 
@@ -1090,14 +1722,19 @@ static __isl_give isl_printer *clear_device(__isl_take isl_printer *p,
  * The node for initializing the device is called "init_device".
  * The node for clearing the device is called "clear_device".
  *
+ * If only a slab of the array needs to be copied, then the statement
+ * has two arguments, the minimal and maximal outermost index
+ * of the elements that need to be copied.
+ *
  * Extract the array (if any) from the identifier and call
- * init_device, clear_device, copy_array_to_device or copy_array_from_device.
+ * init_device, clear_device or copy_array.
  */
 static __isl_give isl_printer *print_device_node(__isl_take isl_printer *p,
 	__isl_keep isl_ast_node *node, struct gpu_prog *prog,
 	struct opencl_info *opencl)
 {
 	isl_ast_expr *expr, *arg;
+	isl_ast_expr *lo = NULL, *hi = NULL;
 	isl_id *id;
 	const char *name;
 	struct gpu_array_info *array;
@@ -1109,21 +1746,28 @@ static __isl_give isl_printer *print_device_node(__isl_take isl_printer *p,
 	array = isl_id_get_user(id);
 	isl_id_free(id);
 	isl_ast_expr_free(arg);
+	if (isl_ast_expr_get_op_n_arg(expr) == 3) {
+		lo = isl_ast_expr_get_op_arg(expr, 1);
+		hi = isl_ast_expr_get_op_arg(expr, 2);
+	}
 	isl_ast_expr_free(expr);
 
 	if (!name)
-		return isl_printer_free(p);
-	if (!strcmp(name, "init_device"))
-		return init_device(p, prog, opencl);
-	if (!strcmp(name, "clear_device"))
-		return clear_device(p, prog, opencl);
-	if (!array)
-		return isl_printer_free(p);
-
-	if (!prefixcmp(name, "to_device"))
-		return copy_array(p, array, 0);
+		p = isl_printer_free(p);
+	else if (!strcmp(name, "init_device"))
+		p = init_device(p, prog, opencl);
+	else if (!strcmp(name, "clear_device"))
+		p = clear_device(p, prog, opencl);
+	else if (!array)
+		p = isl_printer_free(p);
+	else if (!prefixcmp(name, "to_device"))
+		p = copy_array(p, array, 0, lo, hi, opencl->options);
 	else
-		return copy_array(p, array, 1);
+		p = copy_array(p, array, 1, lo, hi, opencl->options);
+
+	isl_ast_expr_free(lo);
+	isl_ast_expr_free(hi);
+	return p;
 }
 
 /* Print the user statement of the host code to "p".
@@ -1155,6 +1799,10 @@ static __isl_give isl_printer *print_device_node(__isl_take isl_printer *p,
  *
  * For more information check:
  * http://www.khronos.org/registry/cl/sdk/1.0/docs/man/xhtml/clEnqueueNDRangeKernel.html
+ *
+ * Unless the --async-transfers option is set, the host waits
+ * for the kernel to complete.  Otherwise, the in-order command queue
+ * takes care of executing the commands in the order of the host code.
  */
 static __isl_give isl_printer *opencl_print_host_user(
 	__isl_take isl_printer *p,
@@ -1227,6 +1875,7 @@ static __isl_give isl_printer *opencl_print_host_user(
 
 	opencl_set_kernel_arguments(p, data->prog, kernel);
 
+	p = print_timing_start(p, data->opencl->options);
 	p = isl_printer_start_line(p);
 	p = isl_printer_print_str(p, "openclCheckReturn(clEnqueueNDRangeKernel"
 		"(queue, kernel");
@@ -1238,18 +1887,23 @@ static __isl_give isl_printer *opencl_print_host_user(
 		p = isl_printer_print_int(p, 1);
 
 	p = isl_printer_print_str(p, ", NULL, global_work_size, "
-					"block_size, "
-					"0, NULL, NULL));");
+					"block_size, 0, NULL, ");
+	p = print_timing_event(p, data->opencl->options);
+	p = isl_printer_print_str(p, "));");
 	p = isl_printer_end_line(p);
+	p = print_timing_end(p, data->opencl->options, "kernel", kernel,
+				NULL, NULL, NULL);
 	p = isl_printer_start_line(p);
 	p = isl_printer_print_str(p, "openclCheckReturn("
 					"clReleaseKernel(kernel");
 	p = isl_printer_print_int(p, kernel->id);
 	p = isl_printer_print_str(p, "));");
 	p = isl_printer_end_line(p);
-	p = isl_printer_start_line(p);
-	p = isl_printer_print_str(p, "clFinish(queue);");
-	p = isl_printer_end_line(p);
+	if (!data->opencl->options->async_transfers) {
+		p = isl_printer_start_line(p);
+		p = isl_printer_print_str(p, "clFinish(queue);");
+		p = isl_printer_end_line(p);
+	}
 	p = isl_printer_indent(p, -2);
 	p = isl_printer_start_line(p);
 	p = isl_printer_print_str(p, "}");
@@ -1299,6 +1953,8 @@ static __isl_give isl_printer *print_opencl(__isl_take isl_printer *p,
 	if (opencl->options->opencl_print_kernel_types)
 		opencl->kprinter = gpu_print_types(opencl->kprinter, types,
 								prog);
+	opencl->kprinter = gpu_print_atomic_add_macro(opencl->kprinter, prog,
+							"atomic_add");
 
 	if (!opencl->kprinter)
 		return isl_printer_free(p);
@@ -15,6 +15,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 #include <isl/ctx.h>
 #include <isl/id.h>
 #include <isl/val.h>
@@ -35,12 +38,18 @@
 #include "cuda.h"
 #include "opencl.h"
 #include "cpu.h"
+#include "util.h"
 
+/* "input" is the name of the input file.  It is not parsed
+ * as an ISL_ARG_ARG argument since it is not required
+ * in combination with the batch option.
+ */
 struct options {
 	struct pet_options *pet;
 	struct ppcg_options *ppcg;
-	char *input;
+	const char *input;
 	char *output;
+	char *batch;
 };
 
 const char *ppcg_version(void);
@@ -54,12 +63,25 @@ ISL_ARG_CHILD(struct options, pet, "pet", &pet_options_args, "pet options")
 ISL_ARG_CHILD(struct options, ppcg, NULL, &ppcg_options_args, "ppcg options")
 ISL_ARG_STR(struct options, output, 'o', NULL,
 	"filename", NULL, "output filename (c and opencl targets)")
-ISL_ARG_ARG(struct options, input, "input", NULL)
+ISL_ARG_STR(struct options, batch, 0, "batch", "file", NULL,
+	"process each input file, optionally followed by an output filename, "
+	"listed on the lines of <file> in a single invocation")
 ISL_ARG_VERSION(print_version)
 ISL_ARGS_END
 
 ISL_ARG_DEF(options, struct options, options_args)
 
+/* A copy of the command line arguments, used to create isl_ctx objects
+ * with the same options in worker threads.
+ * The argument parser may permute the arguments it is passed,
+ * so this copy is never parsed directly.
+ */
+static int ppcg_argc;
+static char **ppcg_argv;
+/* The input file name taken from ppcg_argv, if any.
+ */
+static const char *ppcg_input;
+
 /* Return a pointer to the final path component of "filename" or
  * to "filename" itself if it does not contain any components.
  */
@@ -113,6 +135,51 @@ int ppcg_scop_any_hidden_declarations(struct ppcg_scop *scop)
 	return 0;
 }
 
+/* Has "stmt" been identified as a reduction in "scop"?
+ * That is, does "scop->reductions" contain any write access
+ * of "stmt"?
+ */
+isl_bool ppcg_scop_is_reduction(struct ppcg_scop *scop, struct pet_stmt *stmt)
+{
+	isl_space *space;
+	isl_union_set *dom;
+	isl_set *set;
+	isl_bool empty;
+
+	if (!scop || !stmt)
+		return isl_bool_error;
+
+	dom = isl_union_map_domain(isl_union_map_copy(scop->reductions));
+	space = isl_set_get_space(stmt->domain);
+	set = isl_union_set_extract_set(dom, space);
+	isl_union_set_free(dom);
+	empty = isl_set_is_empty(set);
+	isl_set_free(set);
+
+	return isl_bool_not(empty);
+}
+
+/* Return the pairs of reduction statement instances in "scop"
+ * that update the same array element.
+ * Since all reductions are performed using the same associative and
+ * commutative operator, the order in which these pairs are executed
+ * does not affect the final result, such that the dependences between
+ * them do not prevent parallel execution, as long as the updates
+ * themselves are performed atomically.
+ */
+__isl_give isl_union_map *ppcg_scop_reduction_dependences(
+	struct ppcg_scop *scop)
+{
+	isl_union_map *write;
+
+	if (!scop)
+		return NULL;
+
+	write = isl_union_map_copy(scop->reductions);
+	return isl_union_map_apply_range(isl_union_map_copy(write),
+					isl_union_map_reverse(write));
+}
+
 /* Collect all variable names that are in use in "scop".
  * In particular, collect all parameters in the context and
  * all the array names.
@@ -432,7 +499,9 @@ static void compute_tagged_flow_dep_only(struct ppcg_scop *ps)
 	isl_union_map *must_source;
 	isl_union_map *kills;
 	isl_union_map *tagged_flow;
+	struct ppcg_timer timer;
 
+	ppcg_timer_start(&timer);
 	tagger = isl_union_pw_multi_aff_copy(ps->tagger);
 	schedule = isl_schedule_copy(ps->schedule);
 	schedule = isl_schedule_pullback_union_pw_multi_aff(schedule, tagger);
@@ -451,6 +520,8 @@ static void compute_tagged_flow_dep_only(struct ppcg_scop *ps)
 	live_in = isl_union_flow_get_may_no_source(flow);
 	ps->live_in = project_out_tags(live_in);
 	isl_union_flow_free(flow);
+	ppcg_timer_report(&timer, ps->options, "compute_tagged_flow_dep",
+			"scop", ps->start);
 }
 
 /* Compute ps->dep_flow from ps->tagged_dep_flow
@@ -524,7 +595,9 @@ static void compute_order_dependences(struct ppcg_scop *ps)
 	isl_schedule *schedule;
 	isl_union_access_info *access;
 	isl_union_flow *flow;
+	struct ppcg_timer timer;
 
+	ppcg_timer_start(&timer);
 	tagger = isl_union_pw_multi_aff_copy(ps->tagger);
 	schedule = isl_schedule_copy(ps->schedule);
 	schedule = isl_schedule_pullback_union_pw_multi_aff(schedule, tagger);
@@ -543,6 +616,8 @@ static void compute_order_dependences(struct ppcg_scop *ps)
 
 	ps->tagged_dep_order = isl_union_map_copy(shared_access);
 	ps->dep_order = isl_union_map_factor_domain(shared_access);
+	ppcg_timer_report(&timer, ps->options, "compute_order_dependences",
+			"scop", ps->start);
 }
 
 /* Compute those validity dependences of the program represented by "scop"
@@ -660,8 +735,11 @@ static void remove_independences_from_tagged_flow(struct ppcg_scop *ps)
 /* Compute the dependences of the program represented by "scop"
  * in case live range reordering is allowed.
  *
- * We compute the actual live ranges and the corresponding order
- * false dependences.
+ * We compute the actual live ranges.
+ * The corresponding order dependences and the forced dependences
+ * are only computed when they are first needed,
+ * by ppcg_scop_get_dep_order, ppcg_scop_get_tagged_dep_order or
+ * ppcg_scop_get_dep_forced.
  *
  * The independences are removed from the flow dependences
  * (provided the source is not a must-write) as well as
@@ -672,8 +750,51 @@ static void compute_live_range_reordering_dependences(struct ppcg_scop *ps)
 	compute_tagged_flow_dep_only(ps);
 	remove_independences_from_tagged_flow(ps);
 	derive_flow_dep_from_tagged_flow_dep(ps);
-	compute_order_dependences(ps);
-	compute_forced_dependences(ps);
+}
+
+/* Return the (untagged) order dependences of "ps",
+ * computing them if they have not been computed yet.
+ * Return NULL if live range reordering is not allowed.
+ *
+ * If the order dependences are computed on demand, then
+ * this happens after dead code elimination.
+ * Only dependences involving dead statement instances are affected,
+ * except that live writes that only have dead readers are then
+ * treated as writes without a corresponding read.
+ */
+__isl_keep isl_union_map *ppcg_scop_get_dep_order(struct ppcg_scop *ps)
+{
+	if (!ps || !ps->options->live_range_reordering)
+		return NULL;
+	if (!ps->dep_order)
+		compute_order_dependences(ps);
+	return ps->dep_order;
+}
+
+/* Return the tagged order dependences of "ps",
+ * computing them if they have not been computed yet.
+ * Return NULL if live range reordering is not allowed.
+ */
+__isl_keep isl_union_map *ppcg_scop_get_tagged_dep_order(
+	struct ppcg_scop *ps)
+{
+	if (!ppcg_scop_get_dep_order(ps))
+		return NULL;
+	return ps->tagged_dep_order;
+}
+
+/* Return the validity constraints of "ps" that should be enforced
+ * even when live-range reordering is used,
+ * computing them if they have not been computed yet.
+ * Return NULL if live range reordering is not allowed.
+ */
+__isl_keep isl_union_map *ppcg_scop_get_dep_forced(struct ppcg_scop *ps)
+{
+	if (!ps || !ps->options->live_range_reordering)
+		return NULL;
+	if (!ps->dep_forced)
+		compute_forced_dependences(ps);
+	return ps->dep_forced;
 }
 
 /* Compute the potential flow dependences and the potential live in
@@ -704,6 +825,254 @@ static void compute_flow_dep(struct ppcg_scop *ps)
 	isl_union_flow_free(flow);
 }
 
+/* The number of relations stored in the dependence cache per scop.
+ */
+#define PPCG_N_CACHED_DEPS	5
+
+/* Return pointers to the fields of "ps" that are computed
+ * by compute_dependences in "fields", in the order in which
+ * they are stored in the dependence cache.
+ * The order dependences and the forced dependences are not included
+ * since they are computed on demand, after dead code elimination.
+ */
+static void dependence_fields(struct ppcg_scop *ps,
+	isl_union_map **fields[PPCG_N_CACHED_DEPS])
+{
+	fields[0] = &ps->live_out;
+	fields[1] = &ps->live_in;
+	fields[2] = &ps->dep_flow;
+	fields[3] = &ps->tagged_dep_flow;
+	fields[4] = &ps->dep_false;
+}
+
+/* Print "umap" on a separate line of "p" or "-" if it is NULL.
+ */
+static __isl_give isl_printer *print_cache_line(__isl_take isl_printer *p,
+	__isl_keep isl_union_map *umap)
+{
+	if (umap)
+		p = isl_printer_print_union_map(p, umap);
+	else
+		p = isl_printer_print_str(p, "-");
+	p = isl_printer_end_line(p);
+
+	return p;
+}
+
+/* Return a description of the input of compute_dependences on "ps" that
+ * is used as the key in the dependence cache.
+ * The description consists of the options that affect
+ * the dependence analysis, the access relations, the independences and
+ * the schedule.
+ */
+static char *dependence_cache_key(struct ppcg_scop *ps)
+{
+	isl_printer *p;
+	char *key;
+
+	p = isl_printer_to_str(isl_set_get_ctx(ps->context));
+	p = isl_printer_print_str(p, "live_range_reordering: ");
+	p = isl_printer_print_int(p, ps->options->live_range_reordering);
+	p = isl_printer_end_line(p);
+	p = isl_printer_print_str(p, "tagged: ");
+	p = isl_printer_print_int(p, ps->options->target != PPCG_TARGET_C);
+	p = isl_printer_end_line(p);
+	p = print_cache_line(p, ps->tagged_reads);
+	p = print_cache_line(p, ps->tagged_may_writes);
+	p = print_cache_line(p, ps->tagged_must_writes);
+	p = print_cache_line(p, ps->tagged_must_kills);
+	p = print_cache_line(p, ps->independence);
+	p = isl_printer_print_schedule(p, ps->schedule);
+	key = isl_printer_get_str(p);
+	isl_printer_free(p);
+
+	return key;
+}
+
+/* Collect the identifiers of the parameters, statements and arrays
+ * of "ps".
+ */
+static __isl_give isl_id_list *collect_ids(struct ppcg_scop *ps)
+{
+	int i, n;
+	isl_ctx *ctx = isl_set_get_ctx(ps->context);
+	isl_id_list *ids;
+
+	n = isl_set_dim(ps->context, isl_dim_param);
+	ids = isl_id_list_alloc(ctx, n + ps->pet->n_stmt + ps->pet->n_array);
+	for (i = 0; i < n; ++i)
+		ids = isl_id_list_add(ids,
+			isl_set_get_dim_id(ps->context, isl_dim_param, i));
+	for (i = 0; i < ps->pet->n_stmt; ++i)
+		ids = isl_id_list_add(ids,
+			isl_set_get_tuple_id(ps->pet->stmts[i]->domain));
+	for (i = 0; i < ps->pet->n_array; ++i)
+		ids = isl_id_list_add(ids,
+			isl_set_get_tuple_id(ps->pet->arrays[i]->extent));
+
+	return ids;
+}
+
+/* Is "umap" a subset of "universe"?
+ */
+static int cached_is_subset(__isl_keep isl_union_map *umap,
+	__isl_take isl_union_map *universe)
+{
+	isl_bool subset;
+
+	subset = isl_union_map_is_subset(umap, universe);
+	isl_union_map_free(universe);
+
+	return subset == isl_bool_true;
+}
+
+/* Check that the relations read from the dependence cache
+ * into "fields" live in the spaces of "ps".
+ * That is, check that the live-in and live-out accesses are subsets
+ * of the accesses of "ps" and that the (tagged) dependences
+ * relate (tagged) statement instances of "ps".
+ * This ensures that any mismatch in identifiers is detected.
+ */
+static int cached_dependences_match(struct ppcg_scop *ps,
+	isl_union_map *fields[PPCG_N_CACHED_DEPS])
+{
+	int i;
+	isl_union_set *dom, *tagged;
+	isl_union_map *all, *tagged_all;
+	int match = 1;
+
+	all = isl_union_map_union(isl_union_map_copy(ps->reads),
+				isl_union_map_copy(ps->may_writes));
+	all = isl_union_map_union(all, isl_union_map_copy(ps->must_kills));
+	dom = isl_union_map_domain(all);
+	all = isl_union_map_from_domain_and_range(isl_union_set_copy(dom),
+						dom);
+	tagged_all = isl_union_map_union(isl_union_map_copy(ps->tagged_reads),
+				isl_union_map_copy(ps->tagged_may_writes));
+	tagged_all = isl_union_map_union(tagged_all,
+				isl_union_map_copy(ps->tagged_must_kills));
+	tagged = isl_union_map_domain(tagged_all);
+	tagged_all = isl_union_map_from_domain_and_range(
+				isl_union_set_copy(tagged), tagged);
+
+	if (fields[0] && !cached_is_subset(fields[0],
+				isl_union_map_copy(ps->may_writes)))
+		match = 0;
+	if (fields[1] && !cached_is_subset(fields[1],
+				isl_union_map_copy(ps->reads)))
+		match = 0;
+	for (i = 2; i < PPCG_N_CACHED_DEPS; ++i) {
+		isl_union_map *universe;
+
+		if (!fields[i])
+			continue;
+		if (i == 3)
+			universe = isl_union_map_copy(tagged_all);
+		else
+			universe = isl_union_map_copy(all);
+		if (!cached_is_subset(fields[i], universe))
+			match = 0;
+	}
+
+	isl_union_map_free(tagged_all);
+	isl_union_map_free(all);
+
+	return match;
+}
+
+/* Try and read the dependences of "ps" for the input described by "key"
+ * from the dependence cache.
+ * Return 1 if they were found and 0 otherwise.
+ *
+ * The ".key" file contains the description of the input, in order
+ * to detect hash collisions, and the ".deps" file contains
+ * one line for each of the relations returned by dependence_fields,
+ * with "-" representing a relation that was not computed.
+ */
+static int load_dependences(struct ppcg_scop *ps, const char *key)
+{
+	const char *dir = ps->options->dependence_cache_dir;
+	isl_ctx *ctx = isl_set_get_ctx(ps->context);
+	isl_union_map **fields[PPCG_N_CACHED_DEPS];
+	isl_union_map *read[PPCG_N_CACHED_DEPS] = { NULL };
+	char *key_file, *deps_file, *contents = NULL, *line;
+	isl_id_list *ids;
+	int i, found = 0;
+
+	key_file = ppcg_cache_file_name(dir, key, ".key");
+	deps_file = ppcg_cache_file_name(dir, key, ".deps");
+	if (key_file && deps_file && ppcg_file_has_contents(key_file, key))
+		contents = ppcg_read_file(deps_file);
+	free(deps_file);
+	free(key_file);
+	if (!contents)
+		return 0;
+
+	ids = collect_ids(ps);
+	line = contents;
+	for (i = 0; i < PPCG_N_CACHED_DEPS; ++i) {
+		char *end = strchr(line, '\n');
+
+		if (!end)
+			break;
+		*end = '\0';
+		if (strcmp(line, "-")) {
+			read[i] = isl_union_map_read_from_str(ctx, line);
+			read[i] = ppcg_union_map_restore_ids(read[i], ids);
+			if (!read[i])
+				break;
+		}
+		line = end + 1;
+	}
+	isl_id_list_free(ids);
+	free(contents);
+
+	if (i == PPCG_N_CACHED_DEPS && cached_dependences_match(ps, read))
+		found = 1;
+
+	dependence_fields(ps, fields);
+	for (i = 0; i < PPCG_N_CACHED_DEPS; ++i) {
+		if (found)
+			*fields[i] = read[i];
+		else
+			isl_union_map_free(read[i]);
+	}
+
+	return found;
+}
+
+/* Store the dependences of "ps" for the input described by "key"
+ * in the dependence cache, in the format expected by load_dependences.
+ * The dependences are written before the key such that the presence
+ * of the key implies that of the dependences.
+ * Failures are ignored since they only mean that the dependences
+ * will have to be computed again next time.
+ */
+static void store_dependences(struct ppcg_scop *ps, const char *key)
+{
+	const char *dir = ps->options->dependence_cache_dir;
+	isl_union_map **fields[PPCG_N_CACHED_DEPS];
+	char *key_file, *deps_file, *contents;
+	isl_printer *p;
+	int i;
+
+	dependence_fields(ps, fields);
+	p = isl_printer_to_str(isl_set_get_ctx(ps->context));
+	for (i = 0; i < PPCG_N_CACHED_DEPS; ++i)
+		p = print_cache_line(p, *fields[i]);
+	contents = isl_printer_get_str(p);
+	isl_printer_free(p);
+
+	key_file = ppcg_cache_file_name(dir, key, ".key");
+	deps_file = ppcg_cache_file_name(dir, key, ".deps");
+	if (contents && key_file && deps_file &&
+	    ppcg_write_file(deps_file, contents) == 0)
+		ppcg_write_file(key_file, key);
+	free(deps_file);
+	free(key_file);
+	free(contents);
+}
+
 /* Compute the dependences of the program represented by "scop".
  * Store the computed potential flow dependences
  * in scop->dep_flow and the reads with potentially no corresponding writes in
@@ -711,19 +1080,17 @@ static void compute_flow_dep(struct ppcg_scop *ps)
  * Store the potential live out accesses in scop->live_out.
  * Store the potential false (anti and output) dependences in scop->dep_false.
  *
- * If live range reordering is allowed, then we compute a separate
- * set of order dependences and a set of external false dependences
- * in compute_live_range_reordering_dependences.
+ * If live range reordering is allowed, then we compute the tagged
+ * flow dependences in compute_live_range_reordering_dependences.
+ * The separate set of order dependences and the set of
+ * external false dependences are computed on demand.
  */
-static void compute_dependences(struct ppcg_scop *scop)
+static void compute_dependences_uncached(struct ppcg_scop *scop)
 {
 	isl_union_map *may_source;
 	isl_union_access_info *access;
 	isl_union_flow *flow;
 
-	if (!scop)
-		return;
-
 	compute_live_out(scop);
 
 	if (scop->options->live_range_reordering)
@@ -749,6 +1116,50 @@ static void compute_dependences(struct ppcg_scop *scop)
 	isl_union_flow_free(flow);
 }
 
+/* Compute the dependences of the program represented by "scop"
+ * as in compute_dependences_uncached and report the time spent.
+ *
+ * If a dependence cache directory has been specified, then
+ * first try and read the dependences from the cache and
+ * only compute them if they cannot be found.
+ * Newly computed dependences are added to the cache.
+ * The dependences that are computed on demand are not cached
+ * such that they are computed at the same point,
+ * after dead code elimination, whether or not the cache is used.
+ */
+static void compute_dependences(struct ppcg_scop *scop)
+{
+	struct ppcg_timer timer;
+	char *key;
+
+	if (!scop)
+		return;
+
+	ppcg_timer_start(&timer);
+	if (!scop->options->dependence_cache_dir) {
+		compute_dependences_uncached(scop);
+		ppcg_timer_report(&timer, scop->options, "compute_dependences",
+				"scop", scop->start);
+		return;
+	}
+
+	key = dependence_cache_key(scop);
+	if (key && load_dependences(scop, key)) {
+		if (scop->options->debug->verbose)
+			fprintf(stdout, "Using cached dependences\n");
+		free(key);
+		ppcg_timer_report(&timer, scop->options, "compute_dependences",
+				"scop", scop->start);
+		return;
+	}
+	compute_dependences_uncached(scop);
+	if (key)
+		store_dependences(scop, key);
+	free(key);
+	ppcg_timer_report(&timer, scop->options, "compute_dependences",
+			"scop", scop->start);
+}
+
 /* Eliminate dead code from ps->domain.
  *
  * In particular, intersect both ps->domain and the domain of
@@ -834,6 +1245,179 @@ static __isl_give isl_set *set_intersect_str(__isl_take isl_set *set,
 	return set;
 }
 
+/* Is "type" an element type for which the target specified
+ * by "options" supports atomic additions?
+ * The C target uses OpenMP reduction clauses or atomic directives,
+ * which support all arithmetic types.
+ * CUDA provides atomicAdd for int, unsigned int, unsigned long long,
+ * float and double, while OpenCL only provides atomic_add
+ * for 32-bit integers.
+ */
+static int is_supported_reduction_type(const char *type,
+	struct ppcg_options *options)
+{
+	static const char *cuda_types[] = { "int", "unsigned int",
+		"unsigned", "unsigned long long", "float", "double" };
+	static const char *opencl_types[] = { "int", "unsigned int",
+		"unsigned" };
+	const char **types;
+	int i, n;
+
+	if (options->target == PPCG_TARGET_C)
+		return 1;
+	if (options->target == PPCG_TARGET_CUDA) {
+		types = cuda_types;
+		n = sizeof(cuda_types) / sizeof(cuda_types[0]);
+	} else {
+		types = opencl_types;
+		n = sizeof(opencl_types) / sizeof(opencl_types[0]);
+	}
+	for (i = 0; i < n; ++i)
+		if (!strcmp(type, types[i]))
+			return 1;
+
+	return 0;
+}
+
+/* Is the access expression "expr" an access to
+ * the array identified by "user"?
+ * Return -1 if it is, in order to abort the search.
+ */
+static int is_access_to(__isl_keep pet_expr *expr, void *user)
+{
+	isl_id *id = user;
+	isl_id *expr_id;
+	int is_equal;
+
+	expr_id = pet_expr_access_get_id(expr);
+	is_equal = expr_id == id;
+	isl_id_free(expr_id);
+
+	return is_equal ? -1 : 0;
+}
+
+/* Return the pet_array in "scop" with identifier "id" or
+ * NULL if there is no such array.
+ */
+static struct pet_array *find_array(struct pet_scop *scop,
+	__isl_keep isl_id *id)
+{
+	int i;
+
+	for (i = 0; i < scop->n_array; ++i) {
+		isl_id *array_id;
+
+		array_id = isl_set_get_tuple_id(scop->arrays[i]->extent);
+		isl_id_free(array_id);
+		if (array_id == id)
+			return scop->arrays[i];
+	}
+
+	return NULL;
+}
+
+/* If "stmt" is a reduction, then return the write access relation
+ * of its reduction target.  Otherwise, return an empty relation
+ * in the space "space".
+ *
+ * A statement is considered to be a reduction if its body
+ * is of the form
+ *
+ *	A[f] += e
+ *
+ * where "A[f]" is a plain array (or scalar) access, i.e., not
+ * a member access, of a basic type that is supported by the target and
+ * where neither "e" nor any data dependent index in "f" accesses "A".
+ * Statements with data dependent arguments are not considered.
+ * Since all reductions use the same operator, any pair of reduction
+ * instances updating the same element may be executed in any order.
+ */
+static __isl_give isl_union_map *extract_reduction(struct ppcg_scop *ps,
+	struct pet_stmt *stmt, __isl_take isl_space *space)
+{
+	pet_expr *expr, *lhs, *rhs;
+	struct pet_array *array;
+	isl_multi_pw_aff *index;
+	isl_union_map *write;
+	isl_id *id;
+	int i, wrapping, accesses;
+
+	if (stmt->n_arg > 0 || pet_tree_get_type(stmt->body) != pet_tree_expr)
+		return isl_union_map_empty(space);
+	expr = pet_tree_expr_get_expr(stmt->body);
+	if (pet_expr_get_type(expr) != pet_expr_op ||
+	    pet_expr_op_get_type(expr) != pet_op_add_assign) {
+		pet_expr_free(expr);
+		return isl_union_map_empty(space);
+	}
+	lhs = pet_expr_get_arg(expr, 0);
+	rhs = pet_expr_get_arg(expr, 1);
+	pet_expr_free(expr);
+	if (pet_expr_get_type(lhs) != pet_expr_access) {
+		pet_expr_free(lhs);
+		pet_expr_free(rhs);
+		return isl_union_map_empty(space);
+	}
+
+	index = pet_expr_access_get_index(lhs);
+	wrapping = isl_multi_pw_aff_range_is_wrapping(index);
+	isl_multi_pw_aff_free(index);
+	id = pet_expr_access_get_id(lhs);
+	array = find_array(ps->pet, id);
+	accesses = pet_expr_foreach_access_expr(rhs, &is_access_to, id) < 0;
+	for (i = 0; !accesses && i < pet_expr_get_n_arg(lhs); ++i) {
+		pet_expr *arg = pet_expr_get_arg(lhs, i);
+		accesses = pet_expr_foreach_access_expr(arg,
+						&is_access_to, id) < 0;
+		pet_expr_free(arg);
+	}
+	isl_id_free(id);
+	pet_expr_free(rhs);
+
+	if (wrapping || accesses || !array || array->element_is_record ||
+	    !is_supported_reduction_type(array->element_type, ps->options)) {
+		pet_expr_free(lhs);
+		return isl_union_map_empty(space);
+	}
+
+	isl_space_free(space);
+	write = pet_expr_access_get_may_write(lhs);
+	pet_expr_free(lhs);
+	write = isl_union_map_intersect_domain(write,
+			isl_union_set_from_set(isl_set_copy(stmt->domain)));
+
+	return write;
+}
+
+/* Collect the write accesses of all reduction statements in "ps"
+ * and store them in ps->reductions.
+ * Reductions are only detected if the reductions option is set.
+ */
+static void compute_reductions(struct ppcg_scop *ps)
+{
+	int i;
+	isl_space *space;
+
+	space = isl_set_get_space(ps->context);
+	ps->reductions = isl_union_map_empty(isl_space_copy(space));
+	if (!ps->options->reductions) {
+		isl_space_free(space);
+		return;
+	}
+
+	for (i = 0; i < ps->pet->n_stmt; ++i) {
+		struct pet_stmt *stmt = ps->pet->stmts[i];
+		isl_union_map *write;
+
+		if (pet_stmt_is_kill(stmt))
+			continue;
+		write = extract_reduction(ps, stmt, isl_space_copy(space));
+		ps->reductions = isl_union_map_union(ps->reductions, write);
+	}
+
+	isl_space_free(space);
+}
+
 static void *ppcg_scop_free(struct ppcg_scop *ps)
 {
 	if (!ps)
@@ -861,6 +1445,7 @@ static void *ppcg_scop_free(struct ppcg_scop *ps)
 	isl_schedule_free(ps->schedule);
 	isl_union_pw_multi_aff_free(ps->tagger);
 	isl_union_map_free(ps->independence);
+	isl_union_map_free(ps->reductions);
 	isl_id_to_ast_expr_free(ps->names);
 
 	free(ps);
@@ -916,6 +1501,7 @@ static struct ppcg_scop *ppcg_scop_from_pet_scop(struct pet_scop *scop,
 	for (i = 0; i < scop->n_independence; ++i)
 		ps->independence = isl_union_map_union(ps->independence,
 			isl_union_map_copy(scop->independences[i]->filter));
+	compute_reductions(ps);
 
 	compute_tagger(ps);
 	compute_dependences(ps);
@@ -923,19 +1509,24 @@ static struct ppcg_scop *ppcg_scop_from_pet_scop(struct pet_scop *scop,
 
 	if (!ps->context || !ps->domain || !ps->call || !ps->reads ||
 	    !ps->may_writes || !ps->must_writes || !ps->tagged_must_kills ||
-	    !ps->must_kills || !ps->schedule || !ps->independence || !ps->names)
+	    !ps->must_kills || !ps->schedule || !ps->independence ||
+	    !ps->reductions || !ps->names)
 		return ppcg_scop_free(ps);
 
 	return ps;
 }
 
 /* Internal data structure for ppcg_transform.
+ *
+ * "timer" measures the time spent by pet since the start of the parsing
+ * or since the end of the previous callback.
  */
 struct ppcg_transform_data {
 	struct ppcg_options *options;
 	__isl_give isl_printer *(*transform)(__isl_take isl_printer *p,
 		struct ppcg_scop *scop, void *user);
 	void *user;
+	struct ppcg_timer timer;
 };
 
 /* Should we print the original code?
@@ -976,9 +1567,13 @@ static __isl_give isl_printer *transform(__isl_take isl_printer *p,
 	struct ppcg_transform_data *data = user;
 	struct ppcg_scop *ps;
 
+	ppcg_timer_report(&data->timer, data->options, "pet extraction",
+			"scop", pet_loc_get_start(scop->loc));
+
 	if (print_original(scop, data->options)) {
 		p = pet_scop_print_original(scop, p);
 		pet_scop_free(scop);
+		ppcg_timer_start(&data->timer);
 		return p;
 	}
 
@@ -990,6 +1585,7 @@ static __isl_give isl_printer *transform(__isl_take isl_printer *p,
 	ppcg_scop_free(ps);
 	pet_scop_free(scop);
 
+	ppcg_timer_start(&data->timer);
 	return p;
 }
 
@@ -1006,9 +1602,398 @@ int ppcg_transform(isl_ctx *ctx, const char *input, FILE *out,
 		struct ppcg_scop *scop, void *user), void *user)
 {
 	struct ppcg_transform_data data = { options, fn, user };
+
+	ppcg_timer_start(&data.timer);
 	return pet_transform_C_source(ctx, input, out, &transform, &data);
 }
 
+/* Is "arg" the option "name", either with an attached value or
+ * without a value, meaning that the value is the next argument?
+ * In the latter case, set *next.
+ * "name" is either a short option of the form "-o" or
+ * a long option of the form "--output".
+ */
+static int is_option(const char *arg, const char *name, int *next)
+{
+	size_t len = strlen(name);
+
+	if (strncmp(arg, name, len))
+		return 0;
+	if (!arg[len]) {
+		*next = 1;
+		return 1;
+	}
+	if (name[1] != '-')
+		return 1;
+	return arg[len] == '=';
+}
+
+/* Print the command line options of ppcg that affect the generated code
+ * to "p" on a single line, followed by the version of ppcg on another line.
+ * The name of the executable, the input file and the options
+ * that specify input or output file names are skipped since
+ * they do not affect the generated code.
+ */
+__isl_give isl_printer *ppcg_print_options_key(__isl_take isl_printer *p)
+{
+	int i;
+	int first = 1;
+
+	for (i = 1; i < ppcg_argc; ++i) {
+		int next = 0;
+
+		if (ppcg_argv[i] == ppcg_input)
+			continue;
+		if (is_option(ppcg_argv[i], "-o", &next) ||
+		    is_option(ppcg_argv[i], "--output", &next) ||
+		    is_option(ppcg_argv[i], "--batch", &next)) {
+			i += next;
+			continue;
+		}
+		if (!first)
+			p = isl_printer_print_str(p, " ");
+		p = isl_printer_print_str(p, ppcg_argv[i]);
+		first = 0;
+	}
+	p = isl_printer_end_line(p);
+	p = isl_printer_print_str(p, ppcg_version());
+	p = isl_printer_end_line(p);
+
+	return p;
+}
+
+/* Extract the name of the input file from the command line arguments
+ * "argc" and "argv" that remain after parsing the options and
+ * store it in options->input.
+ * An input file is required, unless the batch option is set.
+ * Return -1 on error.
+ */
+static int extract_input(struct options *options, int argc, char **argv)
+{
+	int i;
+
+	for (i = 1; i < argc; ++i) {
+		if (argv[i][0] != '-' || !argv[i][1])
+			continue;
+		fprintf(stderr, "%s: unrecognized option: %s\n",
+			argv[0], argv[i]);
+		return -1;
+	}
+	if (argc > 2) {
+		fprintf(stderr, "%s: extra argument: %s\n", argv[0], argv[2]);
+		return -1;
+	}
+	if (argc < 2 && !options->batch) {
+		fprintf(stderr, "%s: expecting 1 more argument\n", argv[0]);
+		return -1;
+	}
+	options->input = argc == 2 ? argv[1] : NULL;
+
+	return 0;
+}
+
+/* Allocate an isl_ctx with the options specified by
+ * the command line arguments "argc" and "argv" and
+ * return the corresponding options in *options_p.
+ * Return NULL if the arguments could not be parsed.
+ *
+ * The arguments that are not options are left in "argv"
+ * by options_parse and are handled by extract_input.
+ */
+static isl_ctx *alloc_ctx(int argc, char **argv, struct options **options_p)
+{
+	isl_ctx *ctx;
+	struct options *options;
+
+	options = options_new_with_defaults();
+	assert(options);
+
+	ctx = isl_ctx_alloc_with_options(&options_args, options);
+	ppcg_options_set_target_defaults(options->ppcg);
+	isl_options_set_ast_build_detect_min_max(ctx, 1);
+	isl_options_set_ast_print_macro_once(ctx, 1);
+	isl_options_set_schedule_whole_component(ctx, 0);
+	isl_options_set_schedule_maximize_band_depth(ctx, 1);
+	isl_options_set_schedule_maximize_coincidence(ctx, 1);
+	pet_options_set_encapsulate_dynamic_control(ctx, 1);
+	argc = options_parse(options, argc, argv, 0);
+	if (argc >= 0)
+		argc = extract_input(options, argc, argv);
+
+	*options_p = options;
+	if (argc < 0) {
+		isl_ctx_free(ctx);
+		return NULL;
+	}
+	return ctx;
+}
+
+#ifdef HAVE_PTHREAD_H
+
+/* Data shared by the threads of ppcg_transform_parallel.
+ *
+ * "input" is the name of the input file.
+ * "options", "fn" and "user" are the arguments of
+ * ppcg_transform_parallel and "copy_user" and "free_user"
+ * create and free a copy of "user" for use by a single thread.
+ * "n" is the number of scops in "input".
+ * "claimed" keeps track of the scops that have been claimed by a thread.
+ * "code" contains the code generated for each scop.
+ * "lock" protects "claimed" and "error".
+ * "error" is set if an error occurred in any of the threads.
+ */
+struct ppcg_parallel_data {
+	const char *input;
+	struct ppcg_options *options;
+	__isl_give isl_printer *(*fn)(__isl_take isl_printer *p,
+		struct ppcg_scop *scop, void *user);
+	void *(*copy_user)(void *user);
+	void (*free_user)(void *user);
+	void *user;
+
+	int n;
+	int *claimed;
+	char **code;
+	pthread_mutex_t lock;
+	int error;
+};
+
+/* Data private to a thread of ppcg_transform_parallel.
+ *
+ * "shared" is the data shared by all threads.
+ * "next" is the sequence number of the next scop encountered
+ * by the thread.
+ * "transform" is the argument of the transform callback.
+ */
+struct ppcg_parallel_worker {
+	struct ppcg_parallel_data *shared;
+	int next;
+	struct ppcg_transform_data transform;
+};
+
+/* Callback for pet_transform_C_source that counts the number of scops
+ * in *user.
+ */
+static __isl_give isl_printer *count_scop(__isl_take isl_printer *p,
+	struct pet_scop *scop, void *user)
+{
+	int *n = user;
+
+	(*n)++;
+	pet_scop_free(scop);
+
+	return p;
+}
+
+/* Callback for pet_transform_C_source in a worker thread.
+ *
+ * If the scop has not been claimed by any other thread yet,
+ * then claim it, transform it and store the generated code.
+ * The generated code is printed to a string rather than to "p"
+ * since only the final pass of ppcg_transform_parallel writes
+ * to the output file.
+ */
+static __isl_give isl_printer *transform_claimed(__isl_take isl_printer *p,
+	struct pet_scop *scop, void *user)
+{
+	struct ppcg_parallel_worker *worker = user;
+	struct ppcg_parallel_data *data = worker->shared;
+	isl_printer *p_scop;
+	int i, claim;
+
+	i = worker->next++;
+	pthread_mutex_lock(&data->lock);
+	claim = i < data->n && !data->claimed[i] && !data->error;
+	if (claim)
+		data->claimed[i] = 1;
+	pthread_mutex_unlock(&data->lock);
+
+	if (!claim) {
+		pet_scop_free(scop);
+		return p;
+	}
+
+	p_scop = isl_printer_to_str(isl_printer_get_ctx(p));
+	p_scop = isl_printer_set_output_format(p_scop, ISL_FORMAT_C);
+	p_scop = transform(p_scop, scop, &worker->transform);
+	data->code[i] = isl_printer_get_str(p_scop);
+	isl_printer_free(p_scop);
+
+	if (!data->code[i]) {
+		pthread_mutex_lock(&data->lock);
+		data->error = 1;
+		pthread_mutex_unlock(&data->lock);
+	}
+
+	return p;
+}
+
+/* Main function of a worker thread of ppcg_transform_parallel.
+ *
+ * The thread parses the input file in its own isl_ctx and
+ * transforms the scops that have not been claimed by other threads
+ * using its own copy of the user data.
+ * Any code outside the scops is written to a temporary file
+ * that is discarded.
+ */
+static void *parallel_worker(void *arg)
+{
+	struct ppcg_parallel_data *data = arg;
+	struct ppcg_parallel_worker worker;
+	struct options *options;
+	isl_ctx *ctx = NULL;
+	char **argv;
+	FILE *out;
+	int r = -1;
+
+	argv = malloc(ppcg_argc * sizeof(char *));
+	if (argv) {
+		memcpy(argv, ppcg_argv, ppcg_argc * sizeof(char *));
+		ctx = alloc_ctx(ppcg_argc, argv, &options);
+	}
+	worker.shared = data;
+	worker.next = 0;
+	worker.transform.options = data->options;
+	worker.transform.transform = data->fn;
+	worker.transform.user = data->copy_user(data->user);
+	out = tmpfile();
+	ppcg_timer_start(&worker.transform.timer);
+	if (ctx && out && worker.transform.user)
+		r = pet_transform_C_source(ctx, data->input, out,
+					&transform_claimed, &worker);
+	if (out)
+		fclose(out);
+	if (worker.transform.user)
+		data->free_user(worker.transform.user);
+	isl_ctx_free(ctx);
+	free(argv);
+
+	if (r < 0) {
+		pthread_mutex_lock(&data->lock);
+		data->error = 1;
+		pthread_mutex_unlock(&data->lock);
+	}
+
+	return NULL;
+}
+
+/* Callback for pet_transform_C_source in the final pass
+ * of ppcg_transform_parallel that prints the code generated
+ * for the scop by one of the worker threads.
+ */
+static __isl_give isl_printer *print_generated(__isl_take isl_printer *p,
+	struct pet_scop *scop, void *user)
+{
+	struct ppcg_parallel_worker *worker = user;
+	struct ppcg_parallel_data *data = worker->shared;
+	int i;
+
+	i = worker->next++;
+	pet_scop_free(scop);
+	if (i >= data->n || !data->code[i])
+		return isl_printer_free(p);
+
+	return isl_printer_print_str(p, data->code[i]);
+}
+
+/* Transform the C source file "input" by rewriting each scop
+ * through a call to "fn", using options->threads threads,
+ * and write the transformed C code to "out".
+ *
+ * The scops are first counted.  Each thread then parses "input"
+ * in its own isl_ctx and transforms the scops that are not being
+ * transformed by any other thread yet, using its own copy of "user",
+ * obtained through "copy_user" and freed through "free_user".
+ * Since the threads claim scops as they encounter them,
+ * a thread that finishes a scop early picks up the next unclaimed one.
+ * Finally, the original file is copied to "out" with each scop
+ * replaced by the code generated for it, in the original order.
+ * If there is at most one scop, then it is transformed directly.
+ */
+static int transform_parallel(isl_ctx *ctx, const char *input, FILE *out,
+	struct ppcg_options *options,
+	__isl_give isl_printer *(*fn)(__isl_take isl_printer *p,
+		struct ppcg_scop *scop, void *user),
+	void *(*copy_user)(void *user), void (*free_user)(void *user),
+	void *user)
+{
+	struct ppcg_parallel_data data = { input, options, fn,
+					    copy_user, free_user, user };
+	struct ppcg_parallel_worker final;
+	pthread_t *threads;
+	FILE *tmp;
+	int i, n_thread, r;
+
+	data.n = 0;
+	tmp = tmpfile();
+	if (!tmp)
+		return -1;
+	r = pet_transform_C_source(ctx, input, tmp, &count_scop, &data.n);
+	fclose(tmp);
+	if (r < 0)
+		return -1;
+	if (data.n <= 1)
+		return ppcg_transform(ctx, input, out, options, fn, user);
+
+	n_thread = options->threads < data.n ? options->threads : data.n;
+	data.claimed = isl_calloc_array(ctx, int, data.n);
+	data.code = isl_calloc_array(ctx, char *, data.n);
+	threads = isl_calloc_array(ctx, pthread_t, n_thread);
+	data.error = 0;
+	if (data.n && (!data.claimed || !data.code || !threads))
+		data.error = 1;
+	pthread_mutex_init(&data.lock, NULL);
+	for (i = 0; !data.error && i < n_thread; ++i)
+		if (pthread_create(&threads[i], NULL, &parallel_worker, &data))
+			break;
+	n_thread = i;
+	for (i = 0; i < n_thread; ++i)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&data.lock);
+
+	r = -1;
+	if (!data.error && n_thread > 0) {
+		final.shared = &data;
+		final.next = 0;
+		r = pet_transform_C_source(ctx, input, out, &print_generated,
+					    &final);
+	}
+
+	for (i = 0; i < data.n && data.code; ++i)
+		free(data.code[i]);
+	free(data.code);
+	free(data.claimed);
+	free(threads);
+
+	return r;
+}
+
+#endif
+
+/* Transform the C source file "input" in the same way as ppcg_transform,
+ * but transform the scops in parallel if the threads option
+ * is greater than one.
+ * Each thread uses a copy of "user" created by "copy_user" and
+ * freed by "free_user".
+ *
+ * The transformation is performed serially if ppcg was built
+ * without thread support.
+ */
+int ppcg_transform_parallel(isl_ctx *ctx, const char *input, FILE *out,
+	struct ppcg_options *options,
+	__isl_give isl_printer *(*fn)(__isl_take isl_printer *p,
+		struct ppcg_scop *scop, void *user),
+	void *(*copy_user)(void *user), void (*free_user)(void *user),
+	void *user)
+{
+#ifdef HAVE_PTHREAD_H
+	if (options->threads > 1 && ppcg_argv)
+		return transform_parallel(ctx, input, out, options, fn,
+					copy_user, free_user, user);
+#endif
+	return ppcg_transform(ctx, input, out, options, fn, user);
+}
+
 /* Check consistency of options.
  *
  * Return -1 on error.
@@ -1030,37 +2015,127 @@ static int check_options(isl_ctx *ctx)
 	return 0;
 }
 
+/* Generate code for the target selected in "options" from
+ * the input file "input" and write it to "output",
+ * or to a file derived from "input" if "output" is NULL.
+ * The CUDA target always derives the names of its output files
+ * from "input".
+ */
+static int generate(isl_ctx *ctx, struct options *options,
+	const char *input, const char *output)
+{
+	if (options->ppcg->target == PPCG_TARGET_CUDA)
+		return generate_cuda(ctx, options->ppcg, input);
+	else if (options->ppcg->target == PPCG_TARGET_OPENCL)
+		return generate_opencl(ctx, options->ppcg, input, output);
+	else
+		return generate_cpu(ctx, options->ppcg, input, output);
+}
+
+/* Skip the white space at the start of "s" and
+ * return a pointer to the first other character.
+ */
+static char *skip_space(char *s)
+{
+	while (*s == ' ' || *s == '\t' || *s == '\r')
+		++s;
+	return s;
+}
+
+/* Store the word at the start of "s" in *word, terminate it and
+ * return a pointer to the position after the word.
+ * Set *word to NULL if there is no word at the start of "s".
+ */
+static char *extract_word(char *s, char **word)
+{
+	char *end;
+
+	*word = NULL;
+	if (!*s)
+		return s;
+	for (end = s; *end && *end != ' ' && *end != '\t' && *end != '\r';
+	    ++end)
+		;
+	*word = s;
+	if (*end)
+		*end++ = '\0';
+	return end;
+}
+
+/* Generate code for each of the input files listed in
+ * the file options->batch, reusing "ctx" and the options
+ * for all of them.
+ * Each non-empty line that does not start with '#' contains
+ * the name of an input file, optionally followed by
+ * the name of the corresponding output file.
+ * An error in one of the files does not prevent the other files
+ * from being processed, but does result in a failure exit status.
+ */
+static int generate_batch(isl_ctx *ctx, struct options *options)
+{
+	char *contents;
+	char *line, *next;
+	int r = EXIT_SUCCESS;
+
+	contents = ppcg_read_file(options->batch);
+	if (!contents) {
+		fprintf(stderr, "Unable to read batch file '%s'\n",
+			options->batch);
+		return EXIT_FAILURE;
+	}
+
+	for (line = contents; line; line = next) {
+		char *input, *output;
+
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = '\0';
+		line = skip_space(line);
+		if (*line == '#')
+			continue;
+		line = extract_word(line, &input);
+		line = extract_word(skip_space(line), &output);
+		if (!input)
+			continue;
+		if (options->ppcg->debug->verbose)
+			fprintf(stdout, "Processing %s\n", input);
+		isl_ctx_reset_error(ctx);
+		if (generate(ctx, options, input, output) != 0)
+			r = EXIT_FAILURE;
+	}
+
+	free(contents);
+	return r;
+}
+
 int main(int argc, char **argv)
 {
 	int r;
 	isl_ctx *ctx;
 	struct options *options;
 
-	options = options_new_with_defaults();
-	assert(options);
+	ppcg_argv = malloc(argc * sizeof(char *));
+	if (ppcg_argv) {
+		memcpy(ppcg_argv, argv, argc * sizeof(char *));
+		ppcg_argc = argc;
+	}
 
-	ctx = isl_ctx_alloc_with_options(&options_args, options);
-	ppcg_options_set_target_defaults(options->ppcg);
-	isl_options_set_ast_build_detect_min_max(ctx, 1);
-	isl_options_set_ast_print_macro_once(ctx, 1);
-	isl_options_set_schedule_whole_component(ctx, 0);
-	isl_options_set_schedule_maximize_band_depth(ctx, 1);
-	isl_options_set_schedule_maximize_coincidence(ctx, 1);
-	pet_options_set_encapsulate_dynamic_control(ctx, 1);
-	argc = options_parse(options, argc, argv, ISL_ARG_ALL);
+	ctx = alloc_ctx(argc, argv, &options);
+	if (!ctx) {
+		free(ppcg_argv);
+		return EXIT_FAILURE;
+	}
+	ppcg_input = options->input;
 
 	if (check_options(ctx) < 0)
 		r = EXIT_FAILURE;
-	else if (options->ppcg->target == PPCG_TARGET_CUDA)
-		r = generate_cuda(ctx, options->ppcg, options->input);
-	else if (options->ppcg->target == PPCG_TARGET_OPENCL)
-		r = generate_opencl(ctx, options->ppcg, options->input,
-				options->output);
+	else if (options->batch)
+		r = generate_batch(ctx, options);
 	else
-		r = generate_cpu(ctx, options->ppcg, options->input,
-				options->output);
+		r = generate(ctx, options, options->input, options->output);
 
 	isl_ctx_free(ctx);
+	free(ppcg_argv);
 
 	return r;
 }
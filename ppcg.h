@@ -47,6 +47,10 @@ int ppcg_extract_base_name(char *name, const char *input);
  *
  * "independence" is the union of all independence filters.
  *
+ * "reductions" contains the write accesses of the statements that
+ *	have been identified as reductions.  It is only non-empty
+ *	if the reductions option is set.
+ *
  * "dep_flow" represents the potential flow dependences.
  * "tagged_dep_flow" is the same as "dep_flow", except that both domain and
  *	range are wrapped relations mapping an iteration domain to
@@ -54,6 +58,8 @@ int ppcg_extract_base_name(char *name, const char *input);
  * "dep_false" represents the potential false (anti and output) dependences.
  * "dep_forced" represents the validity constraints that should be enforced
  *	even when live-range reordering is used.
+ *	It is computed on demand and should be accessed through
+ *	ppcg_scop_get_dep_forced.
  *	In particular, these constraints ensure that all live-in
  *	accesses remain live-in and that all live-out accesses remain live-out
  *	and that multiple potential sources for the same read are
@@ -62,6 +68,8 @@ int ppcg_extract_base_name(char *name, const char *input);
  *	the live range intervals in "dep_flow"/"tagged_dep_flow".
  *	It is only used if the live_range_reordering
  *	option is set.  Otherwise it is NULL.
+ *	They are computed on demand and should be accessed through
+ *	ppcg_scop_get_dep_order and ppcg_scop_get_tagged_dep_order.
  *	If "dep_order" is used, then "dep_false" only contains a limited
  *	set of anti and output dependences.
  * "schedule" represents the (original) schedule.
@@ -94,6 +102,7 @@ struct ppcg_scop {
 	isl_union_pw_multi_aff *tagger;
 
 	isl_union_map *independence;
+	isl_union_map *reductions;
 
 	isl_union_map *dep_flow;
 	isl_union_map *tagged_dep_flow;
@@ -109,12 +118,27 @@ struct ppcg_scop {
 };
 
 int ppcg_scop_any_hidden_declarations(struct ppcg_scop *scop);
+__isl_keep isl_union_map *ppcg_scop_get_dep_order(struct ppcg_scop *ps);
+__isl_keep isl_union_map *ppcg_scop_get_tagged_dep_order(
+	struct ppcg_scop *ps);
+__isl_keep isl_union_map *ppcg_scop_get_dep_forced(struct ppcg_scop *ps);
+isl_bool ppcg_scop_is_reduction(struct ppcg_scop *scop, struct pet_stmt *stmt);
+__isl_give isl_union_map *ppcg_scop_reduction_dependences(
+	struct ppcg_scop *scop);
 __isl_give isl_id_list *ppcg_scop_generate_names(struct ppcg_scop *scop,
 	int n, const char *prefix);
 
+__isl_give isl_printer *ppcg_print_options_key(__isl_take isl_printer *p);
+
 int ppcg_transform(isl_ctx *ctx, const char *input, FILE *out,
 	struct ppcg_options *options,
 	__isl_give isl_printer *(*fn)(__isl_take isl_printer *p,
 		struct ppcg_scop *scop, void *user), void *user);
+int ppcg_transform_parallel(isl_ctx *ctx, const char *input, FILE *out,
+	struct ppcg_options *options,
+	__isl_give isl_printer *(*fn)(__isl_take isl_printer *p,
+		struct ppcg_scop *scop, void *user),
+	void *(*copy_user)(void *user), void (*free_user)(void *user),
+	void *user);
 
 #endif
@@ -17,6 +17,23 @@ static struct isl_arg_choice target[] = {
 	{0}
 };
 
+static struct isl_arg_choice openmp_schedule[] = {
+	{"default",	PPCG_OPENMP_SCHEDULE_DEFAULT},
+	{"auto",	PPCG_OPENMP_SCHEDULE_AUTO},
+	{"static",	PPCG_OPENMP_SCHEDULE_STATIC},
+	{"dynamic",	PPCG_OPENMP_SCHEDULE_DYNAMIC},
+	{"guided",	PPCG_OPENMP_SCHEDULE_GUIDED},
+	{0}
+};
+
+static struct isl_arg_choice openmp_proc_bind[] = {
+	{"none",	PPCG_OPENMP_PROC_BIND_NONE},
+	{"master",	PPCG_OPENMP_PROC_BIND_MASTER},
+	{"close",	PPCG_OPENMP_PROC_BIND_CLOSE},
+	{"spread",	PPCG_OPENMP_PROC_BIND_SPREAD},
+	{0}
+};
+
 /* Set defaults that depend on the target.
  * In particular, set --schedule-outer-coincidence iff target is a GPU.
  */
@@ -58,6 +75,11 @@ ISL_ARG_BOOL(struct ppcg_debug_options, dump_sizes, 0,
 	"dump-sizes", 0,
 	"dump effectively used per kernel tile, grid and block sizes")
 ISL_ARG_BOOL(struct ppcg_debug_options, verbose, 'v', "verbose", 0, NULL)
+ISL_ARG_BOOL(struct ppcg_debug_options, time_report, 0,
+	"time-report", 0,
+	"report the wall and processor time spent in each phase "
+	"per scop and per kernel, along with the peak memory usage, "
+	"on stderr")
 ISL_ARGS_END
 
 ISL_ARGS_START(struct ppcg_options, ppcg_opencl_options_args)
@@ -73,6 +95,15 @@ ISL_ARG_BOOL(struct ppcg_options, opencl_print_kernel_types, 0,
 	"print definitions of types in the kernel file")
 ISL_ARG_BOOL(struct ppcg_options, opencl_embed_kernel_code, 0,
 	"embed-kernel-code", 0, "embed kernel code into host code")
+ISL_ARG_STR(struct ppcg_options, opencl_offline_compiler, 0,
+	"offline-compiler", "command", NULL,
+	"compile the kernels to SPIR-V at ppcg time by running "
+	"\"<command> <compiler options> <kernel file> -o <output>\" and "
+	"embed the result into the host code")
+ISL_ARG_BOOL(struct ppcg_options, opencl_zero_copy, 0,
+	"zero-copy", 0, "use host memory directly for device buffers "
+	"on devices that share memory with the host, as determined "
+	"at run time")
 ISL_ARGS_END
 
 ISL_ARGS_START(struct ppcg_options, ppcg_options_args)
@@ -82,6 +113,13 @@ ISL_ARG_CHILD(struct ppcg_options, debug, NULL, &ppcg_debug_options_args,
 ISL_ARG_BOOL(struct ppcg_options, group_chains, 0, "group-chains", 1,
 	"group chains of interdependent statements that are executed "
 	"consecutively in the original schedule before scheduling")
+ISL_ARG_INT(struct ppcg_options, fusion_distance, 0, "fusion-distance",
+	"n", -1, "also group consecutive statements in the same loop body "
+	"of the original schedule where each instance of the second "
+	"statement consumes data produced by the first statement "
+	"at most <n> iterations of the enclosing loops earlier, "
+	"such that the two are not distributed; statements in different "
+	"loop nests are not fused (-1: disabled; requires --group-chains)")
 ISL_ARG_BOOL(struct ppcg_options, reschedule, 0, "reschedule", 1,
 	"replace original schedule by isl computed schedule")
 ISL_ARG_BOOL(struct ppcg_options, scale_tile_loops, 0,
@@ -89,6 +127,9 @@ ISL_ARG_BOOL(struct ppcg_options, scale_tile_loops, 0,
 ISL_ARG_BOOL(struct ppcg_options, wrap, 0, "wrap", 1, NULL)
 ISL_ARG_BOOL(struct ppcg_options, use_shared_memory, 0, "shared-memory", 1,
 	"use shared memory in kernel code")
+ISL_ARG_BOOL(struct ppcg_options, pad_shared_memory, 0, "pad-shared-memory",
+	0, "pad the innermost dimension of shared memory tiles "
+	"that are accessed across rows by consecutive threads")
 ISL_ARG_BOOL(struct ppcg_options, use_private_memory, 0, "private-memory", 1,
 	"use private memory in kernel code")
 ISL_ARG_STR(struct ppcg_options, ctx, 0, "ctx", "context", NULL,
@@ -99,17 +140,96 @@ ISL_ARG_BOOL(struct ppcg_options, non_negative_parameters, 0,
 ISL_ARG_BOOL(struct ppcg_options, tile, 0, "tile", 0,
 	"perform tiling (C target)")
 ISL_ARG_INT(struct ppcg_options, tile_size, 'S', "tile-size", "size", 32, NULL)
+ISL_ARG_BOOL(struct ppcg_options, wavefront, 0, "wavefront", 0,
+	"skew tiled bands without outer parallelism into a wavefront "
+	"(C target with --openmp)")
 ISL_ARG_BOOL(struct ppcg_options, isolate_full_tiles, 0, "isolate-full-tiles",
-	0, "isolate full tiles from partial tiles (hybrid tiling)")
+	0, "isolate full tiles from partial tiles "
+	"(hybrid tiling and GPU targets)")
 ISL_ARG_STR(struct ppcg_options, sizes, 0, "sizes", "sizes", NULL,
-	"Per kernel tile, grid and block sizes")
+	"Per kernel tile, grid and block sizes (GPU targets) "
+	"or per band tile sizes (C target)")
+ISL_ARG_STR(struct ppcg_options, tuning_db, 0, "tuning-db", "file", NULL,
+	"read per kernel tile, grid and block sizes "
+	"from tuning database <file>")
+ISL_ARG_STR(struct ppcg_options, versions, 0, "versions", "sets", NULL,
+	"semicolon separated list of parameter sets, each of which "
+	"results in a specialized version of the code, selected at run time "
+	"(GPU targets)")
+ISL_ARG_STR(struct ppcg_options, kernel_report, 0, "kernel-report", "file",
+	NULL, "append a JSON description of the resources used by each kernel "
+	"and of the host/device transfers to <file>, one object per line "
+	"(GPU targets)")
 ISL_ARG_INT(struct ppcg_options, max_shared_memory, 0,
 	"max-shared-memory", "size", 8192, "maximal amount of shared memory")
+ISL_ARG_BOOL(struct ppcg_options, read_only_memory, 0, "read-only-memory", 0,
+	"access arrays that are only read by a kernel through "
+	"the read-only data cache (CUDA target) or "
+	"constant memory (OpenCL target)")
+ISL_ARG_INT(struct ppcg_options, max_constant_memory, 0,
+	"max-constant-memory", "size", 65536,
+	"maximal amount of constant memory (OpenCL target)")
+ISL_ARG_BOOL(struct ppcg_options, launch_bounds, 0, "launch-bounds", 0,
+	"annotate kernels with their block size through __launch_bounds__ "
+	"(CUDA target) or reqd_work_group_size (OpenCL target)")
+ISL_ARG_INT(struct ppcg_options, min_blocks_per_multiprocessor, 0,
+	"min-blocks-per-multiprocessor", "n", 0,
+	"minimal number of resident blocks per multiprocessor "
+	"passed to __launch_bounds__ (CUDA target)")
+ISL_ARG_BOOL(struct ppcg_options, analytical_tile_size, 0,
+	"analytical-tile-size", 0,
+	"derive default tile sizes from the estimated shared memory "
+	"footprint of a tile (GPU targets)")
 ISL_ARG_BOOL(struct ppcg_options, openmp, 0, "openmp", 0,
 	"Generate OpenMP macros (only for C target)")
+ISL_ARG_CHOICE(struct ppcg_options, openmp_schedule, 0, "openmp-schedule",
+	openmp_schedule, PPCG_OPENMP_SCHEDULE_DEFAULT,
+	"schedule clause of openmp parallel loops, where \"auto\" selects "
+	"a dynamic schedule for loops with unbalanced iterations "
+	"(only for C target)")
+ISL_ARG_INT(struct ppcg_options, openmp_chunk_size, 0, "openmp-chunk-size",
+	"size", 0,
+	"chunk size in the schedule clause of openmp parallel loops, "
+	"if positive (only for C target)")
+ISL_ARG_BOOL(struct ppcg_options, openmp_tasks, 0, "openmp-tasks", 0,
+	"execute the children of an outer sequence as openmp tasks "
+	"with dependences derived from the scop (only for C target)")
+ISL_ARG_CHOICE(struct ppcg_options, openmp_proc_bind, 0, "openmp-proc-bind",
+	openmp_proc_bind, PPCG_OPENMP_PROC_BIND_NONE,
+	"proc_bind clause of openmp parallel regions (only for C target)")
+ISL_ARG_BOOL(struct ppcg_options, openmp_first_touch, 0,
+	"openmp-first-touch", 0,
+	"copy arrays accessed by openmp parallel loops into local arrays "
+	"that are first touched by the threads that use them "
+	"(only for C target)")
+ISL_ARG_BOOL(struct ppcg_options, register_promotion, 0,
+	"register-promotion", 0,
+	"promote array elements that are invariant in an innermost loop "
+	"to local scalars (only for C target)")
+ISL_ARG_BOOL(struct ppcg_options, prefetch, 0, "prefetch", 0,
+	"prefetch array elements that innermost loops stream through "
+	"using __builtin_prefetch, if GNU extensions are allowed "
+	"(only for C target)")
+ISL_ARG_INT(struct ppcg_options, prefetch_distance, 0, "prefetch-distance",
+	"n", 0,
+	"number of iterations to prefetch ahead; the default tile size "
+	"if not positive")
+ISL_ARG_BOOL(struct ppcg_options, openmp_simd, 0, "openmp-simd", 0,
+	"mark innermost loops that can be vectorized with "
+	"\"omp simd\" pragmas (only for C target)")
+ISL_ARG_BOOL(struct ppcg_options, array_layout, 0, "array-layout", 0,
+	"copy arrays that are traversed column-wise by innermost loops "
+	"into transposed or padded local arrays (only for C target)")
+ISL_ARG_INT(struct ppcg_options, array_padding, 0, "array-padding", "n", 0,
+	"number of elements by which to pad the innermost dimension "
+	"of the local arrays created by --array-layout")
 ISL_ARG_USER_OPT_CHOICE(struct ppcg_options, target, 0, "target", target,
 	&set_target, PPCG_TARGET_CUDA, PPCG_TARGET_CUDA,
 	"the target to generate code for")
+ISL_ARG_INT(struct ppcg_options, threads, 0, "threads", "n", 1,
+	"number of threads used for transforming the scops "
+	"of the input file in parallel (only for C target) and "
+	"for scheduling independent components of a scop in parallel")
 ISL_ARG_BOOL(struct ppcg_options, linearize_device_arrays, 0,
 	"linearize-device-arrays", 1,
 	"linearize all device arrays, even those of fixed size")
@@ -120,17 +240,103 @@ ISL_ARG_BOOL(struct ppcg_options, live_range_reordering, 0,
 	"live-range-reordering", 1,
 	"allow successive live ranges on the same memory element "
 	"to be reordered")
+ISL_ARG_BOOL(struct ppcg_options, reductions, 0, "reductions", 0,
+	"detect reductions and allow their iterations to be executed "
+	"in parallel using atomic operations or reduction clauses")
+ISL_ARG_BOOL(struct ppcg_options, shared_histograms, 0, "shared-histograms",
+	0, "accumulate reductions in a shared memory copy of their target "
+	"that is atomically added to global memory afterwards "
+	"(GPU targets, requires --reductions)")
 ISL_ARG_BOOL(struct ppcg_options, hybrid, 0, "hybrid", 0,
 	"apply hybrid tiling whenever a suitable input pattern is found "
-	"(GPU targets)")
+	"(GPU targets and C target with --tile and --openmp)")
+ISL_ARG_BOOL(struct ppcg_options, hybrid_auto_sizes, 0, "hybrid-auto-sizes",
+	1, "enlarge the hexagon base of hybrid tiles to the smallest width "
+	"allowed by the dependence distances if it is too narrow")
+ISL_ARG_BOOL(struct ppcg_options, hybrid_split, 0, "hybrid-split", 0,
+	"in hybrid tiling, split tile the space dimensions other than "
+	"the first instead of tiling them classically, such that "
+	"tiles in these dimensions can start concurrently")
+ISL_ARG_BOOL(struct ppcg_options, fuse_kernels, 0, "fuse-kernels", 0,
+	"fuse consecutive outermost permutable bands into a single kernel "
+	"whenever the dependences allow it (GPU targets)")
 ISL_ARG_BOOL(struct ppcg_options, unroll_copy_shared, 0, "unroll-copy-shared",
 	0, "unroll code for copying to/from shared memory")
 ISL_ARG_BOOL(struct ppcg_options, unroll_gpu_tile, 0, "unroll-gpu-tile", 0,
 	"unroll code inside tile on GPU targets")
+ISL_ARG_INT(struct ppcg_options, vector_width, 0, "vector-width", "width", 1,
+	"read 2 or 4 elements at once using vector types when copying "
+	"from global to shared memory, if alignment allows (GPU targets)")
+ISL_ARG_BOOL(struct ppcg_options, double_buffer, 0, "double-buffer", 0,
+	"double buffer shared memory tiles of read-only groups and "
+	"prefetch the next tile (GPU targets)")
+ISL_ARG_BOOL(struct ppcg_options, async_transfers, 0, "async-transfers", 0,
+	"overlap transfers with kernel execution using separate streams "
+	"(CUDA target) or enqueue transfers and kernels without blocking, "
+	"only waiting for the command queue to drain at the end of "
+	"a scop (OpenCL target)")
+ISL_ARG_BOOL(struct ppcg_options, cuda_graphs, 0, "cuda-graphs", 0,
+	"capture the transfers and kernel launches of each scop "
+	"in a CUDA graph and replay the instantiated graph, "
+	"reusing it across calls whenever possible (CUDA target)")
+ISL_ARG_BOOL(struct ppcg_options, persistent_kernels, 0,
+	"persistent-kernels", 0,
+	"move a host loop that only launches a single kernel inside "
+	"that kernel, separating iterations by grid-wide synchronization. "
+	"The grid needs to fit on the device (CUDA target)")
+ISL_ARG_BOOL(struct ppcg_options, partial_transfers, 0, "partial-transfers", 0,
+	"only copy the accessed range of outermost array indices "
+	"(GPU targets)")
+ISL_ARG_BOOL(struct ppcg_options, pinned_host_memory, 0, "pinned-host-memory",
+	0, "use page-locked host memory for transfers to and from the device "
+	"(GPU targets)")
+ISL_ARG_BOOL(struct ppcg_options, managed_memory, 0, "managed-memory", 0,
+	"allocate device arrays in managed memory and migrate them "
+	"using prefetch hints (CUDA target)")
+ISL_ARG_INT(struct ppcg_options, num_devices, 0, "num-devices", "n", 1,
+	"split the outermost block dimension of each kernel across "
+	"up to the given number of devices, relying on managed memory "
+	"to move the data accessed by each device (CUDA target, "
+	"requires --managed-memory)")
+ISL_ARG_BOOL(struct ppcg_options, persistent_device_data, 0,
+	"persistent-device-data", 0,
+	"keep device arrays allocated across executions of a scop and "
+	"only copy an array to the device if its host contents "
+	"have changed since the device copy was last known to hold them "
+	"(CUDA target)")
+ISL_ARG_INT(struct ppcg_options, max_device_memory, 0,
+	"max-device-memory", "MiB", 0,
+	"stream the outermost tile loop of a kernel in chunks of which "
+	"the device footprint fits in the given amount of memory, "
+	"if the entire footprint does not fit.  "
+	"Zero means unlimited (CUDA target)")
+ISL_ARG_BOOL(struct ppcg_options, device_timing, 0, "device-timing", 0,
+	"time every kernel launch and transfer using device events and "
+	"write a summary to the file named by the PPCG_TIMING_REPORT "
+	"environment variable (or stderr) on exit (GPU targets)")
 ISL_ARG_GROUP("opencl", &ppcg_opencl_options_args, "OpenCL options")
 ISL_ARG_STR(struct ppcg_options, save_schedule_file, 0, "save-schedule",
 	"file", NULL, "save isl computed schedule to <file>")
 ISL_ARG_STR(struct ppcg_options, load_schedule_file, 0, "load-schedule",
 	"file", NULL, "load schedule from <file>, "
 	"using it instead of an isl computed schedule")
+ISL_ARG_INT(struct ppcg_options, schedule_max_operations, 0,
+	"schedule-max-operations", "n", 0,
+	"maximal number of isl operations for computing a schedule "
+	"(0: no limit); if exceeded, the schedule is computed again "
+	"with cheaper settings and, failing that, the original schedule "
+	"is used")
+ISL_ARG_STR(struct ppcg_options, schedule_cache_dir, 0, "schedule-cache",
+	"dir", NULL, "reuse the schedules of identical scheduling problems "
+	"stored in the existing directory <dir> and store newly computed "
+	"schedules there")
+ISL_ARG_STR(struct ppcg_options, dependence_cache_dir, 0,
+	"dependence-cache", "dir", NULL,
+	"reuse the dependences of scops with identical accesses and "
+	"schedule stored in the existing directory <dir> and store newly "
+	"computed dependences there")
+ISL_ARG_STR(struct ppcg_options, code_cache_dir, 0, "code-cache", "dir", NULL,
+	"reuse the code generated for unchanged scops stored in "
+	"the existing directory <dir> and store newly generated code there "
+	"(c target)")
 ISL_ARGS_END
@@ -10,6 +10,7 @@ struct ppcg_debug_options {
 	int dump_final_schedule;
 	int dump_sizes;
 	int verbose;
+	int time_report;
 };
 
 struct ppcg_options {
@@ -18,6 +19,11 @@ struct ppcg_options {
 
 	/* Group chains of consecutive statements before scheduling. */
 	int group_chains;
+	/* Also group consecutive statements in the same loop body
+	 * where the second consumes data produced at most this many
+	 * iterations earlier by the first; -1 if disabled.
+	 */
+	int fusion_distance;
 
 	/* Use isl to compute a schedule replacing the original schedule. */
 	int reschedule;
@@ -28,10 +34,18 @@ struct ppcg_options {
 	int non_negative_parameters;
 	char *ctx;
 	char *sizes;
+	/* Name of tuning database with per kernel sizes or NULL. */
+	char *tuning_db;
+	/* Parameter sets for which specialized code should be generated. */
+	char *versions;
+	/* Append a JSON resource report of each kernel to this file. */
+	char *kernel_report;
 
 	/* Perform tiling (C target). */
 	int tile;
 	int tile_size;
+	/* Skew tiled bands without outer parallelism into a wavefront. */
+	int wavefront;
 
 	/* Isolate full tiles from partial tiles. */
 	int isolate_full_tiles;
@@ -41,15 +55,53 @@ struct ppcg_options {
 
 	/* Take advantage of shared memory. */
 	int use_shared_memory;
+	/* Pad shared memory tiles to avoid bank conflicts. */
+	int pad_shared_memory;
 
 	/* Maximal amount of shared memory. */
 	int max_shared_memory;
+	/* Use read-only data cache or constant memory for read-only arrays. */
+	int read_only_memory;
+	/* Maximal amount of constant memory. */
+	int max_constant_memory;
+	/* Annotate kernels with their block size. */
+	int launch_bounds;
+	/* Minimal number of resident blocks per multiprocessor (CUDA). */
+	int min_blocks_per_multiprocessor;
+	/* Derive default tile sizes from the shared memory footprint. */
+	int analytical_tile_size;
 
 	/* The target we generate code for. */
 	int target;
+	/* Number of threads for transforming scops (C target only)
+	 * and for scheduling independent components.
+	 */
+	int threads;
 
 	/* Generate OpenMP macros (C target only). */
 	int openmp;
+	/* Schedule clause of openmp parallel loops (C target only). */
+	int openmp_schedule;
+	/* Chunk size in the schedule clause, if positive. */
+	int openmp_chunk_size;
+	/* Execute the children of an outer sequence as openmp tasks. */
+	int openmp_tasks;
+	/* proc_bind clause of openmp parallel regions. */
+	int openmp_proc_bind;
+	/* First touch local copies of arrays in parallel (C target only). */
+	int openmp_first_touch;
+	/* Promote loop invariant array elements to scalars (C target only). */
+	int register_promotion;
+	/* Prefetch array elements accessed by innermost loops (C target). */
+	int prefetch;
+	/* Prefetch distance in loop iterations; tile size if not positive. */
+	int prefetch_distance;
+	/* Mark vectorizable innermost loops "omp simd" (C target only). */
+	int openmp_simd;
+	/* Change the layout of badly traversed arrays (C target only). */
+	int array_layout;
+	/* Number of padding elements in the innermost array dimension. */
+	int array_padding;
 
 	/* Linearize all device arrays. */
 	int linearize_device_arrays;
@@ -60,13 +112,54 @@ struct ppcg_options {
 	/* Allow live range to be reordered. */
 	int live_range_reordering;
 
+	/* Detect reductions and allow them to be executed in parallel. */
+	int reductions;
+	/* Accumulate reductions in shared memory before adding the results
+	 * to global memory.
+	 */
+	int shared_histograms;
+
 	/* Allow hybrid tiling whenever a suitable input pattern is found. */
 	int hybrid;
+	/* Enlarge hybrid tile sizes that are too narrow
+	 * for the dependence distances.
+	 */
+	int hybrid_auto_sizes;
+	/* Split tile the remaining space dimensions in hybrid tiling. */
+	int hybrid_split;
+
+	/* Fuse consecutive kernels whenever the dependences allow it. */
+	int fuse_kernels;
 
 	/* Unroll the code for copying to/from shared memory. */
 	int unroll_copy_shared;
 	/* Unroll code inside tile on GPU targets. */
 	int unroll_gpu_tile;
+	/* Number of elements read at once in copies to shared memory. */
+	int vector_width;
+	/* Double buffer read-only shared memory tiles (GPU targets). */
+	int double_buffer;
+
+	/* Use asynchronous transfers (GPU targets). */
+	int async_transfers;
+	/* Capture the host code in a CUDA graph (CUDA target). */
+	int cuda_graphs;
+	/* Move sequential host loops around a kernel inside the kernel. */
+	int persistent_kernels;
+	/* Only transfer the accessed slab of arrays (GPU targets). */
+	int partial_transfers;
+	/* Use page-locked host memory for transfers (GPU targets). */
+	int pinned_host_memory;
+	/* Allocate device arrays in managed memory (CUDA target). */
+	int managed_memory;
+	/* Maximal number of devices to split kernels across (CUDA target). */
+	int num_devices;
+	/* Keep device arrays alive across executions of a scop. */
+	int persistent_device_data;
+	/* Device memory (in MiB) available for streaming; 0 if unlimited. */
+	int max_device_memory;
+	/* Time kernel launches and transfers in the generated code. */
+	int device_timing;
 
 	/* Options to pass to the OpenCL compiler.  */
 	char *opencl_compiler_options;
@@ -80,11 +173,25 @@ struct ppcg_options {
 	int opencl_print_kernel_types;
 	/* Embed OpenCL kernel code in host code. */
 	int opencl_embed_kernel_code;
+	/* Command for compiling kernels ahead of time or NULL. */
+	char *opencl_offline_compiler;
+	/* Use host memory for buffers on devices with unified memory. */
+	int opencl_zero_copy;
 
 	/* Name of file for saving isl computed schedule or NULL. */
 	char *save_schedule_file;
 	/* Name of file for loading schedule or NULL. */
 	char *load_schedule_file;
+	/* Maximal number of isl operations for computing a schedule;
+	 * 0 if there is no limit.
+	 */
+	int schedule_max_operations;
+	/* Directory of the schedule cache; NULL if no cache is used. */
+	char *schedule_cache_dir;
+	/* Directory of the dependence cache; NULL if no cache is used. */
+	char *dependence_cache_dir;
+	/* Directory of the code cache (C target); NULL if no cache is used. */
+	char *code_cache_dir;
 };
 
 ISL_ARG_DECL(ppcg_debug_options, struct ppcg_debug_options,
@@ -95,6 +202,17 @@ ISL_ARG_DECL(ppcg_options, struct ppcg_options, ppcg_options_args)
 #define		PPCG_TARGET_CUDA	1
 #define		PPCG_TARGET_OPENCL      2
 
+#define		PPCG_OPENMP_SCHEDULE_DEFAULT	0
+#define		PPCG_OPENMP_SCHEDULE_AUTO	1
+#define		PPCG_OPENMP_SCHEDULE_STATIC	2
+#define		PPCG_OPENMP_SCHEDULE_DYNAMIC	3
+#define		PPCG_OPENMP_SCHEDULE_GUIDED	4
+
+#define		PPCG_OPENMP_PROC_BIND_NONE	0
+#define		PPCG_OPENMP_PROC_BIND_MASTER	1
+#define		PPCG_OPENMP_PROC_BIND_CLOSE	2
+#define		PPCG_OPENMP_PROC_BIND_SPREAD	3
+
 void ppcg_options_set_target_defaults(struct ppcg_options *options);
 
 #endif
@@ -10,6 +10,7 @@
 #include <isl/aff.h>
 #include <isl/ast_build.h>
 
+#include "ppcg_options.h"
 #include "print.h"
 #include "util.h"
 
@@ -316,6 +317,24 @@ const char *ppcg_min = "ppcg_min";
 const char *ppcg_max = "ppcg_max";
 const char *ppcg_fdiv_q = "ppcg_fdiv_q";
 
+/* Print the proc_bind clause of an openmp parallel region
+ * corresponding to "proc_bind", if any.
+ */
+__isl_give isl_printer *ppcg_print_openmp_proc_bind(__isl_take isl_printer *p,
+	int proc_bind)
+{
+	switch (proc_bind) {
+	case PPCG_OPENMP_PROC_BIND_MASTER:
+		return isl_printer_print_str(p, " proc_bind(master)");
+	case PPCG_OPENMP_PROC_BIND_CLOSE:
+		return isl_printer_print_str(p, " proc_bind(close)");
+	case PPCG_OPENMP_PROC_BIND_SPREAD:
+		return isl_printer_print_str(p, " proc_bind(spread)");
+	default:
+		return p;
+	}
+}
+
 /* Set the names of the macros that may appear in a printed isl AST.
  */
 __isl_give isl_printer *ppcg_set_macro_names(__isl_take isl_printer *p)
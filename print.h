@@ -24,6 +24,9 @@ __isl_give isl_printer *ppcg_print_body_macros(__isl_take isl_printer *p,
 __isl_give isl_printer *ppcg_print_macros(__isl_take isl_printer *p,
 	__isl_keep isl_ast_node *node);
 
+__isl_give isl_printer *ppcg_print_openmp_proc_bind(__isl_take isl_printer *p,
+	int proc_bind);
+
 __isl_give isl_ast_expr *ppcg_build_size_expr(__isl_take isl_multi_pw_aff *size,
 	__isl_keep isl_ast_build *build);
 
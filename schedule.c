@@ -11,14 +11,26 @@
 #include <assert.h>
 #include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 
+#include <isl/id.h>
+#include <isl/aff.h>
 #include <isl/set.h>
 #include <isl/map.h>
+#include <isl/union_set.h>
+#include <isl/union_map.h>
+#include <isl/schedule_node.h>
 #include <isl/constraint.h>
+#include <isl/options.h>
 
 #include "grouping.h"
 #include "schedule.h"
+#include "util.h"
 
 /* Add parameters with identifiers "ids" to "set".
  */
@@ -126,30 +138,981 @@ static void save_schedule(__isl_keep isl_schedule *schedule,
 	fclose(file);
 }
 
+/* Add the tuple identifier of "set", if any, to the list *user.
+ */
+static isl_stat add_tuple_id(__isl_take isl_set *set, void *user)
+{
+	isl_id_list **ids = user;
+
+	if (isl_set_has_tuple_id(set) == isl_bool_true)
+		*ids = isl_id_list_add(*ids, isl_set_get_tuple_id(set));
+	isl_set_free(set);
+
+	return *ids ? isl_stat_ok : isl_stat_error;
+}
+
+/* Collect the identifiers of the parameters and of the statements
+ * of "domain".
+ */
+static __isl_give isl_id_list *collect_domain_ids(
+	__isl_keep isl_union_set *domain)
+{
+	int i, n;
+	isl_space *space;
+	isl_id_list *ids;
+
+	space = isl_union_set_get_space(domain);
+	n = isl_space_dim(space, isl_dim_param);
+	ids = isl_id_list_alloc(isl_union_set_get_ctx(domain), n);
+	for (i = 0; i < n; ++i)
+		ids = isl_id_list_add(ids,
+			isl_space_get_dim_id(space, isl_dim_param, i));
+	isl_space_free(space);
+	if (isl_union_set_foreach_set(domain, &add_tuple_id, &ids) < 0)
+		ids = isl_id_list_free(ids);
+
+	return ids;
+}
+
+/* Replace the identifiers in "mupa" by the original identifiers "ids"
+ * with the same names.
+ * Return NULL if "mupa" has no members since it then
+ * cannot be converted to a union map.
+ */
+static __isl_give isl_multi_union_pw_aff *restore_mupa_ids(
+	__isl_take isl_multi_union_pw_aff *mupa, __isl_keep isl_id_list *ids)
+{
+	isl_union_map *umap;
+
+	if (isl_multi_union_pw_aff_dim(mupa, isl_dim_set) <= 0)
+		return isl_multi_union_pw_aff_free(mupa);
+	umap = isl_union_map_from_multi_union_pw_aff(mupa);
+	umap = ppcg_union_map_restore_ids(umap, ids);
+	return isl_multi_union_pw_aff_from_union_map(umap);
+}
+
+static __isl_give isl_schedule *rebuild_with_ids(
+	__isl_take isl_schedule_node *node, __isl_keep isl_id_list *ids);
+
+/* Construct a schedule for the subtree at the band node "node"
+ * with the identifiers replaced by "ids", as in rebuild_with_ids.
+ * Of the properties of the band, only the permutability and
+ * the coincidence of the members are set by the isl scheduler,
+ * so these are the only ones that are copied.
+ */
+static __isl_give isl_schedule *rebuild_band_with_ids(
+	__isl_take isl_schedule_node *node, __isl_keep isl_id_list *ids)
+{
+	int i, n;
+	isl_multi_union_pw_aff *mupa;
+	isl_schedule *schedule;
+	isl_schedule_node *band;
+
+	schedule = rebuild_with_ids(isl_schedule_node_get_child(node, 0), ids);
+	mupa = isl_schedule_node_band_get_partial_schedule(node);
+	mupa = restore_mupa_ids(mupa, ids);
+	schedule = isl_schedule_insert_partial_schedule(schedule, mupa);
+	band = isl_schedule_get_root(schedule);
+	isl_schedule_free(schedule);
+	band = isl_schedule_node_child(band, 0);
+	band = isl_schedule_node_band_set_permutable(band,
+			isl_schedule_node_band_get_permutable(node));
+	n = isl_schedule_node_band_n_member(node);
+	for (i = 0; i < n; ++i)
+		band = isl_schedule_node_band_member_set_coincident(band, i,
+			isl_schedule_node_band_member_get_coincident(node, i));
+	isl_schedule_node_free(node);
+	schedule = isl_schedule_node_get_schedule(band);
+	isl_schedule_node_free(band);
+
+	return schedule;
+}
+
+/* Construct a schedule for the subtree at the sequence or set node "node"
+ * with the identifiers replaced by "ids", as in rebuild_with_ids.
+ * The filters of the children are recreated by isl_schedule_sequence or
+ * isl_schedule_set from the domains of the schedules of the children.
+ */
+static __isl_give isl_schedule *rebuild_children_with_ids(
+	__isl_take isl_schedule_node *node, __isl_keep isl_id_list *ids)
+{
+	int i, n;
+	enum isl_schedule_node_type type;
+	isl_schedule *schedule = NULL;
+
+	type = isl_schedule_node_get_type(node);
+	n = isl_schedule_node_n_children(node);
+	for (i = 0; i < n; ++i) {
+		isl_schedule *child;
+
+		child = rebuild_with_ids(isl_schedule_node_get_child(node, i),
+					ids);
+		if (i == 0)
+			schedule = child;
+		else if (type == isl_schedule_node_sequence)
+			schedule = isl_schedule_sequence(schedule, child);
+		else
+			schedule = isl_schedule_set(schedule, child);
+	}
+	isl_schedule_node_free(node);
+
+	return schedule;
+}
+
+/* Construct a schedule for the subtree at "node" of a schedule
+ * that has been read from a textual representation,
+ * with the identifiers replaced by the original identifiers "ids"
+ * with the same names.
+ * Only the types of nodes that are produced by the isl scheduler
+ * are supported, i.e., bands, sequences, sets, filters and leaves.
+ * Return NULL if "node" contains any other type of node.
+ * The filters are only recreated as children of sequences and sets.
+ * Elsewhere, they are dropped, but the domains of the leaves
+ * below them are still restricted to the filtered instances.
+ */
+static __isl_give isl_schedule *rebuild_with_ids(
+	__isl_take isl_schedule_node *node, __isl_keep isl_id_list *ids)
+{
+	isl_union_set *domain;
+
+	switch (isl_schedule_node_get_type(node)) {
+	case isl_schedule_node_leaf:
+		domain = isl_schedule_node_get_domain(node);
+		isl_schedule_node_free(node);
+		domain = ppcg_union_set_restore_ids(domain, ids);
+		return isl_schedule_from_domain(domain);
+	case isl_schedule_node_domain:
+	case isl_schedule_node_filter:
+		return rebuild_with_ids(isl_schedule_node_child(node, 0), ids);
+	case isl_schedule_node_band:
+		return rebuild_band_with_ids(node, ids);
+	case isl_schedule_node_sequence:
+	case isl_schedule_node_set:
+		return rebuild_children_with_ids(node, ids);
+	default:
+		isl_schedule_node_free(node);
+		return NULL;
+	}
+}
+
+/* Replace the parameter and statement identifiers of "schedule",
+ * which has been read from a textual representation,
+ * by the identifiers of "domain" with the same names.
+ * Identifiers read from a textual representation do not have
+ * a user pointer, while those constructed by pet may have one.
+ * Return NULL if "schedule" cannot be reconstructed or
+ * if the domain of the result is not equal to "domain",
+ * meaning that some of the identifiers could not be matched.
+ */
+static __isl_give isl_schedule *restore_schedule_ids(
+	__isl_take isl_schedule *schedule, __isl_keep isl_union_set *domain)
+{
+	isl_id_list *ids;
+	isl_union_set *res_domain;
+	isl_schedule *res;
+	isl_bool equal;
+
+	if (!schedule || !domain)
+		return isl_schedule_free(schedule);
+
+	ids = collect_domain_ids(domain);
+	res = rebuild_with_ids(isl_schedule_get_root(schedule), ids);
+	isl_schedule_free(schedule);
+	isl_id_list_free(ids);
+
+	res_domain = isl_schedule_get_domain(res);
+	equal = isl_union_set_is_equal(res_domain, domain);
+	isl_union_set_free(res_domain);
+	if (equal != isl_bool_true)
+		return isl_schedule_free(res);
+
+	return res;
+}
+
+#ifdef HAVE_PTHREAD_H
+
+/* The isl scheduler options that are copied to the isl_ctx objects
+ * of the threads of compute_components_parallel.
+ */
+static struct {
+	int (*get)(isl_ctx *ctx);
+	isl_stat (*set)(isl_ctx *ctx, int val);
+} schedule_options[] = {
+	{ &isl_options_get_schedule_max_coefficient,
+	  &isl_options_set_schedule_max_coefficient },
+	{ &isl_options_get_schedule_max_constant_term,
+	  &isl_options_set_schedule_max_constant_term },
+	{ &isl_options_get_schedule_maximize_band_depth,
+	  &isl_options_set_schedule_maximize_band_depth },
+	{ &isl_options_get_schedule_maximize_coincidence,
+	  &isl_options_set_schedule_maximize_coincidence },
+	{ &isl_options_get_schedule_outer_coincidence,
+	  &isl_options_set_schedule_outer_coincidence },
+	{ &isl_options_get_schedule_split_scaled,
+	  &isl_options_set_schedule_split_scaled },
+	{ &isl_options_get_schedule_treat_coalescing,
+	  &isl_options_set_schedule_treat_coalescing },
+	{ &isl_options_get_schedule_separate_components,
+	  &isl_options_set_schedule_separate_components },
+	{ &isl_options_get_schedule_serialize_sccs,
+	  &isl_options_set_schedule_serialize_sccs },
+	{ &isl_options_get_schedule_whole_component,
+	  &isl_options_set_schedule_whole_component },
+	{ &isl_options_get_schedule_algorithm,
+	  &isl_options_set_schedule_algorithm },
+};
+
+#define PPCG_N_SCHEDULE_OPTIONS \
+	(sizeof(schedule_options) / sizeof(schedule_options[0]))
+
+/* A statement of the domain of the schedule constraints
+ * with identifier "id" (not a copy) at position "pos".
+ */
+struct ppcg_component_stmt {
+	isl_id *id;
+	int pos;
+};
+
+/* Internal data structure for extract_components.
+ *
+ * "n" statements in "stmt", sorted by identifier once they have
+ * all been collected, "set" the corresponding instance sets and
+ * "parent" the union-find data structure on these statements.
+ */
+struct ppcg_components {
+	int n;
+	struct ppcg_component_stmt *stmt;
+	isl_set **set;
+	int *parent;
+};
+
+/* Compare the identifiers of the statements "a" and "b".
+ */
+static int cmp_component_stmt(const void *a, const void *b)
+{
+	const struct ppcg_component_stmt *stmt_a = a;
+	const struct ppcg_component_stmt *stmt_b = b;
+	uintptr_t id_a = (uintptr_t) stmt_a->id;
+	uintptr_t id_b = (uintptr_t) stmt_b->id;
+
+	return id_a < id_b ? -1 : id_a > id_b ? 1 : 0;
+}
+
+/* Add "set" to the statements in "components".
+ * The statement is required to have an identifier.
+ */
+static isl_stat add_component_stmt(__isl_take isl_set *set, void *user)
+{
+	struct ppcg_components *components = user;
+	struct ppcg_component_stmt *stmt;
+	isl_id *id;
+
+	if (!isl_set_has_tuple_id(set)) {
+		isl_set_free(set);
+		return isl_stat_error;
+	}
+	id = isl_set_get_tuple_id(set);
+	stmt = &components->stmt[components->n];
+	stmt->id = id;
+	stmt->pos = components->n;
+	components->set[components->n] = set;
+	components->parent[components->n] = components->n;
+	components->n++;
+	isl_id_free(id);
+
+	return isl_stat_ok;
+}
+
+/* Return the position of the statement with identifier "id"
+ * in "components" or -1 if there is no such statement.
+ */
+static int find_component_stmt(struct ppcg_components *components,
+	__isl_take isl_id *id)
+{
+	struct ppcg_component_stmt key = { id };
+	struct ppcg_component_stmt *stmt;
+
+	stmt = bsearch(&key, components->stmt, components->n, sizeof(key),
+			&cmp_component_stmt);
+	isl_id_free(id);
+
+	return stmt ? stmt->pos : -1;
+}
+
+/* Return the representative of the component containing
+ * the statement at position "i" in "components".
+ */
+static int find_component(struct ppcg_components *components, int i)
+{
+	while (components->parent[i] != i) {
+		components->parent[i] =
+			components->parent[components->parent[i]];
+		i = components->parent[i];
+	}
+
+	return i;
+}
+
+/* Merge the components of the domain and the range of "map",
+ * provided both have an identifier.
+ */
+static isl_stat merge_components(__isl_take isl_map *map, void *user)
+{
+	struct ppcg_components *components = user;
+	int src, dst;
+
+	if (!isl_map_has_tuple_id(map, isl_dim_in) ||
+	    !isl_map_has_tuple_id(map, isl_dim_out)) {
+		isl_map_free(map);
+		return isl_stat_error;
+	}
+	src = find_component_stmt(components,
+				isl_map_get_tuple_id(map, isl_dim_in));
+	dst = find_component_stmt(components,
+				isl_map_get_tuple_id(map, isl_dim_out));
+	isl_map_free(map);
+	if (src < 0 || dst < 0)
+		return isl_stat_ok;
+
+	src = find_component(components, src);
+	dst = find_component(components, dst);
+	components->parent[dst] = src;
+
+	return isl_stat_ok;
+}
+
+/* Free all memory allocated in "components".
+ */
+static void ppcg_components_clear(struct ppcg_components *components)
+{
+	int i;
+
+	for (i = 0; components->set && i < components->n; ++i)
+		isl_set_free(components->set[i]);
+	free(components->set);
+	free(components->parent);
+	free(components->stmt);
+}
+
+/* Split the domain of "sc" into the weakly connected components
+ * of the graph formed by all the schedule constraints in "sc".
+ * Return the domains of these components and store their number in *n.
+ * Return NULL if the domain cannot be split or if there is
+ * only a single component.
+ */
+static isl_union_set **extract_components(
+	__isl_keep isl_schedule_constraints *sc, int *n)
+{
+	int i, n_set, r;
+	isl_ctx *ctx;
+	isl_union_set *domain;
+	isl_union_map *constraints, *condition;
+	isl_union_set **comp = NULL;
+	int *comp_nr = NULL;
+	struct ppcg_components components = { 0 };
+
+	ctx = isl_schedule_constraints_get_ctx(sc);
+	domain = isl_schedule_constraints_get_domain(sc);
+	n_set = isl_union_set_n_set(domain);
+	if (n_set <= 1) {
+		isl_union_set_free(domain);
+		return NULL;
+	}
+	components.stmt = isl_alloc_array(ctx, struct ppcg_component_stmt,
+					n_set);
+	components.set = isl_alloc_array(ctx, isl_set *, n_set);
+	components.parent = isl_alloc_array(ctx, int, n_set);
+	if (!components.stmt || !components.set || !components.parent)
+		r = -1;
+	else
+		r = isl_union_set_foreach_set(domain, &add_component_stmt,
+						&components);
+	isl_union_set_free(domain);
+	if (r < 0)
+		goto done;
+	qsort(components.stmt, components.n, sizeof(*components.stmt),
+		&cmp_component_stmt);
+
+	constraints = isl_schedule_constraints_get_validity(sc);
+	constraints = isl_union_map_union(constraints,
+			isl_schedule_constraints_get_coincidence(sc));
+	constraints = isl_union_map_union(constraints,
+			isl_schedule_constraints_get_proximity(sc));
+	constraints = isl_union_map_union(constraints,
+			isl_schedule_constraints_get_conditional_validity(sc));
+	condition = isl_schedule_constraints_get_conditional_validity_condition(
+			sc);
+	constraints = isl_union_map_union(constraints, condition);
+	r = isl_union_map_foreach_map(constraints, &merge_components,
+					&components);
+	isl_union_map_free(constraints);
+	if (r < 0)
+		goto done;
+
+	comp_nr = isl_alloc_array(ctx, int, components.n);
+	comp = isl_calloc_array(ctx, isl_union_set *, components.n);
+	if (!comp_nr || !comp)
+		goto done;
+	*n = 0;
+	for (i = 0; i < components.n; ++i) {
+		int root = find_component(&components, i);
+
+		if (root == i)
+			comp_nr[i] = (*n)++;
+	}
+	for (i = 0; i < components.n; ++i) {
+		int c = comp_nr[find_component(&components, i)];
+		isl_set *set = components.set[i];
+
+		components.set[i] = NULL;
+		if (!comp[c])
+			comp[c] = isl_union_set_from_set(set);
+		else
+			comp[c] = isl_union_set_add_set(comp[c], set);
+		if (!comp[c])
+			break;
+	}
+	if (i < components.n || *n <= 1) {
+		for (i = 0; i < components.n; ++i)
+			isl_union_set_free(comp[i]);
+		free(comp);
+		comp = NULL;
+	}
+
+done:
+	free(comp_nr);
+	ppcg_components_clear(&components);
+	return comp;
+}
+
+/* Data shared by the threads of compute_components_parallel.
+ *
+ * "n" is the number of components.
+ * "sc" contains the schedule constraints of each component,
+ * printed to a string, and "schedule" the computed schedules,
+ * also printed to a string.
+ * "option" contains the values of the isl scheduler options and
+ * "max_operations" the maximal number of isl operations per component.
+ * "next" is the next component that has not been claimed by any thread.
+ * "lock" protects "next" and "error".
+ * "error" is set if an error occurred in any of the threads.
+ */
+struct ppcg_parallel_schedule {
+	int n;
+	char **sc;
+	char **schedule;
+	int option[PPCG_N_SCHEDULE_OPTIONS];
+	int max_operations;
+	int next;
+	pthread_mutex_t lock;
+	int error;
+};
+
+/* Compute a schedule for the schedule constraints "str"
+ * in "ctx" and return the result printed to a string.
+ */
+static char *compute_schedule_from_str(isl_ctx *ctx, const char *str,
+	int max_operations)
+{
+	isl_schedule_constraints *sc;
+	isl_schedule *schedule;
+	isl_printer *p;
+	char *res;
+
+	isl_ctx_reset_operations(ctx);
+	isl_ctx_set_max_operations(ctx, max_operations);
+	sc = isl_schedule_constraints_read_from_str(ctx, str);
+	schedule = isl_schedule_constraints_compute_schedule(sc);
+	p = isl_printer_to_str(ctx);
+	p = isl_printer_print_schedule(p, schedule);
+	res = isl_printer_get_str(p);
+	isl_printer_free(p);
+	isl_schedule_free(schedule);
+
+	return res;
+}
+
+/* Main function of a thread of compute_components_parallel.
+ *
+ * The thread computes the schedules of the components that have not
+ * been claimed yet in its own isl_ctx, with the same scheduler options
+ * as the original isl_ctx.  Errors are not printed since
+ * compute_components_parallel falls back to computing
+ * the schedule in the original isl_ctx.
+ */
+static void *schedule_worker(void *arg)
+{
+	struct ppcg_parallel_schedule *data = arg;
+	isl_ctx *ctx;
+	int i;
+
+	ctx = isl_ctx_alloc();
+	if (!ctx) {
+		pthread_mutex_lock(&data->lock);
+		data->error = 1;
+		pthread_mutex_unlock(&data->lock);
+		return NULL;
+	}
+	isl_options_set_on_error(ctx, ISL_ON_ERROR_CONTINUE);
+	for (i = 0; i < PPCG_N_SCHEDULE_OPTIONS; ++i)
+		schedule_options[i].set(ctx, data->option[i]);
+
+	for (;;) {
+		pthread_mutex_lock(&data->lock);
+		i = data->error ? data->n : data->next++;
+		pthread_mutex_unlock(&data->lock);
+		if (i >= data->n)
+			break;
+		data->schedule[i] = compute_schedule_from_str(ctx,
+					data->sc[i], data->max_operations);
+		if (!data->schedule[i]) {
+			pthread_mutex_lock(&data->lock);
+			data->error = 1;
+			pthread_mutex_unlock(&data->lock);
+		}
+	}
+
+	isl_ctx_free(ctx);
+	return NULL;
+}
+
+/* Free all memory allocated in "data".
+ */
+static void ppcg_parallel_schedule_clear(struct ppcg_parallel_schedule *data)
+{
+	int i;
+
+	for (i = 0; i < data->n; ++i) {
+		if (data->sc)
+			free(data->sc[i]);
+		if (data->schedule)
+			free(data->schedule[i]);
+	}
+	free(data->sc);
+	free(data->schedule);
+}
+
+/* Compute a schedule for "sc" by splitting its domain into
+ * the weakly connected components of the graph formed
+ * by its schedule constraints and scheduling these components
+ * in options->threads parallel threads.
+ * The schedules of the components are combined in a set node,
+ * as they would be by the isl scheduler if it is asked
+ * to separate components.
+ *
+ * Since isl_ctx objects cannot be shared between threads,
+ * each thread uses its own isl_ctx and the schedule constraints
+ * and the schedules are exchanged in textual form.
+ * If anything goes wrong in any of the threads, then the schedule
+ * is computed in the original isl_ctx instead, which also takes care
+ * of reporting any errors.
+ * Identifiers that are read back from their textual form do not have
+ * a user pointer, while the parameters and statements of "sc"
+ * may have been constructed with one (e.g., by pet).
+ * The identifiers of the schedule of each component are therefore
+ * replaced by those of the component (see restore_schedule_ids).
+ * If this fails for any component, then the schedule
+ * is also computed in the original isl_ctx.
+ */
+static __isl_give isl_schedule *compute_components_parallel(
+	__isl_take isl_schedule_constraints *sc, struct ppcg_options *options)
+{
+	int i, n, n_thread;
+	isl_ctx *ctx;
+	isl_union_set **comp;
+	isl_schedule *res = NULL;
+	pthread_t *threads;
+	struct ppcg_parallel_schedule data = { 0 };
+
+	comp = extract_components(sc, &n);
+	if (!comp)
+		return isl_schedule_constraints_compute_schedule(sc);
+
+	ctx = isl_schedule_constraints_get_ctx(sc);
+	data.n = n;
+	data.sc = isl_calloc_array(ctx, char *, n);
+	data.schedule = isl_calloc_array(ctx, char *, n);
+	data.error = !data.sc || !data.schedule;
+	for (i = 0; i < n; ++i) {
+		isl_schedule_constraints *sc_i;
+		isl_printer *p;
+
+		sc_i = isl_schedule_constraints_copy(sc);
+		sc_i = isl_schedule_constraints_intersect_domain(sc_i,
+						isl_union_set_copy(comp[i]));
+		p = isl_printer_to_str(ctx);
+		p = isl_printer_print_schedule_constraints(p, sc_i);
+		if (data.sc)
+			data.sc[i] = isl_printer_get_str(p);
+		isl_printer_free(p);
+		isl_schedule_constraints_free(sc_i);
+		if (!data.sc || !data.sc[i])
+			data.error = 1;
+	}
+	for (i = 0; i < PPCG_N_SCHEDULE_OPTIONS; ++i)
+		data.option[i] = schedule_options[i].get(ctx);
+	data.max_operations = options->schedule_max_operations;
+
+	n_thread = options->threads < n ? options->threads : n;
+	threads = isl_alloc_array(ctx, pthread_t, n_thread);
+	if (!data.error && threads &&
+	    pthread_mutex_init(&data.lock, NULL) == 0) {
+		for (i = 0; i < n_thread; ++i)
+			if (pthread_create(&threads[i], NULL,
+					    &schedule_worker, &data))
+				break;
+		n_thread = i;
+		for (i = 0; i < n_thread; ++i)
+			pthread_join(threads[i], NULL);
+		pthread_mutex_destroy(&data.lock);
+		if (n_thread == 0)
+			data.error = 1;
+	} else {
+		data.error = 1;
+	}
+	free(threads);
+
+	for (i = 0; !data.error && i < n; ++i) {
+		isl_schedule *schedule_i;
+
+		schedule_i = isl_schedule_read_from_str(ctx, data.schedule[i]);
+		if (schedule_i)
+			schedule_i = restore_schedule_ids(schedule_i, comp[i]);
+		if (!schedule_i)
+			data.error = 1;
+		res = res ? isl_schedule_set(res, schedule_i) : schedule_i;
+	}
+	ppcg_parallel_schedule_clear(&data);
+	for (i = 0; i < n; ++i)
+		isl_union_set_free(comp[i]);
+	free(comp);
+
+	if (data.error || !res) {
+		isl_schedule_free(res);
+		return isl_schedule_constraints_compute_schedule(sc);
+	}
+	isl_schedule_constraints_free(sc);
+	return res;
+}
+
+#endif
+
 /* Compute a schedule on the domain of "sc" that respects the schedule
  * constraints in "sc", without trying to combine groups of statements.
+ *
+ * If several threads are available and if the isl scheduler is asked
+ * to schedule weakly connected components separately,
+ * then schedule these components in parallel.
  */
 __isl_give isl_schedule *ppcg_compute_non_grouping_schedule(
 	__isl_take isl_schedule_constraints *sc, struct ppcg_options *options)
 {
 	if (options->debug->dump_schedule_constraints)
 		isl_schedule_constraints_dump(sc);
+#ifdef HAVE_PTHREAD_H
+	if (sc && options->threads > 1) {
+		isl_ctx *ctx = isl_schedule_constraints_get_ctx(sc);
+
+		if (isl_options_get_schedule_separate_components(ctx))
+			return compute_components_parallel(sc, options);
+	}
+#endif
 	return isl_schedule_constraints_compute_schedule(sc);
 }
 
+/* Compute a schedule on the domain of "sc" that respects the schedule
+ * constraints in "sc", using at most options->schedule_max_operations
+ * isl operations, if this number is positive.
+ * Return NULL and leave the quota error set on the isl_ctx
+ * if the computation requires more operations.
+ */
+static __isl_give isl_schedule *compute_schedule_with_budget(
+	__isl_take isl_schedule_constraints *sc,
+	__isl_keep isl_schedule *schedule, struct ppcg_options *options)
+{
+	isl_ctx *ctx;
+	isl_schedule *res;
+
+	if (!sc)
+		return NULL;
+
+	ctx = isl_schedule_constraints_get_ctx(sc);
+	isl_ctx_reset_error(ctx);
+	isl_ctx_reset_operations(ctx);
+	isl_ctx_set_max_operations(ctx, options->schedule_max_operations);
+	if (options->group_chains)
+		res = ppcg_compute_grouping_schedule(sc, schedule, options);
+	else
+		res = ppcg_compute_non_grouping_schedule(sc, options);
+	isl_ctx_set_max_operations(ctx, 0);
+
+	return res;
+}
+
+/* Is the last error on "ctx" caused by exceeding the maximal number
+ * of operations?
+ */
+static int out_of_budget(isl_ctx *ctx)
+{
+	return isl_ctx_last_error(ctx) == isl_error_quota;
+}
+
+/* Compute a schedule on the domain of "sc" that respects the schedule
+ * constraints in "sc", without consulting the schedule cache.
+ *
+ * If the computation exceeds the budget of isl operations
+ * set by options->schedule_max_operations, then try again
+ * with the cheaper settings of not scheduling entire components
+ * at once and not maximizing coincidence.
+ * If this also exceeds the budget, then return NULL,
+ * leaving the quota error set such that the caller can detect
+ * the failure using ppcg_schedule_out_of_budget and fall back
+ * to the original schedule.
+ * The errors are silenced while the budget is in effect
+ * since they are expected.
+ */
+static __isl_give isl_schedule *compute_schedule(
+	__isl_take isl_schedule_constraints *sc,
+	__isl_keep isl_schedule *schedule, struct ppcg_options *options)
+{
+	isl_ctx *ctx;
+	isl_schedule *res;
+	struct ppcg_timer timer;
+	int on_error, whole, maximize;
+
+	if (!sc)
+		return NULL;
+
+	ppcg_timer_start(&timer);
+	ctx = isl_schedule_constraints_get_ctx(sc);
+	if (options->schedule_max_operations <= 0) {
+		res = compute_schedule_with_budget(sc, schedule, options);
+		ppcg_timer_report(&timer, options, "compute_schedule",
+				NULL, 0);
+		return res;
+	}
+
+	on_error = isl_options_get_on_error(ctx);
+	isl_options_set_on_error(ctx, ISL_ON_ERROR_CONTINUE);
+	res = compute_schedule_with_budget(isl_schedule_constraints_copy(sc),
+					schedule, options);
+	if (!res && out_of_budget(ctx)) {
+		if (options->debug->verbose)
+			fprintf(stdout, "Scheduling exceeded the budget, "
+				"retrying with cheaper settings\n");
+		whole = isl_options_get_schedule_whole_component(ctx);
+		maximize = isl_options_get_schedule_maximize_coincidence(ctx);
+		isl_options_set_schedule_whole_component(ctx, 0);
+		isl_options_set_schedule_maximize_coincidence(ctx, 0);
+		res = compute_schedule_with_budget(
+				isl_schedule_constraints_copy(sc),
+				schedule, options);
+		isl_options_set_schedule_whole_component(ctx, whole);
+		isl_options_set_schedule_maximize_coincidence(ctx, maximize);
+	}
+	if (!res && out_of_budget(ctx) && options->debug->verbose)
+		fprintf(stdout, "Scheduling exceeded the budget, "
+			"falling back to the original schedule\n");
+	isl_options_set_on_error(ctx, on_error);
+	isl_schedule_constraints_free(sc);
+	ppcg_timer_report(&timer, options, "compute_schedule", NULL, 0);
+
+	return res;
+}
+
+/* Did the last schedule computation on "ctx" fail because
+ * it exceeded the budget of isl operations?
+ * If so, clear the error such that the caller can continue
+ * with a fallback schedule.
+ */
+int ppcg_schedule_out_of_budget(isl_ctx *ctx)
+{
+	if (!out_of_budget(ctx))
+		return 0;
+	isl_ctx_reset_error(ctx);
+	return 1;
+}
+
+/* Print the isl option called "name" with value "value" to "p".
+ */
+static __isl_give isl_printer *print_option(__isl_take isl_printer *p,
+	const char *name, int value)
+{
+	p = isl_printer_print_str(p, name);
+	p = isl_printer_print_str(p, ": ");
+	p = isl_printer_print_int(p, value);
+	p = isl_printer_end_line(p);
+
+	return p;
+}
+
+/* Return a description of the scheduling problem of computing
+ * a schedule for "sc", given the known correct schedule "schedule",
+ * that is used as the key in the schedule cache.
+ * The description consists of the options that affect the result
+ * of the scheduler, "sc" itself and, if statements are combined
+ * based on "schedule", "schedule" as well.
+ */
+static char *schedule_cache_key(__isl_keep isl_schedule_constraints *sc,
+	__isl_keep isl_schedule *schedule, struct ppcg_options *options)
+{
+	isl_ctx *ctx = isl_schedule_constraints_get_ctx(sc);
+	isl_printer *p;
+	char *key;
+
+	p = isl_printer_to_str(ctx);
+	p = print_option(p, "group_chains", options->group_chains);
+	p = print_option(p, "fusion_distance", options->fusion_distance);
+	p = print_option(p, "max_operations",
+		options->schedule_max_operations);
+	p = print_option(p, "max_coefficient",
+		isl_options_get_schedule_max_coefficient(ctx));
+	p = print_option(p, "max_constant_term",
+		isl_options_get_schedule_max_constant_term(ctx));
+	p = print_option(p, "maximize_band_depth",
+		isl_options_get_schedule_maximize_band_depth(ctx));
+	p = print_option(p, "maximize_coincidence",
+		isl_options_get_schedule_maximize_coincidence(ctx));
+	p = print_option(p, "outer_coincidence",
+		isl_options_get_schedule_outer_coincidence(ctx));
+	p = print_option(p, "split_scaled",
+		isl_options_get_schedule_split_scaled(ctx));
+	p = print_option(p, "treat_coalescing",
+		isl_options_get_schedule_treat_coalescing(ctx));
+	p = print_option(p, "separate_components",
+		isl_options_get_schedule_separate_components(ctx));
+	p = print_option(p, "serialize_sccs",
+		isl_options_get_schedule_serialize_sccs(ctx));
+	p = print_option(p, "whole_component",
+		isl_options_get_schedule_whole_component(ctx));
+	p = print_option(p, "algorithm",
+		isl_options_get_schedule_algorithm(ctx));
+	p = isl_printer_print_schedule_constraints(p, sc);
+	if (options->group_chains) {
+		p = isl_printer_end_line(p);
+		p = isl_printer_print_schedule(p, schedule);
+	}
+	key = isl_printer_get_str(p);
+	isl_printer_free(p);
+
+	return key;
+}
+
+/* Look up the schedule for the scheduling problem described by "key"
+ * on the domain "domain" in the schedule cache.
+ * Return NULL if it is not in the cache.
+ *
+ * The cache contains a ".key" file with the description of the problem,
+ * in order to detect hash collisions, and a ".schedule" file
+ * with the corresponding schedule.
+ * The identifiers of the schedule read from the cache are replaced
+ * by those of "domain".  If this fails, then the cached schedule
+ * is not used.
+ */
+static __isl_give isl_schedule *schedule_cache_lookup(
+	__isl_keep isl_union_set *domain, const char *key,
+	struct ppcg_options *options)
+{
+	isl_ctx *ctx = isl_union_set_get_ctx(domain);
+	char *key_file, *schedule_file;
+	isl_schedule *schedule = NULL;
+	FILE *file;
+
+	key_file = ppcg_cache_file_name(options->schedule_cache_dir, key,
+					".key");
+	schedule_file = ppcg_cache_file_name(options->schedule_cache_dir, key,
+					".schedule");
+	if (key_file && schedule_file &&
+	    ppcg_file_has_contents(key_file, key)) {
+		file = fopen(schedule_file, "r");
+		if (file) {
+			schedule = isl_schedule_read_from_file(ctx, file);
+			fclose(file);
+		}
+	}
+	free(schedule_file);
+	free(key_file);
+
+	if (!schedule)
+		return NULL;
+	return restore_schedule_ids(schedule, domain);
+}
+
+/* Store "schedule" as the schedule for the scheduling problem
+ * described by "key" in the schedule cache.
+ * The schedule is written before the key such that the presence
+ * of the key implies that of the schedule.
+ * Failures are ignored since they only mean that the schedule
+ * will have to be computed again next time.
+ */
+static void schedule_cache_store(__isl_keep isl_schedule *schedule,
+	const char *key, struct ppcg_options *options)
+{
+	char *key_file, *schedule_file;
+	char *contents = NULL;
+
+	key_file = ppcg_cache_file_name(options->schedule_cache_dir, key,
+					".key");
+	schedule_file = ppcg_cache_file_name(options->schedule_cache_dir, key,
+					".schedule");
+	if (schedule && key_file && schedule_file) {
+		isl_printer *p;
+
+		p = isl_printer_to_str(isl_schedule_get_ctx(schedule));
+		p = isl_printer_set_yaml_style(p, ISL_YAML_STYLE_BLOCK);
+		p = isl_printer_print_schedule(p, schedule);
+		contents = isl_printer_get_str(p);
+		isl_printer_free(p);
+	}
+	if (contents && ppcg_write_file(schedule_file, contents) == 0)
+		ppcg_write_file(key_file, key);
+	free(contents);
+	free(schedule_file);
+	free(key_file);
+}
+
 /* Compute a schedule on the domain of "sc" that respects the schedule
  * constraints in "sc".
  *
  * "schedule" is a known correct schedule that is used to combine
  * groups of statements if options->group_chains is set.
+ *
+ * If a schedule cache directory has been specified, then first
+ * look for a schedule of the same scheduling problem in the cache and
+ * only run the scheduler if it cannot be found.  A newly computed
+ * schedule is added to the cache.
  */
 __isl_give isl_schedule *ppcg_compute_schedule(
 	__isl_take isl_schedule_constraints *sc,
 	__isl_keep isl_schedule *schedule, struct ppcg_options *options)
 {
-	if (options->group_chains)
-		return ppcg_compute_grouping_schedule(sc, schedule, options);
-	return ppcg_compute_non_grouping_schedule(sc, options);
+	isl_union_set *domain;
+	isl_schedule *res;
+	char *key;
+
+	if (!options->schedule_cache_dir || !sc)
+		return compute_schedule(sc, schedule, options);
+
+	key = schedule_cache_key(sc, schedule, options);
+	if (!key)
+		return compute_schedule(sc, schedule, options);
+
+	domain = isl_schedule_constraints_get_domain(sc);
+	res = schedule_cache_lookup(domain, key, options);
+	isl_union_set_free(domain);
+	if (res) {
+		if (options->debug->verbose)
+			fprintf(stdout, "Using cached schedule\n");
+		isl_schedule_constraints_free(sc);
+		free(key);
+		return res;
+	}
+
+	res = compute_schedule(sc, schedule, options);
+	schedule_cache_store(res, key, options);
+	free(key);
+
+	return res;
 }
 
 /* Obtain a schedule, either by reading it form a file
@@ -16,6 +16,7 @@ __isl_give isl_schedule *ppcg_compute_non_grouping_schedule(
 __isl_give isl_schedule *ppcg_compute_schedule(
 	__isl_take isl_schedule_constraints *sc,
 	__isl_keep isl_schedule *schedule, struct ppcg_options *options);
+int ppcg_schedule_out_of_budget(isl_ctx *ctx);
 
 __isl_give isl_schedule *ppcg_get_schedule(isl_ctx *ctx,
 	struct ppcg_options *options,
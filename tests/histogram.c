@@ -0,0 +1,28 @@
+#include <stdlib.h>
+
+/* Check that all updates to the elements of a histogram
+ * at data dependent positions are accumulated,
+ * also if the histogram is privatized per block.
+ */
+int main()
+{
+	int idx[1000], w[1000], hist[16];
+
+	for (int i = 0; i < 1000; ++i) {
+		idx[i] = (i * 7) % 16;
+		w[i] = i % 5;
+	}
+	for (int k = 0; k < 16; ++k)
+		hist[k] = k;
+#pragma scop
+	for (int i = 0; i < 1000; ++i)
+		hist[idx[i]] += w[i];
+#pragma endscop
+	for (int i = 0; i < 1000; ++i)
+		hist[(i * 7) % 16] -= i % 5;
+	for (int k = 0; k < 16; ++k)
+		if (hist[k] != k)
+			return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,49 @@
+#include <stdlib.h>
+
+/* Check that arrays that are traversed column-wise by innermost loops
+ * have the correct contents after the scop when they are copied
+ * into arrays with a different layout.
+ */
+int main()
+{
+	int A[40][50], B[50], C[10][20][30];
+
+	for (int i = 0; i < 40; ++i)
+		for (int j = 0; j < 50; ++j)
+			A[i][j] = i * j;
+	for (int i = 0; i < 10; ++i)
+		for (int j = 0; j < 20; ++j)
+			for (int k = 0; k < 30; ++k)
+				C[i][j][k] = i + j + k;
+#pragma scop
+	for (int j = 0; j < 50; ++j) {
+		B[j] = 0;
+		for (int i = 0; i < 40; ++i)
+			B[j] += A[i][j];
+	}
+	for (int i = 0; i < 40; ++i)
+		for (int j = 0; j < 50; ++j)
+			A[i][j] = B[j] - A[i][j];
+	for (int i = 0; i < 10; ++i)
+		for (int k = 0; k < 30; ++k)
+			for (int j = 1; j < 20; ++j)
+				C[i][j][k] += C[i][j - 1][k];
+#pragma endscop
+	for (int j = 0; j < 50; ++j)
+		if (B[j] != 780 * j)
+			return EXIT_FAILURE;
+	for (int i = 0; i < 40; ++i)
+		for (int j = 0; j < 50; ++j)
+			if (A[i][j] != 780 * j - i * j)
+				return EXIT_FAILURE;
+	for (int i = 0; i < 10; ++i)
+		for (int j = 0; j < 20; ++j)
+			for (int k = 0; k < 30; ++k) {
+				int v = (j + 1) * (i + k) + j * (j + 1) / 2;
+
+				if (C[i][j][k] != v)
+					return EXIT_FAILURE;
+			}
+
+	return EXIT_SUCCESS;
+}
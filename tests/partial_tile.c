@@ -0,0 +1,27 @@
+#include <stdlib.h>
+
+/* Check that both the full tiles and the partial tiles
+ * at the boundary of a domain with sizes that are not multiples
+ * of the tile sizes are executed, also if they are separated.
+ */
+int main()
+{
+	int A[45][77], B[77][45], C[45][77];
+
+	for (int i = 0; i < 45; ++i)
+		for (int j = 0; j < 77; ++j) {
+			A[i][j] = i + 2 * j;
+			B[j][i] = 3 * i - j;
+		}
+#pragma scop
+	for (int i = 0; i < 45; ++i)
+		for (int j = 0; j < 77; ++j)
+			C[i][j] = A[i][j] + B[j][i];
+#pragma endscop
+	for (int i = 0; i < 45; ++i)
+		for (int j = 0; j < 77; ++j)
+			if (C[i][j] != 4 * i + j)
+				return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
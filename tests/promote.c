@@ -0,0 +1,33 @@
+#include <stdlib.h>
+
+/* Check that array elements that are updated in every iteration
+ * of an innermost loop, but that do not depend on its iterator,
+ * keep their final values when they are promoted to scalars.
+ */
+int main()
+{
+	int A[20][30], B[30], C[20];
+
+	for (int i = 0; i < 20; ++i)
+		for (int j = 0; j < 30; ++j)
+			A[i][j] = i + j;
+	for (int j = 0; j < 30; ++j)
+		B[j] = j % 3;
+#pragma scop
+	for (int i = 0; i < 20; ++i) {
+		C[i] = 0;
+		for (int j = 0; j < 30; ++j)
+			C[i] += A[i][j] * B[j];
+	}
+#pragma endscop
+	for (int i = 0; i < 20; ++i) {
+		int sum = 0;
+
+		for (int j = 0; j < 30; ++j)
+			sum += (i + j) * (j % 3);
+		if (C[i] != sum)
+			return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,32 @@
+#include <stdlib.h>
+
+/* Check that the code generated for several scops
+ * in the same input file is combined in the original order,
+ * also when the scops are transformed in parallel.
+ */
+int main()
+{
+	int A[100], B[100], C[100];
+
+#pragma scop
+	for (int i = 0; i < 100; ++i)
+		A[i] = i;
+#pragma endscop
+	A[0] = 100;
+#pragma scop
+	for (int i = 0; i < 100; ++i)
+		B[i] = A[i] + 1;
+#pragma endscop
+	B[1] = 200;
+#pragma scop
+	for (int i = 0; i < 100; ++i)
+		C[i] = B[99 - i] + A[i];
+#pragma endscop
+	if (C[0] != 200 || C[98] != 298 || C[99] != 200)
+		return EXIT_FAILURE;
+	for (int i = 1; i < 98; ++i)
+		if (C[i] != 100)
+			return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,45 @@
+#include <stdlib.h>
+
+/* Check that a stencil computation with bounded dependence distances
+ * in the time dimension and in both space dimensions produces
+ * the same results when it is tiled, e.g., using hybrid tiling.
+ */
+int main()
+{
+	int A[11][30][40], R[30][40], T[30][40];
+
+	for (int t = 0; t < 11; ++t)
+		for (int i = 0; i < 30; ++i)
+			for (int j = 0; j < 40; ++j)
+				A[t][i][j] = (i * 7 + j * 3) % 100;
+	for (int i = 0; i < 30; ++i)
+		for (int j = 0; j < 40; ++j)
+			R[i][j] = A[0][i][j];
+#pragma scop
+	for (int t = 0; t < 10; ++t)
+		for (int i = 1; i < 29; ++i)
+			for (int j = 1; j < 39; ++j)
+				A[t + 1][i][j] = (A[t][i - 1][j] +
+					A[t][i + 1][j] + A[t][i][j - 1] +
+					A[t][i][j + 1] + A[t][i][j]) % 1009;
+#pragma endscop
+	for (int t = 0; t < 10; ++t) {
+		for (int i = 0; i < 30; ++i)
+			for (int j = 0; j < 40; ++j)
+				T[i][j] = R[i][j];
+		for (int i = 1; i < 29; ++i)
+			for (int j = 1; j < 39; ++j)
+				T[i][j] = (R[i - 1][j] + R[i + 1][j] +
+					R[i][j - 1] + R[i][j + 1] +
+					R[i][j]) % 1009;
+		for (int i = 0; i < 30; ++i)
+			for (int j = 0; j < 40; ++j)
+				R[i][j] = T[i][j];
+	}
+	for (int i = 0; i < 30; ++i)
+		for (int j = 0; j < 40; ++j)
+			if (A[10][i][j] != R[i][j])
+				return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
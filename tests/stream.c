@@ -0,0 +1,27 @@
+#include <stdlib.h>
+
+/* Check that innermost loops that stream through arrays
+ * compute the same results when prefetches are inserted,
+ * including in partial tiles.
+ */
+int main()
+{
+	int A[70][100], B[70][100], C[100];
+
+	for (int i = 0; i < 70; ++i)
+		for (int j = 0; j < 100; ++j)
+			B[i][j] = i - j;
+	for (int j = 0; j < 100; ++j)
+		C[j] = 3 * j;
+#pragma scop
+	for (int i = 0; i < 70; ++i)
+		for (int j = 0; j < 100; ++j)
+			A[i][j] = B[i][j] + C[j];
+#pragma endscop
+	for (int i = 0; i < 70; ++i)
+		for (int j = 0; j < 100; ++j)
+			if (A[i][j] != i + 2 * j)
+				return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,24 @@
+#include <stdlib.h>
+
+/* Check that the children of an outer sequence that depend
+ * on each other are executed in order, also when they are
+ * executed as openmp tasks.
+ */
+int main()
+{
+	int A[100], B[100], C[100];
+
+#pragma scop
+	for (int i = 0; i < 100; ++i)
+		A[i] = i;
+	for (int i = 0; i < 100; ++i)
+		B[i] = 2 * i;
+	for (int i = 0; i < 100; ++i)
+		C[i] = A[i] + B[99 - i];
+#pragma endscop
+	for (int i = 0; i < 100; ++i)
+		if (C[i] != i + 2 * (99 - i))
+			return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
@@ -7,10 +7,22 @@
  * Ecole Normale Superieure, 45 rue d'Ulm, 75230 Paris, France
  */
 
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <isl/id.h>
 #include <isl/space.h>
 #include <isl/val.h>
 #include <isl/aff.h>
 #include <isl/set.h>
+#include <isl/union_set.h>
+#include <isl/union_map.h>
 
 #include "util.h"
 
@@ -103,3 +115,415 @@ __isl_give isl_multi_pw_aff *ppcg_size_from_extent(__isl_take isl_set *set)
 
 	return mpa;
 }
+
+/* Internal data structure for extract_size_of_type.
+ * "type" specifies the name of the space that we want to extract.
+ * "res" is used to store the subset of that space.
+ */
+struct ppcg_extract_size_data {
+	const char *type;
+	isl_set *res;
+};
+
+/* This function is called for each set in a union_set.
+ * If the name of the set matches data->type, we store the
+ * set in data->res.
+ */
+static isl_stat extract_size_of_type(__isl_take isl_set *size, void *user)
+{
+	struct ppcg_extract_size_data *data = user;
+	const char *name;
+
+	name = isl_set_get_tuple_name(size);
+	if (name && !strcmp(name, data->type)) {
+		data->res = size;
+		return isl_stat_error;
+	}
+
+	isl_set_free(size);
+	return isl_stat_ok;
+}
+
+/* Given a union map { domain[i] -> *[...] },
+ * return the range in the space called "type" for the element of
+ * the space called "domain" with sequence number "id".
+ * "domain" is "kernel" for the GPU targets and "band" for the C target.
+ */
+__isl_give isl_set *ppcg_extract_sizes(__isl_keep isl_union_map *sizes,
+	const char *domain, const char *type, int id)
+{
+	isl_space *space;
+	isl_set *dom;
+	isl_union_set *local_sizes;
+	struct ppcg_extract_size_data data = { type, NULL };
+
+	if (!sizes)
+		return NULL;
+
+	space = isl_union_map_get_space(sizes);
+	space = isl_space_set_from_params(space);
+	space = isl_space_add_dims(space, isl_dim_set, 1);
+	space = isl_space_set_tuple_name(space, isl_dim_set, domain);
+	dom = isl_set_universe(space);
+	dom = isl_set_fix_si(dom, isl_dim_set, 0, id);
+
+	local_sizes = isl_union_set_apply(isl_union_set_from_set(dom),
+					isl_union_map_copy(sizes));
+	isl_union_set_foreach_set(local_sizes, &extract_size_of_type, &data);
+	isl_union_set_free(local_sizes);
+	return data.res;
+}
+
+/* Given a singleton set, extract the first (at most *len) elements
+ * of the single integer tuple into *sizes and update *len if needed.
+ */
+void ppcg_read_sizes_from_set(__isl_take isl_set *set, int *sizes, int *len)
+{
+	int i;
+	int dim;
+
+	if (!set)
+		return;
+
+	dim = isl_set_dim(set, isl_dim_set);
+	if (dim < *len)
+		*len = dim;
+
+	for (i = 0; i < *len; ++i) {
+		isl_val *v;
+
+		v = isl_set_plain_get_val_if_fixed(set, isl_dim_set, i);
+		assert(v);
+
+		sizes[i] = isl_val_get_num_si(v);
+		isl_val_free(v);
+	}
+
+	isl_set_free(set);
+}
+
+/* Add the map { domain[id] -> type[sizes] } to "used_sizes",
+ * where "sizes" has "len" elements, and return the result.
+ */
+__isl_give isl_union_map *ppcg_add_used_sizes(
+	__isl_take isl_union_map *used_sizes, const char *domain,
+	const char *type, int id, int *sizes, int len)
+{
+	int i;
+	isl_space *space;
+	isl_map *map;
+
+	space = isl_union_map_get_space(used_sizes);
+	space = isl_space_set_from_params(space);
+	space = isl_space_add_dims(space, isl_dim_set, 1);
+	space = isl_space_set_tuple_name(space, isl_dim_set, domain);
+	space = isl_space_from_domain(space);
+	space = isl_space_add_dims(space, isl_dim_out, len);
+	space = isl_space_set_tuple_name(space, isl_dim_out, type);
+
+	map = isl_map_universe(space);
+	map = isl_map_fix_si(map, isl_dim_in, 0, id);
+	for (i = 0; i < len; ++i)
+		map = isl_map_fix_si(map, isl_dim_out, i, sizes[i]);
+
+	return isl_union_map_add_map(used_sizes, map);
+}
+
+/* Return the name of the file in the cache directory "dir"
+ * that corresponds to "key", with extension "ext".
+ * The name is derived from the 64-bit FNV-1a hash of "key".
+ * The caller is responsible for freeing the result.
+ */
+char *ppcg_cache_file_name(const char *dir, const char *key, const char *ext)
+{
+	uint64_t hash = UINT64_C(14695981039346656037);
+	size_t len;
+	char *name;
+
+	for (; *key; ++key) {
+		hash ^= (unsigned char) *key;
+		hash *= UINT64_C(1099511628211);
+	}
+
+	len = strlen(dir) + 1 + 16 + strlen(ext) + 1;
+	name = malloc(len);
+	if (!name)
+		return NULL;
+	snprintf(name, len, "%s/%08lx%08lx%s", dir,
+		(unsigned long) (hash >> 32),
+		(unsigned long) (hash & UINT32_C(0xffffffff)), ext);
+
+	return name;
+}
+
+/* Return the contents of the file called "filename" or
+ * NULL if it cannot be read.
+ * The caller is responsible for freeing the result.
+ */
+char *ppcg_read_file(const char *filename)
+{
+	FILE *file;
+	char *contents = NULL;
+	size_t size = 0, len = 0, n;
+
+	file = fopen(filename, "r");
+	if (!file)
+		return NULL;
+	for (;;) {
+		char *grown;
+
+		if (len + 1 >= size) {
+			size = size ? 2 * size : 4096;
+			grown = realloc(contents, size);
+			if (!grown)
+				break;
+			contents = grown;
+		}
+		n = fread(contents + len, 1, size - len - 1, file);
+		if (n == 0)
+			break;
+		len += n;
+	}
+	if (ferror(file) || len + 1 >= size) {
+		free(contents);
+		contents = NULL;
+	}
+	fclose(file);
+	if (contents)
+		contents[len] = '\0';
+
+	return contents;
+}
+
+/* Does the file called "filename" contain exactly "contents"?
+ */
+int ppcg_file_has_contents(const char *filename, const char *contents)
+{
+	char *read;
+	int equal;
+
+	read = ppcg_read_file(filename);
+	equal = read && !strcmp(read, contents);
+	free(read);
+
+	return equal;
+}
+
+/* Write "contents" to a file called "filename".
+ * Return 0 on success and -1 on failure.
+ *
+ * The contents are first written to a temporary file in the same directory,
+ * which is then renamed to "filename", such that concurrent readers
+ * never see a partially written file.
+ */
+int ppcg_write_file(const char *filename, const char *contents)
+{
+	FILE *file;
+	char *tmp;
+	size_t len;
+	int fd;
+	int r;
+
+	tmp = malloc(strlen(filename) + strlen(".XXXXXX") + 1);
+	if (!tmp)
+		return -1;
+	sprintf(tmp, "%s.XXXXXX", filename);
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		free(tmp);
+		return -1;
+	}
+	file = fdopen(fd, "w");
+	if (!file) {
+		close(fd);
+		remove(tmp);
+		free(tmp);
+		return -1;
+	}
+	len = strlen(contents);
+	r = fwrite(contents, 1, len, file) == len ? 0 : -1;
+	if (fclose(file))
+		r = -1;
+	if (r == 0 && rename(tmp, filename) != 0)
+		r = -1;
+	if (r < 0)
+		remove(tmp);
+	free(tmp);
+
+	return r;
+}
+
+/* Return the current time of the clock "clock_id" in seconds.
+ */
+static double clock_seconds(clockid_t clock_id)
+{
+	struct timespec ts;
+
+	if (clock_gettime(clock_id, &ts) != 0)
+		return 0;
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Start measuring the time spent in a phase using "timer".
+ * The wall clock time is taken from a monotonic clock such that
+ * it is not affected by adjustments of the system time.
+ * The processor time is that of the calling thread, such that
+ * it does not wrap around and such that it only includes the time
+ * spent by a worker thread on its own scops.
+ */
+void ppcg_timer_start(struct ppcg_timer *timer)
+{
+	timer->wall = clock_seconds(CLOCK_MONOTONIC);
+	timer->cpu = clock_seconds(CLOCK_THREAD_CPUTIME_ID);
+}
+
+/* Report the time spent in the phase called "phase" since "timer"
+ * was started on stderr, if the time_report option is set.
+ * If "unit" is not NULL, then the phase is performed
+ * on the "unit" identified by "id", e.g., a scop or a kernel.
+ * The report also includes the maximal resident set size of the process
+ * so far, which shows in which phase memory usage increases.
+ */
+void ppcg_timer_report(struct ppcg_timer *timer, struct ppcg_options *options,
+	const char *phase, const char *unit, int id)
+{
+	struct ppcg_timer now;
+	struct rusage usage;
+	long max_rss = 0;
+
+	if (!options->debug->time_report)
+		return;
+
+	ppcg_timer_start(&now);
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+		max_rss = usage.ru_maxrss;
+
+	fprintf(stderr, "time-report:");
+	if (unit)
+		fprintf(stderr, " %s %d:", unit, id);
+	fprintf(stderr, " %s: %.3f s wall, %.3f s cpu, %ld KiB max rss\n",
+		phase, now.wall - timer->wall, now.cpu - timer->cpu, max_rss);
+}
+
+/* Return the identifier in "list" with name "name" or
+ * NULL if there is no such identifier.
+ */
+static __isl_give isl_id *find_id(__isl_keep isl_id_list *list,
+	const char *name)
+{
+	int i, n;
+
+	if (!name)
+		return NULL;
+	n = isl_id_list_n_id(list);
+	for (i = 0; i < n; ++i) {
+		isl_id *id = isl_id_list_get_id(list, i);
+		const char *name_i = isl_id_get_name(id);
+
+		if (name_i && !strcmp(name_i, name))
+			return id;
+		isl_id_free(id);
+	}
+
+	return NULL;
+}
+
+/* Replace the identifier of the tuple of type "type" of "map"
+ * by the identifier in "ids" with the same name, if any.
+ * If this tuple is a wrapped relation, then replace the identifier
+ * of its domain instead.
+ */
+static __isl_give isl_map *restore_tuple_id(__isl_take isl_map *map,
+	enum isl_dim_type type, __isl_keep isl_id_list *ids)
+{
+	int wrapped;
+	isl_id *id = NULL;
+
+	if (type == isl_dim_out)
+		map = isl_map_reverse(map);
+	wrapped = isl_map_domain_is_wrapping(map);
+	if (wrapped)
+		map = isl_map_uncurry(map);
+	if (isl_map_has_tuple_name(map, isl_dim_in) == isl_bool_true)
+		id = find_id(ids, isl_map_get_tuple_name(map, isl_dim_in));
+	if (id)
+		map = isl_map_set_tuple_id(map, isl_dim_in, id);
+	if (wrapped)
+		map = isl_map_curry(map);
+	if (type == isl_dim_out)
+		map = isl_map_reverse(map);
+
+	return map;
+}
+
+/* Internal data structure for restore_map_ids.
+ * "ids" are the original identifiers.
+ * "res" collects the results.
+ */
+struct ppcg_restore_ids_data {
+	isl_id_list *ids;
+	isl_union_map *res;
+};
+
+/* Replace the parameter and tuple identifiers of "map"
+ * by the original identifiers with the same names and
+ * add the result to data->res.
+ */
+static isl_stat restore_map_ids(__isl_take isl_map *map, void *user)
+{
+	struct ppcg_restore_ids_data *data = user;
+	int i, n;
+
+	n = isl_map_dim(map, isl_dim_param);
+	for (i = 0; i < n; ++i) {
+		isl_id *id;
+
+		id = find_id(data->ids,
+			isl_map_get_dim_name(map, isl_dim_param, i));
+		if (id)
+			map = isl_map_set_dim_id(map, isl_dim_param, i, id);
+	}
+	map = restore_tuple_id(map, isl_dim_in, data->ids);
+	map = restore_tuple_id(map, isl_dim_out, data->ids);
+	data->res = isl_union_map_add_map(data->res, map);
+
+	return data->res ? isl_stat_ok : isl_stat_error;
+}
+
+/* Replace the identifiers in "umap", which has been read
+ * from a textual representation, e.g., from a cache, by the original
+ * identifiers "ids" with the same names.
+ * This is needed because identifiers read from a file do not
+ * have a user pointer, while those constructed by pet may have one.
+ */
+__isl_give isl_union_map *ppcg_union_map_restore_ids(
+	__isl_take isl_union_map *umap, __isl_keep isl_id_list *ids)
+{
+	struct ppcg_restore_ids_data data;
+	isl_space *space;
+
+	if (!umap)
+		return NULL;
+	space = isl_space_params_alloc(isl_union_map_get_ctx(umap), 0);
+	data.ids = ids;
+	data.res = isl_union_map_empty(space);
+	if (isl_union_map_foreach_map(umap, &restore_map_ids, &data) < 0)
+		data.res = isl_union_map_free(data.res);
+	isl_union_map_free(umap);
+
+	return data.res;
+}
+
+/* Replace the identifiers in "uset", which has been read
+ * from a textual representation, by the original identifiers "ids"
+ * with the same names, as in ppcg_union_map_restore_ids.
+ */
+__isl_give isl_union_set *ppcg_union_set_restore_ids(
+	__isl_take isl_union_set *uset, __isl_keep isl_id_list *ids)
+{
+	isl_union_map *umap;
+
+	umap = isl_union_map_from_domain(uset);
+	umap = ppcg_union_map_restore_ids(umap, ids);
+	return isl_union_map_domain(umap);
+}
@@ -3,8 +3,13 @@
 
 #include <string.h>
 
+#include <isl/id.h>
 #include <isl/space.h>
 #include <isl/val.h>
+#include <isl/set.h>
+#include <isl/union_map.h>
+
+#include "ppcg_options.h"
 
 /* Compare the prefix of "s" to "prefix" up to the length of "prefix".
  */
@@ -19,4 +24,34 @@ __isl_give isl_multi_val *ppcg_multi_val_from_int_list(
 	__isl_take isl_space *space, int *list);
 __isl_give isl_multi_pw_aff *ppcg_size_from_extent(__isl_take isl_set *set);
 
+__isl_give isl_set *ppcg_extract_sizes(__isl_keep isl_union_map *sizes,
+	const char *domain, const char *type, int id);
+void ppcg_read_sizes_from_set(__isl_take isl_set *set, int *sizes, int *len);
+__isl_give isl_union_map *ppcg_add_used_sizes(
+	__isl_take isl_union_map *used_sizes, const char *domain,
+	const char *type, int id, int *sizes, int len);
+
+/* A timer for measuring the time spent in a phase of ppcg.
+ * "wall" is the wall clock time and "cpu" the processor time
+ * of the calling thread at the start of the phase, both in seconds.
+ */
+struct ppcg_timer {
+	double wall;
+	double cpu;
+};
+
+void ppcg_timer_start(struct ppcg_timer *timer);
+void ppcg_timer_report(struct ppcg_timer *timer, struct ppcg_options *options,
+	const char *phase, const char *unit, int id);
+
+char *ppcg_cache_file_name(const char *dir, const char *key, const char *ext);
+char *ppcg_read_file(const char *filename);
+int ppcg_file_has_contents(const char *filename, const char *contents);
+int ppcg_write_file(const char *filename, const char *contents);
+
+__isl_give isl_union_map *ppcg_union_map_restore_ids(
+	__isl_take isl_union_map *umap, __isl_keep isl_id_list *ids);
+__isl_give isl_union_set *ppcg_union_set_restore_ids(
+	__isl_take isl_union_set *uset, __isl_keep isl_id_list *ids);
+
 #endif